@@ -0,0 +1,144 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#include "Bench.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include "fmt/core.h"
+
+namespace picod {
+
+Bench::Bench(const Options & opts):
+opts_(opts) {
+    opts_.repetitions = std::max<uint32_t>(opts_.repetitions, 1);
+}
+
+void Bench::add(const std::string & name, Body body) {
+    benchmarks_.emplace_back(name, std::move(body));
+}
+
+bool Bench::matches(const std::string & name, const std::regex & filter) const {
+    return opts_.filter.empty() || std::regex_search(name, filter);
+}
+
+std::vector<std::string> Bench::names() const {
+    const std::regex filter(opts_.filter);
+    std::vector<std::string> names;
+
+    for (auto const& b : benchmarks_) {
+        if (matches(b.first, filter)) {
+            names.push_back(b.first);
+        }
+    }
+
+    return names;
+}
+
+double Bench::time_run(const Body & body, uint64_t iterations) {
+    const auto start = std::chrono::steady_clock::now();
+    body(iterations);
+    return std::chrono::duration<double, std::nano>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+void Bench::run() {
+    const std::regex filter(opts_.filter);
+    const double min_time_ns = opts_.min_time_s * 1e9;
+    results_.clear();
+
+    for (auto const& [name, body] : benchmarks_) {
+        if (!matches(name, filter)) {
+            continue;
+        }
+
+        // Grow the iterations until one run lasts the minimum time
+        uint64_t iterations = 1;
+        for (;;) {
+            const double elapsed_ns = time_run(body, iterations);
+            if ((elapsed_ns >= min_time_ns) || (iterations >= (UINT64_MAX / 10))) {
+                break;
+            }
+
+            const double scale = (elapsed_ns > 0.0) ? (1.4 * min_time_ns / elapsed_ns) : 10.0;
+            iterations = static_cast<uint64_t>(iterations * std::clamp(scale, 2.0, 10.0));
+        }
+
+        std::vector<double> ns_per_op;
+        for (uint32_t i = 0; i < opts_.repetitions; i++) {
+            ns_per_op.push_back(time_run(body, iterations) / iterations);
+        }
+        std::sort(ns_per_op.begin(), ns_per_op.end());
+
+        const size_t mid = ns_per_op.size() / 2;
+        Result r = {
+            .name = name,
+            .iterations = iterations,
+            .ns_per_op = (ns_per_op.size() % 2) ? ns_per_op[mid] :
+                (ns_per_op[mid - 1] + ns_per_op[mid]) / 2.0,
+            .min_ns_per_op = ns_per_op.front(),
+            .max_ns_per_op = ns_per_op.back(),
+            .baseline_ns_per_op = 0.0
+        };
+
+        fmt::println(stderr, "{:<32} {:>12.1f} ns/op  (min {:.1f}, max {:.1f}, {} iterations)",
+            r.name, r.ns_per_op, r.min_ns_per_op, r.max_ns_per_op, r.iterations);
+        results_.push_back(r);
+    }
+}
+
+std::vector<std::string> Bench::compare(const nlohmann::json & baseline, double threshold_pct) {
+    std::vector<std::string> regressions;
+
+    if (!baseline.contains("benchmarks") || !baseline["benchmarks"].is_array()) {
+        return regressions;
+    }
+
+    for (auto & r : results_) {
+        for (auto const& b : baseline["benchmarks"]) {
+            if (!b.contains("name") || (b["name"] != r.name) || !b.contains("ns_per_op")) {
+                continue;
+            }
+
+            r.baseline_ns_per_op = b["ns_per_op"].get<double>();
+            const double change_pct = (r.baseline_ns_per_op > 0.0) ?
+                (r.ns_per_op / r.baseline_ns_per_op - 1.0) * 100.0 : 0.0;
+
+            if (change_pct > threshold_pct) {
+                regressions.push_back(r.name);
+                fmt::println(stderr, "Regression: {} {:.1f} ns/op, baseline {:.1f} ns/op ({:+.1f}%)",
+                    r.name, r.ns_per_op, r.baseline_ns_per_op, change_pct);
+            }
+            break;
+        }
+    }
+
+    return regressions;
+}
+
+nlohmann::ordered_json Bench::results() const {
+    nlohmann::ordered_json j;
+    j["config"] = { {"filter", opts_.filter}, {"min_time_s", opts_.min_time_s},
+        {"repetitions", opts_.repetitions} };
+
+    j["benchmarks"] = nlohmann::ordered_json::array();
+    for (auto const& r : results_) {
+        nlohmann::ordered_json b;
+        b["name"] = r.name;
+        b["iterations"] = r.iterations;
+        b["ns_per_op"] = r.ns_per_op;
+        b["min_ns_per_op"] = r.min_ns_per_op;
+        b["max_ns_per_op"] = r.max_ns_per_op;
+        if (r.baseline_ns_per_op > 0.0) {
+            b["baseline_ns_per_op"] = r.baseline_ns_per_op;
+            b["change_pct"] = (r.ns_per_op / r.baseline_ns_per_op - 1.0) * 100.0;
+        }
+        j["benchmarks"].push_back(b);
+    }
+
+    return j;
+}
+
+} //@END namespace picod
@@ -0,0 +1,97 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifndef BENCH_HPP_
+#define BENCH_HPP_
+#include <stdint.h>
+#include <functional>
+#include <regex>
+#include <string>
+#include <vector>
+#include "json.hpp"
+
+namespace picod {
+/// @brief Runs micro-benchmarks of picod's code paths and reports the time
+/// per operation, as JSON that can be compared against an earlier run.
+///
+/// Each benchmark is first run with a growing number of iterations until
+/// one run lasts the minimum time, then repeated with that many iterations.
+/// The median time per operation of the repetitions is the result; the
+/// minimum and maximum show how noisy it was.
+class Bench {
+public:
+    /// @brief Runs the operation being measured the given number of times
+    typedef std::function<void(uint64_t iterations)> Body;
+
+    typedef struct Options {
+        /// @brief Benchmarks whose name does not match this regular
+        /// expression are skipped. Empty runs all of them.
+        std::string filter;
+        /// @brief Shortest duration of one repetition (s)
+        double min_time_s;
+        /// @brief Number of timed repetitions
+        uint32_t repetitions;
+    } Options;
+
+    typedef struct Result {
+        std::string name;
+        /// @brief Iterations per repetition
+        uint64_t iterations;
+        /// @brief Median time per operation (ns)
+        double ns_per_op;
+        double min_ns_per_op;
+        double max_ns_per_op;
+        /// @brief Time per operation in the baseline (ns), zero(0) if none
+        double baseline_ns_per_op;
+    } Result;
+
+    explicit Bench(const Options & opts);
+    Bench(Bench const&)   = delete;
+    void operator=(Bench const&)  = delete;
+
+    /// @brief Registers a benchmark
+    /// @param name Unique name, <group>/<operation>
+    void add(const std::string & name, Body body);
+
+    /// @brief Names of the registered benchmarks matching the filter
+    /// @throws std::regex_error if the filter is not a valid regular expression
+    std::vector<std::string> names() const;
+
+    /// @brief Runs every registered benchmark matching the filter, in the
+    /// order they were added. Progress is printed to stderr.
+    /// @throws std::regex_error if the filter is not a valid regular expression
+    void run();
+
+    /// @brief Compares the results against those of an earlier run.
+    /// @param baseline Output of an earlier run
+    /// @param threshold_pct Slowdown (%) counted as a regression
+    /// @return The names of the benchmarks that regressed
+    std::vector<std::string> compare(const nlohmann::json & baseline, double threshold_pct);
+
+    /// @brief Results of the last run, as JSON
+    nlohmann::ordered_json results() const;
+
+    /// @brief Keeps the compiler from optimizing away a value that is
+    /// computed only to be measured
+    template <typename T>
+    static inline void keep(T const& value) {
+        asm volatile("" : : "r,m"(value) : "memory");
+    }
+
+private:
+    Options opts_;
+    std::vector<std::pair<std::string, Body>> benchmarks_;
+    std::vector<Result> results_;
+
+    bool matches(const std::string & name, const std::regex & filter) const;
+
+    /// @brief Runs a benchmark once
+    /// @return Elapsed time (ns)
+    static double time_run(const Body & body, uint64_t iterations);
+};
+
+} //@END namespace picod
+
+#endif //@END BENCH_HPP_
@@ -0,0 +1,492 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#include "FanCalibration.hpp"
+#include "SensorHistory.hpp"
+#include "SensorID.hpp"
+#include "settings.hpp"
+#include "json.hpp"
+#include "fmt/core.h"
+#include <algorithm>
+#include <fstream>
+#include <cmath>
+
+using namespace nlohmann;
+
+namespace picod {
+
+// Readings must agree for this long before a fan changes health
+const std::chrono::seconds STALL_CONFIRM_TIME(3);
+const std::chrono::seconds DEGRADED_CONFIRM_TIME(30);
+const std::chrono::seconds RECOVERED_CONFIRM_TIME(3);
+// Time over which the RPM is averaged after each calibration step settles
+const std::chrono::seconds CALIBRATION_SAMPLE_TIME(2);
+// Without a calibration, a fan run at or above this duty cycle must turn
+const float UNCALIBRATED_STALL_DUTY = 0.5f;
+// Number of events kept for events()
+const size_t MAX_EVENTS = 32;
+
+FanCalibration::FanCalibration()
+:init_done_{false}
+{
+    cal_.running = false;
+}
+
+FanCalibration& FanCalibration::instance() {
+    static FanCalibration theInstance;
+    return theInstance;
+}
+
+const char * FanCalibration::to_string(Health health) {
+    switch (health) {
+    case OK:
+        return "ok";
+    case STALLED:
+        return "stalled";
+    case DEGRADED:
+        return "degraded";
+    default:
+        return "unknown";
+    }
+}
+
+void FanCalibration::init() {
+    init_done_ = true;
+
+    const struct { uint8_t fan_id; SensorId sensorId; float pwm; } fans[] = {
+        { SYS_FAN1, System_FAN_J17, appSettings.fan1_pwm },
+        { CM4_FAN, CM4_FAN_J18, appSettings.cm4_fan_pwm }
+    };
+
+    for (auto const& f : fans) {
+        Fan fan;
+        fan.fan_id = f.fan_id;
+        fan.fan_name = appSettings.sensorIds[f.sensorId];
+        // Start from the PWM setting applied by init_fan_pwm()
+        fan.written_pct = static_cast<int>(f.pwm * FAN_PWM_LSB);
+        fan.have_result = false;
+        fan.health = { .fan_name = fan.fan_name, .health = UNKNOWN,
+            .rpm = 0, .expected_rpm = 0, .duty = -1.0f };
+        fan.candidate = UNKNOWN;
+        fans_.push_back(fan);
+    }
+
+    std::ifstream file(appSettings.fan_calibration_path);
+    if (!file.is_open()) {
+        return;
+    }
+
+    try {
+        json j = json::parse(file);
+        for (auto &fan : fans_) {
+            if (!j.contains(fan.fan_name)) {
+                continue;
+            }
+
+            auto const& r = j[fan.fan_name];
+            fan.result.fan_name = fan.fan_name;
+            fan.result.timestamp_ms = r.at("timestamp_ms").get<int64_t>();
+            fan.result.min_start_duty = r.at("min_start_duty").get<float>();
+            fan.result.min_stop_duty = r.at("min_stop_duty").get<float>();
+            fan.result.curve.clear();
+            for (auto const& p : r.at("curve")) {
+                fan.result.curve.push_back(CurvePoint {
+                    .duty = p.at("duty").get<float>(), .rpm = p.at("rpm").get<uint32_t>() });
+            }
+            fan.have_result = true;
+        }
+    } catch (std::exception &e) {
+        fmt::println(stderr, "Error reading file: {}\n{}", appSettings.fan_calibration_path, e.what());
+    }
+}
+
+void FanCalibration::save() {
+    json j = json::object();
+
+    for (auto const& fan : fans_) {
+        if (!fan.have_result) {
+            continue;
+        }
+
+        json r;
+        r["timestamp_ms"] = fan.result.timestamp_ms;
+        r["min_start_duty"] = fan.result.min_start_duty;
+        r["min_stop_duty"] = fan.result.min_stop_duty;
+        r["curve"] = json::array();
+        for (auto const& p : fan.result.curve) {
+            r["curve"].push_back({ {"duty", p.duty}, {"rpm", p.rpm} });
+        }
+        j[fan.fan_name] = r;
+    }
+
+    std::ofstream file(appSettings.fan_calibration_path);
+    if (!file.is_open()) {
+        fmt::println(stderr, "Error writing file: {}", appSettings.fan_calibration_path);
+        return;
+    }
+
+    file << j.dump(4);
+}
+
+FanCalibration::Fan * FanCalibration::find(uint8_t fan_id) {
+    for (auto &fan : fans_) {
+        if (fan.fan_id == fan_id) {
+            return &fan;
+        }
+    }
+
+    return nullptr;
+}
+
+void FanCalibration::raise(const Fan & fan, const char * event) {
+    FanEvent e = { .timestamp_ms = SensorHistory::now_ms(), .fan_name = fan.fan_name,
+        .event = event, .rpm = fan.health.rpm, .expected_rpm = fan.health.expected_rpm,
+        .duty = fan.health.duty };
+
+    fmt::println("{}: {} (RPM: {}, expected RPM: {}, duty: {:.0f}%)", e.fan_name, e.event,
+        e.rpm, e.expected_rpm, e.duty * 100.0f);
+
+    events_.push_back(e);
+    new_events_.push_back(e);
+
+    while (events_.size() > MAX_EVENTS) {
+        events_.pop_front();
+    }
+
+    while (new_events_.size() > MAX_EVENTS) {
+        new_events_.pop_front();
+    }
+}
+
+bool FanCalibration::start(const std::string & fan_name, std::string & error) {
+    std::lock_guard<std::mutex> lk(m_);
+
+    if (!init_done_) {
+        init();
+    }
+
+    uint8_t fan_id = get_fan_id_from_name(fan_name.c_str());
+    Fan *fan = find(fan_id);
+    if (fan == nullptr) {
+        error = fmt::format("Unknown fan: {}", fan_name);
+        return false;
+    }
+
+    if (cal_.running) {
+        error = fmt::format("Already calibrating {}", find(cal_.fan_id)->fan_name);
+        return false;
+    }
+
+    long step_pct = std::lround(appSettings.fan_calibration_step * FAN_PWM_LSB);
+
+    cal_.running = true;
+    cal_.fan_id = fan_id;
+    cal_.phase = SPIN_UP;
+    cal_.duty_pct = 100;
+    cal_.step_pct = static_cast<int>(std::clamp(step_pct, 1L, 50L));
+    cal_.restore_pct = fan->written_pct;
+    cal_.last_turning_pct = 100;
+    cal_.step_start = std::chrono::steady_clock::now();
+    cal_.rpm_sum = 0;
+    cal_.rpm_count = 0;
+    cal_.result = Result { .fan_name = fan->fan_name, .timestamp_ms = 0,
+        .min_start_duty = -1.0f, .min_stop_duty = -1.0f, .curve = {} };
+
+    fmt::println("{}: calibration started", fan->fan_name);
+
+    return true;
+}
+
+bool FanCalibration::is_calibrating(uint8_t fan_id) {
+    std::lock_guard<std::mutex> lk(m_);
+    return cal_.running && (cal_.fan_id == fan_id);
+}
+
+void FanCalibration::finish_calibration(Fan & fan, bool success,
+    std::vector<struct pico_pkt_fan_pwm_t> & fanInfo) {
+    cal_.running = false;
+
+    // Back to the setting in place before the calibration
+    if (cal_.restore_pct >= 0) {
+        fanInfo.emplace_back(pico_pkt_fan_pwm_t {
+            .fan_id = fan.fan_id, .pwm_pct = (cal_.restore_pct + 0.5f) / FAN_PWM_LSB });
+    }
+
+    // A failed sweep keeps the previous calibration, saved or not
+    if (success) {
+        std::sort(cal_.result.curve.begin(), cal_.result.curve.end(),
+            [](const CurvePoint &a, const CurvePoint &b) { return a.duty < b.duty; });
+        cal_.result.timestamp_ms = SensorHistory::now_ms();
+
+        fan.result = cal_.result;
+        fan.have_result = true;
+        save();
+
+        // Start over, the curve has changed
+        fan.candidate = UNKNOWN;
+        fan.health.health = UNKNOWN;
+    }
+
+    raise(fan, success ? "calibrated" : "calibration_failed");
+}
+
+void FanCalibration::step_calibration(Fan & fan, uint32_t rpm,
+    std::chrono::steady_clock::time_point now, std::vector<struct pico_pkt_fan_pwm_t> & fanInfo) {
+
+    if (fan.written_pct != cal_.duty_pct) {
+        // Half an LSB is added since the packet truncates
+        fanInfo.emplace_back(pico_pkt_fan_pwm_t {
+            .fan_id = fan.fan_id, .pwm_pct = (cal_.duty_pct + 0.5f) / FAN_PWM_LSB });
+        // The fan settles from the time the duty is written
+        cal_.step_start = now;
+        return;
+    }
+
+    auto settle = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>(appSettings.fan_calibration_settle_seconds));
+    auto elapsed = now - cal_.step_start;
+
+    if (elapsed < settle) {
+        return;
+    }
+
+    cal_.rpm_sum += rpm;
+    cal_.rpm_count++;
+
+    if (elapsed < (settle + CALIBRATION_SAMPLE_TIME)) {
+        return;
+    }
+
+    // Steady state RPM at this duty cycle
+    uint32_t avg_rpm = static_cast<uint32_t>(cal_.rpm_sum / cal_.rpm_count);
+    float duty = cal_.duty_pct / FAN_PWM_LSB;
+    cal_.rpm_sum = 0;
+    cal_.rpm_count = 0;
+    cal_.step_start = now;
+
+    switch (cal_.phase) {
+    case SPIN_UP:
+        cal_.result.curve.push_back(CurvePoint { .duty = duty, .rpm = avg_rpm });
+        if (avg_rpm == 0) {
+            // Not turning at full speed: missing or failed
+            finish_calibration(fan, false, fanInfo);
+            return;
+        }
+        cal_.phase = SWEEP_DOWN;
+        cal_.duty_pct = std::max(0, cal_.duty_pct - cal_.step_pct);
+        break;
+
+    case SWEEP_DOWN:
+        cal_.result.curve.push_back(CurvePoint { .duty = duty, .rpm = avg_rpm });
+        if (avg_rpm > 0) {
+            cal_.last_turning_pct = cal_.duty_pct;
+            if (cal_.duty_pct == 0) {
+                // Never stops
+                cal_.result.min_stop_duty = 0.0f;
+                cal_.result.min_start_duty = 0.0f;
+                finish_calibration(fan, true, fanInfo);
+                return;
+            }
+            cal_.duty_pct = std::max(0, cal_.duty_pct - cal_.step_pct);
+        } else {
+            // Stopped. Now find where it starts again.
+            cal_.result.min_stop_duty = cal_.last_turning_pct / FAN_PWM_LSB;
+            cal_.phase = SWEEP_UP;
+            cal_.duty_pct = std::min(100, cal_.duty_pct + cal_.step_pct);
+        }
+        break;
+
+    case SWEEP_UP:
+        if (avg_rpm > 0) {
+            cal_.result.min_start_duty = duty;
+            finish_calibration(fan, true, fanInfo);
+            return;
+        }
+        if (cal_.duty_pct >= 100) {
+            finish_calibration(fan, false, fanInfo);
+            return;
+        }
+        cal_.duty_pct = std::min(100, cal_.duty_pct + cal_.step_pct);
+        break;
+    }
+}
+
+uint32_t FanCalibration::expected_rpm(const Result & result, float duty) {
+    const std::vector<CurvePoint> &points = result.curve;
+
+    if (points.empty()) {
+        return 0;
+    }
+
+    if (duty <= points.front().duty) {
+        return points.front().rpm;
+    }
+
+    for (size_t i = 1; i < points.size(); i++) {
+        const CurvePoint &a = points[i-1];
+        const CurvePoint &b = points[i];
+        if (duty <= b.duty) {
+            float span = b.duty - a.duty;
+            if (span <= 0.0f) {
+                return b.rpm;
+            }
+            return static_cast<uint32_t>(a.rpm +
+                ((float)b.rpm - (float)a.rpm) * (duty - a.duty) / span);
+        }
+    }
+
+    return points.back().rpm;
+}
+
+void FanCalibration::check_health(Fan & fan, uint32_t rpm, std::chrono::steady_clock::time_point now) {
+    FanHealth &h = fan.health;
+    h.rpm = rpm;
+    h.duty = (fan.written_pct < 0) ? -1.0f : (fan.written_pct / FAN_PWM_LSB);
+    h.expected_rpm = fan.have_result ? expected_rpm(fan.result, h.duty) : 0;
+
+    if (fan.written_pct < 0) {
+        h.health = UNKNOWN;
+        fan.candidate = UNKNOWN;
+        return;
+    }
+
+    // Between the stop and start duty cycles a fan may or may not turn
+    bool must_turn = fan.have_result ?
+        ((fan.result.min_start_duty >= 0.0f) && (h.duty >= fan.result.min_start_duty)) :
+        (h.duty >= UNCALIBRATED_STALL_DUTY);
+
+    Health candidate = OK;
+    if (must_turn && (rpm == 0)) {
+        candidate = STALLED;
+    } else if (must_turn && (h.expected_rpm > 0) &&
+        (rpm < h.expected_rpm * (1.0f - appSettings.fan_degraded_tolerance))) {
+        candidate = DEGRADED;
+    }
+
+    if (candidate != fan.candidate) {
+        fan.candidate = candidate;
+        fan.candidate_since = now;
+    }
+
+    if (candidate == h.health) {
+        return;
+    }
+
+    auto confirm_time = (candidate == STALLED) ? STALL_CONFIRM_TIME :
+        (candidate == DEGRADED) ? DEGRADED_CONFIRM_TIME : RECOVERED_CONFIRM_TIME;
+    if ((now - fan.candidate_since) < confirm_time) {
+        return;
+    }
+
+    Health previous = h.health;
+    h.health = candidate;
+
+    if (candidate == STALLED) {
+        raise(fan, "stalled");
+    } else if (candidate == DEGRADED) {
+        raise(fan, "degraded");
+    } else if (previous != UNKNOWN) {
+        raise(fan, "recovered");
+    }
+}
+
+std::vector<struct pico_pkt_fan_pwm_t> FanCalibration::update(const pico_pkt_temperature_u & t) {
+    std::vector<struct pico_pkt_fan_pwm_t> fanInfo;
+    std::lock_guard<std::mutex> lk(m_);
+
+    if (!init_done_) {
+        init();
+    }
+
+    auto now = std::chrono::steady_clock::now();
+
+    for (auto &fan : fans_) {
+        uint32_t rpm = (fan.fan_id == SYS_FAN1) ? t.s.fan1rpm : t.s.cm4_fan_rpm;
+
+        if (cal_.running && (cal_.fan_id == fan.fan_id)) {
+            fan.health.rpm = rpm;
+            step_calibration(fan, rpm, now, fanInfo);
+        } else if (appSettings.enable_fan_health) {
+            check_health(fan, rpm, now);
+        }
+    }
+
+    return fanInfo;
+}
+
+void FanCalibration::record_pwm(const std::vector<struct pico_pkt_fan_pwm_t> & fanInfo) {
+    std::lock_guard<std::mutex> lk(m_);
+
+    if (!init_done_) {
+        init();
+    }
+
+    for (auto const& info : fanInfo) {
+        if (Fan *fan = find(info.fan_id); fan != nullptr) {
+            // Tolerates both (pct + 0.5) and the rounding error of a read back pct
+            fan->written_pct = static_cast<int>(info.pwm_pct * FAN_PWM_LSB + 0.25f);
+        }
+    }
+}
+
+std::vector<FanCalibration::Result> FanCalibration::results() {
+    std::lock_guard<std::mutex> lk(m_);
+    std::vector<Result> out;
+
+    if (!init_done_) {
+        init();
+    }
+
+    for (auto const& fan : fans_) {
+        if (fan.have_result) {
+            out.push_back(fan.result);
+        }
+    }
+
+    return out;
+}
+
+std::vector<FanCalibration::FanHealth> FanCalibration::health() {
+    std::lock_guard<std::mutex> lk(m_);
+    std::vector<FanHealth> out;
+
+    if (!init_done_) {
+        init();
+    }
+
+    for (auto const& fan : fans_) {
+        out.push_back(fan.health);
+    }
+
+    return out;
+}
+
+FanCalibration::Progress FanCalibration::progress() {
+    std::lock_guard<std::mutex> lk(m_);
+    Progress p = { .running = cal_.running, .fan_name = "", .phase = "", .duty = 0.0f };
+
+    if (cal_.running) {
+        const char *phases[] = { "spin_up", "sweep_down", "sweep_up" };
+        p.fan_name = cal_.result.fan_name;
+        p.phase = phases[cal_.phase];
+        p.duty = cal_.duty_pct / FAN_PWM_LSB;
+    }
+
+    return p;
+}
+
+std::vector<FanCalibration::FanEvent> FanCalibration::events() {
+    std::lock_guard<std::mutex> lk(m_);
+    return std::vector<FanEvent>(events_.begin(), events_.end());
+}
+
+std::vector<FanCalibration::FanEvent> FanCalibration::take_events() {
+    std::lock_guard<std::mutex> lk(m_);
+    std::vector<FanEvent> out(new_events_.begin(), new_events_.end());
+    new_events_.clear();
+    return out;
+}
+
+} //@END namespace picod
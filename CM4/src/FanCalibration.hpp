@@ -0,0 +1,183 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifndef FAN_CALIBRATION_HPP_
+#define FAN_CALIBRATION_HPP_
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <chrono>
+#include "pico_pkt_fan_pwm.h"
+#include "pico_pkt_temperature.h"
+
+namespace picod {
+/// @brief Measures each fan's duty cycle to RPM curve and its minimum
+/// start/stop duty cycle, and watches live RPM readings for stalled or
+/// degraded fans.
+///
+/// Like FanController, it is driven by the temperature poll: update() is
+/// called with every reading and returns the PWM settings to write.
+class FanCalibration {
+public:
+    typedef struct CurvePoint {
+        /// @brief Duty cycle [0.0 to 1.0]
+        float duty;
+        /// @brief Steady state Revolutions Per Minute (RPM) at that duty cycle
+        uint32_t rpm;
+    } CurvePoint;
+
+    /// @brief Calibration result of one fan
+    typedef struct Result {
+        std::string fan_name;
+        /// @brief When the calibration finished, in milliseconds since the Unix epoch
+        int64_t timestamp_ms;
+        /// @brief Lowest duty cycle that starts the fan from rest, -1 if it never started
+        float min_start_duty;
+        /// @brief Lowest duty cycle the fan keeps turning at, -1 if it never turned
+        float min_stop_duty;
+        /// @brief Sorted by duty cycle
+        std::vector<CurvePoint> curve;
+    } Result;
+
+    enum Health {
+        UNKNOWN,
+        OK,
+        STALLED,
+        DEGRADED
+    };
+
+    typedef struct FanHealth {
+        std::string fan_name;
+        Health health;
+        uint32_t rpm;
+        /// @brief RPM read from the calibration curve, zero(0) if not calibrated
+        uint32_t expected_rpm;
+        /// @brief Duty cycle [0.0 to 1.0], -1 if unknown
+        float duty;
+    } FanHealth;
+
+    typedef struct FanEvent {
+        /// @brief Milliseconds since the Unix epoch
+        int64_t timestamp_ms;
+        std::string fan_name;
+        /// @brief "stalled", "degraded", "recovered", "calibrated" or "calibration_failed"
+        std::string event;
+        uint32_t rpm;
+        uint32_t expected_rpm;
+        float duty;
+    } FanEvent;
+
+    typedef struct Progress {
+        bool running;
+        std::string fan_name;
+        /// @brief "spin_up", "sweep_down" or "sweep_up"
+        std::string phase;
+        /// @brief Duty cycle [0.0 to 1.0] being measured
+        float duty;
+    } Progress;
+
+    static FanCalibration& instance();
+    FanCalibration(FanCalibration const&)   = delete;
+    void operator=(FanCalibration const&)  = delete;
+
+    /// @brief Starts calibrating a fan. Only one fan is calibrated at a time.
+    /// @param error [out] Reason for failure
+    /// @return True(1) if the calibration started. False(0) otherwise.
+    bool start(const std::string & fan_name, std::string & error);
+
+    /// @brief True(1) while the given fan is being calibrated
+    bool is_calibrating(uint8_t fan_id);
+
+    /// @brief Runs one calibration and health check step with the latest readings.
+    /// @return Fans whose PWM setting must be written to the Pico.
+    /// Call record_pwm() once the write succeeds.
+    std::vector<struct pico_pkt_fan_pwm_t> update(const pico_pkt_temperature_u & t);
+
+    /// @brief Records fan PWM settings written to, or read from, the Pico.
+    void record_pwm(const std::vector<struct pico_pkt_fan_pwm_t> & fanInfo);
+
+    /// @brief Returns the calibration result of every calibrated fan.
+    std::vector<Result> results();
+
+    /// @brief Returns the health of every fan.
+    std::vector<FanHealth> health();
+
+    /// @brief Returns the state of the running calibration, if any.
+    Progress progress();
+
+    /// @brief Returns the most recent events, oldest first.
+    std::vector<FanEvent> events();
+
+    /// @brief Returns the events raised since the last call, oldest first.
+    std::vector<FanEvent> take_events();
+
+    static const char * to_string(Health health);
+
+private:
+    enum Phase {
+        SPIN_UP,
+        SWEEP_DOWN,
+        SWEEP_UP
+    };
+
+    typedef struct Fan {
+        uint8_t fan_id;
+        std::string fan_name;
+        /// @brief Duty cycle in percent last written to the Pico, -1 if unknown
+        int written_pct;
+        bool have_result;
+        Result result;
+        FanHealth health;
+        /// @brief Health suggested by the latest readings, and since when
+        Health candidate;
+        std::chrono::steady_clock::time_point candidate_since;
+    } Fan;
+
+    typedef struct Calibration {
+        bool running;
+        uint8_t fan_id;
+        Phase phase;
+        int duty_pct;
+        int step_pct;
+        /// @brief Duty cycle to restore when done, -1 if unknown
+        int restore_pct;
+        /// @brief Lowest duty cycle at which the fan was still turning
+        int last_turning_pct;
+        std::chrono::steady_clock::time_point step_start;
+        uint64_t rpm_sum;
+        uint32_t rpm_count;
+        Result result;
+    } Calibration;
+
+    std::mutex m_;
+    bool init_done_;
+    std::vector<Fan> fans_;
+    Calibration cal_;
+    std::deque<FanEvent> events_;
+    std::deque<FanEvent> new_events_;
+
+    FanCalibration();
+
+    /// @brief Loads saved results. Must be called with m_ held.
+    void init();
+    /// @brief Must be called with m_ held.
+    void save();
+    Fan * find(uint8_t fan_id);
+    void raise(const Fan & fan, const char * event);
+    void step_calibration(Fan & fan, uint32_t rpm, std::chrono::steady_clock::time_point now,
+        std::vector<struct pico_pkt_fan_pwm_t> & fanInfo);
+    void finish_calibration(Fan & fan, bool success,
+        std::vector<struct pico_pkt_fan_pwm_t> & fanInfo);
+    void check_health(Fan & fan, uint32_t rpm, std::chrono::steady_clock::time_point now);
+
+    /// @brief Linearly interpolates the calibration curve
+    static uint32_t expected_rpm(const Result & result, float duty);
+};
+
+} //@END namespace picod
+
+#endif //@END FAN_CALIBRATION_HPP_
@@ -0,0 +1,211 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#include "FanController.hpp"
+#include "FanCalibration.hpp"
+#include "SensorID.hpp"
+#include "fmt/core.h"
+#include <map>
+#include <cmath>
+
+namespace picod {
+
+FanController::FanController()
+:init_done_{false}
+{
+}
+
+FanController& FanController::instance() {
+    static FanController theInstance;
+    return theInstance;
+}
+
+void FanController::init() {
+    init_done_ = true;
+
+    for (auto const& curve : appSettings.fan_curves) {
+        uint8_t fan_id = get_fan_id_from_name(curve.fan_name.c_str());
+        if (fan_id == INVALID_FAN_ID) {
+            fmt::println(stderr, "fan_control: unknown fan_name {}", curve.fan_name);
+            continue;
+        }
+
+        // Start from the PWM setting applied by init_fan_pwm()
+        float duty = (fan_id == SYS_FAN1) ? appSettings.fan1_pwm : appSettings.cm4_fan_pwm;
+
+        Fan fan = {
+            .curve = curve,
+            .fan_id = fan_id,
+            .state = { .fan_name = curve.fan_name, .duty = duty, .target = duty,
+                .sensor_name = "", .temperature_c = 0.0f },
+            .written_pct = static_cast<int>(duty * FAN_PWM_LSB),  // As packed by the Pico packet
+            .filtered_c = std::vector<float>(curve.sensors.size(), 0.0f),
+            .have_filtered = std::vector<bool>(curve.sensors.size(), false)
+        };
+        fans_.push_back(fan);
+    }
+
+    last_update_ = std::chrono::steady_clock::now();
+}
+
+bool FanController::is_enabled() {
+    std::lock_guard<std::mutex> lk(m_);
+
+    if (!appSettings.enable_fan_control) {
+        return false;
+    }
+
+    if (!init_done_) {
+        init();
+    }
+
+    return !fans_.empty();
+}
+
+float FanController::interpolate(const std::vector<FanCurvePoint> & points, float temperature_c) {
+    if (points.empty()) {
+        return 0.0f;
+    }
+
+    if (temperature_c <= points.front().temperature_c) {
+        return points.front().duty;
+    }
+
+    for (size_t i = 1; i < points.size(); i++) {
+        const FanCurvePoint &a = points[i-1];
+        const FanCurvePoint &b = points[i];
+        if (temperature_c <= b.temperature_c) {
+            float span = b.temperature_c - a.temperature_c;
+            if (span <= 0.0f) {
+                return b.duty;
+            }
+            return a.duty + (b.duty - a.duty) * (temperature_c - a.temperature_c) / span;
+        }
+    }
+
+    return points.back().duty;
+}
+
+std::vector<struct pico_pkt_fan_pwm_t> FanController::update(
+    const pico_pkt_temperature_u & t, float tmp103_c) {
+    std::vector<struct pico_pkt_fan_pwm_t> fanInfo;
+
+    if (!is_enabled()) {
+        return fanInfo;
+    }
+
+    std::lock_guard<std::mutex> lk(m_);
+
+    std::map<std::string, float> readings;
+    if (appSettings.sensorIds.size() > NUM_NTC_SENSORS) {
+        for (int ch=0; ch < NUM_NTC_SENSORS; ch++) {
+            readings[appSettings.sensorIds[ch]] = t.data[ch];
+        }
+    }
+
+    if (picod::SensorId::NUM_SENSOR_IDs == appSettings.sensorIds.size()) {
+        readings[appSettings.sensorIds[picod::RPi_Pico]] = t.s.pico;
+        if (appSettings.enable_tmp103_sensor) {
+            readings[appSettings.sensorIds[picod::Under_CM4_SOC]] = tmp103_c;
+        }
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    float dt = std::chrono::duration<float>(now - last_update_).count();
+    last_update_ = now;
+
+    for (auto &fan : fans_) {
+        if (FanCalibration::instance().is_calibrating(fan.fan_id)) {
+            // The calibration sweep owns this fan until it is done
+            continue;
+        }
+
+        FanState &state = fan.state;
+        state.target = 0.0f;
+        state.sensor_name.clear();
+
+        for (size_t i = 0; i < fan.curve.sensors.size(); i++) {
+            const FanSensorCurve &sensor = fan.curve.sensors[i];
+            auto search = readings.find(sensor.sensor_name);
+            if (search == readings.end()) {
+                continue;
+            }
+
+            // Follow rising temperatures at once, falling ones only
+            // once they drop by more than the hysteresis.
+            float temperature_c = search->second;
+            float &filtered_c = fan.filtered_c[i];
+            if (!fan.have_filtered[i] || (temperature_c > filtered_c)) {
+                filtered_c = temperature_c;
+                fan.have_filtered[i] = true;
+            } else if (temperature_c < (filtered_c - appSettings.fan_hysteresis_c)) {
+                filtered_c = temperature_c + appSettings.fan_hysteresis_c;
+            }
+
+            float demand = sensor.weight * interpolate(sensor.points, filtered_c);
+            demand = (demand > 1.0f) ? 1.0f : demand;
+            if (state.sensor_name.empty() || (demand > state.target)) {
+                state.target = demand;
+                state.sensor_name = sensor.sensor_name;
+                state.temperature_c = filtered_c;
+            }
+        }
+
+        if (state.sensor_name.empty()) {
+            // No readings: leave the fan alone
+            continue;
+        }
+
+        // Limit how fast the duty cycle changes
+        float delta = state.target - state.duty;
+        float max_up = appSettings.fan_slew_up_per_second * dt;
+        float max_down = appSettings.fan_slew_down_per_second * dt;
+        if ((appSettings.fan_slew_up_per_second > 0.0f) && (delta > max_up)) {
+            delta = max_up;
+        } else if ((appSettings.fan_slew_down_per_second > 0.0f) && (delta < -max_down)) {
+            delta = -max_down;
+        }
+
+        state.duty += delta;
+        state.duty = (state.duty < appSettings.fan_min_duty) ? appSettings.fan_min_duty : state.duty;
+        state.duty = (state.duty > 1.0f) ? 1.0f : state.duty;
+
+        // The Pico resolution is 1%
+        int pct = static_cast<int>(std::lround(state.duty * FAN_PWM_LSB));
+        if (pct != fan.written_pct) {
+            // Half an LSB is added since the packet truncates
+            fanInfo.emplace_back(pico_pkt_fan_pwm_t {
+                .fan_id = fan.fan_id, .pwm_pct = (pct + 0.5f) / FAN_PWM_LSB });
+        }
+    }
+
+    return fanInfo;
+}
+
+void FanController::confirm(const std::vector<struct pico_pkt_fan_pwm_t> & fanInfo) {
+    std::lock_guard<std::mutex> lk(m_);
+
+    for (auto const& info : fanInfo) {
+        for (auto &fan : fans_) {
+            if (fan.fan_id == info.fan_id) {
+                // Tolerates both (pct + 0.5) and the rounding error of a read back pct
+                fan.written_pct = static_cast<int>(info.pwm_pct * FAN_PWM_LSB + 0.25f);
+            }
+        }
+    }
+}
+
+std::vector<FanController::FanState> FanController::state() {
+    std::lock_guard<std::mutex> lk(m_);
+    std::vector<FanState> states;
+
+    for (auto const& fan : fans_) {
+        states.push_back(fan.state);
+    }
+
+    return states;
+}
+
+} //@END namespace picod
@@ -0,0 +1,85 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifndef FAN_CONTROLLER_HPP_
+#define FAN_CONTROLLER_HPP_
+#include <string>
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include "settings.hpp"
+#include "pico_pkt_fan_pwm.h"
+#include "pico_pkt_temperature.h"
+
+namespace picod {
+/// @brief Closed loop fan control. Maps sensor temperatures through the
+/// fan curves configured in fan_control, and limits how fast and how low
+/// the fan duty cycle may go.
+class FanController {
+public:
+    /// @brief Controller state of one fan
+    typedef struct FanState {
+        std::string fan_name;
+        /// @brief Duty cycle [0.0 to 1.0] last commanded
+        float duty;
+        /// @brief Duty cycle [0.0 to 1.0] requested by the fan curves
+        float target;
+        /// @brief Sensor whose curve requested the highest duty cycle
+        std::string sensor_name;
+        /// @brief Temperature (°C) of that sensor, after hysteresis
+        float temperature_c;
+    } FanState;
+
+    static FanController& instance();
+    FanController(FanController const&)   = delete;
+    void operator=(FanController const&)  = delete;
+
+    /// @brief True(1) when fan control is enabled and at least one fan has a curve
+    bool is_enabled();
+
+    /// @brief Runs one control step with the latest sensor readings.
+    /// @param t Pico temperature readings
+    /// @param tmp103_c TMP103 temperature (°C), ignored unless enable_tmp103_sensor is set
+    /// @return Fans whose PWM setting must be written to the Pico.
+    /// Call confirm() once the write succeeds.
+    std::vector<struct pico_pkt_fan_pwm_t> update(const pico_pkt_temperature_u & t, float tmp103_c);
+
+    /// @brief Records PWM settings written to the Pico. Manual writes to a 
+    /// controlled fan are reported here too, so the controller restores 
+    /// its own setting on the next update().
+    void confirm(const std::vector<struct pico_pkt_fan_pwm_t> & fanInfo);
+
+    /// @brief Returns the state of every controlled fan.
+    std::vector<FanState> state();
+
+private:
+    typedef struct Fan {
+        FanCurve curve;
+        uint8_t fan_id;
+        FanState state;
+        /// @brief Duty cycle in percent last written to the Pico, -1 if unknown
+        int written_pct;
+        /// @brief Hysteresis filtered temperature of each sensor
+        std::vector<float> filtered_c;
+        std::vector<bool> have_filtered;
+    } Fan;
+
+    std::mutex m_;
+    bool init_done_;
+    std::vector<Fan> fans_;
+    std::chrono::steady_clock::time_point last_update_;
+
+    FanController();
+
+    /// @brief Resolves fan IDs. Must be called with m_ held.
+    void init();
+
+    /// @brief Linearly interpolates a fan curve
+    static float interpolate(const std::vector<FanCurvePoint> & points, float temperature_c);
+};
+
+} //@END namespace picod
+
+#endif //@END FAN_CONTROLLER_HPP_
@@ -0,0 +1,426 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#include "HttpLoad.hpp"
+#include "fmt/core.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <thread>
+
+using namespace nlohmann;
+
+namespace picod {
+
+static const char * const KIND_NAMES[] = { "status", "home", "settings" };
+
+/// @brief Count, mean and percentiles of durations (us)
+static ordered_json summarize(std::vector<uint32_t> us) {
+    ordered_json j;
+    j["count"] = us.size();
+    if (us.empty()) {
+        return j;
+    }
+
+    std::sort(us.begin(), us.end());
+    auto percentile = [&us](double p) {
+        size_t rank = (size_t)std::ceil(p / 100.0 * us.size());
+        return us[(rank == 0) ? 0 : rank - 1];
+    };
+
+    double sum = 0.0;
+    for (auto v : us) {
+        sum += v;
+    }
+
+    j["min"] = us.front();
+    j["mean"] = std::round(sum / us.size() * 10.0) / 10.0;
+    j["p50"] = percentile(50.0);
+    j["p90"] = percentile(90.0);
+    j["p99"] = percentile(99.0);
+    j["p99_9"] = percentile(99.9);
+    j["max"] = us.back();
+    return j;
+}
+
+template <typename Duration>
+static uint32_t to_us(Duration d) {
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+    return (us < 0) ? 0 : (uint32_t)std::min<int64_t>(us, UINT32_MAX);
+}
+
+/// @brief Reads the integer value of the last "<key>": in an event
+/// @return True(1) if the key was found. False(0) otherwise.
+static bool find_value(const std::string & event, const char * key, int64_t & value) {
+    // seq and sent_us are only used at the top level of an event
+    const size_t pos = event.rfind(key);
+    if (pos == std::string::npos) {
+        return false;
+    }
+
+    const char * start = event.c_str() + pos + strlen(key);
+    char * end = nullptr;
+    value = strtoll(start, &end, 10);
+    return end != start;
+}
+
+HttpLoad::HttpLoad(const Options & opts)
+:opts_{opts}
+,mix_total_{0}
+,completed_{0}
+,events_{0}
+,running_subscribers_{0}
+,elapsed_s_{0.0}
+{
+    for (int k = 0; k < NUM_KINDS; k++) {
+        if (opts_.mix[k] > 0) {
+            mix_total_ += opts_.mix[k];
+            mix_.emplace_back(mix_total_, (Kind)k);
+        }
+    }
+
+    if (mix_.empty()) {
+        mix_total_ = 1;
+        mix_.emplace_back(1, STATUS);
+    }
+}
+
+bool HttpLoad::get_kind(const std::string & name, Kind & kind) {
+    for (int k = 0; k < NUM_KINDS; k++) {
+        if (name == KIND_NAMES[k]) {
+            kind = (Kind)k;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char * HttpLoad::to_string(Kind kind) {
+    return (kind < NUM_KINDS) ? KIND_NAMES[kind] : "unknown";
+}
+
+void HttpLoad::run_worker(uint32_t index, Worker & w, const std::atomic<bool> & stop) {
+    httplib::Client cli(opts_.host, opts_.port);
+    cli.set_keep_alive(true);
+    cli.set_connection_timeout(std::chrono::milliseconds(opts_.timeout_ms));
+    cli.set_read_timeout(std::chrono::milliseconds(opts_.timeout_ms));
+    cli.set_write_timeout(std::chrono::milliseconds(opts_.timeout_ms));
+
+    json settings;
+    settings["fan_name"] = opts_.fan_name;
+    if (opts_.pwm_pct >= 0) {
+        settings["fan_pwm_pct"] = opts_.pwm_pct;
+    }
+    const std::string settings_body = settings.dump();
+
+    // Each connection sends its share of the rate, offset from the others
+    const auto interval = (opts_.rate > 0.0) ? std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(opts_.connections / opts_.rate)) : Clock::duration::zero();
+    auto next_send = Clock::now() + (interval * index) / opts_.connections;
+    uint64_t n = index;
+
+    while (!stop) {
+        if (interval.count() > 0) {
+            auto now = Clock::now();
+            while (!stop && (now < next_send)) {
+                std::this_thread::sleep_until(std::min(next_send, now + std::chrono::milliseconds(100)));
+                now = Clock::now();
+            }
+            if (stop) {
+                break;
+            }
+            if ((now - next_send) > interval) {
+                w.late++;
+            }
+            next_send += interval;
+        }
+
+        // Interleaves the kinds in proportion to the mix, without randomness
+        // so that runs can be compared
+        const uint64_t slot = (n++ * 0x9E3779B97F4A7C15ull) % mix_total_;
+        Kind kind = mix_.back().second;
+        for (auto const & m : mix_) {
+            if (slot < m.first) {
+                kind = m.second;
+                break;
+            }
+        }
+
+        w.sent[kind]++;
+        const auto t0 = Clock::now();
+        auto res = (kind == SETTINGS) ?
+            cli.Post("/api/settings/fan_pwm", settings_body, "application/json") :
+            cli.Get((kind == STATUS) ? "/api/status" : "/");
+        const auto latency = Clock::now() - t0;
+
+        if (!res) {
+            w.connection_errors[kind]++;
+        } else if (res->status != httplib::StatusCode::OK_200) {
+            w.http_errors[kind]++;
+        } else if (res->body.rfind("{\"error\"", 0) == 0) {
+            w.api_errors[kind]++;
+        } else {
+            w.ok[kind]++;
+            w.latency_us[kind].push_back(to_us(latency));
+        }
+        completed_++;
+    }
+}
+
+void HttpLoad::on_stream_data(Subscriber & s, const char * data, size_t length) {
+    const auto now = Clock::now();
+    const int64_t now_us = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+
+    s.pending.append(data, length);
+
+    size_t end;
+    while ((end = s.pending.find("\n\n")) != std::string::npos) {
+        const std::string event = s.pending.substr(0, end);
+        s.pending.erase(0, end + 2);
+
+        int64_t seq, sent_us;
+        if ((event.rfind("data: ", 0) != 0) || !find_value(event, "\"seq\":", seq) ||
+            !find_value(event, "\"sent_us\":", sent_us)) {
+            s.bad_events++;
+            continue;
+        }
+
+        // A lower sequence number means picod restarted
+        if ((s.last_seq >= 0) && (seq > (s.last_seq + 1))) {
+            s.missed += seq - s.last_seq - 1;
+        }
+        s.last_seq = seq;
+
+        if (s.last_event != Clock::time_point()) {
+            s.interval_us.push_back(to_us(now - s.last_event));
+        }
+        s.last_event = now;
+
+        if (now_us < sent_us) {
+            s.clock_skew++;
+        }
+        s.lag_us.push_back(to_us(std::chrono::microseconds(now_us - sent_us)));
+        s.arrivals.emplace_back(seq, now);
+        s.events++;
+        events_++;
+    }
+}
+
+void HttpLoad::run_subscriber(Subscriber & s, httplib::Client & cli, const std::atomic<bool> & stop) {
+    cli.set_connection_timeout(std::chrono::milliseconds(opts_.timeout_ms));
+    // Long gaps between events are measured, not treated as errors
+    cli.set_read_timeout(std::chrono::seconds(60));
+
+    while (!stop) {
+        s.connects++;
+        s.pending.clear();
+        // The interval since the last event before a reconnection is not counted
+        s.last_event = Clock::time_point();
+
+        cli.Get("/stream", [&](const char * data, size_t length) {
+            on_stream_data(s, data, length);
+            return !stop;
+        });
+
+        if (stop) {
+            break;
+        }
+
+        s.disconnects++;
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+
+    running_subscribers_--;
+}
+
+void HttpLoad::print_progress(double elapsed_s) const {
+    fmt::println(stderr, "{:8.1f} s: {} requests ({:.1f}/s), {} events",
+        elapsed_s, completed_.load(), (elapsed_s > 0.0) ? completed_ / elapsed_s : 0.0,
+        events_.load());
+}
+
+void HttpLoad::run(const std::atomic<bool> & quit) {
+    std::atomic<bool> stop(false);
+    std::vector<std::unique_ptr<httplib::Client>> clients;
+    std::vector<std::thread> threads;
+
+    workers_.assign(opts_.connections, Worker{});
+    subscribers_.assign(opts_.subscribers, Subscriber{});
+    completed_ = 0;
+    events_ = 0;
+
+    const auto start = Clock::now();
+    const auto end = start + std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(opts_.duration_s));
+    const auto progress = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(opts_.progress_s));
+    auto next_progress = start + progress;
+
+    running_subscribers_ = opts_.subscribers;
+    for (auto & s : subscribers_) {
+        s.last_seq = -1;
+        clients.emplace_back(new httplib::Client(opts_.host, opts_.port));
+        threads.emplace_back(&HttpLoad::run_subscriber, this, std::ref(s),
+            std::ref(*clients.back()), std::cref(stop));
+    }
+
+    for (uint32_t i = 0; i < opts_.connections; i++) {
+        threads.emplace_back(&HttpLoad::run_worker, this, i, std::ref(workers_[i]), std::cref(stop));
+    }
+
+    auto now = Clock::now();
+    while (!quit && (now < end)) {
+        std::this_thread::sleep_until(std::min(end, now + std::chrono::milliseconds(100)));
+        now = Clock::now();
+
+        if ((opts_.progress_s > 0.0) && (now >= next_progress)) {
+            print_progress(std::chrono::duration<double>(now - start).count());
+            next_progress += progress;
+        }
+    }
+
+    stop = true;
+    elapsed_s_ = std::chrono::duration<double>(Clock::now() - start).count();
+
+    // Subscribers wait on /stream until their connection is shut down
+    while (running_subscribers_ > 0) {
+        for (auto & cli : clients) {
+            cli->stop();
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+
+    for (auto & t : threads) {
+        t.join();
+    }
+}
+
+ordered_json HttpLoad::results() const {
+    ordered_json j;
+
+    ordered_json mix = ordered_json::object();
+    for (int k = 0; k < NUM_KINDS; k++) {
+        if (opts_.mix[k] > 0) {
+            mix[KIND_NAMES[k]] = opts_.mix[k];
+        }
+    }
+
+    j["config"] = {
+        {"host", opts_.host},
+        {"port", opts_.port},
+        {"subscribers", opts_.subscribers},
+        {"connections", opts_.connections},
+        {"rate", opts_.rate},
+        {"mix", mix},
+        {"fan_name", opts_.fan_name},
+        {"pwm_pct", opts_.pwm_pct},
+        {"duration_s", opts_.duration_s},
+        {"timeout_ms", opts_.timeout_ms}
+    };
+    j["elapsed_s"] = elapsed_s_;
+
+    // Requests, summed over the connections
+    Worker total = {};
+    for (auto const & w : workers_) {
+        for (int k = 0; k < NUM_KINDS; k++) {
+            total.sent[k] += w.sent[k];
+            total.ok[k] += w.ok[k];
+            total.http_errors[k] += w.http_errors[k];
+            total.api_errors[k] += w.api_errors[k];
+            total.connection_errors[k] += w.connection_errors[k];
+            total.latency_us[k].insert(total.latency_us[k].end(),
+                w.latency_us[k].begin(), w.latency_us[k].end());
+        }
+        total.late += w.late;
+    }
+
+    auto counts = [this](uint64_t sent, uint64_t ok, uint64_t http_errors,
+        uint64_t api_errors, uint64_t connection_errors) {
+        return ordered_json {
+            {"sent", sent},
+            {"ok", ok},
+            {"http_errors", http_errors},
+            {"api_errors", api_errors},
+            {"connection_errors", connection_errors},
+            {"per_s", (elapsed_s_ > 0.0) ? ok / elapsed_s_ : 0.0}
+        };
+    };
+
+    ordered_json requests, latency;
+    uint64_t sent = 0, ok = 0, http_errors = 0, api_errors = 0, connection_errors = 0;
+    std::vector<uint32_t> all;
+    for (int k = 0; k < NUM_KINDS; k++) {
+        sent += total.sent[k];
+        ok += total.ok[k];
+        http_errors += total.http_errors[k];
+        api_errors += total.api_errors[k];
+        connection_errors += total.connection_errors[k];
+        all.insert(all.end(), total.latency_us[k].begin(), total.latency_us[k].end());
+    }
+    requests["all"] = counts(sent, ok, http_errors, api_errors, connection_errors);
+    latency["all"] = summarize(all);
+    for (int k = 0; k < NUM_KINDS; k++) {
+        if (opts_.mix[k] > 0) {
+            requests[KIND_NAMES[k]] = counts(total.sent[k], total.ok[k], total.http_errors[k],
+                total.api_errors[k], total.connection_errors[k]);
+            latency[KIND_NAMES[k]] = summarize(total.latency_us[k]);
+        }
+    }
+    requests["late"] = total.late;
+    j["requests"] = requests;
+    j["latency_us"] = latency;
+
+    // Each event's first arrival, at any subscriber
+    std::map<uint64_t, Clock::time_point> first;
+    for (auto const & s : subscribers_) {
+        for (auto const & [seq, t] : s.arrivals) {
+            auto search = first.find(seq);
+            if ((search == first.end()) || (t < search->second)) {
+                first[seq] = t;
+            }
+        }
+    }
+
+    ordered_json subscribers = ordered_json::array();
+    std::vector<uint32_t> all_lag, all_behind, all_interval;
+    for (auto const & s : subscribers_) {
+        std::vector<uint32_t> behind;
+        for (auto const & [seq, t] : s.arrivals) {
+            behind.push_back(to_us(t - first[seq]));
+        }
+
+        subscribers.push_back({
+            {"connects", s.connects},
+            {"disconnects", s.disconnects},
+            {"events", s.events},
+            {"missed", s.missed},
+            {"bad_events", s.bad_events},
+            {"clock_skew", s.clock_skew},
+            {"lag_us", summarize(s.lag_us)},
+            {"behind_first_us", summarize(behind)},
+            {"interval_us", summarize(s.interval_us)}
+        });
+
+        all_lag.insert(all_lag.end(), s.lag_us.begin(), s.lag_us.end());
+        all_behind.insert(all_behind.end(), behind.begin(), behind.end());
+        all_interval.insert(all_interval.end(), s.interval_us.begin(), s.interval_us.end());
+    }
+
+    j["events"] = {
+        {"received", first.size()},
+        {"lag_us", summarize(all_lag)},
+        {"behind_first_us", summarize(all_behind)},
+        {"interval_us", summarize(all_interval)},
+        {"subscribers", subscribers}
+    };
+
+    return j;
+}
+
+} //@END namespace picod
@@ -0,0 +1,142 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifndef HTTP_LOAD_HPP_
+#define HTTP_LOAD_HPP_
+#include <stdint.h>
+#include <atomic>
+#include <array>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "httplib.h"
+#include "json.hpp"
+
+namespace picod {
+/// @brief Loads picod's web interface the way operators and dashboards do:
+/// server-sent event (SSE) subscribers on /stream, and requests for
+/// /api/status, the home page and settings.
+///
+/// Each connection sends its share of the requests, one at a time, as fast
+/// as possible or at a fixed rate. Each subscriber keeps a /stream open and
+/// records when every event arrives: its lag behind the time picod sent it,
+/// its delay behind the first subscriber to receive it, the interval since
+/// the previous event, and the events it missed.
+class HttpLoad {
+public:
+    typedef enum Kind {
+        /// @brief GET /api/status
+        STATUS = 0,
+        /// @brief GET /, the home page
+        HOME,
+        /// @brief POST /api/settings/fan_pwm
+        SETTINGS,
+        NUM_KINDS
+    } Kind;
+
+    typedef struct Options {
+        std::string host;
+        uint16_t port;
+        /// @brief Number of SSE subscribers
+        uint32_t subscribers;
+        /// @brief Number of connections sending requests
+        uint32_t connections;
+        /// @brief Requests per second, over all connections. Zero(0) sends
+        /// each request as soon as the previous one completed.
+        double rate;
+        /// @brief Relative number of requests of each kind
+        std::array<uint32_t, NUM_KINDS> mix;
+        /// @brief Fan of the settings requests
+        std::string fan_name;
+        /// @brief Duty cycle (%) the settings requests write. Negative only
+        /// reads it.
+        int32_t pwm_pct;
+        /// @brief Length of the run (s)
+        double duration_s;
+        /// @brief Connect and read timeout of the requests
+        uint32_t timeout_ms;
+        /// @brief Print a progress line every this many seconds. Zero(0) never does.
+        double progress_s;
+    } Options;
+
+    explicit HttpLoad(const Options & opts);
+    HttpLoad(HttpLoad const&)   = delete;
+    void operator=(HttpLoad const&)  = delete;
+
+    /// @brief Runs the load until its duration is reached, or quit is set.
+    void run(const std::atomic<bool> & quit);
+
+    /// @brief Results of the last run, as JSON
+    nlohmann::ordered_json results() const;
+
+    /// @brief Looks up a request kind by name (status, home, settings)
+    /// @return True(1) if the name is known. False(0) otherwise.
+    static bool get_kind(const std::string & name, Kind & kind);
+
+    static const char * to_string(Kind kind);
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    /// @brief What one connection measured
+    typedef struct Worker {
+        std::array<uint64_t, NUM_KINDS> sent;
+        std::array<uint64_t, NUM_KINDS> ok;
+        /// @brief Responses with a status other than 200 OK
+        std::array<uint64_t, NUM_KINDS> http_errors;
+        /// @brief 200 OK responses carrying an error, e.g. the Pico not answering
+        std::array<uint64_t, NUM_KINDS> api_errors;
+        /// @brief Requests that failed to connect, timed out or were cut off
+        std::array<uint64_t, NUM_KINDS> connection_errors;
+        /// @brief Requests sent more than one interval behind schedule
+        uint64_t late;
+        /// @brief Latency (us) of the completed requests, per kind
+        std::array<std::vector<uint32_t>, NUM_KINDS> latency_us;
+    } Worker;
+
+    /// @brief What one SSE subscriber measured
+    typedef struct Subscriber {
+        uint64_t connects;
+        uint64_t disconnects;
+        uint64_t events;
+        /// @brief Gaps in the event sequence numbers
+        uint64_t missed;
+        /// @brief Events without a sequence number or send time
+        uint64_t bad_events;
+        /// @brief Events stamped later than they arrived: the clocks differ
+        uint64_t clock_skew;
+        /// @brief Time (us) from picod sending each event to its arrival
+        std::vector<uint32_t> lag_us;
+        /// @brief Time (us) between consecutive events
+        std::vector<uint32_t> interval_us;
+        /// @brief Sequence number and arrival of each event
+        std::vector<std::pair<uint64_t, Clock::time_point>> arrivals;
+        int64_t last_seq;
+        Clock::time_point last_event;
+        /// @brief Stream data not yet parsed
+        std::string pending;
+    } Subscriber;
+
+    Options opts_;
+    /// @brief Cumulative request mix, for picking the next kind
+    std::vector<std::pair<uint64_t, Kind>> mix_;
+    uint64_t mix_total_;
+    std::vector<Worker> workers_;
+    std::vector<Subscriber> subscribers_;
+    std::atomic<uint64_t> completed_;
+    std::atomic<uint64_t> events_;
+    std::atomic<uint32_t> running_subscribers_;
+    double elapsed_s_;
+
+    void run_worker(uint32_t index, Worker & w, const std::atomic<bool> & stop);
+    void run_subscriber(Subscriber & s, httplib::Client & cli, const std::atomic<bool> & stop);
+    /// @brief Parses the events received so far
+    void on_stream_data(Subscriber & s, const char * data, size_t length);
+    void print_progress(double elapsed_s) const;
+};
+
+} //@END namespace picod
+
+#endif //@END HTTP_LOAD_HPP_
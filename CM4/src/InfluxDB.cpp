@@ -5,6 +5,7 @@
  */
 #include "InfluxDB.hpp"
 #include "settings.hpp"
+#include "Trace.hpp"
 #include <iostream>
 
 namespace picod {
@@ -45,29 +46,70 @@ std::string InfluxDB::geWriteEndpointURL(){
 }
 
 void InfluxDB::publish() {
-    // If the stream is not empty:
-    if ((dataOut_.tellp() != 0)) {
-        std::string rcvd_message;
-        auto res = client_.Post(path_, dataOut_.str(), "text/plain");
-        //client_.postRequest(dataOut_.str(), rcvd_message, lastError_);
+    TRACE_SCOPE("influx/publish");
+    auto lines = takeLines();
+    // If the stream was not empty:
+    if (!lines.empty()) {
+        auto res = client_.Post(path_, lines, "text/plain");
         if (!res->body.empty()) {
             std::cout << res->body << std::endl;
         }     
-        dataOut_.str("");
-        dataOut_.clear();   
     }
 }
 
-void InfluxDB::addTemperature(std::string sensorId, float value){
-    //TemperatureSensors,sensor_id=NTC1 temperature=33.45
+std::string InfluxDB::takeLines() {
+    std::string lines = dataOut_.str();
+    dataOut_.str("");
+    dataOut_.clear();
+    return lines;
+}
+
+void InfluxDB::endLine(int64_t timestamp_ms){
+    // Without a timestamp, InfluxDB uses the time the line is written
+    if (timestamp_ms > 0) {
+        dataOut_ << " " << timestamp_ms;
+    }
+    dataOut_ << std::endl;
+}
+
+void InfluxDB::addTemperature(std::string sensorId, float value, int64_t timestamp_ms){
+    //TemperatureSensors,sensor_id=NTC1 temperature=33.45 1718000000000
     dataOut_ << "TemperatureSensors,sensor_id=" << sensorId <<
-    " temperature=" << value << std::endl;    
+    " temperature=" << value;
+    endLine(timestamp_ms);
 }
 
-void InfluxDB::addTachometer(std::string sensorId, float value){
-    //FanTachometers,sensor_id=FAN1 rpm=4800
+void InfluxDB::addTachometer(std::string sensorId, float value, int64_t timestamp_ms){
+    //FanTachometers,sensor_id=FAN1 rpm=4800 1718000000000
     dataOut_ << "FanTachometers,sensor_id=" << sensorId <<
-    " rpm=" << value << std::endl;
+    " rpm=" << value;
+    endLine(timestamp_ms);
+}
+
+void InfluxDB::addPicoEvent(std::string event, uint16_t data, uint16_t boot, int64_t timestamp_ms){
+    //PicoEvents,event=watchdog_reset data=2i,boot=3i 1718000000000
+    dataOut_ << "PicoEvents,event=" << event << " data=" << data << "i,boot=" << boot << "i";
+    endLine(timestamp_ms);
+}
+
+void InfluxDB::addLatency(const std::string & group, const std::string & name,
+    const LatencyHistogram::Summary & summary) {
+    //Latency,group=http,name=GET\ /api/status count=60i,mean=812.5,p50=767i,...,max=2047i
+    std::string tag;
+    for (char c : name) {
+        // Tag values escape commas, equal signs and spaces
+        if ((c == ',') || (c == '=') || (c == ' ')) {
+            tag += '\\';
+        }
+        tag += c;
+    }
+
+    dataOut_ << "Latency,group=" << group << ",name=" << tag <<
+    " count=" << summary.count << "i,mean=" << summary.mean_us <<
+    ",min=" << summary.min_us << "i,p50=" << summary.p50_us <<
+    "i,p90=" << summary.p90_us << "i,p99=" << summary.p99_us <<
+    "i,p99_9=" << summary.p99_9_us << "i,max=" << summary.max_us << "i";
+    endLine(0);
 }
 
 } //@END namespace picod
\ No newline at end of file
@@ -7,6 +7,7 @@
 #define INFLUX_DB_HPP_
 #include <sstream>
 #include "httplib.h"
+#include "LatencyHistogram.hpp"
 
 namespace picod {
 /// @brief This is a helper class used to publish sensor
@@ -24,13 +25,38 @@ public:
     /// @brief Aggregates temperature sensor data
     /// @param sensorId Sensor ID (name)
     /// @param value Temperature (°C)
-    void addTemperature(std::string sensorId, float value);
+    /// @param timestamp_ms When it was sampled, in milliseconds since the
+    /// Unix epoch. Zero(0) to let InfluxDB use the time it is written.
+    void addTemperature(std::string sensorId, float value, int64_t timestamp_ms = 0);
 
     /// @brief Aggregates tachometer sensor data
     /// @param sensorId  Sensor ID (name)
     /// @param value Revolutions Per Minute (RPM)
-    void addTachometer(std::string sensorId, float value);
+    /// @param timestamp_ms As for addTemperature()
+    void addTachometer(std::string sensorId, float value, int64_t timestamp_ms = 0);
+
+    /// @brief Aggregates an event read from the Pico event log
+    /// @param event Event name
+    /// @param data Event data
+    /// @param boot Pico boot number
+    /// @param timestamp_ms Milliseconds since the Unix epoch, zero(0) if unknown
+    void addPicoEvent(std::string event, uint16_t data, uint16_t boot, int64_t timestamp_ms);
+
+    /// @brief Aggregates latency percentiles, see Latency
+    /// @param group poll, i2c, serial_rtt or http
+    /// @param name Name within the group, e.g. a packet type or HTTP route
+    /// @param summary Percentiles (us) of the durations recorded since the
+    /// previous report
+    void addLatency(const std::string & group, const std::string & name,
+        const LatencyHistogram::Summary & summary);
+
+    /// @brief Returns the aggregated data, in InfluxDB line protocol, and
+    /// clears it. publish() sends what this returns.
+    std::string takeLines();
 private:    
+    /// @brief Ends a line, with its timestamp if known
+    void endLine(int64_t timestamp_ms);
+
     /// @brief InfluxDB host, e.g. localhost
     std::string hostname_;
     /// @brief Organization
@@ -0,0 +1,144 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#include "Latency.hpp"
+#include "pico_pkt_id.h"
+#include <cstdlib>
+
+namespace picod {
+
+// How often the summaries are reported, e.g. to InfluxDB
+const auto LATENCY_REPORT_INTERVAL = std::chrono::seconds(60);
+
+static const char * const PACKET_NAMES[] = {
+    "temperature", "fan_pwm", "watchdog", "shutdown", "ping", "version",
+    "fan_ctrl", "ntc_cal", "event_log", "time", "flash_config"
+};
+
+static int64_t to_ns(std::chrono::steady_clock::time_point t) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count();
+}
+
+Latency::Latency()
+:poll_start_ns_{0}
+,last_report_{std::chrono::steady_clock::now()}
+{
+    static_assert(sizeof(PACKET_NAMES) / sizeof(PACKET_NAMES[0]) == NUM_PACKET_TYPES);
+}
+
+Latency& Latency::instance() {
+    static Latency theInstance;
+    return theInstance;
+}
+
+const char * Latency::packet_name(uint8_t magic) {
+    if ((magic < PICO_PKT_TEMPERATURE_MAGIC) || (magic > PICO_PKT_FLASH_CONFIG_MAGIC)) {
+        return nullptr;
+    }
+
+    return PACKET_NAMES[magic - PICO_PKT_TEMPERATURE_MAGIC];
+}
+
+void Latency::start_poll(std::chrono::steady_clock::time_point now,
+    std::chrono::steady_clock::time_point deadline) {
+    const int64_t now_ns = to_ns(now);
+    poll_start_ns_.store(now_ns, std::memory_order_relaxed);
+    poll_jitter_.record(std::abs(now_ns - to_ns(deadline)) / 1000);
+}
+
+void Latency::end_poll(std::chrono::steady_clock::time_point now) {
+    const int64_t start_ns = poll_start_ns_.load(std::memory_order_relaxed);
+
+    if (start_ns != 0) {
+        poll_cycle_.record((to_ns(now) - start_ns) / 1000);
+    }
+}
+
+LatencyHistogram * Latency::serial_rtt(uint8_t magic) {
+    if (packet_name(magic) == nullptr) {
+        return nullptr;
+    }
+
+    return &serial_rtt_[magic - PICO_PKT_TEMPERATURE_MAGIC];
+}
+
+LatencyHistogram & Latency::http(const std::string & route) {
+    std::lock_guard<std::mutex> lk(m_);
+    auto & h = http_[route];
+    if (!h) {
+        h = std::make_unique<LatencyHistogram>();
+    }
+    return *h;
+}
+
+template <typename Fn>
+void Latency::for_each(Fn fn) {
+    fn("poll", "cycle", poll_cycle_);
+    fn("poll", "jitter", poll_jitter_);
+    fn("i2c", "tmp103_read", i2c_read_);
+
+    for (size_t i = 0; i < NUM_PACKET_TYPES; i++) {
+        fn("serial_rtt", PACKET_NAMES[i], serial_rtt_[i]);
+    }
+
+    std::lock_guard<std::mutex> lk(m_);
+    for (auto const& [route, h] : http_) {
+        fn("http", route, *h);
+    }
+}
+
+std::vector<Latency::Entry> Latency::summaries() {
+    std::vector<Entry> entries;
+
+    for_each([&](const std::string & group, const std::string & name, LatencyHistogram & h) {
+        auto summary = LatencyHistogram::summarize(h.snapshot());
+        if (summary.count > 0) {
+            entries.push_back(Entry { .group = group, .name = name, .summary = summary });
+        }
+    });
+
+    return entries;
+}
+
+nlohmann::json Latency::to_json() {
+    nlohmann::json j = nlohmann::json::object();
+
+    for (auto const& e : summaries()) {
+        auto const& s = e.summary;
+        j[e.group][e.name] = { {"count", s.count}, {"mean", s.mean_us}, {"min", s.min_us},
+            {"p50", s.p50_us}, {"p90", s.p90_us}, {"p99", s.p99_us}, {"p99_9", s.p99_9_us},
+            {"max", s.max_us} };
+    }
+
+    return j;
+}
+
+bool Latency::is_report_due() {
+    std::lock_guard<std::mutex> lk(m_);
+    return (std::chrono::steady_clock::now() - last_report_) >= LATENCY_REPORT_INTERVAL;
+}
+
+std::vector<Latency::Entry> Latency::take_interval_summaries() {
+    std::vector<Entry> entries;
+    std::map<const LatencyHistogram *, LatencyHistogram::Snapshot> reported;
+
+    for_each([&](const std::string & group, const std::string & name, LatencyHistogram & h) {
+        auto now = h.snapshot();
+        auto summary = LatencyHistogram::summarize(reported_.count(&h) ?
+            LatencyHistogram::difference(now, reported_[&h]) : now);
+        reported[&h] = now;
+
+        if (summary.count > 0) {
+            entries.push_back(Entry { .group = group, .name = name, .summary = summary });
+        }
+    });
+
+    std::lock_guard<std::mutex> lk(m_);
+    reported_ = std::move(reported);
+    last_report_ = std::chrono::steady_clock::now();
+    return entries;
+}
+
+} //@END namespace picod
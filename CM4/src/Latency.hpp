@@ -0,0 +1,108 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifndef LATENCY_HPP_
+#define LATENCY_HPP_
+#include <stdint.h>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "LatencyHistogram.hpp"
+#include "json.hpp"
+
+namespace picod {
+/// @brief picod's latency histograms, to tell from their percentiles whether
+/// the poll interval is met, and what is slow when it is not:
+///
+///   poll/cycle        A poll cycle, from its start to its readings being
+///                     published
+///   poll/jitter       How far from its deadline a poll cycle started: one
+///                     poll interval after the wait for it began
+///   i2c/tmp103_read   Reading the TMP103 sensors
+///   serial_rtt/<type> A request to the Pico, from being sent to the first
+///                     frame of its response arriving, per packet type
+///   http/<route>      An HTTP request, from its request line being read to
+///                     its response being written, per route
+///
+/// All durations are in us, and recorded wait-free.
+class Latency {
+public:
+    typedef struct Entry {
+        /// @brief poll, i2c, serial_rtt or http
+        std::string group;
+        std::string name;
+        LatencyHistogram::Summary summary;
+    } Entry;
+
+    static Latency& instance();
+    Latency(Latency const&)   = delete;
+    void operator=(Latency const&)  = delete;
+
+    /// @brief Records the start of a poll cycle, and its jitter.
+    /// @param deadline When the poll cycle was due to start
+    void start_poll(std::chrono::steady_clock::time_point now,
+        std::chrono::steady_clock::time_point deadline);
+
+    /// @brief Records the duration of the poll cycle started last
+    void end_poll(std::chrono::steady_clock::time_point now);
+
+    LatencyHistogram & i2c_read() { return i2c_read_; }
+
+    /// @brief Round trip histogram of a packet type
+    /// @return Nullptr(0) for unknown packet types
+    LatencyHistogram * serial_rtt(uint8_t magic);
+
+    /// @brief Histogram of an HTTP route (e.g. "GET /api/status"), created
+    /// on first use
+    LatencyHistogram & http(const std::string & route);
+
+    /// @brief Summaries of the durations recorded since picod started, of
+    /// the histograms that recorded any, group by group in the order above
+    std::vector<Entry> summaries();
+
+    /// @brief The summaries, as {"<group>": {"<name>": {...}}}
+    nlohmann::json to_json();
+
+    /// @brief True(1) when the summaries should be reported again, e.g. to InfluxDB
+    bool is_report_due();
+
+    /// @brief Summaries of the durations recorded since the previous call,
+    /// of the histograms that recorded any. Called from one thread only.
+    std::vector<Entry> take_interval_summaries();
+
+    /// @brief Name of a packet type, nullptr(0) if unknown
+    static const char * packet_name(uint8_t magic);
+
+private:
+    /// @brief Packet types 'A' (temperature) to 'K' (flash_config)
+    static const size_t NUM_PACKET_TYPES = 11;
+
+    LatencyHistogram poll_cycle_;
+    LatencyHistogram poll_jitter_;
+    LatencyHistogram i2c_read_;
+    std::array<LatencyHistogram, NUM_PACKET_TYPES> serial_rtt_;
+    /// @brief Steady clock (ns) of the last poll cycle start, zero(0) if none
+    std::atomic<int64_t> poll_start_ns_;
+
+    std::mutex m_;
+    std::map<std::string, std::unique_ptr<LatencyHistogram>> http_;
+    /// @brief Snapshots at the previous take_interval_summaries()
+    std::map<const LatencyHistogram *, LatencyHistogram::Snapshot> reported_;
+    std::chrono::steady_clock::time_point last_report_;
+
+    Latency();
+    /// @brief Calls fn(group, name, histogram) for every histogram
+    template <typename Fn>
+    void for_each(Fn fn);
+};
+
+} //@END namespace picod
+
+#endif //@END LATENCY_HPP_
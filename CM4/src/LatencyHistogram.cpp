@@ -0,0 +1,96 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#include "LatencyHistogram.hpp"
+#include <cmath>
+
+namespace picod {
+
+LatencyHistogram::LatencyHistogram()
+:sum_us_{0}
+{
+    for (auto & c : counts_) {
+        c = 0;
+    }
+}
+
+/// @brief Lowest duration (us) a bucket holds
+static uint64_t bucket_min(size_t index) {
+    const size_t sub_buckets = LatencyHistogram::SUB_BUCKETS;
+    if (index < sub_buckets) {
+        return index;
+    }
+
+    const size_t shift = (index - sub_buckets) / sub_buckets;
+    return (uint64_t)(sub_buckets + (index - sub_buckets) % sub_buckets) << shift;
+}
+
+uint64_t LatencyHistogram::bucket_max(size_t index) {
+    if (index < SUB_BUCKETS) {
+        return index;
+    }
+
+    const size_t shift = (index - SUB_BUCKETS) / SUB_BUCKETS;
+    return bucket_min(index) + (1ull << shift) - 1;
+}
+
+LatencyHistogram::Snapshot LatencyHistogram::snapshot() const {
+    Snapshot s;
+    s.count = 0;
+    for (size_t i = 0; i < NUM_BUCKETS; i++) {
+        s.counts[i] = counts_[i].load(std::memory_order_relaxed);
+        s.count += s.counts[i];
+    }
+    // May include a few durations recorded after their bucket was read
+    s.sum_us = sum_us_.load(std::memory_order_relaxed);
+    return s;
+}
+
+LatencyHistogram::Snapshot LatencyHistogram::difference(const Snapshot & later, const Snapshot & earlier) {
+    Snapshot d;
+    for (size_t i = 0; i < NUM_BUCKETS; i++) {
+        d.counts[i] = later.counts[i] - earlier.counts[i];
+    }
+    d.count = later.count - earlier.count;
+    d.sum_us = later.sum_us - earlier.sum_us;
+    return d;
+}
+
+LatencyHistogram::Summary LatencyHistogram::summarize(const Snapshot & s) {
+    Summary r = {};
+    r.count = s.count;
+    if (s.count == 0) {
+        return r;
+    }
+
+    r.mean_us = (double)s.sum_us / s.count;
+
+    const double percentiles[] = { 0.5, 0.9, 0.99, 0.999 };
+    uint64_t * values[] = { &r.p50_us, &r.p90_us, &r.p99_us, &r.p99_9_us };
+    size_t next = 0;
+    uint64_t seen = 0;
+    bool have_min = false;
+
+    for (size_t i = 0; i < NUM_BUCKETS; i++) {
+        if (s.counts[i] == 0) {
+            continue;
+        }
+
+        if (!have_min) {
+            r.min_us = bucket_min(i);
+            have_min = true;
+        }
+
+        seen += s.counts[i];
+        while ((next < 4) && (seen >= (uint64_t)std::ceil(percentiles[next] * s.count))) {
+            *values[next++] = bucket_max(i);
+        }
+        r.max_us = bucket_max(i);
+    }
+
+    return r;
+}
+
+} //@END namespace picod
@@ -0,0 +1,97 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifndef LATENCY_HISTOGRAM_HPP_
+#define LATENCY_HISTOGRAM_HPP_
+#include <stdint.h>
+#include <stddef.h>
+#include <array>
+#include <atomic>
+
+namespace picod {
+/// @brief Counts durations (us) in logarithmic buckets, HDR histogram style,
+/// to report their percentiles without keeping every sample.
+///
+/// Durations below 2^SUB_BUCKET_BITS us each have a bucket of their own.
+/// Above that, every power of two is split into 2^SUB_BUCKET_BITS buckets
+/// of equal width, so a percentile is reported within 1/2^SUB_BUCKET_BITS
+/// (6.25%) of the recorded value. Durations of 2^MAX_BITS us (about 71
+/// minutes) or more are counted in the last bucket.
+///
+/// record() is wait-free: two relaxed atomic additions, whatever the
+/// number of threads recording or reading.
+class LatencyHistogram {
+public:
+    static const uint32_t SUB_BUCKET_BITS = 4;
+    static const uint32_t MAX_BITS = 32;
+    static const size_t SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    static const size_t NUM_BUCKETS = SUB_BUCKETS + (MAX_BITS - SUB_BUCKET_BITS) * SUB_BUCKETS;
+
+    /// @brief Bucket counts and sum, at one point in time
+    typedef struct Snapshot {
+        std::array<uint64_t, NUM_BUCKETS> counts;
+        uint64_t count;
+        uint64_t sum_us;
+    } Snapshot;
+
+    typedef struct Summary {
+        uint64_t count;
+        double mean_us;
+        uint64_t min_us;
+        uint64_t p50_us;
+        uint64_t p90_us;
+        uint64_t p99_us;
+        uint64_t p99_9_us;
+        uint64_t max_us;
+    } Summary;
+
+    LatencyHistogram();
+    LatencyHistogram(LatencyHistogram const&)   = delete;
+    void operator=(LatencyHistogram const&)  = delete;
+
+    /// @brief Counts one duration. Negative durations count as zero(0).
+    void record(int64_t duration_us) {
+        const uint64_t us = (duration_us > 0) ? (uint64_t)duration_us : 0;
+        counts_[bucket(us)].fetch_add(1, std::memory_order_relaxed);
+        sum_us_.fetch_add(us, std::memory_order_relaxed);
+    }
+
+    /// @brief Copies the counts. Durations recorded meanwhile may or may not
+    /// be included.
+    Snapshot snapshot() const;
+
+    /// @brief The counts recorded between two snapshots
+    static Snapshot difference(const Snapshot & later, const Snapshot & earlier);
+
+    /// @brief Percentiles of a snapshot. Each is the highest duration its
+    /// bucket holds, so it errs on the slow side.
+    static Summary summarize(const Snapshot & s);
+
+    /// @brief Bucket of a duration
+    static size_t bucket(uint64_t us) {
+        if (us < SUB_BUCKETS) {
+            return (size_t)us;
+        }
+
+        const uint32_t msb = 63 - (uint32_t)__builtin_clzll(us);
+        if (msb >= MAX_BITS) {
+            return NUM_BUCKETS - 1;
+        }
+
+        const uint32_t shift = msb - SUB_BUCKET_BITS;
+        return SUB_BUCKETS + shift * SUB_BUCKETS + (size_t)((us >> shift) - SUB_BUCKETS);
+    }
+
+    /// @brief Highest duration (us) a bucket holds
+    static uint64_t bucket_max(size_t index);
+
+private:
+    std::array<std::atomic<uint64_t>, NUM_BUCKETS> counts_;
+    std::atomic<uint64_t> sum_us_;
+};
+
+} //@END namespace picod
+
+#endif //@END LATENCY_HISTOGRAM_HPP_
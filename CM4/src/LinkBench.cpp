@@ -0,0 +1,445 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#include "LinkBench.hpp"
+#include "pico_pkt_ping.h"
+#include "pico_pkt_temperature.h"
+#include "fmt/core.h"
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+using namespace nlohmann;
+
+namespace picod {
+
+static const char * const KIND_NAMES[] = { "ping", "temperature", "bundle" };
+
+/// @brief Termios speed of a baud rate
+/// @return True(1) if the rate is supported. False(0) otherwise.
+static bool get_speed(uint32_t baud_rate, speed_t & speed) {
+    static const struct { uint32_t rate; speed_t speed; } speeds[] = {
+        { 9600, B9600 }, { 19200, B19200 }, { 38400, B38400 }, { 57600, B57600 },
+        { 115200, B115200 }, { 230400, B230400 }, { 460800, B460800 },
+        { 921600, B921600 }, { 1000000, B1000000 }, { 2000000, B2000000 },
+        { 3000000, B3000000 }, { 4000000, B4000000 }
+    };
+
+    for (auto const & s : speeds) {
+        if (s.rate == baud_rate) {
+            speed = s.speed;
+            return true;
+        }
+    }
+    return false;
+}
+
+static double to_seconds(const struct timeval & tv) {
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/// @brief Count, mean and percentiles of round trip times (us)
+static ordered_json summarize(std::vector<uint32_t> rtt_us) {
+    ordered_json j;
+    j["count"] = rtt_us.size();
+    if (rtt_us.empty()) {
+        return j;
+    }
+
+    std::sort(rtt_us.begin(), rtt_us.end());
+    auto percentile = [&rtt_us](double p) {
+        size_t rank = (size_t)std::ceil(p / 100.0 * rtt_us.size());
+        return rtt_us[(rank == 0) ? 0 : rank - 1];
+    };
+
+    double sum = 0.0;
+    for (auto rtt : rtt_us) {
+        sum += rtt;
+    }
+
+    j["min"] = rtt_us.front();
+    j["mean"] = std::round(sum / rtt_us.size() * 10.0) / 10.0;
+    j["p50"] = percentile(50.0);
+    j["p90"] = percentile(90.0);
+    j["p99"] = percentile(99.0);
+    j["p99_9"] = percentile(99.9);
+    j["max"] = rtt_us.back();
+    return j;
+}
+
+LinkBench::LinkBench(const Options & opts)
+:opts_{opts}
+,fd_{-1}
+,rx_len_{0}
+,mix_total_{0}
+,next_kind_{0}
+,counters_{}
+,failed_{false}
+,elapsed_s_{0.0}
+,cpu_user_s_{0.0}
+,cpu_system_s_{0.0}
+{
+    opts_.concurrency = (opts_.concurrency < 1) ? 1 : opts_.concurrency;
+
+    for (int k = 0; k < NUM_KINDS; k++) {
+        if (opts_.mix[k] > 0) {
+            mix_total_ += opts_.mix[k];
+            mix_.emplace_back(mix_total_, (Kind)k);
+        }
+    }
+
+    if (mix_.empty()) {
+        mix_total_ = 1;
+        mix_.emplace_back(1, PING);
+    }
+}
+
+LinkBench::~LinkBench() {
+    if (fd_ >= 0) {
+        close(fd_);
+    }
+}
+
+bool LinkBench::get_kind(const std::string & name, Kind & kind) {
+    for (int k = 0; k < NUM_KINDS; k++) {
+        if (name == KIND_NAMES[k]) {
+            kind = (Kind)k;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char * LinkBench::to_string(Kind kind) {
+    return (kind < NUM_KINDS) ? KIND_NAMES[kind] : "unknown";
+}
+
+bool LinkBench::open() {
+    speed_t speed;
+    if (!get_speed(opts_.baud_rate, speed)) {
+        fmt::println(stderr, "Unsupported baud rate: {}", opts_.baud_rate);
+        return false;
+    }
+
+    fd_ = ::open(opts_.device_path.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (fd_ < 0) {
+        fmt::println(stderr, "Failed to open: {}, {}", opts_.device_path, strerror(errno));
+        return false;
+    }
+
+    // Same line settings as picod, see get_serial_port_settings()
+    struct termios settings;
+    memset(&settings, 0, sizeof(settings));
+    settings.c_cflag = CS8 | CLOCAL | CREAD;
+    settings.c_cc[VMIN] = 1;
+    settings.c_cc[VTIME] = 0;
+    cfsetispeed(&settings, speed);
+    cfsetospeed(&settings, speed);
+
+    tcflush(fd_, TCIOFLUSH);
+    if (tcsetattr(fd_, TCSANOW, &settings) == -1) {
+        fmt::println(stderr, "Failed to apply serial port settings: {}", strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+LinkBench::Kind LinkBench::pick_kind() {
+    // Interleaves the kinds in proportion to the mix, without randomness
+    // so that runs can be compared
+    const uint64_t slot = (next_kind_++ * 0x9E3779B97F4A7C15ull) % mix_total_;
+    for (auto const & m : mix_) {
+        if (slot < m.first) {
+            return m.second;
+        }
+    }
+    return mix_.back().second;
+}
+
+bool LinkBench::send_request(Clock::time_point now) {
+    InFlight r;
+    r.kind = pick_kind();
+    r.frames = 0;
+
+    if (r.kind == PING) {
+        pico_pkt_ping_req_pack(r.req.data());
+        // Number the payload, so that a response to another request is noticed
+        for (size_t i = PICO_PKT_PING_RESV; i < PICO_PKT_LEN; i++) {
+            r.req[i] = (uint8_t)(counters_.sent >> (8 * ((i - PICO_PKT_PING_RESV) % 8)));
+        }
+    } else {
+        pico_pkt_temperature_req_t t = {
+            .statistic = PICO_TEMPERATURE_STAT_MEAN,
+            .configure = false,
+            .sample_rate_hz = 0,
+            .window_ms = 0,
+            .timestamp = (r.kind == BUNDLE)
+        };
+        pico_pkt_temperature_req_pack(r.req.data(), &t);
+    }
+
+    ssize_t n = write(fd_, r.req.data(), PICO_PKT_LEN);
+    if (n != PICO_PKT_LEN) {
+        // A full output queue is retried, anything else ends the run
+        if ((n >= 0) || (errno != EAGAIN)) {
+            fmt::println(stderr, "Error writing to serial port: {}", 
+                (n < 0) ? strerror(errno) : "short write");
+            failed_ = true;
+        }
+        return false;
+    }
+
+    r.sent = now;
+    in_flight_.push_back(r);
+    counters_.sent++;
+    counters_.tx_frames++;
+    return true;
+}
+
+void LinkBench::on_readable() {
+    uint8_t buf[256];
+    ssize_t n = read(fd_, buf, sizeof(buf));
+    if (n <= 0) {
+        if ((n < 0) && (errno != EAGAIN)) {
+            fmt::println(stderr, "Failed to read serial port: {}", strerror(errno));
+        }
+        return;
+    }
+
+    for (ssize_t i = 0; i < n; i++) {
+        rx_buf_[rx_len_++] = buf[i];
+        if (rx_len_ == PICO_PKT_LEN) {
+            rx_len_ = 0;
+            counters_.rx_frames++;
+            on_frame(rx_buf_.data());
+        }
+    }
+}
+
+void LinkBench::on_frame(const uint8_t * frame) {
+    if (in_flight_.empty() || (frame[PKT_MAGIC_IDX] != in_flight_.front().req[PKT_MAGIC_IDX])) {
+        resync();
+        return;
+    }
+
+    auto & r = in_flight_.front();
+    if (!check_response(r, frame)) {
+        return;
+    }
+
+    const auto rtt = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - r.sent);
+    rtt_us_[r.kind].push_back((uint32_t)rtt.count());
+    counters_.completed++;
+    in_flight_.pop_front();
+}
+
+bool LinkBench::check_response(InFlight & r, const uint8_t * frame) {
+    bool success = false;
+    bool corrupt = false;
+
+    if (r.kind == PING) {
+        pico_pkt_ping_resp_unpack(frame, &success);
+        corrupt = (memcmp(&frame[PICO_PKT_PING_RESV], &r.req[PICO_PKT_PING_RESV],
+            PICO_PKT_LEN - PICO_PKT_PING_RESV) != 0);
+    } else if (r.frames == 0) {
+        pico_pkt_temperature_u t;
+        pico_pkt_temperature_resp_unpack(frame, &t, &success);
+        corrupt = pico_pkt_temperature_is_time(frame) ||
+            ((frame[PICO_PKT_TEMPERATURE_IDX_FLAGS] & PICO_PKT_TEMPERATURE_STAT_MASK) !=
+            (r.req[PICO_PKT_TEMPERATURE_IDX_FLAGS] & PICO_PKT_TEMPERATURE_STAT_MASK));
+    } else {
+        pico_pkt_temperature_time_t t;
+        pico_pkt_temperature_time_unpack(frame, &t, &success);
+        corrupt = !pico_pkt_temperature_is_time(frame);
+    }
+
+    counters_.corrupt += corrupt ? 1 : 0;
+    counters_.failed += (!corrupt && !success) ? 1 : 0;
+
+    r.frames++;
+    return (r.kind != BUNDLE) || (r.frames == 2);
+}
+
+void LinkBench::resync() {
+    counters_.resyncs++;
+    counters_.lost += in_flight_.size();
+    in_flight_.clear();
+    rx_len_ = 0;
+
+    // Let the frames still on their way arrive, then drop them
+    usleep(50000);
+    tcflush(fd_, TCIFLUSH);
+}
+
+void LinkBench::expire_requests(Clock::time_point now) {
+    const auto timeout = std::chrono::milliseconds(opts_.timeout_ms);
+    while (!in_flight_.empty() && (now - in_flight_.front().sent >= timeout)) {
+        counters_.timeouts++;
+        in_flight_.pop_front();
+    }
+
+    // A late response would now be taken for the next request's
+    if (in_flight_.empty()) {
+        rx_len_ = 0;
+    }
+}
+
+void LinkBench::print_progress(double elapsed_s) const {
+    std::vector<uint32_t> all;
+    for (auto const & v : rtt_us_) {
+        all.insert(all.end(), v.begin(), v.end());
+    }
+    auto s = summarize(all);
+
+    fmt::println(stderr, "{:8.1f} s: {} completed, {} timeouts, {} resyncs, {} corrupt. "
+        "RTT p50 {} us, p99 {} us", elapsed_s, counters_.completed, counters_.timeouts,
+        counters_.resyncs, counters_.corrupt, s.value("p50", 0u), s.value("p99", 0u));
+}
+
+void LinkBench::run(const std::atomic<bool> & quit) {
+    struct rusage usage_start, usage_end;
+    getrusage(RUSAGE_SELF, &usage_start);
+
+    const auto start = Clock::now();
+    const auto end = start + std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(opts_.duration_s));
+    const auto interval = (opts_.rate > 0.0) ? std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(1.0 / opts_.rate)) : Clock::duration::zero();
+    const auto progress = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(opts_.progress_s));
+
+    auto next_send = start;
+    auto next_progress = start + progress;
+
+    for (;;) {
+        auto now = Clock::now();
+        const bool sending = !quit && (now < end) &&
+            ((opts_.max_requests == 0) || (counters_.sent < opts_.max_requests));
+
+        if (failed_ || (!sending && in_flight_.empty())) {
+            break;
+        }
+
+        expire_requests(now);
+
+        while (sending && (in_flight_.size() < opts_.concurrency) && (now >= next_send)) {
+            if (!send_request(now)) {
+                next_send = now + std::chrono::milliseconds(1);
+                break;
+            }
+            next_send = (interval.count() > 0) ? (next_send + interval) : now;
+            if ((opts_.max_requests != 0) && (counters_.sent >= opts_.max_requests)) {
+                break;
+            }
+        }
+
+        if ((opts_.progress_s > 0.0) && (now >= next_progress)) {
+            print_progress(std::chrono::duration<double>(now - start).count());
+            next_progress += progress;
+        }
+
+        // Sleep until a response, the next request or the oldest timeout is due
+        auto wake = now + std::chrono::milliseconds(100);
+        if (!in_flight_.empty()) {
+            wake = std::min(wake, in_flight_.front().sent + std::chrono::milliseconds(opts_.timeout_ms));
+        }
+        if (sending && (in_flight_.size() < opts_.concurrency)) {
+            wake = std::min(wake, next_send);
+        }
+
+        struct pollfd pfd = { .fd = fd_, .events = POLLIN, .revents = 0 };
+        const auto wait_us = std::chrono::duration_cast<std::chrono::microseconds>(wake - now).count();
+        struct timespec ts = { .tv_sec = 0, .tv_nsec = 0 };
+        if (wait_us > 0) {
+            ts.tv_sec = wait_us / 1000000;
+            ts.tv_nsec = (wait_us % 1000000) * 1000;
+        }
+
+        int res = ppoll(&pfd, 1, &ts, NULL);
+        if ((res > 0) && (pfd.revents & (POLLERR | POLLHUP)) && !(pfd.revents & POLLIN)) {
+            fmt::println(stderr, "Serial port closed");
+            break;
+        } else if (res > 0) {
+            on_readable();
+        } else if ((res < 0) && (errno != EINTR)) {
+            fmt::println(stderr, "poll() failed on serial port: {}", strerror(errno));
+            break;
+        }
+    }
+
+    elapsed_s_ = std::chrono::duration<double>(Clock::now() - start).count();
+    getrusage(RUSAGE_SELF, &usage_end);
+    cpu_user_s_ = to_seconds(usage_end.ru_utime) - to_seconds(usage_start.ru_utime);
+    cpu_system_s_ = to_seconds(usage_end.ru_stime) - to_seconds(usage_start.ru_stime);
+}
+
+ordered_json LinkBench::results() const {
+    ordered_json j;
+    const uint64_t frames = counters_.tx_frames + counters_.rx_frames;
+
+    ordered_json mix = ordered_json::object();
+    for (int k = 0; k < NUM_KINDS; k++) {
+        if (opts_.mix[k] > 0) {
+            mix[KIND_NAMES[k]] = opts_.mix[k];
+        }
+    }
+
+    j["config"] = {
+        {"device", opts_.device_path},
+        {"baud_rate", opts_.baud_rate},
+        {"mix", mix},
+        {"concurrency", opts_.concurrency},
+        {"rate", opts_.rate},
+        {"duration_s", opts_.duration_s},
+        {"max_requests", opts_.max_requests},
+        {"timeout_ms", opts_.timeout_ms}
+    };
+    j["elapsed_s"] = elapsed_s_;
+    j["completed_run"] = !failed_;
+    j["requests"] = {
+        {"sent", counters_.sent},
+        {"completed", counters_.completed},
+        {"timeouts", counters_.timeouts},
+        {"corrupt", counters_.corrupt},
+        {"failed", counters_.failed},
+        {"lost", counters_.lost},
+        {"resyncs", counters_.resyncs},
+        {"per_s", (elapsed_s_ > 0.0) ? counters_.completed / elapsed_s_ : 0.0}
+    };
+    j["frames"] = {
+        {"tx", counters_.tx_frames},
+        {"rx", counters_.rx_frames},
+        {"per_s", (elapsed_s_ > 0.0) ? frames / elapsed_s_ : 0.0}
+    };
+    j["cpu"] = {
+        {"user_s", cpu_user_s_},
+        {"system_s", cpu_system_s_},
+        {"us_per_frame", (frames > 0) ? (cpu_user_s_ + cpu_system_s_) * 1e6 / frames : 0.0}
+    };
+
+    std::vector<uint32_t> all;
+    ordered_json latency;
+    for (int k = 0; k < NUM_KINDS; k++) {
+        all.insert(all.end(), rtt_us_[k].begin(), rtt_us_[k].end());
+    }
+    latency["all"] = summarize(all);
+    for (int k = 0; k < NUM_KINDS; k++) {
+        if (opts_.mix[k] > 0) {
+            latency[KIND_NAMES[k]] = summarize(rtt_us_[k]);
+        }
+    }
+    j["rtt_us"] = latency;
+
+    return j;
+}
+
+} //@END namespace picod
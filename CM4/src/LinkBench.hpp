@@ -0,0 +1,142 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifndef LINK_BENCH_HPP_
+#define LINK_BENCH_HPP_
+#include <stdint.h>
+#include <atomic>
+#include <array>
+#include <chrono>
+#include <deque>
+#include <string>
+#include <vector>
+#include "pkt_handler.h"
+#include "json.hpp"
+
+namespace picod {
+/// @brief Measures the serial link to the RPi Pico, or to pico-sim and
+/// firmware_host on a pseudo terminal: round trip latency, frame rate,
+/// timeouts, bad responses and the CPU time spent per frame.
+///
+/// Requests are kept in flight up to the concurrency, sent as fast as
+/// possible or at a fixed rate. The Pico answers them in order, so each
+/// response belongs to the oldest request in flight. A response of the
+/// wrong packet type means the frames are out of step: the link is then
+/// resynchronized by dropping the requests in flight and the input.
+class LinkBench {
+public:
+    /// @brief Request types: ping, temperature reading, and temperature
+    /// reading bundled with its timestamp frame (two frame response)
+    typedef enum Kind {
+        PING = 0,
+        TEMPERATURE,
+        BUNDLE,
+        NUM_KINDS
+    } Kind;
+
+    typedef struct Options {
+        /// @brief Serial port of the Pico, or a pseudo terminal
+        std::string device_path;
+        /// @brief Termios baud rate, e.g. 115200
+        uint32_t baud_rate;
+        /// @brief Relative number of requests of each kind
+        std::array<uint32_t, NUM_KINDS> mix;
+        /// @brief Most requests in flight at once
+        uint32_t concurrency;
+        /// @brief Requests per second. Zero(0) sends a request as soon as
+        /// one completes.
+        double rate;
+        /// @brief Length of the run (s)
+        double duration_s;
+        /// @brief Stops after this many requests. Zero(0) for no limit.
+        uint64_t max_requests;
+        /// @brief A request without a response for this long has timed out
+        uint32_t timeout_ms;
+        /// @brief Print a progress line every this many seconds. Zero(0) never does.
+        double progress_s;
+    } Options;
+
+    explicit LinkBench(const Options & opts);
+    ~LinkBench();
+    LinkBench(LinkBench const&)   = delete;
+    void operator=(LinkBench const&)  = delete;
+
+    /// @brief Opens and configures the serial port
+    /// @return True(1) on success. False(0) on failure.
+    bool open();
+
+    /// @brief Runs the benchmark until its duration or request count is
+    /// reached, or quit is set.
+    void run(const std::atomic<bool> & quit);
+
+    /// @brief Results of the last run, as JSON
+    nlohmann::ordered_json results() const;
+
+    /// @brief Looks up a request kind by name (ping, temperature, bundle)
+    /// @return True(1) if the name is known. False(0) otherwise.
+    static bool get_kind(const std::string & name, Kind & kind);
+
+    static const char * to_string(Kind kind);
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    /// @brief A request awaiting its response
+    typedef struct InFlight {
+        Kind kind;
+        std::array<uint8_t, PICO_PKT_LEN> req;
+        Clock::time_point sent;
+        /// @brief Response frames received so far
+        uint32_t frames;
+    } InFlight;
+
+    typedef struct Counters {
+        uint64_t sent;
+        uint64_t completed;
+        uint64_t timeouts;
+        /// @brief Responses whose contents did not match the request
+        uint64_t corrupt;
+        /// @brief Responses without the success flag
+        uint64_t failed;
+        /// @brief Requests dropped when the link was resynchronized
+        uint64_t lost;
+        uint64_t resyncs;
+        uint64_t tx_frames;
+        uint64_t rx_frames;
+    } Counters;
+
+    Options opts_;
+    int fd_;
+    std::deque<InFlight> in_flight_;
+    std::array<uint8_t, PICO_PKT_LEN> rx_buf_;
+    size_t rx_len_;
+    /// @brief Cumulative request mix, for picking the next kind
+    std::vector<std::pair<uint64_t, Kind>> mix_;
+    uint64_t mix_total_;
+    uint64_t next_kind_;
+    Counters counters_;
+    /// @brief True(1) once the serial port failed
+    bool failed_;
+    /// @brief Round trip times (us), per kind
+    std::array<std::vector<uint32_t>, NUM_KINDS> rtt_us_;
+    double elapsed_s_;
+    double cpu_user_s_;
+    double cpu_system_s_;
+
+    Kind pick_kind();
+    bool send_request(Clock::time_point now);
+    void on_readable();
+    void on_frame(const uint8_t * frame);
+    /// @brief Checks a response frame against its request.
+    /// @return True(1) once the last frame of the response arrived.
+    bool check_response(InFlight & r, const uint8_t * frame);
+    void resync();
+    void expire_requests(Clock::time_point now);
+    void print_progress(double elapsed_s) const;
+};
+
+} //@END namespace picod
+
+#endif //@END LINK_BENCH_HPP_
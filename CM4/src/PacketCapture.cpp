@@ -0,0 +1,263 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#include "PacketCapture.hpp"
+#include "fmt/core.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+namespace picod {
+
+static const char CAPTURE_MAGIC[8] = { 'P', 'I', 'C', 'O', 'C', 'A', 'P', '1' };
+const size_t CAPTURE_HEADER_LEN = 32;
+const size_t FRAME_RECORD_LEN = 1 + 4 + PICO_PKT_LEN;
+const size_t CLOCK_RECORD_LEN = 1 + 8;
+// Longest time the newest records may wait in the stdio buffer
+const auto CAPTURE_FLUSH_INTERVAL = std::chrono::seconds(1);
+
+static void put_le(uint8_t * p, uint64_t value, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        p[i] = (uint8_t)(value >> (8 * i));
+    }
+}
+
+static uint64_t get_le(const uint8_t * p, size_t len) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < len; i++) {
+        value |= (uint64_t)p[i] << (8 * i);
+    }
+    return value;
+}
+
+static int64_t steady_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static std::string segment_path(const std::string & path, uint32_t index) {
+    return fmt::format("{}.{}", path, index);
+}
+
+/// @brief Reads the header of a capture segment.
+/// @return True(1) if the data starts with a valid header. False(0) otherwise.
+static bool parse_header(const uint8_t * data, size_t len, uint32_t & seq,
+    int64_t & start_us, int64_t & start_unix_ms) {
+    if ((len < CAPTURE_HEADER_LEN) || (memcmp(data, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC)) != 0) ||
+        (get_le(&data[12], 4) != PICO_PKT_LEN)) {
+        return false;
+    }
+
+    seq = (uint32_t)get_le(&data[8], 4);
+    start_us = (int64_t)get_le(&data[16], 8);
+    start_unix_ms = (int64_t)get_le(&data[24], 8);
+    return true;
+}
+
+PacketCapture::PacketCapture()
+:open_{false}
+,segment_size_{0}
+,segments_{0}
+,seq_{0}
+,file_{nullptr}
+,size_{0}
+,last_us_{0}
+{
+}
+
+PacketCapture::~PacketCapture() {
+    close();
+}
+
+PacketCapture& PacketCapture::instance() {
+    static PacketCapture theInstance;
+    return theInstance;
+}
+
+bool PacketCapture::open(const std::string & path, size_t segment_size_bytes, uint32_t segments) {
+    std::lock_guard<std::mutex> lk(m_);
+
+    if (open_) {
+        return true;
+    }
+
+    path_ = path;
+    segment_size_ = (segment_size_bytes < CAPTURE_HEADER_LEN + FRAME_RECORD_LEN) ?
+        CAPTURE_HEADER_LEN + FRAME_RECORD_LEN : segment_size_bytes;
+    segments_ = (segments < 1) ? 1 : segments;
+
+    // Carry on numbering after the segments of an earlier run, so they
+    // are replayed in order
+    uint32_t next_seq = 0;
+    for (uint32_t i = 0; i < segments_; i++) {
+        std::ifstream f(segment_path(path_, i), std::ios::binary);
+        uint8_t header[CAPTURE_HEADER_LEN];
+        uint32_t seq = 0;
+        int64_t start_us = 0, start_unix_ms = 0;
+        if (f.read((char *)header, sizeof(header)) &&
+            parse_header(header, sizeof(header), seq, start_us, start_unix_ms)) {
+            next_seq = std::max(next_seq, seq + 1);
+        }
+    }
+
+    if (!start_segment(next_seq, steady_us())) {
+        return false;
+    }
+
+    fmt::println("Capturing Pico serial traffic to {}.[0-{}]", path_, segments_ - 1);
+    open_ = true;
+    return true;
+}
+
+void PacketCapture::close() {
+    std::lock_guard<std::mutex> lk(m_);
+    open_ = false;
+    if (file_) {
+        fclose(file_);
+        file_ = nullptr;
+    }
+}
+
+bool PacketCapture::start_segment(uint32_t seq, int64_t now_us) {
+    if (file_) {
+        fclose(file_);
+        file_ = nullptr;
+    }
+
+    const std::string path = segment_path(path_, seq % segments_);
+    file_ = fopen(path.c_str(), "wb");
+    if (!file_) {
+        fmt::println(stderr, "Failed to open capture file {}: {}", path, strerror(errno));
+        return false;
+    }
+
+    const int64_t unix_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+
+    uint8_t header[CAPTURE_HEADER_LEN];
+    memcpy(header, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC));
+    put_le(&header[8], seq, 4);
+    put_le(&header[12], PICO_PKT_LEN, 4);
+    put_le(&header[16], (uint64_t)now_us, 8);
+    put_le(&header[24], (uint64_t)unix_ms, 8);
+    fwrite(header, sizeof(header), 1, file_);
+
+    seq_ = seq;
+    size_ = sizeof(header);
+    last_us_ = now_us;
+    last_flush_ = std::chrono::steady_clock::now();
+    return true;
+}
+
+void PacketCapture::write_record(RecordType type, const uint8_t * frame) {
+    const int64_t now_us = steady_us();
+    std::lock_guard<std::mutex> lk(m_);
+
+    if (!file_) {
+        return;
+    }
+
+    if ((size_ + CLOCK_RECORD_LEN + FRAME_RECORD_LEN > segment_size_) &&
+        !start_segment(seq_ + 1, now_us)) {
+        open_ = false;
+        return;
+    }
+
+    // Frames may be recorded slightly out of order by different threads
+    const int64_t delta_us = (now_us > last_us_) ? (now_us - last_us_) : 0;
+    if (delta_us > UINT32_MAX) {
+        uint8_t clock[CLOCK_RECORD_LEN];
+        clock[0] = CLOCK;
+        put_le(&clock[1], (uint64_t)now_us, 8);
+        fwrite(clock, sizeof(clock), 1, file_);
+        size_ += sizeof(clock);
+        last_us_ = now_us;
+    }
+
+    uint8_t rec[FRAME_RECORD_LEN];
+    rec[0] = type;
+    put_le(&rec[1], (uint64_t)((now_us > last_us_) ? (now_us - last_us_) : 0), 4);
+    memcpy(&rec[5], frame, PICO_PKT_LEN);
+    fwrite(rec, sizeof(rec), 1, file_);
+    size_ += sizeof(rec);
+    last_us_ = std::max(last_us_, now_us);
+
+    const auto now = std::chrono::steady_clock::now();
+    if (now - last_flush_ >= CAPTURE_FLUSH_INTERVAL) {
+        fflush(file_);
+        last_flush_ = now;
+    }
+}
+
+bool PacketCapture::Reader::open(const std::vector<std::string> & paths, std::string & error) {
+    segments_.clear();
+
+    for (auto const & path : paths) {
+        std::ifstream f(path, std::ios::binary);
+        if (!f) {
+            error = fmt::format("cannot open {}: {}", path, strerror(errno));
+            return false;
+        }
+
+        Segment s;
+        s.data.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+        if (!parse_header(s.data.data(), s.data.size(), s.seq, s.start_us, s.start_unix_ms)) {
+            error = fmt::format("{} is not a Pico capture file", path);
+            return false;
+        }
+        segments_.push_back(std::move(s));
+    }
+
+    std::sort(segments_.begin(), segments_.end(),
+        [](const Segment &a, const Segment &b) { return a.seq < b.seq; });
+
+    rewind();
+    return true;
+}
+
+void PacketCapture::Reader::rewind() {
+    segment_ = 0;
+    offset_ = CAPTURE_HEADER_LEN;
+    time_us_ = segments_.empty() ? 0 : segments_.front().start_us;
+    truncated_ = 0;
+}
+
+bool PacketCapture::Reader::next(Record & record) {
+    while (segment_ < segments_.size()) {
+        const auto & s = segments_[segment_];
+        const size_t remaining = s.data.size() - offset_;
+        const uint8_t * p = &s.data[offset_];
+
+        if (remaining == 0) {
+            if (++segment_ < segments_.size()) {
+                offset_ = CAPTURE_HEADER_LEN;
+                time_us_ = segments_[segment_].start_us;
+            }
+            continue;
+        }
+
+        if ((p[0] == CLOCK) && (remaining >= CLOCK_RECORD_LEN)) {
+            time_us_ = (int64_t)get_le(&p[1], 8);
+            offset_ += CLOCK_RECORD_LEN;
+        } else if (((p[0] == RX) || (p[0] == TX)) && (remaining >= FRAME_RECORD_LEN)) {
+            time_us_ += (int64_t)get_le(&p[1], 4);
+            record.type = (RecordType)p[0];
+            record.time_us = time_us_;
+            memcpy(record.frame.data(), &p[5], PICO_PKT_LEN);
+            offset_ += FRAME_RECORD_LEN;
+            return true;
+        } else {
+            // Cut short, or corrupted: skip the rest of the segment
+            truncated_++;
+            offset_ = s.data.size();
+        }
+    }
+
+    return false;
+}
+
+} //@END namespace picod
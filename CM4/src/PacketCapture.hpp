@@ -0,0 +1,135 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifndef PACKET_CAPTURE_HPP_
+#define PACKET_CAPTURE_HPP_
+#include <stdint.h>
+#include <stdio.h>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "pkt_handler.h"
+
+namespace picod {
+/// @brief Records every frame sent to and received from the RPi Pico into
+/// a ring of capture files (segments), so field incidents can be replayed
+/// through PacketHandler with pico-replay.
+///
+/// Segments are named <path>.0 to <path>.<segments - 1>. When a segment is
+/// full, the oldest one is overwritten. Each segment starts with a header:
+///
+///   char     magic[8]      "PICOCAP1"
+///   uint32_t seq           Segment number, counting up across the ring
+///   uint32_t frame_len     PICO_PKT_LEN
+///   int64_t  start_us      Steady (monotonic) clock at the segment start
+///   int64_t  start_unix_ms Wall clock at the segment start
+///
+/// followed by records, all little endian:
+///
+///   uint8_t  type          RX (Pico to host), TX (host to Pico) or CLOCK
+///   RX, TX:  uint32_t delta_us  Time since the previous record (or the
+///                               segment start), then the frame.
+///   CLOCK:   int64_t  time_us   Steady clock, for gaps too long for delta_us
+class PacketCapture {
+public:
+    typedef enum RecordType : uint8_t {
+        RX = 0,
+        TX = 1,
+        CLOCK = 2
+    } RecordType;
+
+    typedef struct Record {
+        RecordType type;
+        /// @brief Steady (monotonic) clock when the frame was sent or received
+        int64_t time_us;
+        std::array<uint8_t, PICO_PKT_LEN> frame;
+    } Record;
+
+    static PacketCapture& instance();
+    ~PacketCapture();
+    PacketCapture(PacketCapture const&)   = delete;
+    void operator=(PacketCapture const&)  = delete;
+
+    /// @brief Starts recording.
+    /// @param path Segment file names, without the .<n> suffix
+    /// @param segment_size_bytes A new segment is started past this size
+    /// @param segments Number of segments in the ring
+    /// @return True(1) on success. False(0) on failure.
+    bool open(const std::string & path, size_t segment_size_bytes, uint32_t segments);
+
+    /// @brief Stops recording and flushes the current segment.
+    void close();
+
+    bool is_open() const { return open_; }
+
+    /// @brief Records one frame. Does nothing unless open.
+    void record(RecordType type, const uint8_t * frame) {
+        if (open_) {
+            write_record(type, frame);
+        }
+    }
+
+    /// @brief Reads capture segments back, oldest first.
+    class Reader {
+    public:
+        /// @brief Opens segments, which are then read in segment number order.
+        /// @param error [out] Why a segment could not be opened
+        /// @return True(1) on success. False(0) on failure.
+        bool open(const std::vector<std::string> & paths, std::string & error);
+
+        /// @brief Reads the next RX or TX record.
+        /// @return True(1) on success. False(0) at the end of the capture.
+        bool next(Record & record);
+
+        /// @brief Starts over from the first record
+        void rewind();
+
+        /// @brief Wall clock (ms since the Unix epoch) of the first segment start
+        int64_t start_unix_ms() const { return segments_.empty() ? 0 : segments_.front().start_unix_ms; }
+
+        /// @brief Number of truncated records (e.g. cut short by a power loss)
+        size_t truncated() const { return truncated_; }
+    private:
+        typedef struct Segment {
+            uint32_t seq;
+            int64_t start_us;
+            int64_t start_unix_ms;
+            std::vector<uint8_t> data;
+        } Segment;
+
+        std::vector<Segment> segments_;
+        size_t segment_ = 0;
+        size_t offset_ = 0;
+        int64_t time_us_ = 0;
+        size_t truncated_ = 0;
+    };
+
+private:
+    std::mutex m_;
+    std::atomic<bool> open_;
+    std::string path_;
+    size_t segment_size_;
+    uint32_t segments_;
+    /// @brief Number of the current segment
+    uint32_t seq_;
+    FILE * file_;
+    size_t size_;
+    /// @brief Steady clock of the previous record
+    int64_t last_us_;
+    std::chrono::steady_clock::time_point last_flush_;
+
+    PacketCapture();
+    void write_record(RecordType type, const uint8_t * frame);
+    /// @brief Closes the current segment and starts the next one.
+    /// Must be called with m_ held.
+    bool start_segment(uint32_t seq, int64_t now_us);
+};
+
+} //@END namespace picod
+
+#endif //@END PACKET_CAPTURE_HPP_
@@ -12,6 +12,30 @@
 #include "pico_pkt_fan_pwm.h"
 #include "pico_pkt_watchdog.h"
 #include "pico_pkt_shutdown.h"
+#include "pico_pkt_fan_ctrl.h"
+#include "pico_pkt_ntc_cal.h"
+#include "pico_pkt_event_log.h"
+#include "pico_pkt_time.h"
+#include "pico_pkt_flash_config.h"
+#include "PacketCapture.hpp"
+#include "Trace.hpp"
+#include "Latency.hpp"
+
+using picod::PacketCapture;
+
+// Maximum number of asynchronous requests waiting to be sent
+const size_t MAX_PENDING_TRANSACTIONS = 16;
+
+// How long to wait for the Pico to respond to a request
+const auto PICO_RESPONSE_TIMEOUT = std::chrono::seconds(1);
+
+// Longest a RequestLock waits for the asynchronous requests to drain
+const auto REQUEST_LOCK_TIMEOUT = PICO_RESPONSE_TIMEOUT * (MAX_PENDING_TRANSACTIONS + 1);
+
+static int64_t steady_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
 
 PacketHandler::PacketHandler()
 :pico_fd_{0}
@@ -19,8 +43,22 @@ PacketHandler::PacketHandler()
     {PICO_PKT_TEMPERATURE_MAGIC, std::make_shared<ConcurrentQueue<BufPtr>>(10)},
     {PICO_PKT_FAN_PWM_MAGIC, std::make_shared<ConcurrentQueue<BufPtr>>(10)},
     {PICO_PKT_WATCHDOG_MAGIC, std::make_shared<ConcurrentQueue<BufPtr>>(10)},
-    {PICO_PKT_VERSION_MAGIC, std::make_shared<ConcurrentQueue<BufPtr>>(10)} }
+    {PICO_PKT_VERSION_MAGIC, std::make_shared<ConcurrentQueue<BufPtr>>(10)},
+    {PICO_PKT_FAN_CTRL_MAGIC, std::make_shared<ConcurrentQueue<BufPtr>>(10)},
+    {PICO_PKT_NTC_CAL_MAGIC, std::make_shared<ConcurrentQueue<BufPtr>>(10)},
+    {PICO_PKT_EVENT_LOG_MAGIC, std::make_shared<ConcurrentQueue<BufPtr>>(10)},
+    {PICO_PKT_TIME_MAGIC, std::make_shared<ConcurrentQueue<BufPtr>>(10)},
+    {PICO_PKT_FLASH_CONFIG_MAGIC, std::make_shared<ConcurrentQueue<BufPtr>>(10)} }
+,lock_depth_{0}
+,async_in_flight_{false}
+,reader_running_{false}
+,rx_len_{0}
+,replay_{false}
+,stats_{}
 {
+    for (auto &sent_ns : request_sent_ns_) {
+        sent_ns = 0;
+    }
 }
 
 PacketHandler::~PacketHandler()
@@ -38,11 +76,9 @@ bool PacketHandler::is_init_done(){
     return initDone_.wait(std::chrono::seconds(3));
 }
 
-int PacketHandler::run(){
+int PacketHandler::open_serial_port(){
     int retVal  = EXIT_SUCCESS;
     int result = 0;
-    int maxfd; // maximum file descriptor used
-    fd_set readfds; // file descriptor set
     
     // open the device to be non-blocking (read will return immediately)
     pico_fd_ = open(appSettings.pico_serial_device_path.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
@@ -86,6 +122,23 @@ int PacketHandler::run(){
     }
 
     initDone_.set();
+    return retVal;
+
+cleanup:    
+    close(pico_fd_);
+    pico_fd_ = 0;   
+    return retVal; 
+}
+
+int PacketHandler::run(){
+    int maxfd; // maximum file descriptor used
+    fd_set readfds; // file descriptor set
+
+    if (open_serial_port() != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+
+    reader_running_ = true;
     
     maxfd = pico_fd_ + 1;  // maximum bit entry (pico_fd_) to test
 
@@ -96,8 +149,7 @@ int PacketHandler::run(){
         
         struct timeval timeout;
         // set timeout value
-        timeout.tv_usec = 0;  // Microseconds
-        timeout.tv_sec  = 1;  // Seconds
+        timeout = get_select_timeout();
         int res = select(maxfd, &readfds, NULL, NULL, &timeout);
         if (res == -1) {
             // Handle error.
@@ -106,107 +158,387 @@ int PacketHandler::run(){
             // message from pico to host is available
             handle_message_from_pico();
         }
+
+        service_timeouts();
         
     }//@END while (true)
 
-cleanup:    
+    reader_running_ = false;
     close(pico_fd_);
     pico_fd_ = 0;   
-    return retVal; 
+    return EXIT_SUCCESS; 
 }
 
-void PacketHandler::handle_message_from_pico() {    
-    static pkt_buf pkt = {0,0,0};
-    static bool initDone = false;
-       
-    static bool have_request = false;
-
-    if (!initDone) {
-        initDone = true;
-
-        memset((void *)&pkt.req, 0, sizeof(pkt.req));
-        memset((void *)&pkt.resp, 0, sizeof(pkt.resp));
-        pkt.ready = false;
-    }
+void PacketHandler::on_serial_readable() {
+    handle_message_from_pico();
+}
 
-    static size_t numBytesRead = 0;
-    static size_t numBytesToRead = PICO_PKT_LEN;
+void PacketHandler::handle_message_from_pico() {
+    TRACE_SCOPE("serial/read");
+    uint8_t buf[4 * PICO_PKT_LEN];
 
-    int res = read(pico_fd_, (void*)&pkt.resp[numBytesRead], numBytesToRead);
+    int res = read(pico_fd_, (void*)buf, sizeof(buf));
             
     if (res == -1) {
         print_err("Host failed to read serial port: %s\n", strerror(errno));
         return;
     }
 
-    numBytesRead += res;
-    numBytesToRead -= res;
+    feed(buf, res);
+}
 
-    // Bookkeeping: reset counters as necessary
-    if (numBytesRead == PICO_PKT_LEN) {        
-        have_request = true;
-        numBytesRead = 0;
-        numBytesToRead = PICO_PKT_LEN;
-    }
+void PacketHandler::feed(const uint8_t * data, size_t length) {
+    while (length > 0) {
+        const size_t n = MIN(length, PICO_PKT_LEN - rx_len_);
+        memcpy(&rx_buf_[rx_len_], data, n);
+        rx_len_ += n;
+        data += n;
+        length -= n;
 
-    if (!have_request) {
-        return;
+        if (rx_len_ == PICO_PKT_LEN) {
+            rx_len_ = 0;
+            PacketCapture::instance().record(PacketCapture::RX, rx_buf_.data());
+            dispatch_frame(rx_buf_.data());
+        }
     }
+}
 
-    // We have a command in the UART
+void PacketHandler::dispatch_frame(const uint8_t * frame) {
+    TRACE_SCOPE("serial/dispatch_frame");
+    const uint8_t magic = frame[PKT_MAGIC_IDX];
 
-    // Pointer to currently active packet handler    
-    const uint8_t *magic = &pkt.resp[PKT_MAGIC_IDX];
-    
-    pkt.ready = false;
-    have_request = false;
+    stats_.rx_frames++;
+
+    // Only the first frame of a response counts towards the round trip
+    const int64_t sent_ns = request_sent_ns_[magic].exchange(0, std::memory_order_relaxed);
+    if (sent_ns != 0) {
+        if (auto rtt = picod::Latency::instance().serial_rtt(magic)) {
+            rtt->record((steady_ns() - sent_ns) / 1000);
+        }
+    }
+
+    // Responses to asynchronous requests bypass the packet queues
+    if (complete_transaction(magic, frame)) {
+        stats_.async_responses++;
+        return;
+    }
 
     // Determine which packet queue should receive this message
-    if (auto search = pktQueues_.find(*magic); search != pktQueues_.end()) {
+    if (auto search = pktQueues_.find(magic); search != pktQueues_.end()) {
         auto pktQ = search->second.get();
+        if (replay_) {
+            stats_.queued++;
+            return;
+        }
+
         BufPtr ptr(new uint8_t[PICO_PKT_LEN]);
         if (pktQ && !pktQ->isFull() && ptr.get()) {
-            memcpy(ptr.get(), &pkt.resp, PICO_PKT_LEN);
+            memcpy(ptr.get(), frame, PICO_PKT_LEN);
             pktQ->push(ptr);
-        }       
-    } else if (*magic == PICO_PKT_SHUTDOWN_MAGIC) {
-        pkt_shutdown(&pkt);
+            stats_.queued++;
+        } else {
+            stats_.queue_full++;
+        }
+    } else if (magic == PICO_PKT_SHUTDOWN_MAGIC) {
+        stats_.shutdown_requests++;
+        if (!replay_) {
+            pkt_buf pkt = {{0},{0},0};
+            memcpy(pkt.resp, frame, PICO_PKT_LEN);
+            pkt_shutdown(&pkt);
+        }
     } else {
         // We are out of sync, just discard the data and
         // wait for the next packet
+        stats_.out_of_sync++;
         print_err("Host out of sync.\n")
-        print_bytes("Response data:", pkt.resp, PICO_PKT_LEN);
+        print_bytes("Response data:", frame, PICO_PKT_LEN);
     } 
 }
 
+PacketHandler::Stats PacketHandler::stats() const {
+    return Stats {
+        .rx_frames = stats_.rx_frames,
+        .async_responses = stats_.async_responses,
+        .queued = stats_.queued,
+        .queue_full = stats_.queue_full,
+        .shutdown_requests = stats_.shutdown_requests,
+        .out_of_sync = stats_.out_of_sync
+    };
+}
+
 ssize_t PacketHandler::send_pico_request(const uint8_t * buf, size_t length){
+    TRACE_SCOPE("serial/send_pico_request");
     std::lock_guard<std::mutex> lk(m_);
+
+    if (replay_) {
+        return length;
+    }
     
-    int result = tcflush(pico_fd_, TCIFLUSH);
-    if (result == -1) {
-        print_err("Failed to flush serial port: %s\n", strerror(errno));
+    // Keep the response of the asynchronous request in flight, if any
+    if (!async_in_flight_) {
+        int result = tcflush(pico_fd_, TCIFLUSH);
+        if (result == -1) {
+            print_err("Failed to flush serial port: %s\n", strerror(errno));
+        }
     }
        
+    // Stamped before writing, in case the response is read first
+    const int64_t now_ns = steady_ns();
+    for (size_t i = 0; (i + PICO_PKT_LEN) <= length; i += PICO_PKT_LEN) {
+        request_sent_ns_[buf[i + PKT_MAGIC_IDX]].store(now_ns, std::memory_order_relaxed);
+    }
+
     ssize_t bytesWritten = write(pico_fd_, buf, length);
     
     if (bytesWritten != (ssize_t)length) {
        print_err("Error writing to serial port: %s\n", strerror(errno));
     }
 
+    for (size_t i = 0; (i + PICO_PKT_LEN) <= (size_t)MAX(bytesWritten, 0); i += PICO_PKT_LEN) {
+        PacketCapture::instance().record(PacketCapture::TX, &buf[i]);
+    }
+
     return bytesWritten;
 }
 
 bool PacketHandler::get_pico_response(pkt_buf &pkt, uint8_t pkt_id) {
+    TRACE_SCOPE("serial/get_pico_response");
     bool success = false;
 
     if (auto search = pktQueues_.find(pkt_id); search != pktQueues_.end()) {
         auto pktQ = search->second.get();
         BufPtr ptr;
-        if (pktQ && pktQ->wait_and_pop(ptr, std::chrono::seconds(1))) {
+        bool have_response = false;
+
+        if (pktQ && reader_running_) {
+            have_response = pktQ->wait_and_pop(ptr, std::chrono::seconds(1));
+        } else if (pktQ) {
+            have_response = pump_until_response(pktQ, ptr);
+        }
+
+        if (have_response) {
             memcpy(&pkt.resp, ptr.get(), PICO_PKT_LEN);
             success = true;
         }  
     }
 
     return success;
-}
\ No newline at end of file
+}
+
+bool PacketHandler::pump_until_response(ConcurrentQueue<BufPtr> * pktQ, BufPtr &ptr) {
+    using namespace std::chrono;
+    const auto deadline = steady_clock::now() + PICO_RESPONSE_TIMEOUT;
+
+    while (!pktQ->try_pop(ptr)) {
+        auto remaining = duration_cast<microseconds>(deadline - steady_clock::now());
+        if (remaining.count() <= 0) {
+            return false;
+        }
+
+        fd_set readfds;
+        FD_ZERO(&readfds);
+        FD_SET(pico_fd_, &readfds);
+
+        struct timeval timeout;
+        timeout.tv_sec  = remaining.count() / 1000000;  // Seconds
+        timeout.tv_usec = remaining.count() % 1000000;  // Microseconds
+        int res = select(pico_fd_ + 1, &readfds, NULL, NULL, &timeout);
+        if (res == -1) {
+            print_err("select() failed on serial port: %s\n", strerror(errno));
+            return false;
+        } else if ((res > 0) && (FD_ISSET(pico_fd_, &readfds))) {
+            handle_message_from_pico();
+        }
+    }
+
+    return true;
+}
+
+void PacketHandler::set_timeout_scheduler(TimeoutScheduler scheduler) {
+    std::lock_guard<std::mutex> lk(txn_m_);
+    schedule_timeout_ = std::move(scheduler);
+}
+
+bool PacketHandler::send_pico_request_async(const uint8_t * buf, uint8_t pkt_id, 
+    ResponseHandler handler) {
+    return send_pico_request_async(buf, pkt_id, std::move(handler), nullptr);
+}
+
+bool PacketHandler::send_pico_request_async(const uint8_t * buf, uint8_t pkt_id, 
+    ResponseHandler handler, LastFrameTest is_last) {
+    TRACE_SCOPE("serial/send_pico_request_async");
+    std::lock_guard<std::mutex> lk(txn_m_);
+
+    if (transactions_.size() >= MAX_PENDING_TRANSACTIONS) {
+        return false;
+    }
+
+    Transaction t;
+    memcpy(t.req.data(), buf, PICO_PKT_LEN);
+    t.pkt_id = pkt_id;
+    t.handler = std::move(handler);
+    t.is_last = std::move(is_last);
+    t.sent = false;
+    transactions_.push_back(std::move(t));
+
+    // The Pico handles one request at a time, the rest wait their turn.
+    if (transactions_.size() == 1) {
+        send_front_transaction();
+    }
+
+    return true;
+}
+
+void PacketHandler::send_front_transaction() {
+    // Sent once the synchronous request is done with the serial port
+    if (lock_depth_ > 0) {
+        return;
+    }
+
+    auto &t = transactions_.front();
+    t.sent = true;
+    t.deadline = std::chrono::steady_clock::now() + PICO_RESPONSE_TIMEOUT;
+    send_pico_request(t.req.data(), PICO_PKT_LEN);
+    async_in_flight_ = true;
+
+    schedule_timeout(PICO_RESPONSE_TIMEOUT);
+}
+
+void PacketHandler::schedule_timeout(std::chrono::steady_clock::duration timeout) {
+    if (schedule_timeout_) {
+        // Rounded up, so the timer does not expire before the deadline
+        schedule_timeout_(static_cast<int>(
+            std::chrono::ceil<std::chrono::milliseconds>(timeout).count()));
+    }
+}
+
+bool PacketHandler::complete_transaction(uint8_t pkt_id, const uint8_t * resp) {
+    ResponseHandler handler;
+    {
+        std::lock_guard<std::mutex> lk(txn_m_);
+        if (transactions_.empty() || !transactions_.front().sent ||
+            (transactions_.front().pkt_id != pkt_id)) {
+            return false;
+        }
+
+        auto &t = transactions_.front();
+        if (t.is_last && !t.is_last(resp)) {
+            // More frames to come, keep the transaction at the front
+            handler = t.handler;
+            t.deadline = std::chrono::steady_clock::now() + PICO_RESPONSE_TIMEOUT;
+            schedule_timeout(PICO_RESPONSE_TIMEOUT);
+        } else {
+            handler = std::move(t.handler);
+            pop_front_transaction();
+        }
+    }
+
+    if (handler) {
+        handler(true, resp);
+    }
+
+    return true;
+}
+
+void PacketHandler::pop_front_transaction() {
+    transactions_.pop_front();
+    async_in_flight_ = false;
+
+    if (!transactions_.empty()) {
+        send_front_transaction();
+    }
+
+    txn_cv_.notify_all();
+}
+
+void PacketHandler::lock_requests() {
+    std::unique_lock<std::mutex> lk(txn_m_);
+    const auto self = std::this_thread::get_id();
+
+    if ((lock_depth_ > 0) && (lock_owner_ == self)) {
+        lock_depth_++;
+        return;
+    }
+
+    // Without a reader loop, the asynchronous request in flight can only
+    // complete while this thread services the serial port, so its response
+    // is read first and the lock is taken without waiting for it.
+    if (reader_running_) {
+        txn_cv_.wait_for(lk, REQUEST_LOCK_TIMEOUT, [this]() {
+            return (lock_depth_ == 0) && !async_in_flight_;
+        });
+    }
+
+    txn_cv_.wait(lk, [this]() { return lock_depth_ == 0; });
+
+    lock_owner_ = self;
+    lock_depth_ = 1;
+}
+
+void PacketHandler::unlock_requests() {
+    std::lock_guard<std::mutex> lk(txn_m_);
+
+    if (--lock_depth_ > 0) {
+        return;
+    }
+
+    lock_owner_ = std::thread::id();
+
+    if (!transactions_.empty() && !transactions_.front().sent) {
+        send_front_transaction();
+    }
+
+    txn_cv_.notify_all();
+}
+
+PacketHandler::RequestLock::RequestLock() {
+    PacketHandler::instance().lock_requests();
+}
+
+PacketHandler::RequestLock::~RequestLock() {
+    PacketHandler::instance().unlock_requests();
+}
+
+void PacketHandler::service_timeouts() {
+    ResponseHandler handler;
+    {
+        std::lock_guard<std::mutex> lk(txn_m_);
+        if (transactions_.empty() || !transactions_.front().sent) {
+            return;
+        }
+
+        const auto now = std::chrono::steady_clock::now();
+        if (now < transactions_.front().deadline) {
+            // The event loop timer may expire early, e.g. uloop checks it 
+            // to the millisecond: nothing else would time the request out
+            schedule_timeout(transactions_.front().deadline - now);
+            return;
+        }
+
+        handler = std::move(transactions_.front().handler);
+        pop_front_transaction();
+    }
+
+    if (handler) {
+        handler(false, nullptr);
+    }
+}
+
+struct timeval PacketHandler::get_select_timeout() {
+    using namespace std::chrono;
+    auto wait = duration_cast<microseconds>(seconds(1));
+    {
+        std::lock_guard<std::mutex> lk(txn_m_);
+        if (!transactions_.empty() && transactions_.front().sent) {
+            auto remaining = duration_cast<microseconds>(
+                transactions_.front().deadline - steady_clock::now());
+            wait = (remaining < wait) ? remaining : wait;
+            wait = (wait.count() < 0) ? microseconds(0) : wait;
+        }
+    }
+
+    struct timeval timeout;
+    timeout.tv_sec  = wait.count() / 1000000;  // Seconds
+    timeout.tv_usec = wait.count() % 1000000;  // Microseconds
+    return timeout;
+}
@@ -10,19 +10,96 @@
 #include "pkt_handler.h"
 #include "Event.hpp"
 #include <map>
+#include <deque>
+#include <array>
+#include <functional>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <thread>
 
 class PacketHandler
 {    
 public:
     typedef std::shared_ptr<uint8_t[]> BufPtr;
 
+    /// @brief Called once an asynchronous request completes.
+    /// @param success True(1) if a response was received. False(0) on timeout.
+    /// @param resp Response packet (PICO_PKT_LEN bytes), nullptr on timeout.
+    /// Only valid for the duration of the call.
+    typedef std::function<void(bool success, const uint8_t * resp)> ResponseHandler;
+
+    /// @brief Tells whether a response frame is the last one of a request
+    typedef std::function<bool(const uint8_t * resp)> LastFrameTest;
+
+    /// @brief Asks an event loop to call service_timeouts() after timeout_ms.
+    typedef std::function<void(int timeout_ms)> TimeoutScheduler;
+
+    /// @brief Held by a synchronous request from before it is sent until
+    /// its last response frame is read. Asynchronous requests are not sent
+    /// meanwhile, and it waits for the one in flight, so a response can only
+    /// be taken by the request it answers. Nests within a thread.
+    class RequestLock {
+    public:
+        RequestLock();
+        ~RequestLock();
+        RequestLock(RequestLock const&)   = delete;
+        void operator=(RequestLock const&)  = delete;
+    };
+
     static PacketHandler& instance();
     ~PacketHandler();
     PacketHandler(PacketHandler const&)   = delete;
     void operator=(PacketHandler const&)  = delete;
+    /// @brief Opens the serial port and services it until quit is signalled.
     int run();
     bool is_init_done();
 
+    /// @brief Opens and configures the serial port without starting a 
+    /// reader loop. The caller is then responsible for calling 
+    /// on_serial_readable() whenever fd() becomes readable, and 
+    /// service_timeouts() when the scheduled timeout expires.
+    /// @return Exit code: 0 - Success, 1 - Failure.
+    int open_serial_port();
+
+    /// @brief Serial port file descriptor
+    int fd() const { return pico_fd_; }
+
+    /// @brief Reads pending bytes from the serial port and dispatches any 
+    /// complete packet.
+    void on_serial_readable();
+
+    /// @brief Frames bytes received from the RPi Pico into packets and
+    /// dispatches each complete one, as if read from the serial port.
+    void feed(const uint8_t * data, size_t length);
+
+    /// @brief Counts of the received packets, by where they were dispatched
+    typedef struct Stats {
+        uint64_t rx_frames;
+        /// @brief Responses to asynchronous requests
+        uint64_t async_responses;
+        /// @brief Responses handed to the packet queues
+        uint64_t queued;
+        /// @brief Responses dropped because their packet queue was full
+        uint64_t queue_full;
+        uint64_t shutdown_requests;
+        uint64_t out_of_sync;
+    } Stats;
+
+    Stats stats() const;
+
+    /// @brief In replay mode nothing is written to the serial port, 
+    /// shutdown requests are only counted, and responses are counted
+    /// rather than handed to the packet queues. Used by pico-replay.
+    void set_replay_mode(bool replay) { replay_ = replay; }
+
+    /// @brief Fails the oldest pending asynchronous request if it timed out.
+    void service_timeouts();
+
+    /// @brief Installs the event loop hook used to time out asynchronous 
+    /// requests when there is no reader loop.
+    void set_timeout_scheduler(TimeoutScheduler scheduler);
+
     /// @brief Sends command packet to RPi Pico 
     /// @param buf Packet to sent.
     /// @param length Packet length in bytes.
@@ -34,14 +111,98 @@ public:
     /// @param pkt_id Expected Packet ID
     /// @return True(1) on success. False(0) on failure.
     bool get_pico_response(pkt_buf &pkt, uint8_t pkt_id);
+
+    /// @brief Queues a command packet for the RPi Pico without waiting for
+    /// its response. Queued requests are sent one at a time, in order, and
+    /// the handler is called from the thread servicing the serial port once the response
+    /// arrives or the request times out.
+    /// @param buf Packet to send (PICO_PKT_LEN bytes).
+    /// @param pkt_id Expected response Packet ID.
+    /// @param handler Completion callback.
+    /// @return True(1) if the request was queued. False(0) if the queue is full.
+    bool send_pico_request_async(const uint8_t * buf, uint8_t pkt_id, ResponseHandler handler);
+
+    /// @brief Same as above, for requests the Pico answers with several frames.
+    /// The handler is called for every frame, up to and including the one 
+    /// is_last returns True(1) for. The timeout restarts with each frame.
+    bool send_pico_request_async(const uint8_t * buf, uint8_t pkt_id, ResponseHandler handler,
+        LastFrameTest is_last);
 private:
+    /// @brief An asynchronous request awaiting its response
+    typedef struct Transaction {
+        std::array<uint8_t, PICO_PKT_LEN> req;
+        uint8_t pkt_id;
+        ResponseHandler handler;
+        /// @brief Empty for single frame responses
+        LastFrameTest is_last;
+        /// @brief False(0) while held back by a RequestLock
+        bool sent;
+        std::chrono::steady_clock::time_point deadline;
+    } Transaction;
+
     int pico_fd_;
     std::mutex m_;
     Event initDone_;
     std::map<uint8_t, std::shared_ptr<ConcurrentQueue<BufPtr>>> pktQueues_;
+    std::mutex txn_m_;
+    std::deque<Transaction> transactions_;
+    /// @brief Signalled when the RequestLock is released or the
+    /// asynchronous request in flight completes
+    std::condition_variable txn_cv_;
+    /// @brief Thread holding the RequestLock, and how many times
+    std::thread::id lock_owner_;
+    int lock_depth_;
+    /// @brief True(1) while an asynchronous request awaits its response
+    std::atomic<bool> async_in_flight_;
+    TimeoutScheduler schedule_timeout_;
+    std::atomic<bool> reader_running_;
+    /// @brief Packet being received
+    std::array<uint8_t, PICO_PKT_LEN> rx_buf_;
+    size_t rx_len_;
+    bool replay_;
+    struct {
+        std::atomic<uint64_t> rx_frames;
+        std::atomic<uint64_t> async_responses;
+        std::atomic<uint64_t> queued;
+        std::atomic<uint64_t> queue_full;
+        std::atomic<uint64_t> shutdown_requests;
+        std::atomic<uint64_t> out_of_sync;
+    } stats_;
+    /// @brief Steady clock (ns) when the last request of each packet type
+    /// was sent, zero(0) once its response arrived
+    std::array<std::atomic<int64_t>, 256> request_sent_ns_;
     PacketHandler();
     void handle_message_from_pico();
-        
+
+    /// @brief Dispatches one complete packet received from the RPi Pico
+    void dispatch_frame(const uint8_t * frame);
+
+    /// @brief Hands a response to the oldest pending asynchronous request.
+    /// @return True(1) if the response was consumed. False(0) otherwise.
+    bool complete_transaction(uint8_t pkt_id, const uint8_t * resp);
+
+    /// @brief Sends the oldest pending asynchronous request, unless a
+    /// RequestLock is held. Must be called with txn_m_ held.
+    void send_front_transaction();
+
+    /// @brief Removes the oldest asynchronous request, then sends the next
+    /// one. Must be called with txn_m_ held.
+    void pop_front_transaction();
+
+    /// @brief Asks the event loop, if any, to call service_timeouts()
+    /// once timeout has elapsed. Must be called with txn_m_ held.
+    void schedule_timeout(std::chrono::steady_clock::duration timeout);
+
+    void lock_requests();
+    void unlock_requests();
+
+    /// @brief Time until the oldest pending asynchronous request times out,
+    /// capped at one (1) second.
+    struct timeval get_select_timeout();
+
+    /// @brief Services the serial port until a response arrives on pktQ.
+    /// Used by synchronous requests when there is no reader loop.
+    bool pump_until_response(ConcurrentQueue<BufPtr> * pktQ, BufPtr &ptr);
 };
 
 #endif // @END PACKET_HANDLER_HPP
\ No newline at end of file
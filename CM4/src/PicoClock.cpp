@@ -0,0 +1,197 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#include "PicoClock.hpp"
+#include "fmt/core.h"
+#include <algorithm>
+#include <cmath>
+
+namespace picod {
+
+// Number of recent exchanges the estimate is based on
+const size_t MAX_EXCHANGES = 32;
+// Exchanges whose round trip took this much longer than the quickest are left out
+const int64_t DELAY_TOLERANCE_US = 200;
+// The drift is only fitted once the exchanges span this long
+const uint64_t MIN_DRIFT_SPAN_US = 30000000;
+// Crystal oscillators are well within this
+const double MAX_DRIFT = 500e-6;
+// An offset this far from the prediction means one of the clocks was set
+const double STEP_THRESHOLD_US = 50000.0;
+// Exchanges are made this often once synchronized, and more often until then
+const std::chrono::seconds SYNC_INTERVAL(10);
+const std::chrono::seconds FAST_SYNC_INTERVAL(1);
+const size_t FAST_SYNC_EXCHANGES = 4;
+
+PicoClock::PicoClock()
+:base_offset_us_{0}
+,offset_us_{0.0}
+,drift_{0.0}
+,ref_pico_us_{0}
+,min_delay_us_{0}
+,num_fitted_{0}
+{
+}
+
+PicoClock& PicoClock::instance() {
+    static PicoClock theInstance;
+    return theInstance;
+}
+
+int64_t PicoClock::now_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+void PicoClock::reset() {
+    std::lock_guard<std::mutex> lk(m_);
+    exchanges_.clear();
+    offset_us_ = 0.0;
+    drift_ = 0.0;
+    num_fitted_ = 0;
+}
+
+double PicoClock::predict(uint64_t pico_us) const {
+    return offset_us_ + drift_ * static_cast<double>(
+        static_cast<int64_t>(pico_us - ref_pico_us_));
+}
+
+void PicoClock::add_exchange(int64_t host_send_us, uint64_t pico_recv_us,
+    uint32_t turnaround_us, int64_t host_recv_us) {
+    std::lock_guard<std::mutex> lk(m_);
+
+    const int64_t pico_us = static_cast<int64_t>(pico_recv_us);
+    int64_t delay_us = (host_recv_us - host_send_us) - turnaround_us;
+    delay_us = (delay_us < 0) ? 0 : delay_us;
+
+    // Twice the NTP offset: (T1 - T2) + (T4 - T3), host minus Pico
+    const int64_t offset_x2 = host_send_us + host_recv_us - turnaround_us - 2 * pico_us;
+
+    if (!exchanges_.empty() && (pico_recv_us < exchanges_.back().pico_us)) {
+        fmt::println("Pico clock: the Pico restarted, synchronizing again");
+        exchanges_.clear();
+        num_fitted_ = 0;
+    }
+
+    if (exchanges_.empty()) {
+        base_offset_us_ = offset_x2 / 2;
+        drift_ = 0.0;
+    }
+
+    double offset_us = static_cast<double>(offset_x2 - 2 * base_offset_us_) / 2.0;
+
+    if ((num_fitted_ > 0) &&
+        (std::fabs(offset_us - predict(pico_recv_us)) > (STEP_THRESHOLD_US + delay_us / 2.0))) {
+        fmt::println("Pico clock: offset jumped by {:.0f} us, synchronizing again",
+            offset_us - predict(pico_recv_us));
+        exchanges_.clear();
+        num_fitted_ = 0;
+        base_offset_us_ = offset_x2 / 2;
+        drift_ = 0.0;
+        offset_us = static_cast<double>(offset_x2 - 2 * base_offset_us_) / 2.0;
+    }
+
+    exchanges_.push_back(Exchange { .pico_us = pico_recv_us, .offset_us = offset_us,
+        .delay_us = delay_us });
+
+    while (exchanges_.size() > MAX_EXCHANGES) {
+        exchanges_.pop_front();
+    }
+
+    fit();
+}
+
+void PicoClock::fit() {
+    if (exchanges_.empty()) {
+        return;
+    }
+
+    min_delay_us_ = exchanges_.front().delay_us;
+    for (auto const& e : exchanges_) {
+        min_delay_us_ = std::min(min_delay_us_, e.delay_us);
+    }
+
+    // Offsets are fitted relative to the newest exchange's Pico time
+    ref_pico_us_ = exchanges_.back().pico_us;
+
+    double n = 0.0, sum_x = 0.0, sum_y = 0.0;
+    uint64_t first_us = ref_pico_us_;
+    for (auto const& e : exchanges_) {
+        if (e.delay_us > (min_delay_us_ + DELAY_TOLERANCE_US)) {
+            continue;
+        }
+
+        n += 1.0;
+        sum_x += static_cast<double>(static_cast<int64_t>(e.pico_us - ref_pico_us_));
+        sum_y += e.offset_us;
+        first_us = std::min(first_us, e.pico_us);
+    }
+
+    const double mean_x = sum_x / n;
+    const double mean_y = sum_y / n;
+
+    if ((ref_pico_us_ - first_us) >= MIN_DRIFT_SPAN_US) {
+        double sxx = 0.0, sxy = 0.0;
+        for (auto const& e : exchanges_) {
+            if (e.delay_us > (min_delay_us_ + DELAY_TOLERANCE_US)) {
+                continue;
+            }
+
+            const double dx = static_cast<double>(
+                static_cast<int64_t>(e.pico_us - ref_pico_us_)) - mean_x;
+            sxx += dx * dx;
+            sxy += dx * (e.offset_us - mean_y);
+        }
+
+        drift_ = std::clamp(sxy / sxx, -MAX_DRIFT, MAX_DRIFT);
+    }
+
+    offset_us_ = mean_y - drift_ * mean_x;
+    num_fitted_ = static_cast<size_t>(n);
+    last_exchange_ = std::chrono::steady_clock::now();
+}
+
+bool PicoClock::to_host_ms(uint64_t pico_us, int64_t & host_ms) {
+    std::lock_guard<std::mutex> lk(m_);
+
+    if (num_fitted_ == 0) {
+        return false;
+    }
+
+    const int64_t host_us = static_cast<int64_t>(pico_us) + base_offset_us_ +
+        std::llround(predict(pico_us));
+    host_ms = (host_us + 500) / 1000;
+    return true;
+}
+
+bool PicoClock::is_sync_due() {
+    std::lock_guard<std::mutex> lk(m_);
+    const auto now = std::chrono::steady_clock::now();
+    const auto interval = (exchanges_.size() < FAST_SYNC_EXCHANGES) ?
+        FAST_SYNC_INTERVAL : SYNC_INTERVAL;
+
+    if ((now - last_exchange_) < interval) {
+        return false;
+    }
+
+    // Counts as an attempt, so that a Pico that does not answer is not
+    // asked again on every poll
+    last_exchange_ = now;
+    return true;
+}
+
+PicoClock::Status PicoClock::status() {
+    std::lock_guard<std::mutex> lk(m_);
+    Status s = { .synced = (num_fitted_ > 0), .offset_us = 0, .drift_ppm = drift_ * 1e6,
+        .delay_us = min_delay_us_, .num_exchanges = num_fitted_ };
+
+    if (s.synced) {
+        s.offset_us = base_offset_us_ + std::llround(offset_us_);
+    }
+
+    return s;
+}
+
+} //@END namespace picod
@@ -0,0 +1,98 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifndef PICO_CLOCK_HPP_
+#define PICO_CLOCK_HPP_
+#include <stdint.h>
+#include <deque>
+#include <mutex>
+#include <chrono>
+
+namespace picod {
+/// @brief Maps Pico time (us since the Pico booted) to host time, so that
+/// readings are stamped with when the Pico sampled them rather than when
+/// picod received them.
+///
+/// Like NTP, it keeps the offset between the two clocks, and how fast it
+/// drifts, from time packet exchanges. Exchanges that took longer than the
+/// quickest recent ones are left out, as their delay was probably not the
+/// same both ways.
+class PicoClock {
+public:
+    typedef struct Status {
+        bool synced;
+        /// @brief Host time minus Pico time at the latest exchange (us)
+        int64_t offset_us;
+        /// @brief How fast the offset changes, in parts per million
+        double drift_ppm;
+        /// @brief Round trip delay of the quickest recent exchange (us)
+        int64_t delay_us;
+        /// @brief Exchanges the estimate is based on
+        size_t num_exchanges;
+    } Status;
+
+    static PicoClock& instance();
+    PicoClock(PicoClock const&)   = delete;
+    void operator=(PicoClock const&)  = delete;
+
+    /// @brief Adds one time packet exchange.
+    /// @param host_send_us Host time the request was sent
+    /// @param pico_recv_us Pico time the request arrived
+    /// @param turnaround_us Time the Pico took to answer
+    /// @param host_recv_us Host time the response arrived
+    void add_exchange(int64_t host_send_us, uint64_t pico_recv_us,
+        uint32_t turnaround_us, int64_t host_recv_us);
+
+    /// @brief Converts Pico time to host time.
+    /// @param host_ms [out] Milliseconds since the Unix epoch
+    /// @return True(1) once synchronized. False(0) otherwise.
+    bool to_host_ms(uint64_t pico_us, int64_t & host_ms);
+
+    /// @brief True(1) when another exchange should be made
+    bool is_sync_due();
+
+    /// @brief Forgets all exchanges, e.g. after the Pico restarted.
+    void reset();
+
+    Status status();
+
+    /// @brief Current time in microseconds since the Unix epoch
+    static int64_t now_us();
+
+private:
+    typedef struct Exchange {
+        uint64_t pico_us;
+        /// @brief Host time minus Pico time, relative to base_offset_us_
+        double offset_us;
+        int64_t delay_us;
+    } Exchange;
+
+    std::mutex m_;
+    std::deque<Exchange> exchanges_;
+    std::chrono::steady_clock::time_point last_exchange_;
+    /// @brief Offset of the first exchange. Offsets are kept relative to
+    /// it, so that doubles keep sub-microsecond resolution.
+    int64_t base_offset_us_;
+    /// @brief Fitted offset at Pico time ref_pico_us_, relative to base_offset_us_
+    double offset_us_;
+    /// @brief Fitted drift (us per us)
+    double drift_;
+    uint64_t ref_pico_us_;
+    int64_t min_delay_us_;
+    size_t num_fitted_;
+
+    PicoClock();
+
+    /// @brief Fits offset and drift to the quickest exchanges. Must be called with m_ held.
+    void fit();
+
+    /// @brief Predicted offset at a Pico time, relative to base_offset_us_.
+    /// Must be called with m_ held.
+    double predict(uint64_t pico_us) const;
+};
+
+} //@END namespace picod
+
+#endif //@END PICO_CLOCK_HPP_
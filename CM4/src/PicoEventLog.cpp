@@ -0,0 +1,214 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#include "PicoEventLog.hpp"
+#include "SensorHistory.hpp"
+#include "InfluxDB.hpp"
+#include "settings.hpp"
+#include "fmt/core.h"
+
+namespace picod {
+
+// How often the Pico event log is read
+const std::chrono::seconds POLL_INTERVAL(10);
+// Number of events kept for events()
+const size_t MAX_EVENTS = 64;
+// Most requests made by one poll, each returns up to PICO_EVENT_LOG_MAX_BURST events
+const int MAX_REQUESTS_PER_POLL = (PICO_EVENT_LOG_LEN / PICO_EVENT_LOG_MAX_BURST) + 1;
+
+PicoEventLog::PicoEventLog()
+:next_seq_{0}
+,have_polled_{false}
+,polling_{false}
+,have_boot_{false}
+,boot_{0}
+,boot_start_ms_{0}
+{
+}
+
+PicoEventLog& PicoEventLog::instance() {
+    static PicoEventLog theInstance;
+    return theInstance;
+}
+
+const char * PicoEventLog::to_string(uint8_t type) {
+    switch (type) {
+    case PICO_EVENT_BOOT:
+        return "pico_boot";
+    case PICO_EVENT_WATCHDOG_RESET:
+        return "watchdog_reset";
+    case PICO_EVENT_SHUTDOWN_BUTTON:
+        return "shutdown_button";
+    case PICO_EVENT_HARD_RESET_BUTTON:
+        return "hard_reset_button";
+    case PICO_EVENT_POWER_ON_BUTTON:
+        return "power_on_button";
+    case PICO_EVENT_OUT_OF_SYNC:
+        return "out_of_sync";
+    case PICO_EVENT_CM4_OFF:
+        return "cm4_off";
+    case PICO_EVENT_CM4_ON:
+        return "cm4_on";
+    case PICO_EVENT_CONFIG_LOADED:
+        return "config_loaded";
+    case PICO_EVENT_CONFIG_SAVED:
+        return "config_saved";
+    default:
+        return "unknown";
+    }
+}
+
+bool PicoEventLog::is_poll_due() {
+    std::lock_guard<std::mutex> lk(m_);
+    return !polling_ && (!have_polled_ ||
+        ((std::chrono::steady_clock::now() - last_poll_) >= POLL_INTERVAL));
+}
+
+bool PicoEventLog::merge(const std::vector<pico_event_t> & events,
+    const pico_event_log_status_t & status) {
+    std::lock_guard<std::mutex> lk(m_);
+    const int64_t now = SensorHistory::now_ms();
+    const int64_t boot_start_ms = now - static_cast<int64_t>(status.time_ms);
+
+    if (!events.empty() && (events.front().seq != next_seq_)) {
+        if (events.front().seq > next_seq_) {
+            fmt::println(stderr, "Pico event log: {} events were overwritten",
+                events.front().seq - next_seq_);
+        } else {
+            // The Pico lost its log (e.g. power loss) and started over
+            fmt::println(stderr, "Pico event log: restarted at {}", events.front().seq);
+        }
+    }
+
+    for (auto const& pe : events) {
+        Event e = { .seq = pe.seq, .boot = pe.boot, .timestamp_ms = 0,
+            .pico_time_ms = pe.time_ms, .event = to_string(pe.type), .data = pe.data };
+
+        // Pico time counts from the start of its boot, which is only known
+        // for the current boot and the one seen by the previous poll. The
+        // first poll reads back the whole log, including earlier boots
+        // already written by a previous run of picod.
+        if (pe.boot == status.boot) {
+            e.timestamp_ms = boot_start_ms + static_cast<int64_t>(pe.time_ms);
+        } else if (have_boot_ && (pe.boot == boot_)) {
+            e.timestamp_ms = boot_start_ms_ + static_cast<int64_t>(pe.time_ms);
+        }
+
+        fmt::println("Pico: {} (data: 0x{:04x}, boot: {}, Pico time: {} ms)",
+            e.event, e.data, e.boot, e.pico_time_ms);
+
+        // Without a timestamp, InfluxDB would store the event as happening now
+        if (appSettings.enable_influx_db && (e.timestamp_ms != 0)) {
+            InfluxDB::instance().addPicoEvent(e.event, e.data, e.boot, e.timestamp_ms);
+        }
+
+        events_.push_back(e);
+        new_events_.push_back(e);
+    }
+
+    while (events_.size() > MAX_EVENTS) {
+        events_.pop_front();
+    }
+
+    while (new_events_.size() > MAX_EVENTS) {
+        new_events_.pop_front();
+    }
+
+    next_seq_ = events.empty() ? status.next_seq : (events.back().seq + 1);
+
+    have_boot_ = true;
+    boot_ = status.boot;
+    boot_start_ms_ = boot_start_ms;
+
+    return next_seq_ != status.next_seq;
+}
+
+bool PicoEventLog::poll() {
+    {
+        std::lock_guard<std::mutex> lk(m_);
+        have_polled_ = true;
+        last_poll_ = std::chrono::steady_clock::now();
+    }
+
+    for (int i = 0; i < MAX_REQUESTS_PER_POLL; i++) {
+        std::vector<pico_event_t> events;
+        pico_event_log_status_t status = {0};
+        uint32_t first_seq;
+        {
+            std::lock_guard<std::mutex> lk(m_);
+            first_seq = next_seq_;
+        }
+
+        if (!send_event_log_request(first_seq, events, status)) {
+            return false;
+        }
+
+        if (!merge(events, status)) {
+            break;
+        }
+    }
+
+    return true;
+}
+
+bool PicoEventLog::step_async(std::function<void()> done) {
+    uint32_t first_seq;
+    {
+        std::lock_guard<std::mutex> lk(m_);
+        first_seq = next_seq_;
+    }
+
+    bool queued = send_event_log_request_async(first_seq,
+        [this, done](bool success, std::vector<pico_event_t> &events,
+            pico_event_log_status_t &status) {
+            if (success && merge(events, status) && step_async(done)) {
+                return;
+            }
+
+            {
+                std::lock_guard<std::mutex> lk(m_);
+                polling_ = false;
+            }
+
+            if (done) {
+                done();
+            }
+        });
+
+    if (!queued) {
+        std::lock_guard<std::mutex> lk(m_);
+        polling_ = false;
+    }
+
+    return queued;
+}
+
+bool PicoEventLog::poll_async(std::function<void()> done) {
+    {
+        std::lock_guard<std::mutex> lk(m_);
+        if (polling_) {
+            return false;
+        }
+        polling_ = true;
+        have_polled_ = true;
+        last_poll_ = std::chrono::steady_clock::now();
+    }
+
+    return step_async(std::move(done));
+}
+
+std::vector<PicoEventLog::Event> PicoEventLog::events() {
+    std::lock_guard<std::mutex> lk(m_);
+    return std::vector<Event>(events_.begin(), events_.end());
+}
+
+std::vector<PicoEventLog::Event> PicoEventLog::take_events() {
+    std::lock_guard<std::mutex> lk(m_);
+    std::vector<Event> out(new_events_.begin(), new_events_.end());
+    new_events_.clear();
+    return out;
+}
+
+} //@END namespace picod
@@ -0,0 +1,91 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifndef PICO_EVENT_LOG_HPP_
+#define PICO_EVENT_LOG_HPP_
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <chrono>
+#include <functional>
+#include "pico_pkt_event_log.h"
+
+namespace picod {
+/// @brief Reads the events the Pico logged (watchdog resets, button presses,
+/// Pico reboots, etc.), including those logged while picod was not running,
+/// and merges them into picod's own log.
+class PicoEventLog {
+public:
+    typedef struct Event {
+        uint32_t seq;
+        /// @brief Pico boot number
+        uint16_t boot;
+        /// @brief Milliseconds since the Unix epoch. Zero(0) for events of an
+        /// earlier Pico boot picod did not see, whose time relative to the
+        /// host's clock is unknown.
+        int64_t timestamp_ms;
+        /// @brief Milliseconds since the Pico booted
+        uint32_t pico_time_ms;
+        /// @brief See to_string()
+        std::string event;
+        uint16_t data;
+    } Event;
+
+    static PicoEventLog& instance();
+    PicoEventLog(PicoEventLog const&)   = delete;
+    void operator=(PicoEventLog const&)  = delete;
+
+    /// @brief Reads the new events from the Pico, waiting for the responses.
+    /// @return True(1) on success. False(0) on failure.
+    bool poll();
+
+    /// @brief Reads the new events from the Pico without waiting.
+    /// @param done Called from the thread servicing the serial port once
+    /// all new events were read, or a request failed.
+    /// @return True(1) if the request was queued. False(0) otherwise.
+    bool poll_async(std::function<void()> done);
+
+    /// @brief True(1) when the event log should be polled again
+    bool is_poll_due();
+
+    /// @brief Returns the most recent events, oldest first.
+    std::vector<Event> events();
+
+    /// @brief Returns the events read since the last call, oldest first.
+    std::vector<Event> take_events();
+
+    static const char * to_string(uint8_t type);
+
+private:
+    std::mutex m_;
+    /// @brief Sequence number of the next event to read from the Pico
+    uint32_t next_seq_;
+    std::chrono::steady_clock::time_point last_poll_;
+    bool have_polled_;
+    /// @brief True(1) while an asynchronous poll is in progress
+    bool polling_;
+    /// @brief True(1) once a poll has seen the Pico's boot number
+    bool have_boot_;
+    /// @brief Pico boot number at the last poll
+    uint16_t boot_;
+    /// @brief Host time (ms since the Unix epoch) when that boot started
+    int64_t boot_start_ms_;
+    std::deque<Event> events_;
+    std::deque<Event> new_events_;
+
+    PicoEventLog();
+
+    /// @brief Adds the events read from the Pico.
+    /// @return True(1) if the Pico holds more new events.
+    bool merge(const std::vector<pico_event_t> & events, const pico_event_log_status_t & status);
+    /// @brief Requests the next events. Clears polling_ if the request could not be queued.
+    bool step_async(std::function<void()> done);
+};
+
+} //@END namespace picod
+
+#endif //@END PICO_EVENT_LOG_HPP_
@@ -0,0 +1,1041 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#include "PicoSim.hpp"
+#include <fcntl.h>
+#include <poll.h>
+#include <pty.h>
+#include <termios.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <thread>
+#include "pico_pkt_id.h"
+#include "pico_pkt_temperature.h"
+#include "pico_pkt_watchdog.h"
+#include "pico_pkt_shutdown.h"
+#include "pico_pkt_ping.h"
+#include "pico_pkt_version.h"
+#include "pico_pkt_time.h"
+#include "pico_pkt_flash_config.h"
+#include "fmt/core.h"
+#include "fmt/ranges.h"
+
+namespace picod {
+
+// Same as the firmware (uart_dma.h, adc_capture.h, pico_pkt_fan_ctrl.c,
+// pico_pkt_ntc_cal.c, pico_pkt_watchdog.c), which cannot be built here
+const uint64_t UART_RX_IDLE_TIMEOUT_us = 5000;
+const size_t UART_RX_NUM_SLOTS = 8;
+const size_t UART_FIFO_LEN = 32;
+const uint32_t ADC_CAPTURE_MIN_RATE_Hz = 200;
+const uint32_t ADC_CAPTURE_MAX_RATE_Hz = 20000;
+const uint32_t ADC_CAPTURE_MIN_WINDOW_ms = 100;
+const uint32_t ADC_CAPTURE_MAX_WINDOW_ms = 10000;
+const uint64_t FAN_CTRL_STEP_us = 500000;
+const int32_t FAN_CTRL_MIN_VALID_CX100 = -4000;
+const int32_t FAN_CTRL_MAX_VALID_CX100 = 15000;
+const uint16_t NTC_CAL_MIN_BETA = 1000;
+const uint16_t NTC_CAL_MAX_BETA = 10000;
+const int16_t NTC_CAL_MAX_OFFSET_CX100 = 2000;
+const uint16_t NTC_DEFAULT_BETA = 3380;
+const uint64_t CM4_WATCHDOG_CHECK_us = 100000;
+const uint64_t CM4_WATCHDOG_BOOT_TIMEOUT_us = 180000000;
+// The firmware blinks an LED for this long after an unknown request
+const std::chrono::milliseconds OUT_OF_SYNC_STALL(2000);
+// The Pico booted this long before the simulation started
+const uint64_t BOOT_TIME_us = 2000000;
+// Points of a window each sensor is evaluated at
+const uint32_t WINDOW_POINTS = 64;
+
+enum flash_config_pkt {
+    FLASH_CONFIG_PKT_FAN_PWM,
+    FLASH_CONFIG_PKT_WATCHDOG,
+    FLASH_CONFIG_PKT_FAN_CTRL,
+    FLASH_CONFIG_PKT_NTC_CAL = FLASH_CONFIG_PKT_FAN_CTRL + NUM_PWM_FANS,
+    FLASH_CONFIG_NUM_PKTS
+};
+
+// "CFGK", as in the firmware
+const uint32_t FLASH_FILE_MAGIC = 0x4346474B;
+
+static const char * CHANNEL_NAMES[PicoSim::NUM_CHANNELS] = {
+    "ntc1", "ntc2", "ntc3", "ntc4", "pico", "fan1", "cm4_fan"
+};
+
+static const char * DEFAULT_WAVEFORMS[PicoSim::NUM_CHANNELS] = {
+    "sine:45,3,300+noise:0.05", "sine:42,2,240+noise:0.05", "const:38+noise:0.05",
+    "const:40+noise:0.05", "const:35+noise:0.1", "duty:3000,20+noise:10", "duty:6000,20+noise:20"
+};
+
+PicoSim::PicoSim(const Options & opts)
+:opts_(opts)
+,stats_{}
+,master_fd_{-1}
+,rng_(opts.seed)
+,start_(Clock::now())
+,last_rx_(start_)
+,num_dispatched_{0}
+,last_due_(start_)
+,busy_until_(start_)
+,tx_ready_(start_)
+,tx_sending_{false}
+,duty_{0.5f, 0.5f}
+,watchdog_enabled_{false}
+,watchdog_timeout_sec_{0}
+,watchdog_max_retries_{0}
+,last_host_message_us_{0}
+,next_watchdog_check_us_{0}
+,fan_ctrl_{}
+,next_fan_ctrl_step_us_{0}
+,ntc_cal_{}
+,sample_rate_hz_{1000}
+,window_ms_{1000}
+,window_origin_us_{0}
+,window_{}
+,events_(PICO_EVENT_LOG_LEN)
+,next_event_seq_{0}
+,boot_{1}
+,saved_{}
+,loaded_{false}
+{
+    Waveform::set_seed(opts.seed);
+
+    for (int ch = 0; ch < NUM_CHANNELS; ch++) {
+        waveforms_[ch].emplace_back(0.0, Waveform::parse(DEFAULT_WAVEFORMS[ch]));
+    }
+
+    fan_ctrl_[0].cfg.fan_id = SYS_FAN1;
+    fan_ctrl_[1].cfg.fan_id = ::CM4_FAN;
+    ntc_cal_.beta = NTC_DEFAULT_BETA;
+
+    log_event(PICO_EVENT_BOOT, PICO_EVENT_BOOT_POWER_ON);
+    load_flash();
+}
+
+PicoSim::~PicoSim() {
+    if (master_fd_ >= 0) {
+        close(master_fd_);
+    }
+}
+
+bool PicoSim::open(std::string & device_path) {
+    int slave_fd = -1;
+    struct termios settings;
+    memset(&settings, 0, sizeof(settings));
+    cfmakeraw(&settings);
+
+    if (openpty(&master_fd_, &slave_fd, NULL, &settings, NULL) == -1) {
+        fmt::println(stderr, "Failed to open a pseudo terminal: {}", strerror(errno));
+        return false;
+    }
+
+    const char * name = ttyname(slave_fd);
+    device_path = (name != NULL) ? name : "";
+
+    // picod opens the device itself. Keeping it open here would keep the
+    // exclusive mode picod sets after it exits.
+    close(slave_fd);
+    fcntl(master_fd_, F_SETFL, fcntl(master_fd_, F_GETFL) | O_NONBLOCK);
+
+    return !device_path.empty();
+}
+
+void PicoSim::set_waveform(Channel channel, double start_s, const Waveform & w) {
+    auto & list = waveforms_[channel];
+
+    if (start_s <= 0.0) {
+        list.clear();
+    }
+
+    list.emplace_back(start_s, w);
+    std::stable_sort(list.begin(), list.end(),
+        [](auto const& a, auto const& b) { return a.first < b.first; });
+}
+
+bool PicoSim::get_channel(const std::string & name, Channel & channel) {
+    for (int ch = 0; ch < NUM_CHANNELS; ch++) {
+        if (name == CHANNEL_NAMES[ch]) {
+            channel = static_cast<Channel>(ch);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+uint64_t PicoSim::pico_time_us(Clock::time_point t) const {
+    const double elapsed_us = std::chrono::duration<double, std::micro>(t - start_).count();
+    return BOOT_TIME_us + static_cast<uint64_t>(elapsed_us * (1.0 + opts_.clock_drift_ppm * 1e-6));
+}
+
+double PicoSim::value(Channel channel, uint64_t t_us, uint64_t noise_key, double duty) const {
+    const double t_s = (static_cast<double>(t_us) - BOOT_TIME_us) / 1e6;
+    const Waveform * w = &waveforms_[channel].front().second;
+
+    for (auto const& entry : waveforms_[channel]) {
+        if (entry.first > t_s) {
+            break;
+        }
+        w = &entry.second;
+    }
+
+    return w->value(t_s, (static_cast<uint64_t>(channel) << 56) ^ noise_key, duty);
+}
+
+bool PicoSim::chance(double probability) {
+    return (probability > 0.0) &&
+        (std::uniform_real_distribution<double>(0.0, 1.0)(rng_) < probability);
+}
+
+void PicoSim::run(const std::atomic<bool> & quit) {
+    while (!quit) {
+        auto now = Clock::now();
+        const auto deadline = next_deadline(now);
+        const auto timeout_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::max(deadline - now, Clock::duration::zero()));
+
+        // Microsecond timeouts, so that the latency is not rounded up to a millisecond
+        struct timespec timeout = { .tv_sec = static_cast<time_t>(timeout_ns.count() / 1000000000),
+            .tv_nsec = static_cast<long>(timeout_ns.count() % 1000000000) };
+        struct pollfd pfd = { .fd = master_fd_, .events = POLLIN, .revents = 0 };
+        int result = ppoll(&pfd, 1, &timeout, NULL);
+
+        if ((result > 0) && ((pfd.revents & POLLHUP) != 0)) {
+            // Nobody has the device open. Wait for picod.
+            std::this_thread::sleep_for(std::min<Clock::duration>(timeout_ns,
+                std::chrono::milliseconds(50)));
+            rx_frame_.clear();
+        } else if ((result > 0) && ((pfd.revents & POLLIN) != 0)) {
+            receive(Clock::now());
+        }
+
+        now = Clock::now();
+        const uint64_t now_us = pico_time_us(now);
+
+        // A partial frame is dropped once the line goes idle
+        if (!rx_frame_.empty() && rx_fifo_.empty() &&
+            ((now - last_rx_) >= std::chrono::microseconds(UART_RX_IDLE_TIMEOUT_us))) {
+            if (opts_.verbose) {
+                fmt::println("rx: dropped a partial frame of {} bytes", rx_frame_.size());
+            }
+            rx_frame_.clear();
+            stats_.rx_timeouts++;
+        }
+
+        while (!requests_.empty() && (now >= requests_.front().due) && (now >= busy_until_)) {
+            Request r = requests_.front();
+            requests_.pop_front();
+            dispatch(r);
+            drain_rx_fifo(now);
+        }
+
+        watchdog_task(now_us);
+        fan_ctrl_task(now_us);
+        transmit(now);
+    }
+}
+
+PicoSim::Clock::time_point PicoSim::next_deadline(Clock::time_point now) const {
+    auto deadline = now + std::chrono::milliseconds(100);
+
+    if (!requests_.empty()) {
+        deadline = std::min(deadline, std::max(requests_.front().due, busy_until_));
+    }
+
+    if (!rx_frame_.empty()) {
+        deadline = std::min(deadline, last_rx_ + std::chrono::microseconds(UART_RX_IDLE_TIMEOUT_us));
+    }
+
+    if (!tx_frames_.empty()) {
+        deadline = std::min(deadline, tx_ready_);
+    }
+
+    return deadline;
+}
+
+void PicoSim::receive(Clock::time_point now) {
+    uint8_t buf[256];
+
+    while (true) {
+        ssize_t n = read(master_fd_, buf, sizeof(buf));
+        if (n <= 0) {
+            break;
+        }
+
+        last_rx_ = now;
+
+        for (ssize_t i = 0; i < n; i++) {
+            uint8_t byte = buf[i];
+
+            if (chance(opts_.drop_rate)) {
+                stats_.dropped_bytes++;
+                continue;
+            }
+
+            if (chance(opts_.corrupt_rate)) {
+                byte ^= (1 << std::uniform_int_distribution<int>(0, 7)(rng_));
+                stats_.corrupted_bytes++;
+            }
+
+            // The receive DMA stops once every slot is full, then the UART FIFO overruns
+            if ((requests_.size() >= UART_RX_NUM_SLOTS) && (rx_fifo_.size() >= UART_FIFO_LEN)) {
+                stats_.rx_overruns++;
+                continue;
+            }
+
+            rx_fifo_.push_back(byte);
+        }
+    }
+
+    drain_rx_fifo(now);
+}
+
+void PicoSim::drain_rx_fifo(Clock::time_point now) {
+    while (!rx_fifo_.empty() && (requests_.size() < UART_RX_NUM_SLOTS)) {
+        rx_frame_.push_back(rx_fifo_.front());
+        rx_fifo_.pop_front();
+
+        if (rx_frame_.size() < PICO_PKT_LEN) {
+            continue;
+        }
+
+        Request r;
+        std::copy(rx_frame_.begin(), rx_frame_.end(), r.frame.begin());
+        rx_frame_.clear();
+        r.arrival_us = pico_time_us(now);
+
+        uint32_t delay_us = opts_.latency_us;
+        if (opts_.jitter_us > 0) {
+            delay_us += std::uniform_int_distribution<uint32_t>(0, opts_.jitter_us)(rng_);
+        }
+
+        // Requests are handled in the order they arrived
+        r.due = std::max(now + std::chrono::microseconds(delay_us), last_due_);
+        last_due_ = r.due;
+
+        requests_.push_back(r);
+        stats_.rx_frames++;
+
+        // Any frame counts as a message from the host (uart_dma.c)
+        last_host_message_us_ = r.arrival_us;
+    }
+}
+
+void PicoSim::send(const uint8_t *frame) {
+    Frame f;
+    std::copy(frame, frame + PICO_PKT_LEN, f.begin());
+    tx_frames_.push_back(f);
+}
+
+void PicoSim::transmit(Clock::time_point now) {
+    // 10 bits per byte (8N1)
+    const auto frame_time = (opts_.baud_rate > 0) ?
+        std::chrono::microseconds((PICO_PKT_LEN * 10 * 1000000ULL) / opts_.baud_rate) :
+        std::chrono::microseconds(0);
+
+    while (!tx_frames_.empty()) {
+        if (!tx_sending_) {
+            // Written out once its last byte would have reached the host
+            tx_ready_ = std::max(now, tx_ready_) + frame_time;
+            tx_sending_ = true;
+        }
+
+        if (now < tx_ready_) {
+            break;
+        }
+
+        Frame f = tx_frames_.front();
+        tx_frames_.pop_front();
+
+        uint8_t buf[PICO_PKT_LEN];
+        size_t len = 0;
+
+        for (uint8_t byte : f) {
+            if (chance(opts_.drop_rate)) {
+                stats_.dropped_bytes++;
+                continue;
+            }
+
+            if (chance(opts_.corrupt_rate)) {
+                byte ^= (1 << std::uniform_int_distribution<int>(0, 7)(rng_));
+                stats_.corrupted_bytes++;
+            }
+
+            buf[len++] = byte;
+        }
+
+        if (opts_.verbose) {
+            fmt::println("tx: {:02x}", fmt::join(f, " "));
+        }
+
+        // Lost if picod does not have the device open, as on a real UART
+        if ((len > 0) && (write(master_fd_, buf, len) < 0) && opts_.verbose) {
+            fmt::println("tx: {}", strerror(errno));
+        }
+
+        stats_.tx_frames++;
+        tx_sending_ = false;
+    }
+}
+
+void PicoSim::dispatch(const Request & r) {
+    const size_t num_queued = tx_frames_.size();
+
+    if (opts_.verbose) {
+        fmt::println("rx: {:02x}", fmt::join(r.frame, " "));
+    }
+
+    switch (r.frame[PKT_MAGIC_IDX]) {
+    case PICO_PKT_TEMPERATURE_MAGIC:    pkt_temperature(r);     break;
+    case PICO_PKT_FAN_PWM_MAGIC:        pkt_fan_pwm(r);         break;
+    case PICO_PKT_WATCHDOG_MAGIC:       pkt_watchdog(r);        break;
+    case PICO_PKT_SHUTDOWN_MAGIC:       pkt_shutdown(r);        break;
+    case PICO_PKT_PING_MAGIC:           pkt_ping(r);            break;
+    case PICO_PKT_VERSION_MAGIC:        pkt_version(r);         break;
+    case PICO_PKT_FAN_CTRL_MAGIC:       pkt_fan_ctrl(r);        break;
+    case PICO_PKT_NTC_CAL_MAGIC:        pkt_ntc_cal(r);         break;
+    case PICO_PKT_EVENT_LOG_MAGIC:      pkt_event_log(r);       break;
+    case PICO_PKT_TIME_MAGIC:           pkt_time(r);            break;
+    case PICO_PKT_FLASH_CONFIG_MAGIC:   pkt_flash_config(r);    break;
+    default:
+        // We are out of sync, discard the data and wait for the next packet
+        log_event(PICO_EVENT_OUT_OF_SYNC, r.frame[PKT_MAGIC_IDX]);
+        stats_.out_of_sync++;
+        requests_.clear();
+        rx_fifo_.clear();
+        rx_frame_.clear();
+        busy_until_ = Clock::now() + OUT_OF_SYNC_STALL;
+        last_due_ = busy_until_;
+        break;
+    }
+
+    if (++num_dispatched_ == opts_.drop_response) {
+        if (opts_.verbose) {
+            fmt::println("tx: dropped the response to request {}", num_dispatched_);
+        }
+        stats_.dropped_responses += tx_frames_.size() - num_queued;
+        tx_frames_.resize(num_queued);
+    }
+}
+
+void PicoSim::log_event(uint8_t type, uint16_t data) {
+    pico_event_t e = {
+        .seq = next_event_seq_,
+        .time_ms = static_cast<uint32_t>(pico_time_us() / 1000),
+        .boot = boot_,
+        .type = type,
+        .data = data
+    };
+
+    events_[next_event_seq_ % PICO_EVENT_LOG_LEN] = e;
+    next_event_seq_++;
+}
+
+const PicoSim::Window & PicoSim::get_window() {
+    const uint64_t now_us = pico_time_us();
+    const uint64_t length_us = window_ms_ * 1000ULL;
+
+    if (now_us < (window_origin_us_ + length_us)) {
+        // No window completed since the last configuration
+        return window_;
+    }
+
+    const uint64_t start_us = window_origin_us_ +
+        ((now_us - window_origin_us_) / length_us - 1) * length_us;
+
+    if ((start_us == window_.start_us) && (window_.num_samples > 0)) {
+        return window_;
+    }
+
+    window_.start_us = start_us;
+    window_.end_us = start_us + length_us;
+    window_.num_samples = static_cast<uint32_t>((sample_rate_hz_ * window_ms_) / 1000);
+
+    // Evaluated at fewer points than samples, to stay cheap at high request rates
+    const uint32_t points = std::min(window_.num_samples, WINDOW_POINTS);
+
+    for (int ch = 0; ch < PICO_FAN_CTRL_NUM_SENSORS; ch++) {
+        double sum = 0.0;
+        double lo = 0.0;
+        double hi = 0.0;
+
+        for (uint32_t i = 0; i < points; i++) {
+            const uint64_t t_us = start_us + ((2 * i + 1) * length_us) / (2 * points);
+            const double v = value(static_cast<Channel>(NTC1 + ch), t_us, t_us);
+            sum += v;
+            lo = (i == 0) ? v : std::min(lo, v);
+            hi = (i == 0) ? v : std::max(hi, v);
+        }
+
+        window_.mean_cx100[ch] = static_cast<int32_t>(std::lround(sum * 100.0 / points));
+        window_.min_cx100[ch] = static_cast<int32_t>(std::lround(lo * 100.0));
+        window_.max_cx100[ch] = static_cast<int32_t>(std::lround(hi * 100.0));
+    }
+
+    return window_;
+}
+
+int32_t PicoSim::get_temperature_cx100(int input, uint8_t statistic) {
+    const Window & w = get_window();
+    int32_t t = w.mean_cx100[input];
+
+    if (statistic == PICO_TEMPERATURE_STAT_MIN) {
+        t = w.min_cx100[input];
+    } else if (statistic == PICO_TEMPERATURE_STAT_MAX) {
+        t = w.max_cx100[input];
+    }
+
+    if (input < PICO_NTC_CAL_NUM_SENSORS) {
+        t += ntc_cal_.offset_cx100[input];
+    }
+
+    // Packed as 16-bit
+    return std::clamp<int32_t>(t, INT16_MIN, INT16_MAX);
+}
+
+uint16_t PicoSim::get_fan_rpm(size_t fan) {
+    const uint64_t now_us = pico_time_us();
+    const FanCtrl & c = fan_ctrl_[fan];
+    const double duty = c.active ? (c.applied_duty_x100 / 10000.0) : duty_[fan];
+    const double rpm = value(static_cast<Channel>(FAN1 + fan), now_us, now_us, duty);
+
+    return static_cast<uint16_t>(std::clamp(std::lround(rpm), 0L, static_cast<long>(UINT16_MAX)));
+}
+
+void PicoSim::watchdog_task(uint64_t now_us) {
+    if (now_us < next_watchdog_check_us_) {
+        return;
+    }
+
+    next_watchdog_check_us_ = now_us + CM4_WATCHDOG_CHECK_us;
+
+    if (!watchdog_enabled_) {
+        return;
+    }
+
+    uint64_t timeout_us = watchdog_timeout_sec_ * 1000000ULL;
+    if ((last_host_message_us_ == 0) && (timeout_us < CM4_WATCHDOG_BOOT_TIMEOUT_us)) {
+        // picod has not started since the Pico booted
+        timeout_us = CM4_WATCHDOG_BOOT_TIMEOUT_us;
+    }
+
+    if ((now_us - last_host_message_us_) < timeout_us) {
+        return;
+    }
+
+    // The firmware resets the CM4 and then asks it to shut down. The
+    // shutdown request is not sent here: picod would power off this machine.
+    fmt::println("Watchdog: no message from the host for {} s, the CM4 would be reset",
+        (now_us - last_host_message_us_) / 1000000);
+
+    if (watchdog_max_retries_ > 0) {
+        watchdog_max_retries_--;
+    } else {
+        watchdog_enabled_ = false;
+    }
+
+    log_event(PICO_EVENT_WATCHDOG_RESET, watchdog_max_retries_);
+    // Counts as a restart of picod
+    last_host_message_us_ = now_us;
+}
+
+void PicoSim::fan_ctrl_task(uint64_t now_us) {
+    if (now_us < next_fan_ctrl_step_us_) {
+        return;
+    }
+
+    next_fan_ctrl_step_us_ = now_us + FAN_CTRL_STEP_us;
+
+    int32_t temperature_cx100[PICO_FAN_CTRL_NUM_SENSORS] = {0};
+    uint8_t valid_mask = 0;
+
+    for (int ch = 0; ch < PICO_FAN_CTRL_NUM_SENSORS; ch++) {
+        // An open or shorted NTC reads far outside the valid range
+        int32_t t = get_temperature_cx100(ch, PICO_TEMPERATURE_STAT_MEAN);
+        if ((t >= FAN_CTRL_MIN_VALID_CX100) && (t <= FAN_CTRL_MAX_VALID_CX100)) {
+            temperature_cx100[ch] = t;
+            valid_mask |= (1 << ch);
+        }
+    }
+
+    for (auto & c : fan_ctrl_) {
+        if ((c.cfg.mode != PICO_FAN_CTRL_MODE_HOST) || c.active) {
+            fan_ctrl_step(c, temperature_cx100, valid_mask, now_us);
+        }
+    }
+}
+
+void PicoSim::fan_ctrl_step(FanCtrl & c, const int32_t *temperature_cx100, uint8_t valid_mask,
+    uint64_t now_us) {
+    const pico_pkt_fan_ctrl_t & cfg = c.cfg;
+    const uint16_t host_duty_x100 = static_cast<uint16_t>(duty_[cfg.fan_id - 1] * 10000.0f + 0.5f);
+    bool found = false;
+    int32_t hottest = 0;
+
+    for (int ch = 0; ch < PICO_FAN_CTRL_NUM_SENSORS; ch++) {
+        if ((cfg.sensor_mask & valid_mask & (1 << ch)) == 0) {
+            continue;
+        }
+
+        if (!found || (temperature_cx100[ch] > hottest)) {
+            hottest = temperature_cx100[ch];
+            found = true;
+        }
+    }
+
+    if (found) {
+        // Follow rising temperatures at once, falling ones only
+        // once they drop by more than the hysteresis.
+        const int32_t hysteresis_cx100 = cfg.hysteresis_c * 100;
+        if (!c.have_filtered || (hottest > c.filtered_cx100)) {
+            c.filtered_cx100 = hottest;
+            c.have_filtered = true;
+        } else if (hottest < (c.filtered_cx100 - hysteresis_cx100)) {
+            c.filtered_cx100 = hottest + hysteresis_cx100;
+        }
+
+        c.temperature_cx100 = hottest;
+
+        // Linear interpolation of the curve, as in the firmware
+        const pico_fan_ctrl_point_t *p = cfg.points;
+        int32_t duty_x100 = 0;
+        if (cfg.num_points > 0) {
+            duty_x100 = p[cfg.num_points - 1].duty_pct * 100;
+            if (c.filtered_cx100 <= p[0].temperature_c * 100) {
+                duty_x100 = p[0].duty_pct * 100;
+            } else {
+                for (size_t i = 1; i < cfg.num_points; i++) {
+                    const int32_t t0 = p[i-1].temperature_c * 100;
+                    const int32_t t1 = p[i].temperature_c * 100;
+                    if (c.filtered_cx100 <= t1) {
+                        const int32_t d0 = p[i-1].duty_pct * 100;
+                        const int32_t d1 = p[i].duty_pct * 100;
+                        duty_x100 = (t1 <= t0) ? d1 : (d0 + ((d1 - d0) * (c.filtered_cx100 - t0)) / (t1 - t0));
+                        break;
+                    }
+                }
+            }
+        }
+        c.curve_duty_x100 = static_cast<uint16_t>(duty_x100);
+    } else {
+        // No valid sensor: fail safe
+        c.have_filtered = false;
+        c.curve_duty_x100 = 10000;
+    }
+
+    const uint16_t min_duty_x100 = cfg.min_duty_pct * 100;
+    c.curve_duty_x100 = std::clamp<uint16_t>(c.curve_duty_x100, min_duty_x100, 10000);
+
+    c.active = false;
+    if (cfg.mode == PICO_FAN_CTRL_MODE_AUTO) {
+        c.active = true;
+    } else if ((cfg.mode == PICO_FAN_CTRL_MODE_ADVISORY) && (cfg.host_timeout_sec > 0)) {
+        c.active = ((now_us - last_host_message_us_) >= (cfg.host_timeout_sec * 1000000ULL));
+    }
+
+    // The host can only raise the fan speed
+    c.applied_duty_x100 = c.active ? std::max(host_duty_x100, c.curve_duty_x100) : host_duty_x100;
+}
+
+bool PicoSim::fan_ctrl_configure(const pico_pkt_fan_ctrl_t & p) {
+    if ((p.fan_id < 1) || (p.fan_id > NUM_PWM_FANS) || (p.mode >= PICO_FAN_CTRL_MODE_INVALID) ||
+        (p.min_duty_pct > 100) || (p.sensor_mask >= (1 << PICO_FAN_CTRL_NUM_SENSORS))) {
+        return false;
+    }
+
+    for (size_t i = 0; i < p.num_points; i++) {
+        if ((p.points[i].duty_pct > 100) ||
+            ((i > 0) && (p.points[i].temperature_c < p.points[i-1].temperature_c))) {
+            return false;
+        }
+    }
+
+    FanCtrl & c = fan_ctrl_[p.fan_id - 1];
+    c.cfg = p;
+    c.cfg.write = false;
+    c.have_filtered = false;
+    return true;
+}
+
+bool PicoSim::ntc_cal_configure(const pico_pkt_ntc_cal_t & p) {
+    if ((p.beta != 0) && ((p.beta < NTC_CAL_MIN_BETA) || (p.beta > NTC_CAL_MAX_BETA))) {
+        return false;
+    }
+
+    for (size_t i = 0; i < PICO_NTC_CAL_NUM_SENSORS; i++) {
+        if ((p.offset_cx100[i] < -NTC_CAL_MAX_OFFSET_CX100) ||
+            (p.offset_cx100[i] > NTC_CAL_MAX_OFFSET_CX100)) {
+            return false;
+        }
+    }
+
+    // The waveforms are temperatures already, so the B value only gets reported
+    ntc_cal_.beta = (p.beta == 0) ? NTC_DEFAULT_BETA : p.beta;
+    std::copy(p.offset_cx100, p.offset_cx100 + PICO_NTC_CAL_NUM_SENSORS, ntc_cal_.offset_cx100);
+    return true;
+}
+
+void PicoSim::capture_settings(Saved & s) const {
+    for (auto & pkt : s.pkts) {
+        pkt.fill(0);
+    }
+
+    struct pico_pkt_fan_pwm_t fans[NUM_PWM_FANS];
+    for (size_t i = 0; i < NUM_PWM_FANS; i++) {
+        fans[i].fan_id = i + 1;
+        fans[i].pwm_pct = duty_[i] + (0.5f / FAN_PWM_LSB);
+    }
+    pico_pkt_fan_pwm_req_pack(s.pkts[FLASH_CONFIG_PKT_FAN_PWM].data(), fans, true);
+
+    pico_pkt_watchdog_t w = { .write = true, .enable = watchdog_enabled_, .success = false,
+        .timeout = watchdog_timeout_sec_, .max_retries = watchdog_max_retries_ };
+    pico_pkt_watchdog_req_pack(s.pkts[FLASH_CONFIG_PKT_WATCHDOG].data(), &w);
+
+    for (size_t i = 0; i < NUM_PWM_FANS; i++) {
+        pico_pkt_fan_ctrl_t c = fan_ctrl_[i].cfg;
+        c.write = true;
+        pico_pkt_fan_ctrl_req_pack(s.pkts[FLASH_CONFIG_PKT_FAN_CTRL + i].data(), &c);
+    }
+
+    pico_pkt_ntc_cal_t n = ntc_cal_;
+    n.write = true;
+    pico_pkt_ntc_cal_pack(s.pkts[FLASH_CONFIG_PKT_NTC_CAL].data(), &n, false);
+}
+
+void PicoSim::apply_settings(const Saved & s) {
+    // Same as the write requests they were packed as, without the responses
+    Request r = { .frame = {}, .arrival_us = pico_time_us(), .due = Clock::now() };
+    const size_t num_queued = tx_frames_.size();
+
+    for (auto const& pkt : s.pkts) {
+        if (pkt[PKT_MAGIC_IDX] != PICO_PKT_FLASH_CONFIG_MAGIC) {
+            r.frame = pkt;
+            dispatch(r);
+        }
+    }
+
+    tx_frames_.resize(num_queued);
+}
+
+void PicoSim::load_flash() {
+    if (opts_.flash_path.empty()) {
+        return;
+    }
+
+    std::ifstream f(opts_.flash_path, std::ios::binary);
+    uint32_t header[3] = {0};
+    Saved s = {};
+
+    f.read(reinterpret_cast<char *>(header), sizeof(header));
+    for (auto & pkt : s.pkts) {
+        f.read(reinterpret_cast<char *>(pkt.data()), pkt.size());
+    }
+
+    if (!f || (header[0] != FLASH_FILE_MAGIC)) {
+        return;
+    }
+
+    s.valid = true;
+    s.seq = header[1];
+    s.host_tag = header[2];
+    saved_ = s;
+
+    apply_settings(saved_);
+    loaded_ = true;
+    log_event(PICO_EVENT_CONFIG_LOADED, static_cast<uint16_t>(saved_.seq));
+}
+
+bool PicoSim::store_flash() {
+    if (opts_.flash_path.empty()) {
+        return true;
+    }
+
+    if (!saved_.valid) {
+        return (unlink(opts_.flash_path.c_str()) == 0) || (errno == ENOENT);
+    }
+
+    std::ofstream f(opts_.flash_path, std::ios::binary | std::ios::trunc);
+    const uint32_t header[3] = { FLASH_FILE_MAGIC, saved_.seq, saved_.host_tag };
+
+    f.write(reinterpret_cast<const char *>(header), sizeof(header));
+    for (auto const& pkt : saved_.pkts) {
+        f.write(reinterpret_cast<const char *>(pkt.data()), pkt.size());
+    }
+
+    return static_cast<bool>(f);
+}
+
+void PicoSim::pkt_temperature(const Request & r) {
+    uint8_t resp[PICO_PKT_LEN] = {0};
+    bool success = true;
+    pico_pkt_temperature_req_t req = {};
+    pico_pkt_temperature_u temp_data = {};
+
+    pico_pkt_temperature_req_unpack(r.frame.data(), &req);
+
+    if (req.configure) {
+        const uint32_t rate_hz = std::clamp<uint32_t>(req.sample_rate_hz,
+            ADC_CAPTURE_MIN_RATE_Hz, ADC_CAPTURE_MAX_RATE_Hz);
+        const uint32_t window_ms = std::clamp<uint32_t>(req.window_ms,
+            ADC_CAPTURE_MIN_WINDOW_ms, ADC_CAPTURE_MAX_WINDOW_ms);
+
+        if ((rate_hz != sample_rate_hz_) || (window_ms != window_ms_)) {
+            // Takes effect from the next window
+            sample_rate_hz_ = rate_hz;
+            window_ms_ = window_ms;
+            window_origin_us_ = pico_time_us();
+        }
+    }
+
+    if (req.statistic > PICO_TEMPERATURE_STAT_MAX) {
+        req.statistic = PICO_TEMPERATURE_STAT_MEAN;
+        success = false;
+    }
+
+    for (int ch = 0; ch < PICO_FAN_CTRL_NUM_SENSORS; ch++) {
+        temp_data.data[ch] = get_temperature_cx100(ch, req.statistic) / TEMPERATURE_LSB;
+    }
+
+    temp_data.s.fan1rpm = get_fan_rpm(SYS_FAN1 - 1);
+    temp_data.s.cm4_fan_rpm = get_fan_rpm(::CM4_FAN - 1);
+
+    pico_pkt_temperature_resp_pack(resp, &temp_data, req.statistic, success);
+    send(resp);
+
+    if (req.timestamp) {
+        const Window & w = get_window();
+        pico_pkt_temperature_time_t t = {
+            .start_us = w.start_us,
+            .length_us = static_cast<uint32_t>(w.end_us - w.start_us),
+            .num_samples = w.num_samples
+        };
+
+        pico_pkt_temperature_time_pack(resp, &t, true);
+        send(resp);
+    }
+}
+
+void PicoSim::pkt_fan_pwm(const Request & r) {
+    uint8_t resp[PICO_PKT_LEN] = {0};
+    bool write = false;
+    bool success = false;
+
+    struct pico_pkt_fan_pwm_t fans[NUM_PWM_FANS] = {
+        { .fan_id = INVALID_FAN_ID, .pwm_pct = 0.0f },
+        { .fan_id = INVALID_FAN_ID, .pwm_pct = 0.0f },
+    };
+
+    pico_pkt_fan_pwm_unpack(r.frame.data(), fans, &write, &success);
+    success = false;
+
+    for (size_t i = 0; i < NUM_PWM_FANS; i++) {
+        if (fans[i].fan_id != (i + 1)) {
+            continue;
+        }
+
+        if (write) {
+            duty_[i] = std::clamp(fans[i].pwm_pct, 0.0f, 1.0f);
+        } else {
+            fans[i].pwm_pct = duty_[i];
+        }
+        success = true;
+    }
+
+    pico_pkt_fan_pwm_resp_pack(resp, fans, write, success);
+    send(resp);
+}
+
+void PicoSim::pkt_watchdog(const Request & r) {
+    uint8_t resp[PICO_PKT_LEN] = {0};
+    pico_pkt_watchdog_t s = {};
+
+    pico_pkt_watchdog_unpack(r.frame.data(), &s);
+    s.success = true;
+
+    if (s.write) {
+        watchdog_max_retries_ = s.max_retries;
+        watchdog_timeout_sec_ = s.timeout;
+        watchdog_enabled_ = s.enable;
+    }
+
+    s.enable = watchdog_enabled_;
+    s.max_retries = watchdog_max_retries_;
+    s.timeout = watchdog_timeout_sec_;
+
+    pico_pkt_watchdog_resp_pack(resp, &s);
+    send(resp);
+}
+
+void PicoSim::pkt_shutdown(const Request & r) {
+    // picod confirms a graceful shutdown. The firmware does not answer.
+    fmt::println("The host confirmed a graceful shutdown");
+}
+
+void PicoSim::pkt_ping(const Request & r) {
+    uint8_t resp[PICO_PKT_LEN] = {0};
+
+    std::copy(r.frame.begin() + PICO_PKT_PING_RESV, r.frame.end(), resp + PICO_PKT_PING_RESV);
+    pico_pkt_ping_resp_pack(resp, true);
+    send(resp);
+}
+
+void PicoSim::pkt_version(const Request & r) {
+    uint8_t resp[PICO_PKT_LEN] = {0};
+    bool sop = false;
+    bool eop = false;
+
+    pico_pkt_version_resp_pack(resp, &sop, &eop);
+    send(resp);
+}
+
+void PicoSim::pkt_fan_ctrl(const Request & r) {
+    uint8_t resp[PICO_PKT_LEN] = {0};
+    pico_pkt_fan_ctrl_t s = {};
+
+    pico_pkt_fan_ctrl_unpack(r.frame.data(), &s);
+
+    const bool valid_fan = (s.fan_id >= 1) && (s.fan_id <= NUM_PWM_FANS);
+    s.success = valid_fan;
+
+    if (s.success && s.write) {
+        s.success = fan_ctrl_configure(s);
+    }
+
+    if (valid_fan) {
+        const FanCtrl & c = fan_ctrl_[s.fan_id - 1];
+        const bool write = s.write;
+        const bool status = s.status;
+        const bool success = s.success;
+
+        s = c.cfg;
+        s.write = write;
+        s.status = status;
+        s.success = success;
+        s.active = c.active;
+        s.curve_duty_pct = (c.curve_duty_x100 + 50) / 100;
+        s.applied_duty_pct = c.active ? (c.applied_duty_x100 + 50) / 100 :
+            static_cast<uint8_t>(duty_[s.fan_id - 1] * 100.0f + 0.5f);
+        s.temperature_cx100 = static_cast<int16_t>(c.temperature_cx100);
+    }
+
+    pico_pkt_fan_ctrl_resp_pack(resp, &s);
+    send(resp);
+}
+
+void PicoSim::pkt_ntc_cal(const Request & r) {
+    uint8_t resp[PICO_PKT_LEN] = {0};
+    pico_pkt_ntc_cal_t s = {};
+
+    pico_pkt_ntc_cal_unpack(r.frame.data(), &s);
+    s.success = true;
+
+    if (s.write) {
+        s.success = ntc_cal_configure(s);
+    }
+
+    s.beta = ntc_cal_.beta;
+    std::copy(ntc_cal_.offset_cx100, ntc_cal_.offset_cx100 + PICO_NTC_CAL_NUM_SENSORS,
+        s.offset_cx100);
+
+    pico_pkt_ntc_cal_pack(resp, &s, true);
+    send(resp);
+}
+
+void PicoSim::pkt_event_log(const Request & r) {
+    uint8_t resp[PICO_PKT_LEN] = {0};
+    uint32_t seq = 0;
+    uint8_t max_count = 0;
+
+    pico_pkt_event_log_req_unpack(r.frame.data(), &seq, &max_count);
+
+    max_count = ((max_count == 0) || (max_count > PICO_EVENT_LOG_MAX_BURST)) ?
+        PICO_EVENT_LOG_MAX_BURST : max_count;
+
+    pico_event_log_status_t s = {
+        .next_seq = next_event_seq_,
+        .oldest_seq = (next_event_seq_ > PICO_EVENT_LOG_LEN) ?
+            (next_event_seq_ - PICO_EVENT_LOG_LEN) : 0,
+        .time_ms = 0,
+        .boot = boot_
+    };
+
+    // Overwritten events are skipped. A sequence number from the future
+    // means the log was lost (e.g. power loss), so start over.
+    if ((seq < s.oldest_seq) || (seq > s.next_seq)) {
+        seq = s.oldest_seq;
+    }
+
+    for (uint8_t count = 0; (seq != s.next_seq) && (count < max_count); seq++, count++) {
+        pico_pkt_event_log_entry_pack(resp, &events_[seq % PICO_EVENT_LOG_LEN]);
+        send(resp);
+    }
+
+    s.time_ms = static_cast<uint32_t>(pico_time_us() / 1000);
+    pico_pkt_event_log_end_pack(resp, &s, true);
+    send(resp);
+}
+
+void PicoSim::pkt_time(const Request & r) {
+    uint8_t resp[PICO_PKT_LEN] = {0};
+    pico_pkt_time_t p = {};
+
+    p.pico_time_us = r.arrival_us;
+    p.success = true;
+    // Covers the latency added to the request
+    p.turnaround_us = static_cast<uint32_t>(pico_time_us() - r.arrival_us);
+
+    pico_pkt_time_resp_pack(resp, r.frame.data(), &p);
+    send(resp);
+}
+
+void PicoSim::pkt_flash_config(const Request & r) {
+    uint8_t resp[PICO_PKT_LEN] = {0};
+    pico_pkt_flash_config_t p = {};
+    Saved current = {};
+
+    pico_pkt_flash_config_unpack(r.frame.data(), &p);
+    capture_settings(current);
+
+    switch (p.command) {
+    case PICO_FLASH_CONFIG_CMD_READ:
+        p.success = true;
+        break;
+    case PICO_FLASH_CONFIG_CMD_SAVE:
+        if (!saved_.valid || (current.pkts != saved_.pkts) || (p.host_tag != saved_.host_tag)) {
+            current.valid = true;
+            current.seq = saved_.valid ? (saved_.seq + 1) : 1;
+            current.host_tag = p.host_tag;
+            saved_ = current;
+            log_event(PICO_EVENT_CONFIG_SAVED, static_cast<uint16_t>(saved_.seq));
+            p.success = store_flash();
+        } else {
+            // Spare the flash
+            p.success = true;
+        }
+        break;
+    case PICO_FLASH_CONFIG_CMD_CLEAR:
+        saved_ = {};
+        p.success = store_flash();
+        break;
+    default:
+        p.success = false;
+        break;
+    }
+
+    p.saved = saved_.valid;
+    p.loaded = loaded_;
+    p.modified = saved_.valid && (current.pkts != saved_.pkts);
+    p.host_tag = saved_.valid ? saved_.host_tag : 0;
+    p.seq = saved_.valid ? saved_.seq : 0;
+
+    pico_pkt_flash_config_pack(resp, &p, true);
+    send(resp);
+}
+
+} //@END namespace picod
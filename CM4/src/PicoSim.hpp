@@ -0,0 +1,220 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifndef PICO_SIM_HPP_
+#define PICO_SIM_HPP_
+#include <stdint.h>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <random>
+#include <string>
+#include <vector>
+#include "Waveform.hpp"
+#include "pkt_handler.h"
+#include "pico_pkt_fan_pwm.h"
+#include "pico_pkt_fan_ctrl.h"
+#include "pico_pkt_ntc_cal.h"
+#include "pico_pkt_event_log.h"
+
+namespace picod {
+/// @brief Emulates the Pico firmware on a pseudo terminal, so that picod can
+/// run without a CM4-WRT-A board. Every packet type is answered as the
+/// firmware does. Temperatures and fan speeds follow waveforms, and the
+/// line can be made slow and lossy.
+class PicoSim {
+public:
+    typedef std::array<uint8_t, PICO_PKT_LEN> Frame;
+
+    /// @brief Waveform channels: the NTC sensors, the Pico onboard sensor and the fans
+    enum Channel { NTC1, NTC2, NTC3, NTC4, PICO, FAN1, CM4_FAN, NUM_CHANNELS };
+
+    typedef struct Options {
+        /// @brief Time the Pico takes to handle a request (us)
+        uint32_t latency_us;
+        /// @brief Up to this much is added to the latency at random (us)
+        uint32_t jitter_us;
+        /// @brief Probability of a byte being lost, both ways
+        double drop_rate;
+        /// @brief Probability of a bit of a byte being flipped, both ways
+        double corrupt_rate;
+        /// @brief Drops every response frame to this request, numbered from
+        /// one(1) in the order handled, as if lost on the line. Zero(0)
+        /// drops none.
+        uint64_t drop_response;
+        /// @brief Frames are paced at this rate. Zero(0) sends them at once.
+        uint32_t baud_rate;
+        /// @brief How much faster the Pico clock runs than the host's (ppm)
+        double clock_drift_ppm;
+        uint64_t seed;
+        /// @brief File standing in for the Pico flash. Empty keeps the
+        /// saved settings in memory only.
+        std::string flash_path;
+        /// @brief Print every frame
+        bool verbose;
+    } Options;
+
+    typedef struct Stats {
+        uint64_t rx_frames;
+        uint64_t tx_frames;
+        uint64_t dropped_bytes;
+        uint64_t corrupted_bytes;
+        /// @brief Partial frames dropped once the line went idle
+        uint64_t rx_timeouts;
+        /// @brief Bytes lost while the receive queue was full
+        uint64_t rx_overruns;
+        /// @brief Requests with an unknown magic value
+        uint64_t out_of_sync;
+        /// @brief Response frames dropped by drop_response
+        uint64_t dropped_responses;
+    } Stats;
+
+    explicit PicoSim(const Options & opts);
+    ~PicoSim();
+    PicoSim(PicoSim const&)   = delete;
+    void operator=(PicoSim const&)  = delete;
+
+    /// @brief Opens the pseudo terminal
+    /// @param device_path [out] Path picod should open (pico_serial_device_path)
+    /// @return True(1) on success. False(0) on failure.
+    bool open(std::string & device_path);
+
+    /// @brief Makes a channel follow a waveform from a point in time on
+    /// @param start_s Seconds since the simulation started
+    void set_waveform(Channel channel, double start_s, const Waveform & w);
+
+    /// @brief Looks up a channel by name (ntc1 to ntc4, pico, fan1, cm4_fan)
+    /// @return True(1) if the name is known. False(0) otherwise.
+    static bool get_channel(const std::string & name, Channel & channel);
+
+    /// @brief Serves requests until quit is set
+    void run(const std::atomic<bool> & quit);
+
+    Stats stats() const { return stats_; }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    typedef struct Request {
+        Frame frame;
+        /// @brief Pico time the request finished arriving
+        uint64_t arrival_us;
+        /// @brief When the handler runs
+        Clock::time_point due;
+    } Request;
+
+    typedef struct Window {
+        uint64_t start_us;
+        uint64_t end_us;
+        uint32_t num_samples;
+        int32_t mean_cx100[PICO_FAN_CTRL_NUM_SENSORS];
+        int32_t min_cx100[PICO_FAN_CTRL_NUM_SENSORS];
+        int32_t max_cx100[PICO_FAN_CTRL_NUM_SENSORS];
+    } Window;
+
+    typedef struct FanCtrl {
+        pico_pkt_fan_ctrl_t cfg;
+        int32_t filtered_cx100;
+        bool have_filtered;
+        uint16_t curve_duty_x100;
+        uint16_t applied_duty_x100;
+        int32_t temperature_cx100;
+        bool active;
+    } FanCtrl;
+
+    typedef struct Saved {
+        bool valid;
+        uint32_t seq;
+        uint32_t host_tag;
+        std::array<Frame, NUM_PWM_FANS + 3> pkts;
+    } Saved;
+
+    Options opts_;
+    Stats stats_;
+    int master_fd_;
+    std::mt19937_64 rng_;
+    Clock::time_point start_;
+    std::array<std::vector<std::pair<double, Waveform>>, NUM_CHANNELS> waveforms_;
+
+    // Serial line
+    std::deque<uint8_t> rx_fifo_;
+    std::vector<uint8_t> rx_frame_;
+    Clock::time_point last_rx_;
+    std::deque<Request> requests_;
+    /// @brief Number of requests handled
+    uint64_t num_dispatched_;
+    Clock::time_point last_due_;
+    Clock::time_point busy_until_;
+    std::deque<Frame> tx_frames_;
+    /// @brief When the line is free, or the frame being sent is through
+    Clock::time_point tx_ready_;
+    bool tx_sending_;
+
+    // Firmware state
+    float duty_[NUM_PWM_FANS];
+    bool watchdog_enabled_;
+    uint16_t watchdog_timeout_sec_;
+    uint16_t watchdog_max_retries_;
+    uint64_t last_host_message_us_;
+    uint64_t next_watchdog_check_us_;
+    FanCtrl fan_ctrl_[NUM_PWM_FANS];
+    uint64_t next_fan_ctrl_step_us_;
+    pico_pkt_ntc_cal_t ntc_cal_;
+    uint32_t sample_rate_hz_;
+    uint32_t window_ms_;
+    uint64_t window_origin_us_;
+    Window window_;
+    std::vector<pico_event_t> events_;
+    uint32_t next_event_seq_;
+    uint16_t boot_;
+    Saved saved_;
+    bool loaded_;
+
+    uint64_t pico_time_us(Clock::time_point t) const;
+    uint64_t pico_time_us() const { return pico_time_us(Clock::now()); }
+    double value(Channel channel, uint64_t t_us, uint64_t noise_key, double duty = 0.0) const;
+
+    // Line emulation
+    bool chance(double probability);
+    void receive(Clock::time_point now);
+    void drain_rx_fifo(Clock::time_point now);
+    void transmit(Clock::time_point now);
+    void send(const uint8_t *frame);
+    Clock::time_point next_deadline(Clock::time_point now) const;
+
+    // Firmware emulation
+    void dispatch(const Request & r);
+    void log_event(uint8_t type, uint16_t data);
+    const Window & get_window();
+    int32_t get_temperature_cx100(int input, uint8_t statistic);
+    uint16_t get_fan_rpm(size_t fan);
+    void watchdog_task(uint64_t now_us);
+    void fan_ctrl_task(uint64_t now_us);
+    void fan_ctrl_step(FanCtrl & c, const int32_t *temperature_cx100, uint8_t valid_mask,
+        uint64_t now_us);
+    bool fan_ctrl_configure(const pico_pkt_fan_ctrl_t & p);
+    bool ntc_cal_configure(const pico_pkt_ntc_cal_t & p);
+    void capture_settings(Saved & s) const;
+    void apply_settings(const Saved & s);
+    void load_flash();
+    bool store_flash();
+
+    void pkt_temperature(const Request & r);
+    void pkt_fan_pwm(const Request & r);
+    void pkt_watchdog(const Request & r);
+    void pkt_shutdown(const Request & r);
+    void pkt_ping(const Request & r);
+    void pkt_version(const Request & r);
+    void pkt_fan_ctrl(const Request & r);
+    void pkt_ntc_cal(const Request & r);
+    void pkt_event_log(const Request & r);
+    void pkt_time(const Request & r);
+    void pkt_flash_config(const Request & r);
+};
+
+} //@END namespace picod
+
+#endif //@END PICO_SIM_HPP_
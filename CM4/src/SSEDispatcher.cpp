@@ -4,6 +4,7 @@
  * SPDX-License-Identifier: MIT
  */
 #include "SSEDispatcher.hpp"
+#include "Trace.hpp"
 
 using namespace httplib;
 using namespace std;
@@ -23,6 +24,7 @@ void SSEDispatcher::wait_event(httplib::DataSink *sink){
     int id = id_;
     if (cv_.wait_for(lk, std::chrono::milliseconds(1), [&] { return cid_ == id; })) {
         if (!stopEvent_.isSet()) {
+            TRACE_SCOPE("sse/write");
             sink->write(message_.data(), message_.size());
         }
     } 
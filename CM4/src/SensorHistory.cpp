@@ -0,0 +1,169 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#include "SensorHistory.hpp"
+#include "settings.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+namespace picod {
+
+SensorHistory& SensorHistory::instance() {
+    static SensorHistory theInstance;
+    return theInstance;
+}
+
+int64_t SensorHistory::now_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+size_t SensorHistory::capacity() {
+    // One sample per poll for sensor_history_in_seconds
+    auto n = std::ceil(appSettings.sensor_history_in_seconds /
+        appSettings.temperature_poll_interval_seconds);
+    return (n < 1.0) ? 1 : static_cast<size_t>(n);
+}
+
+void SensorHistory::addTemperature(const std::string & sensorId, float value,
+    int64_t timestamp_ms) {
+    add(sensorId, TEMPERATURE, value, timestamp_ms);
+}
+
+void SensorHistory::addTachometer(const std::string & sensorId, float value,
+    int64_t timestamp_ms) {
+    add(sensorId, TACHOMETER, value, timestamp_ms);
+}
+
+void SensorHistory::add(const std::string & sensorId, Kind kind, float value,
+    int64_t timestamp_ms) {
+    std::lock_guard<std::mutex> lk(m_);
+
+    auto search = rings_.find(sensorId);
+    if (search == rings_.end()) {
+        Ring ring = { .kind = kind, .samples = {}, .head = 0, .count = 0 };
+        ring.samples.resize(capacity());
+        search = rings_.emplace(sensorId, std::move(ring)).first;
+    }
+
+    Ring &ring = search->second;
+    ring.samples[ring.head] = Sample { 
+        .timestamp_ms = (timestamp_ms != 0) ? timestamp_ms : now_ms(), .value = value };
+    ring.head = (ring.head + 1) % ring.samples.size();
+    ring.count = std::min(ring.count + 1, ring.samples.size());
+}
+
+std::vector<std::string> SensorHistory::sensors(Kind kind) const {
+    std::lock_guard<std::mutex> lk(m_);
+    std::vector<std::string> names;
+
+    for (auto const& [name, ring] : rings_) {
+        if (ring.kind == kind) {
+            names.push_back(name);
+        }
+    }
+
+    return names;
+}
+
+bool SensorHistory::kind(const std::string & sensorId, Kind & kind) const {
+    std::lock_guard<std::mutex> lk(m_);
+
+    if (auto search = rings_.find(sensorId); search != rings_.end()) {
+        kind = search->second.kind;
+        return true;
+    }
+
+    return false;
+}
+
+std::vector<SensorHistory::Sample> SensorHistory::select(const Ring & ring,
+    int64_t from_ms, int64_t to_ms) const {
+    std::vector<Sample> out;
+    const size_t size = ring.samples.size();
+    const size_t oldest = (ring.head + size - ring.count) % size;
+
+    out.reserve(ring.count);
+    for (size_t i = 0; i < ring.count; i++) {
+        const Sample &s = ring.samples[(oldest + i) % size];
+        if ((s.timestamp_ms >= from_ms) && (s.timestamp_ms <= to_ms)) {
+            out.push_back(s);
+        }
+    }
+
+    return out;
+}
+
+std::vector<SensorHistory::Sample> SensorHistory::series(const std::string & sensorId,
+    int64_t from_ms, int64_t to_ms, size_t max_points) const {
+    std::vector<Sample> samples;
+    {
+        std::lock_guard<std::mutex> lk(m_);
+        if (auto search = rings_.find(sensorId); search != rings_.end()) {
+            samples = select(search->second, from_ms, to_ms);
+        }
+    }
+
+    if ((max_points == 0) || (samples.size() <= max_points)) {
+        return samples;
+    }
+
+    // Average groups of consecutive samples
+    std::vector<Sample> out;
+    const size_t group = (samples.size() + max_points - 1) / max_points;
+    out.reserve(max_points);
+
+    for (size_t i = 0; i < samples.size(); i += group) {
+        const size_t end = std::min(i + group, samples.size());
+        double value = 0.0;
+        double timestamp = 0.0;
+
+        for (size_t j = i; j < end; j++) {
+            value += samples[j].value;
+            timestamp += samples[j].timestamp_ms;
+        }
+
+        const double n = static_cast<double>(end - i);
+        out.push_back(Sample { .timestamp_ms = static_cast<int64_t>(timestamp/n),
+            .value = static_cast<float>(value/n) });
+    }
+
+    return out;
+}
+
+bool SensorHistory::stats(const std::string & sensorId, int64_t from_ms, int64_t to_ms,
+    Stats & out) const {
+    std::vector<Sample> samples = series(sensorId, from_ms, to_ms);
+
+    if (samples.empty()) {
+        return false;
+    }
+
+    std::vector<float> values;
+    double sum = 0.0;
+    values.reserve(samples.size());
+
+    for (auto const& s : samples) {
+        values.push_back(s.value);
+        sum += s.value;
+    }
+
+    std::sort(values.begin(), values.end());
+
+    // Nearest-rank percentile
+    size_t rank = static_cast<size_t>(std::ceil(0.95 * values.size()));
+    rank = (rank < 1) ? 1 : rank;
+
+    out.count = values.size();
+    out.min = values.front();
+    out.max = values.back();
+    out.mean = static_cast<float>(sum / values.size());
+    out.p95 = values[rank - 1];
+
+    return true;
+}
+
+} //@END namespace picod
@@ -0,0 +1,103 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifndef SENSOR_HISTORY_HPP_
+#define SENSOR_HISTORY_HPP_
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+
+namespace picod {
+/// @brief Keeps a fixed length history of every temperature and
+/// tachometer sensor reading.
+class SensorHistory {
+public:
+    enum Kind {
+        TEMPERATURE,
+        TACHOMETER
+    };
+
+    typedef struct Sample {
+        /// @brief Milliseconds since the Unix epoch
+        int64_t timestamp_ms;
+        float value;
+    } Sample;
+
+    typedef struct Stats {
+        size_t count;
+        float min;
+        float max;
+        float mean;
+        /// @brief 95th percentile
+        float p95;
+    } Stats;
+
+    static SensorHistory& instance();
+    SensorHistory(SensorHistory const&)   = delete;
+    void operator=(SensorHistory const&)  = delete;
+
+    /// @brief Records a temperature sensor reading
+    /// @param sensorId Sensor ID (name)
+    /// @param value Temperature (°C)
+    /// @param timestamp_ms When it was sampled, in milliseconds since the 
+    /// Unix epoch. Zero(0) for now.
+    void addTemperature(const std::string & sensorId, float value, int64_t timestamp_ms = 0);
+
+    /// @brief Records a tachometer sensor reading
+    /// @param sensorId Sensor ID (name)
+    /// @param value Revolutions Per Minute (RPM)
+    /// @param timestamp_ms As for addTemperature()
+    void addTachometer(const std::string & sensorId, float value, int64_t timestamp_ms = 0);
+
+    /// @brief Returns the IDs of all sensors of the given kind.
+    std::vector<std::string> sensors(Kind kind) const;
+
+    /// @brief Looks up the kind of a sensor.
+    /// @return True(1) if the sensor has any history. False(0) otherwise.
+    bool kind(const std::string & sensorId, Kind & kind) const;
+
+    /// @brief Returns the samples taken in [from_ms, to_ms], oldest first.
+    /// When there are more than max_points samples, consecutive samples
+    /// are averaged together so that at most max_points are returned.
+    /// @param max_points Zero(0) returns every sample.
+    std::vector<Sample> series(const std::string & sensorId,
+        int64_t from_ms, int64_t to_ms, size_t max_points = 0) const;
+
+    /// @brief Computes min/max/mean/p95 over the samples taken in [from_ms, to_ms].
+    /// @return True(1) if there was at least one sample. False(0) otherwise.
+    bool stats(const std::string & sensorId, int64_t from_ms, int64_t to_ms,
+        Stats & out) const;
+
+    /// @brief Current time in milliseconds since the Unix epoch
+    static int64_t now_ms();
+
+private:
+    /// @brief Fixed capacity ring of samples
+    typedef struct Ring {
+        Kind kind;
+        std::vector<Sample> samples;
+        size_t head;
+        size_t count;
+    } Ring;
+
+    mutable std::mutex m_;
+    std::map<std::string, Ring> rings_;
+
+    SensorHistory() = default;
+    void add(const std::string & sensorId, Kind kind, float value, int64_t timestamp_ms);
+
+    /// @brief Number of samples kept per sensor
+    static size_t capacity();
+
+    /// @brief Copies the samples taken in [from_ms, to_ms], oldest first.
+    /// Must be called with m_ held.
+    std::vector<Sample> select(const Ring & ring, int64_t from_ms, int64_t to_ms) const;
+};
+
+} //@END namespace picod
+
+#endif //@END SENSOR_HISTORY_HPP_
@@ -5,7 +5,11 @@
  */
 
 #include "TMP103_I2C.hpp"
+#include <sys/ioctl.h>
+#include <array>
 #include "Utils.hpp"
+#include "Trace.hpp"
+#include "Latency.hpp"
 
 namespace picod {
 
@@ -43,36 +47,18 @@ numDevices_(0)
         return;
     }
     
-    device_.bus = fd_;
-    device_.addr = tmp_i2c_info[1].address;
-    device_.tenbit = 0;
-    device_.delay = 10;
-    device_.flags = 0;
-    device_.page_bytes = 8;
-    device_.iaddr_bytes = 0;
-    
-    // Detect the number of devices (zones) present
+    // Detect the number of devices (zones) present. Absent devices
+    // do not acknowledge their address, so try each one only once.
     numDevices_ = 0;
 
     for (size_t i = 0; i < MAX_NUM_DEVICES_; i++) {
-        device_.addr = tmp_i2c_info[i].address;
-
         uint8_t data = 0;
-        ssize_t ret = i2c_ioctl_write(&device_, 0x0, &data, 1);
-        if ( (ret == -1) || ((size_t)ret != 1) ) {
-            //print_err("Write failed on i2c bus: %s, %s\n",
-            //    devicePath_.c_str(), strerror(errno));
-            continue;
-        }
-        
-        ret = i2c_ioctl_read(&device_, 0x0, &data, 1);
-        if ( (ret == -1) || ((size_t)ret != 1) ) {
-            //print_err("Read failed on i2c bus: %s, %s\n",
-            //    devicePath_.c_str(), strerror(errno));
+        if (!readRegister(&i, 1, TEMPERATURE_REGISTER_RO, &data, 1)) {
             continue;
         }
 
         tmp_i2c_info[i].present = true;
+        presentDevices_.push_back(i);
         numDevices_++;
     }//@END for (size_t i = 0; i < MAX_NUM_DEVICES; i++)
 
@@ -93,43 +79,42 @@ size_t TMP103_I2C::getNumDevices(){
 }
 
 void TMP103_I2C::dumpDeviceRegisters(){
-    
-    for (size_t i = 0; i < MAX_NUM_DEVICES_; i++) {
-        device_.addr = tmp_i2c_info[i].address;
-       
-       if (!tmp_i2c_info[i].present) {
-            continue;
-       }
-       
-       printf("%s, I2C address: 0x%02X\n", devicePath_.c_str(), tmp_i2c_info[i].address);
-       
-       for (size_t i = 0; i < NUM_REGISTERS_; i++) {
-            uint8_t data = tmp103_reg_map[i].address;
-            ssize_t ret = i2c_ioctl_write(&device_, 0x0, &data, 1);
-            if ( (ret == -1) || ((size_t)ret != 1) ) {
-                print_err("Write failed on i2c bus: %s, %s\n",
-                    devicePath_.c_str(), strerror(errno));
-                continue;
-            }
-            
-            data = 0;
-            ret = i2c_ioctl_read(&device_, 0x0, &data, 1);
-            if ( (ret == -1) || ((size_t)ret != 1) ) {
-                print_err("Read failed on i2c bus: %s, %s\n",
-                    devicePath_.c_str(), strerror(errno));
+    std::array<std::array<uint8_t, ARRAY_SIZE(tmp_i2c_info)>, ARRAY_SIZE(tmp103_reg_map)> data = {};
+    std::array<bool, ARRAY_SIZE(tmp103_reg_map)> valid = {};
+
+    if (presentDevices_.empty()) {
+        return;
+    }
+
+    // One transaction per register, covering every device
+    for (size_t r = 0; r < NUM_REGISTERS_; r++) {
+        valid[r] = readRegister(presentDevices_.data(), presentDevices_.size(),
+            tmp103_reg_map[r].address, data[r].data());
+        if (!valid[r]) {
+            print_err("Read failed on i2c bus: %s, %s\n",
+                devicePath_.c_str(), strerror(errno));
+        }
+    }
+
+    for (size_t d = 0; d < presentDevices_.size(); d++) {
+        const size_t idx = presentDevices_[d];
+        printf("%s, I2C address: 0x%02X\n", devicePath_.c_str(), tmp_i2c_info[idx].address);
+
+        for (size_t i = 0; i < NUM_REGISTERS_; i++) {
+            if (!valid[i]) {
                 continue;
             }
 
             if (i != 1) {
                 printf("\t%s, PTR: 0x%02X, Data: 0x%02X (%d °C)\n", 
                     tmp103_reg_map[i].name, tmp103_reg_map[i].address, 
-                        data, decodeTemperature(data));
+                        data[i][d], decodeTemperature(data[i][d]));
             } else {
                 printf("\t%s, PTR: 0x%02X, Data: 0x%02X\n", 
-                    tmp103_reg_map[i].name, tmp103_reg_map[i].address, data);
-            }            
-       }        
-    }//@END for (size_t i = 0; i < MAX_NUM_DEVICES; i++)
+                    tmp103_reg_map[i].name, tmp103_reg_map[i].address, data[i][d]);
+            }
+        }
+    }//@END for (size_t d = 0; d < presentDevices_.size(); d++)
 }//#END dumpDeviceRegisters()
 
 inline int TMP103_I2C::decodeTemperature(uint8_t dataIn){
@@ -145,7 +130,38 @@ inline int TMP103_I2C::decodeTemperature(uint8_t dataIn){
     return retVal;
 }
 
+bool TMP103_I2C::readRegister(const size_t * devices, size_t count, uint8_t reg,
+    uint8_t * data, int attempts) {
+    // Two messages per device: the pointer write, then the read. The bus
+    // is not released in between (repeated start), nor between devices.
+    std::array<struct i2c_msg, 2 * ARRAY_SIZE(tmp_i2c_info)> msgs;
+    uint8_t pointer = reg;
+
+    if ((count == 0) || (count > MAX_NUM_DEVICES_)) {
+        errno = EINVAL;
+        return false;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        const uint16_t addr = tmp_i2c_info[devices[i] % MAX_NUM_DEVICES_].address;
+        data[i] = 0;
+        msgs[2 * i] = { .addr = addr, .flags = 0, .len = 1, .buf = &pointer };
+        msgs[2 * i + 1] = { .addr = addr, .flags = I2C_M_RD, .len = 1, .buf = &data[i] };
+    }
+
+    struct i2c_rdwr_ioctl_data ioctl_data = { .msgs = msgs.data(), .nmsgs = (uint32_t)(2 * count) };
+
+    for (int attempt = 0; attempt < attempts; attempt++) {
+        if (ioctl(fd_, I2C_RDWR, &ioctl_data) == (int)ioctl_data.nmsgs) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
 int TMP103_I2C::getTemperature(size_t deviceIndex){
+    TRACE_SCOPE("i2c/tmp103_get_temperature");
     int retVal = -273;
     // Sanitize the input
     size_t idx = deviceIndex % MAX_NUM_DEVICES_;
@@ -154,24 +170,46 @@ int TMP103_I2C::getTemperature(size_t deviceIndex){
         return retVal;
     }
 
-    device_.addr = tmp_i2c_info[idx].address;
+    const auto start = std::chrono::steady_clock::now();
 
-    uint8_t data = tmp103_reg_map[TEMPERATURE_REGISTER_RO].address;
-    ssize_t ret = i2c_ioctl_write(&device_, 0x0, &data, 1);
-    if ( (ret == -1) || ((size_t)ret != 1) ) {
-        print_err("Write failed on i2c bus: %s, %s\n",
+    uint8_t data = 0;
+    if (!readRegister(&idx, 1, TEMPERATURE_REGISTER_RO, &data)) {
+        print_err("Read failed on i2c bus: %s, %s\n",
             devicePath_.c_str(), strerror(errno));
+    } else {
+        retVal = decodeTemperature(data);
     }
 
-    data = 0;
-    ret = i2c_ioctl_read(&device_, 0x0, &data, 1);
-    if ( (ret == -1) || ((size_t)ret != 1) ) {
+    Latency::instance().i2c_read().record(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start).count());
+
+    return retVal;
+}
+
+std::vector<int> TMP103_I2C::getTemperatures(){
+    TRACE_SCOPE("i2c/tmp103_get_temperatures");
+    std::vector<int> retVal(MAX_NUM_DEVICES_, -273);
+
+    if (presentDevices_.empty()) {
+        return retVal;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+
+    std::array<uint8_t, ARRAY_SIZE(tmp_i2c_info)> data = {};
+    if (!readRegister(presentDevices_.data(), presentDevices_.size(),
+            TEMPERATURE_REGISTER_RO, data.data())) {
         print_err("Read failed on i2c bus: %s, %s\n",
-            devicePath_.c_str(), strerror(errno));                
+            devicePath_.c_str(), strerror(errno));
     } else {
-        retVal = decodeTemperature(data);
+        for (size_t i = 0; i < presentDevices_.size(); i++) {
+            retVal[presentDevices_[i]] = decodeTemperature(data[i]);
+        }
     }
 
+    Latency::instance().i2c_read().record(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start).count());
+
     return retVal;
 }
 
@@ -8,6 +8,7 @@
 #define TMP103_I2C_H
 #include "syshead.h"
 #include <string>
+#include <vector>
 #include "i2c.h"
 #include "Utils.hpp"
 
@@ -65,7 +66,16 @@ public:
     /// @param deviceIndex Zero based index of device (zone)
     /// @return Temperature in degrees C
     int getTemperature(size_t deviceIndex = 0);
+
+    /// @brief Reads the temperature of every detected device in a
+    /// single I2C transaction
+    /// @return Temperature in degrees C of each zone, indexed like
+    /// getTemperature(). -273 for zones not detected or not read.
+    std::vector<int> getTemperatures();
 private:
+    /// @brief Attempts at an I2C transaction before giving up on it
+    static const int MAX_ATTEMPTS_ = 3;
+
     /// @brief The TMP103 is available in eight versions
     // Ref: TMP103 datasheet SBOS545B
     const size_t MAX_NUM_DEVICES_;
@@ -76,9 +86,6 @@ private:
     /// @brief Device path of i2c bus, such as /dev/i2c-1 
     std::string devicePath_;
     
-    /// @brief Device connection info
-    I2CDevice device_;
-
     /// @brief File descriptor
     int fd_;
     
@@ -88,12 +95,27 @@ private:
     /// @brief Number of devices detected
     size_t numDevices_;
 
+    /// @brief Zero based indexes of the devices detected
+    std::vector<size_t> presentDevices_;
+
     TMP103_I2C(std::string devicePath);
     
     /// @brief Decodes the temperature value from the TMP103
     /// @param dataIn Raw temperature value from the device
     /// @return Temperature in degrees C
     inline int decodeTemperature(uint8_t dataIn);
+
+    /// @brief Reads one register of several devices in one I2C_RDWR
+    /// transaction: for each device, a pointer write followed by a
+    /// repeated start and a one byte read.
+    /// @param devices Zero based indexes of the devices to read
+    /// @param count Number of devices, at most MAX_NUM_DEVICES_
+    /// @param reg Pointer address of the register
+    /// @param data Receives one byte per device, in the order of devices
+    /// @param attempts Number of times to try the transaction
+    /// @return True(1) on success. False(0) on failure.
+    bool readRegister(const size_t * devices, size_t count, uint8_t reg,
+        uint8_t * data, int attempts = MAX_ATTEMPTS_);
 };
 
 } //@END namespace picod
@@ -0,0 +1,163 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#include "Trace.hpp"
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <csignal>
+#include <fstream>
+#include <thread>
+#include "fmt/core.h"
+
+namespace picod {
+
+// Written by the signal handler to wake up the thread writing the trace
+static int signal_fd = -1;
+
+typedef struct SpanCopy {
+    const char * name;
+    int64_t start_ns;
+    int64_t end_ns;
+} SpanCopy;
+
+Trace::Trace()
+{
+}
+
+Trace& Trace::instance() {
+    static Trace theInstance;
+    return theInstance;
+}
+
+Trace::Buffer & Trace::thread_buffer() {
+    static thread_local Buffer * thread_buffer_ = nullptr;
+
+    if (thread_buffer_ == nullptr) {
+        auto buffer = std::make_shared<Buffer>();
+        buffer->tid = (int)syscall(SYS_gettid);
+        buffer->head = 0;
+
+        char name[16] = {0};
+        if (pthread_getname_np(pthread_self(), name, sizeof(name)) == 0) {
+            buffer->thread_name = name;
+        }
+
+        std::lock_guard<std::mutex> lk(m_);
+        buffers_.push_back(buffer);
+        thread_buffer_ = buffer.get();
+    }
+
+    return *thread_buffer_;
+}
+
+void Trace::record(const char * name, int64_t start_ns, int64_t end_ns) {
+    Buffer & b = thread_buffer();
+    const uint64_t head = b.head.load(std::memory_order_relaxed);
+    Span & s = b.spans[head % TRACE_SPANS_PER_THREAD];
+
+    // A reader that sees this span also sees the head that preceded it
+    std::atomic_thread_fence(std::memory_order_release);
+    s.name.store(name, std::memory_order_relaxed);
+    s.start_ns.store(start_ns, std::memory_order_relaxed);
+    s.end_ns.store(end_ns, std::memory_order_relaxed);
+    b.head.store(head + 1, std::memory_order_release);
+}
+
+std::string Trace::to_json() {
+    std::vector<std::shared_ptr<Buffer>> buffers;
+    {
+        std::lock_guard<std::mutex> lk(m_);
+        buffers = buffers_;
+    }
+
+    const int pid = (int)getpid();
+    std::string out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+
+    for (auto const& b : buffers) {
+        out += fmt::format("{}{{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":{},\"tid\":{},"
+            "\"args\":{{\"name\":\"{} {}\"}}}}", first ? "" : ",", pid, b->tid, b->thread_name, b->tid);
+        first = false;
+
+        const uint64_t head = b->head.load(std::memory_order_acquire);
+        const uint64_t oldest = (head > TRACE_SPANS_PER_THREAD) ? (head - TRACE_SPANS_PER_THREAD) : 0;
+        std::vector<std::pair<uint64_t, SpanCopy>> spans;
+
+        for (uint64_t i = oldest; i < head; i++) {
+            const Span & s = b->spans[i % TRACE_SPANS_PER_THREAD];
+            spans.push_back({i, SpanCopy {
+                .name = s.name.load(std::memory_order_relaxed),
+                .start_ns = s.start_ns.load(std::memory_order_relaxed),
+                .end_ns = s.end_ns.load(std::memory_order_relaxed) }});
+        }
+
+        // The owning thread kept recording while the spans were copied: drop
+        // those it may have overwritten, including the one it may be writing
+        std::atomic_thread_fence(std::memory_order_acquire);
+        const uint64_t head_after = b->head.load(std::memory_order_acquire);
+        const uint64_t valid = (head_after + 1 > TRACE_SPANS_PER_THREAD) ?
+            (head_after + 1 - TRACE_SPANS_PER_THREAD) : 0;
+
+        for (auto const& [index, s] : spans) {
+            if (index < valid) {
+                continue;
+            }
+
+            out += fmt::format(",{{\"name\":\"{}\",\"ph\":\"X\",\"ts\":{:.3f},\"dur\":{:.3f},"
+                "\"pid\":{},\"tid\":{}}}", s.name, s.start_ns / 1000.0,
+                (s.end_ns - s.start_ns) / 1000.0, pid, b->tid);
+        }
+    }
+
+    out += "]}";
+    return out;
+}
+
+bool Trace::write(const std::string & path) {
+    std::ofstream file(path, std::ios::trunc);
+    if (!file) {
+        fmt::println(stderr, "Failed to write the trace to {}: {}", path, strerror(errno));
+        return false;
+    }
+
+    file << to_json();
+    file.close();
+    fmt::println("Trace written to {}", path);
+    return true;
+}
+
+void Trace::on_signal(int signum) {
+    const int saved_errno = errno;
+    const uint8_t b = 1;
+    if (::write(signal_fd, &b, 1) < 0) {
+        // Nothing can be done about it in a signal handler
+    }
+    errno = saved_errno;
+}
+
+bool Trace::write_on_signal(int signum, const std::string & path) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        fmt::println(stderr, "Failed to create the trace signal pipe: {}", strerror(errno));
+        return false;
+    }
+
+    signal_fd = fds[1];
+
+    std::thread([this, path, fd = fds[0]]() {
+        uint8_t b;
+        while (read(fd, &b, 1) > 0) {
+            write(path);
+        }
+    }).detach();
+
+    std::signal(signum, on_signal);
+    return true;
+}
+
+} //@END namespace picod
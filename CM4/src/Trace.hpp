@@ -0,0 +1,123 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifndef TRACE_HPP_
+#define TRACE_HPP_
+#include <stdint.h>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#ifdef PICOD_TRACE
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+/// @brief Records the rest of the enclosing scope as a span.
+/// @param name A string literal, e.g. "pico/send_temperature_request"
+#define TRACE_SCOPE(name) picod::TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#else
+#define TRACE_SCOPE(name) do {} while (0)
+#endif
+
+namespace picod {
+/// @brief Collects the spans recorded by TRACE_SCOPE, to see where the time
+/// of a poll cycle or an HTTP request went, and writes them as Chrome trace
+/// JSON (load it in https://ui.perfetto.dev or chrome://tracing).
+///
+/// Spans are only recorded when picod is built with -DPICOD_TRACE=ON;
+/// otherwise TRACE_SCOPE compiles to nothing. Each thread records into its
+/// own ring of the latest TRACE_SPANS_PER_THREAD spans, without locking:
+/// the writer publishes each span by advancing the ring's head, and the
+/// reader drops the spans that may have been overwritten while it copied.
+class Trace {
+public:
+    /// @brief Spans kept per thread. Older spans are overwritten.
+    static const size_t TRACE_SPANS_PER_THREAD = 8192;
+
+    static Trace& instance();
+    Trace(Trace const&)   = delete;
+    void operator=(Trace const&)  = delete;
+
+    /// @brief Records a span of the calling thread.
+    /// @param name A string literal, which must outlive the trace
+    void record(const char * name, int64_t start_ns, int64_t end_ns);
+
+    /// @brief The spans recorded so far, as Chrome trace JSON
+    std::string to_json();
+
+    /// @brief Writes the spans recorded so far to a file.
+    /// @return True(1) on success. False(0) on failure.
+    bool write(const std::string & path);
+
+    /// @brief Writes the trace to path whenever the process receives signum
+    /// (e.g. kill -USR1 $(pidof picod)). The file is written by a thread of
+    /// its own; the signal handler only wakes it up.
+    /// @return True(1) on success. False(0) on failure.
+    bool write_on_signal(int signum, const std::string & path);
+
+    /// @brief Steady (monotonic) clock, in ns
+    static int64_t now_ns() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+private:
+    /// @brief Every field is written by the owning thread and read by
+    /// to_json(), so they are atomics; relaxed ones cost no more than plain
+    /// stores.
+    typedef struct Span {
+        std::atomic<const char *> name;
+        std::atomic<int64_t> start_ns;
+        std::atomic<int64_t> end_ns;
+    } Span;
+
+    typedef struct Buffer {
+        /// @brief Kernel thread id
+        int tid;
+        std::string thread_name;
+        /// @brief Number of spans ever recorded; the next one goes to
+        /// spans[head % TRACE_SPANS_PER_THREAD]
+        std::atomic<uint64_t> head;
+        std::array<Span, TRACE_SPANS_PER_THREAD> spans;
+    } Buffer;
+
+    std::mutex m_;
+    /// @brief Buffers of every thread that recorded a span. They are kept
+    /// after the thread exits, so its spans are still written.
+    std::vector<std::shared_ptr<Buffer>> buffers_;
+
+    Trace();
+    /// @brief The calling thread's buffer, created on first use
+    Buffer & thread_buffer();
+    static void on_signal(int signum);
+};
+
+/// @brief Records its lifetime as a span. Use it through TRACE_SCOPE.
+class TraceScope {
+public:
+    explicit TraceScope(const char * name)
+    :name_{name}
+    ,start_ns_{Trace::now_ns()}
+    {
+    }
+
+    ~TraceScope() {
+        Trace::instance().record(name_, start_ns_, Trace::now_ns());
+    }
+
+    TraceScope(TraceScope const&)   = delete;
+    void operator=(TraceScope const&)  = delete;
+
+private:
+    const char * name_;
+    int64_t start_ns_;
+};
+
+} //@END namespace picod
+
+#endif //@END TRACE_HPP_
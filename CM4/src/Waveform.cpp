@@ -0,0 +1,179 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#include "Waveform.hpp"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <sstream>
+
+namespace picod {
+
+uint64_t Waveform::seed_ = 0;
+
+typedef struct ShapeInfo {
+    const char * name;
+    Waveform::Shape shape;
+    size_t min_params;
+    size_t max_params;
+} ShapeInfo;
+
+static const ShapeInfo SHAPES[] = {
+    { "const",    Waveform::Shape::Constant, 1, 1 },
+    { "sine",     Waveform::Shape::Sine,     3, 4 },
+    { "square",   Waveform::Shape::Square,   3, 4 },
+    { "ramp",     Waveform::Shape::Ramp,     3, 3 },
+    { "triangle", Waveform::Shape::Triangle, 3, 3 },
+    { "duty",     Waveform::Shape::Duty,     1, 2 },
+};
+
+/// @brief Splits "name:p1,p2,..." into the name and its parameters
+static std::string parse_term(const std::string & term, std::vector<double> & params) {
+    const size_t colon = term.find(':');
+    std::string name = term.substr(0, colon);
+    params.clear();
+
+    if (colon == std::string::npos) {
+        return name;
+    }
+
+    std::stringstream ss(term.substr(colon + 1));
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        size_t end = 0;
+        params.push_back(std::stod(item, &end));
+        if (end != item.size()) {
+            throw std::invalid_argument("not a number: " + item);
+        }
+    }
+
+    return name;
+}
+
+Waveform::Waveform()
+:shape_{Shape::Constant}
+,params_{0.0}
+,noise_sd_{0.0}
+,spec_{"const:0"}
+{
+}
+
+Waveform Waveform::parse(const std::string & spec) {
+    Waveform w;
+    w.spec_ = spec;
+
+    std::stringstream ss(spec);
+    std::string term;
+    std::vector<double> params;
+    bool have_shape = false;
+
+    while (std::getline(ss, term, '+')) {
+        const std::string name = parse_term(term, params);
+
+        if (have_shape) {
+            if ((name != "noise") || (params.size() != 1) || (params[0] < 0.0)) {
+                throw std::invalid_argument("expected noise:<sd> after '+' in " + spec);
+            }
+            w.noise_sd_ = params[0];
+            continue;
+        }
+
+        const ShapeInfo * info = nullptr;
+        for (auto const& s : SHAPES) {
+            if (name == s.name) {
+                info = &s;
+                break;
+            }
+        }
+
+        if (info == nullptr) {
+            throw std::invalid_argument("unknown waveform: " + name);
+        }
+
+        if ((params.size() < info->min_params) || (params.size() > info->max_params)) {
+            throw std::invalid_argument("wrong number of parameters in " + spec);
+        }
+
+        if ((info->shape != Shape::Constant) && (info->shape != Shape::Duty) && (params[2] <= 0.0)) {
+            throw std::invalid_argument("the period must be positive in " + spec);
+        }
+
+        w.shape_ = info->shape;
+        w.params_ = params;
+        have_shape = true;
+    }
+
+    if (!have_shape) {
+        throw std::invalid_argument("empty waveform");
+    }
+
+    return w;
+}
+
+void Waveform::set_seed(uint64_t seed) {
+    seed_ = seed;
+}
+
+double Waveform::gaussian(uint64_t key) {
+    // SplitMix64, so that a sample gets the same noise however often it is read
+    auto mix = [](uint64_t z) {
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    };
+
+    const uint64_t a = mix(seed_ + 0x9e3779b97f4a7c15ULL * (2 * key + 1));
+    const uint64_t b = mix(a + 0x9e3779b97f4a7c15ULL);
+    const double u1 = (static_cast<double>(a >> 11) + 1.0) / 9007199254740993.0;
+    const double u2 = static_cast<double>(b >> 11) / 9007199254740992.0;
+
+    // Box-Muller
+    return std::sqrt(-2.0 * std::log(u1)) * std::cos(2.0 * M_PI * u2);
+}
+
+double Waveform::value(double t_s, uint64_t noise_key, double duty) const {
+    const auto & p = params_;
+    double v = 0.0;
+
+    // Position in the period [0.0 to 1.0)
+    auto phase = [&](double offset_s) {
+        double x = std::fmod((t_s + offset_s) / p[2], 1.0);
+        return (x < 0.0) ? (x + 1.0) : x;
+    };
+
+    switch (shape_) {
+    case Shape::Constant:
+        v = p[0];
+        break;
+    case Shape::Sine:
+        v = p[0] + p[1] * std::sin(2.0 * M_PI * phase((p.size() > 3) ? p[3] : 0.0));
+        break;
+    case Shape::Square:
+        v = (phase(0.0) < ((p.size() > 3) ? p[3] : 0.5)) ? p[1] : p[0];
+        break;
+    case Shape::Ramp:
+        v = p[0] + (p[1] - p[0]) * phase(0.0);
+        break;
+    case Shape::Triangle: {
+        double x = phase(0.0);
+        x = (x < 0.5) ? (2.0 * x) : (2.0 - 2.0 * x);
+        v = p[0] + (p[1] - p[0]) * x;
+        break;
+    }
+    case Shape::Duty: {
+        const double stall = ((p.size() > 1) ? p[1] : 0.0) / 100.0;
+        v = ((duty <= 0.0) || (duty < stall)) ? 0.0 : (p[0] * std::min(duty, 1.0));
+        break;
+    }
+    }
+
+    if (noise_sd_ > 0.0) {
+        v += noise_sd_ * gaussian(noise_key);
+    }
+
+    return v;
+}
+
+} //@END namespace picod
@@ -0,0 +1,58 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifndef WAVEFORM_HPP_
+#define WAVEFORM_HPP_
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace picod {
+/// @brief A signal of time, used by pico-sim for the temperatures and fan
+/// speeds it reports. Parsed from "<shape>:<param>,...[+noise:<sd>]":
+///
+///   const:<value>
+///   sine:<mean>,<amplitude>,<period_s>[,<phase_s>]
+///   square:<low>,<high>,<period_s>[,<duty 0-1>]
+///   ramp:<from>,<to>,<period_s>       (sawtooth)
+///   triangle:<from>,<to>,<period_s>
+///   duty:<max_rpm>[,<stall_pct>]      (fans only: follows the PWM duty cycle)
+///
+/// Noise is Gaussian, and the same for the same seed and sample.
+class Waveform {
+public:
+    enum class Shape { Constant, Sine, Square, Ramp, Triangle, Duty };
+
+    Waveform();
+
+    /// @brief Parses a waveform spec.
+    /// @throws std::invalid_argument if the spec is malformed
+    static Waveform parse(const std::string & spec);
+
+    /// @brief Value of the waveform
+    /// @param t_s Seconds since the simulation started
+    /// @param noise_key Picks the noise sample, e.g. channel and sample number
+    /// @param duty PWM duty cycle [0.0 to 1.0], for the duty shape
+    double value(double t_s, uint64_t noise_key, double duty = 0.0) const;
+
+    /// @brief Seeds the noise of every waveform
+    static void set_seed(uint64_t seed);
+
+    const std::string & spec() const { return spec_; }
+
+private:
+    Shape shape_;
+    std::vector<double> params_;
+    double noise_sd_;
+    std::string spec_;
+    static uint64_t seed_;
+
+    /// @brief Standard normal sample picked by the key
+    static double gaussian(uint64_t key);
+};
+
+} //@END namespace picod
+
+#endif //@END WAVEFORM_HPP_
@@ -20,6 +20,14 @@
 #include "version.h"
 #include "TMP103_I2C.hpp"
 #include "InfluxDB.hpp"
+#include "SensorHistory.hpp"
+#include "FanController.hpp"
+#include "FanCalibration.hpp"
+#include "PicoEventLog.hpp"
+#include "PicoClock.hpp"
+#include "pico_pkt_time.h"
+#include "Trace.hpp"
+#include "Latency.hpp"
 
 //#include "DataStore.hpp"
 
@@ -49,6 +57,8 @@ namespace picod
 
 WebServer::WebServer()
 :sequence_number_{0}
+,has_temperature_max_{false}
+,temperature_max_{}
 {
 }
 
@@ -75,14 +85,22 @@ void WebServer::stop(){
 }
 
 void WebServer::update(nlohmann::json message){
+    TRACE_SCOPE("sse/update");
     if (!svr_.is_running()) {
         return;
     }
 
-    message["seq"] = sequence_number_++;
+    // Lets subscribers measure how long the event took to reach them
+    message["sent_us"] = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    appState_.send_event(to_event(message, sequence_number_++));
+}
+
+std::string WebServer::to_event(nlohmann::json & message, size_t seq){
+    message["seq"] = seq;
     std::stringstream ss;
     ss << "data: " << message.dump() << "\n\n";
-    appState_.send_event(ss.str());
+    return ss.str();
 }
 
 void WebServer::start(std::string webRoot){
@@ -114,6 +132,7 @@ void WebServer::start(std::string webRoot){
     });
 
     svr_.Get("/stream", [&](const Request & /*req*/, Response &res) {
+        TRACE_SCOPE("http/GET /stream");
     
         //std::cout << "/stream: SSE stream opened" << std::endl;
 
@@ -128,6 +147,7 @@ void WebServer::start(std::string webRoot){
     });
     
     svr_.Get("/", [&](const Request& req, Response& res) {        
+        TRACE_SCOPE("http/GET /");
         json j;
         j["__version__"] = VERSION_STR;
 
@@ -150,29 +170,59 @@ void WebServer::start(std::string webRoot){
     });
     
     svr_.Post("/quit/now", [&](const Request& req, Response& res) {
+        TRACE_SCOPE("http/POST /quit/now");
         res.set_content("bye", "text/plain");
         svr_.stop();
         getQuitEvent().set();
     });
 
     svr_.Post("/api/start", [&](const Request& req, Response& res) {
+        TRACE_SCOPE("http/POST /api/start");
         appState_.resume();
         SET_CONTENT_SUCCESS
     });
 
     svr_.Post("/api/stop", [&](const Request& req, Response& res) {
+        TRACE_SCOPE("http/POST /api/stop");
         //std::cout << "/api/stop" << std::endl;
         appState_.pause();
         SET_CONTENT_SUCCESS
     });
 
     svr_.Get("/api/status", [&](const Request& req, Response& res) {
+        TRACE_SCOPE("http/GET /api/status");
         //std::cout << "/api/status" << std::endl;
         auto status = get_pico_status();
         res.set_content(status.dump(), "application/json");
     });
 
+    svr_.Get("/api/fan_calibration", [&](const Request& req, Response& res) {
+        TRACE_SCOPE("http/GET /api/fan_calibration");
+        res.set_content(get_fan_calibration().dump(), "application/json");
+    });
+
+    svr_.Get("/api/pico_events", [&](const Request& req, Response& res) {
+        TRACE_SCOPE("http/GET /api/pico_events");
+        res.set_content(get_pico_events().dump(), "application/json");
+    });
+
+    svr_.Post("/api/fan_calibration/:name", [&](const Request& req, Response& res) {
+        TRACE_SCOPE("http/POST /api/fan_calibration/:name");
+        auto name = req.path_params.at("name");
+        std::string error;
+
+        if (!picod::FanCalibration::instance().start(name, error)) {
+            json o;
+            o["error"] = error;
+            res.set_content(o.dump(), "application/json");
+            return;
+        }
+
+        SET_CONTENT_SUCCESS
+    });
+
     svr_.Post("/api/settings/:name", [&](const Request& req, Response& res) {
+        TRACE_SCOPE("http/POST /api/settings/:name");
         auto name = req.path_params.at("name");
 
         auto constexpr is_valid_setting_name = [](auto const & aName) {
@@ -242,6 +292,10 @@ void WebServer::start(std::string webRoot){
 
                 if (send_fan_pwm_request(rw_flag, fanInfo)) {                        
                     result[fan_name] = static_cast<uint32_t>(fanInfo[0].pwm_pct*100);
+                    if (rw_flag) {
+                        picod::FanController::instance().confirm(fanInfo);
+                    }
+                    picod::FanCalibration::instance().record_pwm(fanInfo);
                 } else {
                     SET_CONTENT_PICO_CONNECTION_ERROR
                     return;
@@ -314,43 +368,91 @@ void WebServer::start(std::string webRoot){
         }     
     });
 
-    /*svr.set_logger([](const Request &req, const Response &res) {
-        printf("%s", log(req, res).c_str());
-    });*/
+#ifdef PICOD_TRACE
+    svr_.Get("/api/trace", [&](const Request& req, Response& res) {
+        res.set_content(picod::Trace::instance().to_json(), "application/json");
+    });
+#endif
+
+    // Latency per route, from the request line being read to the response
+    // being written. /stream responses last as long as their subscriber.
+    svr_.set_logger([](const Request &req, const Response &res) {
+        if (req.matched_route == "/stream") {
+            return;
+        }
+
+        std::string route = req.matched_route;
+        if (route.empty()) {
+            route = (req.path.rfind("/static/", 0) == 0) ? "/static" : "other";
+        }
+
+        picod::Latency::instance().http(req.method + " " + route).record(
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - req.start_time_).count());
+    });
 
     fmt::println("Serving at http://{}:{}/", appSettings.http_host, appSettings.http_port);
     svr_.listen(appSettings.http_host , appSettings.http_port);        
 }
 
 nlohmann::json WebServer::get_pico_status() {
+    return build_pico_status(read_pico_status());
+}
+
+WebServer::PicoReadings WebServer::read_pico_status() {
+    TRACE_SCOPE("status/read_pico_status");
     bool rw_flag = false; // Read(0)/Write(1) flag
-    json status;    
+    PicoReadings r = {};
     
-    std::vector<struct pico_pkt_fan_pwm_t> fanInfo;
-    fanInfo.emplace_back(pico_pkt_fan_pwm_t { 
+    r.fanInfo.emplace_back(pico_pkt_fan_pwm_t { 
         .fan_id = SYS_FAN1, .pwm_pct = 0.0f });
-    fanInfo.emplace_back(pico_pkt_fan_pwm_t { 
+    r.fanInfo.emplace_back(pico_pkt_fan_pwm_t { 
         .fan_id = CM4_FAN, .pwm_pct = 0.0f });
 
-    if (send_fan_pwm_request(rw_flag, fanInfo)) {
+    r.has_fan_pwm = send_fan_pwm_request(rw_flag, r.fanInfo);
+    if (r.has_fan_pwm) {
+        picod::FanCalibration::instance().record_pwm(r.fanInfo);
+    }
+
+    r.watchdog.write = rw_flag; 
+    r.has_watchdog = send_watchdog_request(r.watchdog);
+
+    r.has_temperature = send_temperature_request(r.temperature);
+    if (r.has_temperature && appSettings.enable_tmp103_sensor &&
+        (picod::SensorId::NUM_SENSOR_IDs == appSettings.sensorIds.size())) {
+        r.tmp103_c = picod::TMP103_I2C::instance().getTemperature();
+    }
+
+    {
+        std::lock_guard<std::mutex> lk(temperature_max_m_);
+        r.has_temperature_max = has_temperature_max_;
+        r.temperature_max = temperature_max_;
+    }
+
+    return r;
+}
+
+nlohmann::json WebServer::build_pico_status(const PicoReadings & r) {
+    TRACE_SCOPE("status/build_pico_status");
+    json status;    
+
+    if (r.has_fan_pwm) {
         json j;
-        j[appSettings.sensorIds[picod::System_FAN_J17]] = fanInfo[SYS_FAN1-1].pwm_pct*100.0;
-        j[appSettings.sensorIds[picod::CM4_FAN_J18]]    = fanInfo[CM4_FAN-1].pwm_pct*100.0;
+        j[appSettings.sensorIds[picod::System_FAN_J17]] = r.fanInfo[SYS_FAN1-1].pwm_pct*100.0;
+        j[appSettings.sensorIds[picod::CM4_FAN_J18]]    = r.fanInfo[CM4_FAN-1].pwm_pct*100.0;
         status["fan_pwm_pct"] = j;
     }
 
-    pico_pkt_watchdog_t s = {0};
-    s.write = rw_flag; 
-    if (send_watchdog_request(s)) {
+    if (r.has_watchdog) {
         json j;
-        j["is_enabled"] = s.enable;
-        j["timeout_sec"] = s.timeout;
-        j["max_retries"] = s.max_retries;
+        j["is_enabled"] = r.watchdog.enable;
+        j["timeout_sec"] = r.watchdog.timeout;
+        j["max_retries"] = r.watchdog.max_retries;
         status["watchdog"] = j;
     }
 
-    pico_pkt_temperature_u t = {0};
-    if (send_temperature_request(t)) {
+    if (r.has_temperature) {
+        auto &t = r.temperature;
         json j, j2;
         if (appSettings.sensorIds.size() > NUM_NTC_SENSORS) {
             for (int ch=0; ch < NUM_NTC_SENSORS; ch++) {
@@ -362,8 +464,7 @@ nlohmann::json WebServer::get_pico_status() {
             j[appSettings.sensorIds[picod::RPi_Pico]] = t.s.pico;
 
             if (appSettings.enable_tmp103_sensor) { 
-                auto retVal = picod::TMP103_I2C::instance().getTemperature();
-                j[appSettings.sensorIds[picod::Under_CM4_SOC]] = retVal;
+                j[appSettings.sensorIds[picod::Under_CM4_SOC]] = r.tmp103_c;
             }
 
             j2[appSettings.sensorIds[picod::System_FAN_J17]] = t.s.fan1rpm;
@@ -374,74 +475,206 @@ nlohmann::json WebServer::get_pico_status() {
         status["tachometer_rpm"] = j2;
     }
 
+    if (r.has_temperature_max) {
+        auto &t = r.temperature_max;
+        json j;
+        if (appSettings.sensorIds.size() > NUM_NTC_SENSORS) {
+            for (int ch=0; ch < NUM_NTC_SENSORS; ch++) {
+                j[appSettings.sensorIds[ch]] = t.data[ch];
+            }
+        }
+
+        if (picod::SensorId::NUM_SENSOR_IDs == appSettings.sensorIds.size()) {
+            j[appSettings.sensorIds[picod::RPi_Pico]] = t.s.pico;
+        }
+
+        status["temperature_max_c"] = j;
+    }
+
+    if (picod::FanController::instance().is_enabled()) {
+        json j;
+        for (auto const& fan : picod::FanController::instance().state()) {
+            j[fan.fan_name]["duty_pct"] = fan.duty*100.0;
+            j[fan.fan_name]["target_pct"] = fan.target*100.0;
+            j[fan.fan_name]["sensor"] = fan.sensor_name;
+            j[fan.fan_name]["temperature_c"] = fan.temperature_c;
+        }
+        status["fan_control"] = j;
+    }
+
+    status["fan_health"] = get_fan_health();
+
+    auto clock = picod::PicoClock::instance().status();
+    status["pico_clock"] = { {"synced", clock.synced}, {"offset_us", clock.offset_us},
+        {"drift_ppm", clock.drift_ppm}, {"delay_us", clock.delay_us},
+        {"num_exchanges", clock.num_exchanges} };
+
+    status["latency_us"] = picod::Latency::instance().to_json();
+
     return status;
 }
 
-void WebServer::saveTemperatureSensorReading(const std::string & name, 
-    const  float & value){
-    if (auto search = tempDict_.find(name); search != tempDict_.end()) {
-        if (search->second->size() == appSettings.sensor_history_in_seconds){
-            search->second->pop_front();
-        }                    
-        search->second->push_back(value);
-    } else {
-        auto item = std::pair{name, std::make_shared<std::deque<float>>()};
-        tempDict_.insert(item);
-        item.second->push_back(value);
+nlohmann::json WebServer::get_fan_health() {
+    json j = json::object();
+
+    for (auto const& fan : picod::FanCalibration::instance().health()) {
+        j[fan.fan_name]["health"] = picod::FanCalibration::to_string(fan.health);
+        j[fan.fan_name]["rpm"] = fan.rpm;
+        j[fan.fan_name]["expected_rpm"] = fan.expected_rpm;
     }
-    
+
+    return j;
+}
+
+nlohmann::json WebServer::get_fan_calibration() {
+    auto &calibration = picod::FanCalibration::instance();
+    json j;
+
+    j["results"] = json::object();
+    for (auto const& result : calibration.results()) {
+        json r;
+        r["timestamp_ms"] = result.timestamp_ms;
+        r["min_start_duty_pct"] = result.min_start_duty*100.0;
+        r["min_stop_duty_pct"] = result.min_stop_duty*100.0;
+        r["curve"] = json::array();
+        for (auto const& p : result.curve) {
+            r["curve"].push_back({ {"duty_pct", p.duty*100.0}, {"rpm", p.rpm} });
+        }
+        j["results"][result.fan_name] = r;
+    }
+
+    auto progress = calibration.progress();
+    j["progress"]["running"] = progress.running;
+    if (progress.running) {
+        j["progress"]["fan_name"] = progress.fan_name;
+        j["progress"]["phase"] = progress.phase;
+        j["progress"]["duty_pct"] = progress.duty*100.0;
+    }
+
+    j["health"] = get_fan_health();
+
+    j["events"] = json::array();
+    for (auto const& e : calibration.events()) {
+        j["events"].push_back({ {"timestamp_ms", e.timestamp_ms}, {"fan_name", e.fan_name},
+            {"event", e.event}, {"rpm", e.rpm}, {"expected_rpm", e.expected_rpm} });
+    }
+
+    return j;
 }
 
-void WebServer::saveFanRpmSensorReading(const std::string & name, 
-    const uint32_t & value){
-    if (auto search = rpmDict_.find(name); search != rpmDict_.end()) {
-        if (search->second->size() == appSettings.sensor_history_in_seconds){
-            search->second->pop_front();
-        }                    
-        search->second->push_back(value);
-    } else {
-        auto item = std::pair{name, std::make_shared<std::deque<uint32_t>>()};
-        rpmDict_.insert(item);
-        item.second->push_back(value);
+nlohmann::json WebServer::get_pico_events() {
+    json j = json::array();
+
+    for (auto const& e : picod::PicoEventLog::instance().events()) {
+        j.push_back({ {"seq", e.seq}, {"boot", e.boot}, {"timestamp_ms", e.timestamp_ms},
+            {"pico_time_ms", e.pico_time_ms}, {"event", e.event}, {"data", e.data} });
+    }
+
+    return j;
+}
+
+nlohmann::json WebServer::build_history_event() {
+    TRACE_SCOPE("sse/build_history_event");
+    auto &history = picod::SensorHistory::instance();
+    const int64_t now = picod::SensorHistory::now_ms();
+    json j;
+    j["temperature_c"] = json::object();
+    j["tachometer_rpm"] = json::object();
+    j["timestamp_sec"] = json::array();
+
+    // All sensors are sampled together, so any of them will do
+    for (auto const& s : history.series(appSettings.sensorIds[picod::RPi_Pico], 0, now)) {
+        j["timestamp_sec"].push_back(s.timestamp_ms / 1000);
+    }
+
+    for (auto const& key : history.sensors(picod::SensorHistory::TEMPERATURE)) {
+        j["temperature_c"][key] = json::array();
+        for (auto const& s : history.series(key, 0, now)) {
+            j["temperature_c"][key].push_back(s.value);
+        }
     }
+
+    for (auto const& key : history.sensors(picod::SensorHistory::TACHOMETER)) {
+        j["tachometer_rpm"][key] = json::array();
+        for (auto const& s : history.series(key, 0, now)) {
+            j["tachometer_rpm"][key].push_back(static_cast<uint32_t>(s.value));
+        }
+    }
+                
+    j["fan_health"] = get_fan_health();
+
+    return j;
 }
 
 void WebServer::pico_monitor() {
     pico_pkt_temperature_u t = {0};
+    pico_pkt_temperature_time_t time = {0};
+    auto &history = picod::SensorHistory::instance();
+    auto &latency = picod::Latency::instance();
+    const std::chrono::milliseconds interval(
+        static_cast<int64_t>(appSettings.temperature_poll_interval_seconds*1000.0));
+    // Each cycle waits a full interval after the previous one ended
+    auto deadline = std::chrono::steady_clock::now() + interval;
 
-    while (!getQuitEvent().wait(std::chrono::milliseconds(
-        static_cast<int64_t>(appSettings.temperature_poll_interval_seconds*1000.0)))) {
+    while (!getQuitEvent().wait(interval)) {
 
-        if (!send_temperature_request(t)) {
+        TRACE_SCOPE("monitor/cycle");
+        latency.start_poll(std::chrono::steady_clock::now(), deadline);
+
+        if (picod::PicoEventLog::instance().is_poll_due()) {
+            picod::PicoEventLog::instance().poll();
+        }
+
+        if (picod::PicoClock::instance().is_sync_due()) {
+            send_time_request();
+        }
+
+        if (!send_temperature_request(t, PICO_TEMPERATURE_STAT_MEAN, &time)) {
+            latency.end_poll(std::chrono::steady_clock::now());
+            deadline = std::chrono::steady_clock::now() + interval;
             continue;
         }
+
+        if (appSettings.enable_web_interface) {
+            // Hottest reading of each sensor during the Pico's last sampling window
+            pico_pkt_temperature_u t_max = {0};
+            const bool has_t_max = send_temperature_request(t_max, PICO_TEMPERATURE_STAT_MAX);
+
+            std::lock_guard<std::mutex> lk(temperature_max_m_);
+            has_temperature_max_ = has_t_max;
+            temperature_max_ = t_max;
+        }
+
+        // When the Pico sampled the readings, zero(0) if unknown
+        const int64_t sampled_ms = get_temperature_timestamp_ms(time);
         
         if (appSettings.sensorIds.size() > NUM_NTC_SENSORS) {
             for (int ch=0; ch < NUM_NTC_SENSORS; ch++) {
-                saveTemperatureSensorReading(appSettings.sensorIds[ch], t.data[ch]);
+                history.addTemperature(appSettings.sensorIds[ch], t.data[ch], sampled_ms);
                 
                 if (appSettings.enable_influx_db) {
                     picod::InfluxDB::instance().addTemperature(
-                        appSettings.sensorIds[ch], t.data[ch]);
+                        appSettings.sensorIds[ch], t.data[ch], sampled_ms);
                 }
             }
         }
 
         if (picod::SensorId::NUM_SENSOR_IDs == appSettings.sensorIds.size()) {
-            saveTemperatureSensorReading(appSettings.sensorIds[picod::RPi_Pico], t.s.pico);
+            history.addTemperature(appSettings.sensorIds[picod::RPi_Pico], t.s.pico, sampled_ms);
             
             if (appSettings.enable_influx_db) {
                 picod::InfluxDB::instance().addTemperature(
-                    appSettings.sensorIds[picod::RPi_Pico], t.s.pico);
+                    appSettings.sensorIds[picod::RPi_Pico], t.s.pico, sampled_ms);
 
                 picod::InfluxDB::instance().addTachometer(
-                    appSettings.sensorIds[picod::System_FAN_J17], t.s.fan1rpm);
+                    appSettings.sensorIds[picod::System_FAN_J17], t.s.fan1rpm, sampled_ms);
             }
 
+            float retVal = 0.0f;
             if (appSettings.enable_tmp103_sensor) {
-                float retVal = picod::TMP103_I2C::instance().getTemperature();
+                retVal = picod::TMP103_I2C::instance().getTemperature();
 
-                saveTemperatureSensorReading(appSettings.sensorIds[picod::Under_CM4_SOC], retVal);
+                history.addTemperature(appSettings.sensorIds[picod::Under_CM4_SOC], retVal);
 
                 if (appSettings.enable_influx_db) {
                     picod::InfluxDB::instance().addTemperature(
@@ -449,40 +682,36 @@ void WebServer::pico_monitor() {
                 }
             }
 
-            saveFanRpmSensorReading(appSettings.sensorIds[picod::System_FAN_J17], t.s.fan1rpm);
-            saveFanRpmSensorReading(appSettings.sensorIds[picod::CM4_FAN_J18], t.s.cm4_fan_rpm);
-            
-            const auto p1 = std::chrono::system_clock::now();
-            auto t = std::chrono::duration_cast<std::chrono::seconds>(
-                   p1.time_since_epoch()).count();
-            
-            if (timeStamps_.size() == appSettings.sensor_history_in_seconds) {
-                timeStamps_.pop_front();
-            }
+            history.addTachometer(appSettings.sensorIds[picod::System_FAN_J17], t.s.fan1rpm, sampled_ms);
+            history.addTachometer(appSettings.sensorIds[picod::CM4_FAN_J18], t.s.cm4_fan_rpm, sampled_ms);
 
-            timeStamps_.push_back(t);
+            auto fanInfo = picod::FanController::instance().update(t, retVal);
+            auto calibrationInfo = picod::FanCalibration::instance().update(t);
+            fanInfo.insert(fanInfo.end(), calibrationInfo.begin(), calibrationInfo.end());
+            if (!fanInfo.empty() && send_fan_pwm_request(true, fanInfo)) {
+                picod::FanController::instance().confirm(fanInfo);
+                picod::FanCalibration::instance().record_pwm(fanInfo);
+            }
 
             if (appSettings.enable_web_interface) {
-                json j;
-                j["temperature_c"] = json::object();
-                j["tachometer_rpm"] = json::object();
-                j["timestamp_sec"] = timeStamps_;
-
-                for (auto const& [key, val] : tempDict_){
-                    j["temperature_c"][key] = *val.get();
-                }
-
-                for (auto const& [key, val] : rpmDict_){
-                    j["tachometer_rpm"][key] = *val.get();
-                }
-                            
+                TRACE_SCOPE("monitor/web_update");
+                auto j = build_history_event();
                 WebServer::instance().update(j);
             }
 
             if (appSettings.enable_influx_db) {
+                if (latency.is_report_due()) {
+                    for (auto const& e : latency.take_interval_summaries()) {
+                        picod::InfluxDB::instance().addLatency(e.group, e.name, e.summary);
+                    }
+                }
+
                 picod::InfluxDB::instance().publish();
             }
         }
+
+        latency.end_poll(std::chrono::steady_clock::now());
+        deadline = std::chrono::steady_clock::now() + interval;
     }
 }
 
@@ -505,16 +734,20 @@ std::string to_string(const nlohmann::json& j)
 }
 
 void WebServer::get_template(std::ostream & content, std::string name, nlohmann::json & vars, bool show_navbar){
-    NL::Template::LoaderMemory loader;    
-    NL::Template::Template layout( loader );
-
     fs::path filePath(webRootDir_ / "templates" / (name + ".html"));
     if (!fs::is_regular_file(filePath)) {
         fmt::println("Error, file not found: {}", filePath.string());
         return;
     }       
         
-    loader.add( "base", read_file(filePath.string()) );    
+    render_template(content, read_file(filePath.string()), vars);
+}
+
+void WebServer::render_template(std::ostream & content, const std::string & source, nlohmann::json & vars){
+    NL::Template::LoaderMemory loader;    
+    NL::Template::Template layout( loader );
+
+    loader.add( "base", source );    
     layout.load( "base" );
 
     Block & contentBlock = layout.block( "content" );
@@ -11,6 +11,11 @@
 #include "json.hpp"
 #include <map>
 #include <deque>
+#include <vector>
+#include <mutex>
+#include "pico_pkt_fan_pwm.h"
+#include "pico_pkt_temperature.h"
+#include "pico_pkt_watchdog.h"
 
 namespace picod {
     extern std::string picoVersion;
@@ -19,6 +24,21 @@ namespace picod {
 class WebServer
 {
 public:    
+    /// @brief Readings from the Pico (and TMP103) that make up the status.
+    /// A reading whose request failed is left out of the status.
+    typedef struct PicoReadings {
+        bool has_fan_pwm;
+        std::vector<struct pico_pkt_fan_pwm_t> fanInfo;
+        bool has_watchdog;
+        pico_pkt_watchdog_t watchdog;
+        bool has_temperature;
+        pico_pkt_temperature_u temperature;
+        /// @brief TMP103 temperature (°C), if enabled
+        float tmp103_c;
+        bool has_temperature_max;
+        pico_pkt_temperature_u temperature_max;
+    } PicoReadings;
+
     static WebServer & instance();
     ~WebServer();
     WebServer(WebServer const&) = delete;
@@ -29,23 +49,44 @@ public:
     void update(nlohmann::json message);
     void pico_monitor();
     nlohmann::json get_pico_status();
+    /// @brief Requests the readings of the status from the Pico
+    PicoReadings read_pico_status();
+    /// @brief Builds the /api/status JSON from the Pico readings, the fan
+    /// controller, fan health and the Pico clock
+    static nlohmann::json build_pico_status(const PicoReadings & readings);
+    /// @brief Builds the SSE update sent to the web interface, from the
+    /// sensor history and fan health
+    static nlohmann::json build_history_event();
+    /// @brief Serializes an SSE event message
+    /// @param message Event data, to which the sequence number is added
+    /// @param seq Sequence number
+    /// @return The "data: ..." event, ready to send
+    static std::string to_event(nlohmann::json & message, size_t seq);
+    /// @brief Renders an HTML template with the given variables.
+    /// @param content Rendered output.
+    /// @param source Template source.
+    /// @param vars JSON object containing template variables.
+    static void render_template(std::ostream & content, const std::string & source, nlohmann::json & vars);
+    /// @brief Returns fan calibration results, progress, health and events.
+    nlohmann::json get_fan_calibration();
+    /// @brief Returns the events read from the Pico event log.
+    nlohmann::json get_pico_events();
 
 private:
     httplib::Server svr_;
     SSEDispatcher appState_;
     size_t sequence_number_;
     std::filesystem::path webRootDir_;
-    /// @brief Stores temperature history
-    std::map<std::string, std::shared_ptr<std::deque<float>>> tempDict_;
-    /// @brief Stores FAN RPM history
-    std::map<std::string, std::shared_ptr<std::deque<uint32_t>>> rpmDict_;
-    std::deque<size_t> timeStamps_; 
+    std::mutex temperature_max_m_;
+    /// @brief Hottest reading of each sensor during the Pico's last sampling
+    /// window, requested by pico_monitor() rather than by every /api/status
+    bool has_temperature_max_;
+    pico_pkt_temperature_u temperature_max_;
 
     WebServer();
     static std::string log(const httplib::Request &req, const httplib::Response &res);
     static std::string dump_headers(const httplib::Headers &headers);
-    void saveTemperatureSensorReading(const std::string & name, const float & value);
-    void saveFanRpmSensorReading(const std::string & name, const uint32_t & value);
+    static nlohmann::json get_fan_health();
 
     /// @brief Renders HTML template given its name and variables.
     /// @param content Rendered output.
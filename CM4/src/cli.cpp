@@ -10,6 +10,7 @@
 #include <libconfig.h>
 #include <filesystem>
 #include "settings.hpp"
+#include "pico_pkt_ntc_cal.h"
 #include "fmt/core.h"
 
 namespace fs = std::filesystem;
@@ -64,6 +65,195 @@ void parse_cli(int argc, char **argv)
     }    
 }
 
+/// @brief Parses the fan_control group
+/// @return Exit code: 0 - Success, 1 - Failure.
+static int parse_fan_control(config_t & config, const char * file_path)
+{
+    config_setting_t *group = config_lookup(&config, "fan_control");
+    if (group == NULL) {
+        return EXIT_SUCCESS;
+    }
+
+    double value = 0.0;
+    int enabled = 0;
+
+    if (config_setting_lookup_bool(group, "enabled", &enabled)) {
+        appSettings.enable_fan_control = !!enabled;
+    }
+    if (config_setting_lookup_float(group, "min_duty", &value)) {
+        appSettings.fan_min_duty = value;
+    }
+    if (config_setting_lookup_float(group, "hysteresis_c", &value)) {
+        appSettings.fan_hysteresis_c = value;
+    }
+    if (config_setting_lookup_float(group, "slew_up_per_second", &value)) {
+        appSettings.fan_slew_up_per_second = value;
+    }
+    if (config_setting_lookup_float(group, "slew_down_per_second", &value)) {
+        appSettings.fan_slew_down_per_second = value;
+    }
+
+    config_setting_t *fans = config_setting_get_member(group, "fans");
+    if (fans == NULL) {
+        return EXIT_SUCCESS;
+    }
+
+    for (int i = 0; i < config_setting_length(fans); i++) {
+        config_setting_t *fan = config_setting_get_elem(fans, i);
+        picod::FanCurve fanCurve;
+        const char *name = NULL;
+
+        if (!config_setting_lookup_string(fan, "fan_name", &name)) {
+            fmt::println(stderr, "Error reading file: {}\nfan_control: fan {} has no fan_name", file_path, i);
+            return EXIT_FAILURE;
+        }
+        fanCurve.fan_name = name;
+
+        config_setting_t *sensors = config_setting_get_member(fan, "sensors");
+        for (int j = 0; (sensors != NULL) && (j < config_setting_length(sensors)); j++) {
+            config_setting_t *sensor = config_setting_get_elem(sensors, j);
+            picod::FanSensorCurve sensorCurve = { .sensor_name = "", .weight = 1.0f, .points = {} };
+
+            if (!config_setting_lookup_string(sensor, "sensor_name", &name)) {
+                fmt::println(stderr, "Error reading file: {}\nfan_control: {} sensor {} has no sensor_name", 
+                    file_path, fanCurve.fan_name, j);
+                return EXIT_FAILURE;
+            }
+            sensorCurve.sensor_name = name;
+
+            if (config_setting_lookup_float(sensor, "weight", &value)) {
+                sensorCurve.weight = value;
+            }
+
+            // Each point is a [temperature_c, duty] pair
+            config_setting_t *curve = config_setting_get_member(sensor, "curve");
+            for (int k = 0; (curve != NULL) && (k < config_setting_length(curve)); k++) {
+                config_setting_t *point = config_setting_get_elem(curve, k);
+                if (config_setting_length(point) != 2) {
+                    fmt::println(stderr, "Error reading file: {}\nfan_control: {} curve point {} "
+                        "must be [temperature_c, duty]", file_path, sensorCurve.sensor_name, k);
+                    return EXIT_FAILURE;
+                }
+                sensorCurve.points.push_back(picod::FanCurvePoint {
+                    .temperature_c = static_cast<float>(config_setting_get_float_elem(point, 0)),
+                    .duty = static_cast<float>(config_setting_get_float_elem(point, 1)) });
+            }
+
+            if (sensorCurve.points.empty()) {
+                fmt::println(stderr, "Error reading file: {}\nfan_control: {} has no curve", 
+                    file_path, sensorCurve.sensor_name);
+                return EXIT_FAILURE;
+            }
+
+            fanCurve.sensors.push_back(sensorCurve);
+        }
+
+        appSettings.fan_curves.push_back(fanCurve);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/// @brief Parses the pico_fan_control group
+/// @return Exit code: 0 - Success, 1 - Failure.
+static int parse_pico_fan_control(config_t & config, const char * file_path)
+{
+    config_setting_t *group = config_lookup(&config, "pico_fan_control");
+    if (group == NULL) {
+        return EXIT_SUCCESS;
+    }
+
+    const char *mode = NULL;
+    int timeout = 0;
+
+    if (config_setting_lookup_string(group, "mode", &mode)) {
+        appSettings.pico_fan_control_mode = mode;
+    }
+    if (config_setting_lookup_int(group, "host_timeout_seconds", &timeout)) {
+        appSettings.pico_fan_host_timeout_seconds = (timeout < 0) ? 0 : timeout;
+    }
+
+    config_setting_t *fans = config_setting_get_member(group, "fans");
+    for (int i = 0; (fans != NULL) && (i < config_setting_length(fans)); i++) {
+        config_setting_t *fan = config_setting_get_elem(fans, i);
+        picod::PicoFanCurve fanCurve = { .fan_name = "", .sensors = {}, 
+            .min_duty = 0.0f, .hysteresis_c = 2.0f, .points = {} };
+        const char *name = NULL;
+        double value = 0.0;
+
+        if (!config_setting_lookup_string(fan, "fan_name", &name)) {
+            fmt::println(stderr, "Error reading file: {}\npico_fan_control: fan {} has no fan_name", file_path, i);
+            return EXIT_FAILURE;
+        }
+        fanCurve.fan_name = name;
+
+        if (config_setting_lookup_float(fan, "min_duty", &value)) {
+            fanCurve.min_duty = value;
+        }
+        if (config_setting_lookup_float(fan, "hysteresis_c", &value)) {
+            fanCurve.hysteresis_c = value;
+        }
+
+        config_setting_t *sensors = config_setting_get_member(fan, "sensors");
+        for (int j = 0; (sensors != NULL) && (j < config_setting_length(sensors)); j++) {
+            const char *sensor = config_setting_get_string_elem(sensors, j);
+            if (sensor != NULL) {
+                fanCurve.sensors.push_back(sensor);
+            }
+        }
+
+        // Each point is a [temperature_c, duty] pair
+        config_setting_t *curve = config_setting_get_member(fan, "curve");
+        for (int k = 0; (curve != NULL) && (k < config_setting_length(curve)); k++) {
+            config_setting_t *point = config_setting_get_elem(curve, k);
+            if (config_setting_length(point) != 2) {
+                fmt::println(stderr, "Error reading file: {}\npico_fan_control: {} curve point {} "
+                    "must be [temperature_c, duty]", file_path, fanCurve.fan_name, k);
+                return EXIT_FAILURE;
+            }
+            fanCurve.points.push_back(picod::FanCurvePoint {
+                .temperature_c = static_cast<float>(config_setting_get_float_elem(point, 0)),
+                .duty = static_cast<float>(config_setting_get_float_elem(point, 1)) });
+        }
+
+        appSettings.pico_fan_curves.push_back(fanCurve);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/// @brief Parses the ntc_calibration group
+/// @return Exit code: 0 - Success, 1 - Failure.
+static int parse_ntc_calibration(config_t & config, const char * file_path)
+{
+    config_setting_t *group = config_lookup(&config, "ntc_calibration");
+    if (group == NULL) {
+        return EXIT_SUCCESS;
+    }
+
+    int beta = 0;
+
+    if (config_setting_lookup_int(group, "beta", &beta)) {
+        appSettings.ntc_beta = (beta < 0) ? 0 : beta;
+    }
+
+    // One offset per NTC sensor, in sensor_names order
+    appSettings.ntc_offsets_c.assign(PICO_NTC_CAL_NUM_SENSORS, 0.0f);
+    config_setting_t *offsets = config_setting_get_member(group, "offsets_c");
+    if (offsets != NULL) {
+        if (config_setting_length(offsets) != PICO_NTC_CAL_NUM_SENSORS) {
+            fmt::println(stderr, "Error reading file: {}\nntc_calibration: {} offsets_c expected", 
+                file_path, PICO_NTC_CAL_NUM_SENSORS);
+            return EXIT_FAILURE;
+        }
+        for (int i = 0; i < PICO_NTC_CAL_NUM_SENSORS; i++) {
+            appSettings.ntc_offsets_c[i] = static_cast<float>(config_setting_get_float_elem(offsets, i));
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+
 int parse_config_file(const char * file_path) 
 {
     int ret_val = 0;    
@@ -87,6 +277,7 @@ int parse_config_file(const char * file_path)
     
     GET_FLOAT_SETTING("temperature_poll_interval_seconds", appSettings.temperature_poll_interval_seconds)
     GET_BOOLEAN_SETTING("enable_watchdog_timer", appSettings.enable_watchdog_timer)
+    GET_BOOLEAN_SETTING("save_pico_config", appSettings.save_pico_config)
     GET_INTEGER32_SETTING("pico_watchdog_timeout_seconds", appSettings.pico_watchdog_timeout_seconds)
     GET_STRING_SETTING("pico_serial_device_path", appSettings.pico_serial_device_path)
     GET_STRING_SETTING("tmp103_i2c_device_path", appSettings.tmp103_i2c_device_path)
@@ -104,6 +295,22 @@ int parse_config_file(const char * file_path)
     GET_INTEGER16_SETTING("http_port", appSettings.http_port)
     GET_STRING_SETTING("webroot_path", appSettings.webroot_path)
     GET_BOOLEAN_SETTING("enable_web_interface", appSettings.enable_web_interface)
+    GET_BOOLEAN_SETTING("enable_fan_health", appSettings.enable_fan_health)
+    GET_STRING_SETTING("fan_calibration_path", appSettings.fan_calibration_path)
+    GET_FLOAT_SETTING("fan_calibration_step", appSettings.fan_calibration_step)
+    GET_FLOAT_SETTING("fan_calibration_settle_seconds", appSettings.fan_calibration_settle_seconds)
+    GET_FLOAT_SETTING("fan_degraded_tolerance", appSettings.fan_degraded_tolerance)
+    GET_INTEGER32_SETTING("pico_sample_rate_hz", appSettings.pico_sample_rate_hz)
+    GET_INTEGER32_SETTING("pico_sample_window_ms", appSettings.pico_sample_window_ms)
+    GET_STRING_SETTING("capture_path", appSettings.capture_path)
+    GET_INTEGER32_SETTING("capture_segment_size_kb", appSettings.capture_segment_size_kb)
+    GET_INTEGER32_SETTING("capture_segments", appSettings.capture_segments)
+    GET_STRING_SETTING("trace_path", appSettings.trace_path)
+#ifndef NO_UBUS
+    GET_FLOAT_SETTING("ubus_notify_min_interval_seconds", appSettings.ubus_notify_min_interval_seconds)
+    GET_FLOAT_SETTING("ubus_notify_temperature_threshold", appSettings.ubus_notify_temperature_threshold)
+    GET_INTEGER32_SETTING("ubus_notify_rpm_threshold", appSettings.ubus_notify_rpm_threshold)
+#endif
 
 #ifdef NO_UBUS
     if (!fs::is_directory(appSettings.webroot_path)) {
@@ -131,6 +338,18 @@ int parse_config_file(const char * file_path)
         }
     }
     
+    if (parse_fan_control(config, file_path) != EXIT_SUCCESS) {
+        ret_val = EXIT_FAILURE;
+    }
+
+    if (parse_pico_fan_control(config, file_path) != EXIT_SUCCESS) {
+        ret_val = EXIT_FAILURE;
+    }
+
+    if (parse_ntc_calibration(config, file_path) != EXIT_SUCCESS) {
+        ret_val = EXIT_FAILURE;
+    }
+    
     appSettings.sanitize();
 
 clean_up:
@@ -3,20 +3,144 @@
  *
  * SPDX-License-Identifier: MIT
  */
+#include <signal.h>
 #include <stdint.h>
+#include <atomic>
+#include <fstream>
+#include <sstream>
 #include <string>
 #include <iostream>
 //#include <memory>
 #include "json.hpp"
 #include "cxxopts.hpp"
 #include "httplib.h"
+#include "HttpLoad.hpp"
+#include "version.h"
 #include "fmt/core.h"
 
+static std::atomic<bool> quit(false);
+
+static void signal_handler(int signum) {
+    quit = true;
+}
+
+/// @brief Parses a request mix: "<kind>[:<weight>],..."
+/// @throws std::invalid_argument if the mix is malformed
+static std::array<uint32_t, picod::HttpLoad::NUM_KINDS> parse_mix(const std::string & setting) {
+    std::array<uint32_t, picod::HttpLoad::NUM_KINDS> mix = {};
+    std::stringstream ss(setting);
+    std::string item;
+
+    while (std::getline(ss, item, ',')) {
+        const size_t colon = item.find(':');
+        picod::HttpLoad::Kind kind;
+        if (!picod::HttpLoad::get_kind(item.substr(0, colon), kind)) {
+            throw std::invalid_argument("unknown request type: " + item);
+        }
+        mix[kind] += (colon == std::string::npos) ? 1 : std::stoul(item.substr(colon + 1));
+    }
+
+    return mix;
+}
+
+/// @brief pico-cli bench: loads the web interface with SSE subscribers and
+/// requests, and reports latency, event lag and errors as JSON
+static int bench_main(int argc, char const *argv[])
+{
+    using picod::HttpLoad;
+
+    try
+    {
+        std::unique_ptr<cxxopts::Options> allocated(new cxxopts::Options("pico-cli bench",
+            "Loads the picod web interface with SSE subscribers and requests"));
+        auto& options = *allocated;
+
+        options
+        .set_width(70)
+        .set_tab_expansion()
+        .add_options()
+        ("host", "HTTP server host", cxxopts::value<std::string>()->default_value("localhost"))
+        ("n,port", "HTTP server port number", cxxopts::value<uint16_t>()->default_value("8086"))
+        ("s,subscribers", "Number of SSE (/stream) subscribers", cxxopts::value<uint32_t>()->default_value("1"))
+        ("c,connections", "Number of connections sending requests, 0 for none", cxxopts::value<uint32_t>()->default_value("1"))
+        ("r,rate", "Requests per second over all connections, 0 to send as fast as responses allow", cxxopts::value<double>()->default_value("0"))
+        ("m,mix", "Requests to send: <type>[:<weight>],... Types: status (/api/status), home (/), settings (POST fan_pwm)", cxxopts::value<std::string>()->default_value("status"))
+        ("f,fan", "Fan of the settings requests (CM4_FAN_J18, System_Fan_J17)", cxxopts::value<std::string>()->default_value("System_Fan_J17"))
+        ("p,pwm", "Duty cycle (%) the settings requests write. Without it, they only read it.", cxxopts::value<uint32_t>())
+        ("t,duration", "Length of the run (s)", cxxopts::value<double>()->default_value("10"))
+        ("timeout", "Request timeout (ms)", cxxopts::value<uint32_t>()->default_value("5000"))
+        ("progress", "Print a progress line every this many seconds, 0 never", cxxopts::value<double>()->default_value("0"))
+        ("label", "Name of the run, copied to the results", cxxopts::value<std::string>()->default_value(""))
+        ("o,output", "Write the JSON results to a file instead of stdout", cxxopts::value<std::string>())
+        ("h,help", "Print help")
+        ;
+
+        auto result = options.parse(argc, argv);
+
+        if (result.count("help")) {
+            std::cout << options.help() << std::endl;
+            return EXIT_SUCCESS;
+        }
+
+        HttpLoad::Options opts = {
+            .host = result["host"].as<std::string>(),
+            .port = result["port"].as<uint16_t>(),
+            .subscribers = result["subscribers"].as<uint32_t>(),
+            .connections = result["connections"].as<uint32_t>(),
+            .rate = result["rate"].as<double>(),
+            .mix = parse_mix(result["mix"].as<std::string>()),
+            .fan_name = result["fan"].as<std::string>(),
+            .pwm_pct = result.count("pwm") ? (int32_t)std::min(result["pwm"].as<uint32_t>(), 100u) : -1,
+            .duration_s = result["duration"].as<double>(),
+            .timeout_ms = result["timeout"].as<uint32_t>(),
+            .progress_s = result["progress"].as<double>()
+        };
+
+        HttpLoad load(opts);
+
+        signal(SIGINT, signal_handler);
+        signal(SIGTERM, signal_handler);
+
+        load.run(quit);
+
+        nlohmann::ordered_json j;
+        j["tool"] = "pico-cli bench";
+        j["version"] = VERSION_STR;
+        j["label"] = result["label"].as<std::string>();
+        j.update(load.results());
+
+        if (result.count("output")) {
+            std::ofstream f(result["output"].as<std::string>());
+            if (!f) {
+                fmt::println(stderr, "Failed to open {}", result["output"].as<std::string>());
+                return EXIT_FAILURE;
+            }
+            f << j.dump(2) << std::endl;
+        } else {
+            std::cout << j.dump(2) << std::endl;
+        }
+
+    } catch (const cxxopts::exceptions::exception& e) {
+        fmt::println("error parsing options: {}", e.what());
+        return EXIT_FAILURE;
+    } catch (const std::invalid_argument& e) {
+        fmt::println("error: {}", e.what());
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
 int main(int argc, char const *argv[])
 {
+    if ((argc > 1) && (std::string(argv[1]) == "bench")) {
+        return bench_main(argc - 1, &argv[1]);
+    }
+
     try
     {
-        std::unique_ptr<cxxopts::Options> allocated(new cxxopts::Options(argv[0], "Picod commandline client"));
+        std::unique_ptr<cxxopts::Options> allocated(new cxxopts::Options(argv[0],
+            "Picod commandline client. 'pico-cli bench --help' describes the load mode."));
         auto& options = *allocated;
 
         options
@@ -22,9 +22,14 @@
 #include "pico_pkt_watchdog.h"
 #include "pico_pkt_shutdown.h"
 #include "pico_pkt_version.h"
+#include "pico_pkt_fan_ctrl.h"
+#include "pico_pkt_ntc_cal.h"
+#include "pico_pkt_flash_config.h"
 #include "SensorID.hpp"
 #include "TMP103_I2C.hpp"
 #include "PacketHandler.hpp"
+#include "PacketCapture.hpp"
+#include "Trace.hpp"
 #include "fmt/core.h"
 #ifdef NO_UBUS
 #include "WebServer.hpp"
@@ -64,13 +69,29 @@ int main(int argc, char** argv)
         goto cleanup;
     }
 
+    if (!appSettings.capture_path.empty()) {
+        PacketCapture::instance().open(appSettings.capture_path, 
+            (size_t)appSettings.capture_segment_size_kb * 1024, appSettings.capture_segments);
+    }
+
+#ifdef NO_UBUS
     workers.emplace_back([]() -> void {
         PacketHandler::instance().run();
     });
+#else
+    // The serial port is serviced from the ubus event loop
+    if (PacketHandler::instance().open_serial_port() != EXIT_SUCCESS) {
+        retVal = EXIT_FAILURE;
+        goto cleanup;
+    }
+#endif
 
     // Install a signal handler
     std::signal(SIGINT, quit_signal_handler);
     std::signal(SIGTERM, quit_signal_handler);
+#ifdef PICOD_TRACE
+    Trace::instance().write_on_signal(SIGUSR1, appSettings.trace_path);
+#endif
     
     if ((retVal = init_pico()) == EXIT_SUCCESS) {
 #ifdef NO_UBUS
@@ -94,6 +115,8 @@ int main(int argc, char** argv)
         for (auto& th : workers) th.join();
     }
 
+    PacketCapture::instance().close();
+
 cleanup:
     return retVal;
 }
@@ -109,8 +132,8 @@ int init_pico() {
             fmt::println("Pico Version: {}", picoVersion);
         }
 
-        init_fan_pwm();
-        init_watchdog();
+        init_pico_config();
+        init_temperature();
     } else {
         fmt::println(stderr ,"Initialization timed out.");
         retVal  = EXIT_FAILURE;
@@ -0,0 +1,102 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdio.h>
+#include <cstring> // memset
+#include "Utils.hpp"
+#include "pico_pkt_event_log.h"
+#include "PacketHandler.hpp"
+#include "Trace.hpp"
+
+void pkt_event_log(struct pkt_buf *b) {
+    pico_event_t e = {0};
+    pico_event_log_status_t s = {0};
+    bool success = false;
+
+    // Unpack the event log response message
+    if (pico_pkt_event_log_unpack(b->resp, &e, &s, &success)) {
+        printf("Next seq: %u, Oldest seq: %u, Pico time: %u (ms), Boot: %u\n",
+            s.next_seq, s.oldest_seq, s.time_ms, s.boot);
+    } else {
+        printf("Seq: %u, Pico time: %u (ms), Boot: %u, Type: %u, Data: 0x%04x\n",
+            e.seq, e.time_ms, e.boot, e.type, e.data);
+    }
+
+    printf("Success: %s\n", BOOLEAN_TO_STR(success));
+}
+
+bool send_event_log_request(uint32_t first_seq, std::vector<pico_event_t> & events,
+    pico_event_log_status_t & status) {
+    TRACE_SCOPE("pico/send_event_log_request");
+    PacketHandler::RequestLock lock;
+    pkt_buf pkt = {0,0,0};
+    memset((void *)&pkt.req, 0, sizeof(pkt.req));
+    memset((void *)&pkt.resp, 0, sizeof(pkt.resp));
+
+    // Pack the event log request message
+    pico_pkt_event_log_req_pack((uint8_t *)pkt.req, first_seq, PICO_EVENT_LOG_MAX_BURST);
+
+    PacketHandler::instance().send_pico_request(pkt.req, PICO_PKT_LEN);
+
+    events.clear();
+    memset((void *)&status, 0, sizeof(status));
+
+    // Entry frames, then the end frame
+    for (int i = 0; i <= PICO_EVENT_LOG_MAX_BURST; i++) {
+        if (!PacketHandler::instance().get_pico_response(pkt, PICO_PKT_EVENT_LOG_MAGIC)) {
+            return false;
+        }
+
+        pico_event_t e = {0};
+        bool success = false;
+
+        // Unpack the event log response message
+        if (pico_pkt_event_log_unpack(pkt.resp, &e, &status, &success)) {
+            return success;
+        }
+
+        events.push_back(e);
+    }
+
+    // No end frame
+    return false;
+}
+
+bool send_event_log_request_async(uint32_t first_seq,
+    std::function<void(bool success, std::vector<pico_event_t> & events,
+    pico_event_log_status_t & status)> callback) {
+    TRACE_SCOPE("pico/send_event_log_request_async");
+    pkt_buf pkt = {0,0,0};
+    memset((void *)&pkt.req, 0, sizeof(pkt.req));
+
+    // Pack the event log request message
+    pico_pkt_event_log_req_pack((uint8_t *)pkt.req, first_seq, PICO_EVENT_LOG_MAX_BURST);
+
+    // Filled by the entry frames, handed over with the end frame
+    auto events = std::make_shared<std::vector<pico_event_t>>();
+
+    return PacketHandler::instance().send_pico_request_async(pkt.req, PICO_PKT_EVENT_LOG_MAGIC,
+        [callback, events](bool success, const uint8_t *resp) {
+            pico_event_log_status_t s = {0};
+
+            if (success) {
+                pico_event_t e = {0};
+
+                // Unpack the event log response message
+                if (!pico_pkt_event_log_unpack(resp, &e, &s, &success)) {
+                    events->push_back(e);
+                    return;
+                }
+            }
+
+            if (callback) {
+                callback(success, *events, s);
+            }
+        },
+        [](const uint8_t *resp) {
+            return (resp[PICO_PKT_EVENT_LOG_IDX_FLAGS] & PICO_PKT_EVENT_LOG_FLAG_END) != 0;
+        });
+}
@@ -0,0 +1,177 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdio.h>
+#include <cstring> // memset
+#include <strings.h>
+#include <cmath>
+#include "Utils.hpp"
+#include "pico_pkt_fan_ctrl.h"
+#include "pico_pkt_fan_pwm.h"
+#include "pico_pkt_temperature.h"
+#include "SensorID.hpp"
+#include "PacketHandler.hpp"
+#include "fmt/core.h"
+#include "Trace.hpp"
+
+void pkt_fan_ctrl(struct pkt_buf *b) {
+    pico_pkt_fan_ctrl_t s = {0};
+
+    // Unpack the fan control response message
+    pico_pkt_fan_ctrl_unpack(b->resp, &s);
+
+    if (s.status) {
+        printf("FAN%d: Mode %d, Active: %s, Curve duty: %d%%, Applied duty: %d%%, "\
+            "Temperature: %.2f\n", s.fan_id, s.mode, BOOLEAN_TO_STR(s.active),
+            s.curve_duty_pct, s.applied_duty_pct, s.temperature_cx100 / 100.0f);
+    } else {
+        printf("FAN%d: Mode %d, Sensors: 0x%02x, Min duty: %d%%, Hysteresis: %d, "\
+            "Host timeout: %d (Sec), Points: %d\n", s.fan_id, s.mode, s.sensor_mask,
+            s.min_duty_pct, s.hysteresis_c, s.host_timeout_sec, s.num_points);
+    }
+
+    printf("R(0)/W(1): %s, Success: %s\n",
+        BOOLEAN_TO_STR(s.write), BOOLEAN_TO_STR(s.success));
+}
+
+bool send_fan_ctrl_request(pico_pkt_fan_ctrl_t & p) {
+    TRACE_SCOPE("pico/send_fan_ctrl_request");
+    PacketHandler::RequestLock lock;
+    pkt_buf pkt = {0,0,0};
+    memset((void *)&pkt.req, 0, sizeof(pkt.req));
+    memset((void *)&pkt.resp, 0, sizeof(pkt.resp));
+
+    // Pack the fan control request message
+    pico_pkt_fan_ctrl_req_pack((uint8_t *)pkt.req, &p);
+
+    PacketHandler::instance().send_pico_request(pkt.req, PICO_PKT_LEN);
+
+    bool success = PacketHandler::instance().get_pico_response(pkt, PICO_PKT_FAN_CTRL_MAGIC);
+
+    memset((void *)&p, 0, sizeof(p));
+
+    if (success) {
+        // Unpack the fan control response message
+        pico_pkt_fan_ctrl_unpack(pkt.resp, &p);
+        success = p.success;
+    }
+
+    return success;
+}
+
+bool send_fan_ctrl_request_async(const pico_pkt_fan_ctrl_t & p,
+    std::function<void(bool success, pico_pkt_fan_ctrl_t & p)> callback) {
+    TRACE_SCOPE("pico/send_fan_ctrl_request_async");
+    pkt_buf pkt = {0,0,0};
+    memset((void *)&pkt.req, 0, sizeof(pkt.req));
+
+    // Pack the fan control request message
+    pico_pkt_fan_ctrl_req_pack((uint8_t *)pkt.req, &p);
+
+    return PacketHandler::instance().send_pico_request_async(pkt.req, PICO_PKT_FAN_CTRL_MAGIC,
+        [callback](bool success, const uint8_t *resp) {
+            pico_pkt_fan_ctrl_t p = {0};
+
+            if (success) {
+                // Unpack the fan control response message
+                pico_pkt_fan_ctrl_unpack(resp, &p);
+                success = p.success;
+            }
+
+            if (callback) {
+                callback(success, p);
+            }
+        });
+}
+
+/// @brief Returns the Pico sensor mask bit of a sensor, or zero(0)
+/// if the Pico cannot read that sensor.
+static uint8_t get_fan_ctrl_sensor_bit(const std::string & name) {
+    for (int ch = 0; ch < NUM_NTC_SENSORS; ch++) {
+        if (strcasecmp(name.c_str(), appSettings.sensorIds[ch].c_str()) == 0) {
+            return (1 << ch);
+        }
+    }
+
+    if (strcasecmp(name.c_str(), appSettings.sensorIds[picod::RPi_Pico].c_str()) == 0) {
+        return (1 << NUM_NTC_SENSORS);
+    }
+
+    return 0;
+}
+
+/// @brief Converts a duty cycle [0.0 to 1.0] to percent
+static uint8_t to_duty_pct(float duty) {
+    return static_cast<uint8_t>(std::lround(duty * 100.0f));
+}
+
+void init_fan_ctrl() {
+    uint8_t mode = PICO_FAN_CTRL_MODE_INVALID;
+    const std::string & modeName = appSettings.pico_fan_control_mode;
+
+    if (modeName.empty()) {
+        return;
+    } else if (strcasecmp(modeName.c_str(), "host") == 0) {
+        mode = PICO_FAN_CTRL_MODE_HOST;
+    } else if (strcasecmp(modeName.c_str(), "auto") == 0) {
+        mode = PICO_FAN_CTRL_MODE_AUTO;
+    } else if (strcasecmp(modeName.c_str(), "advisory") == 0) {
+        mode = PICO_FAN_CTRL_MODE_ADVISORY;
+    } else {
+        fmt::println(stderr, "pico_fan_control: unknown mode {}", modeName);
+        return;
+    }
+
+    for (uint8_t fan_id : { SYS_FAN1, CM4_FAN }) {
+        pico_pkt_fan_ctrl_t p = {0};
+        p.write = true;
+        p.fan_id = fan_id;
+        // Fans without a curve stay under host control
+        p.mode = PICO_FAN_CTRL_MODE_HOST;
+        p.host_timeout_sec = appSettings.pico_fan_host_timeout_seconds;
+
+        for (auto const& curve : appSettings.pico_fan_curves) {
+            if (get_fan_id_from_name(curve.fan_name.c_str()) != fan_id) {
+                continue;
+            }
+
+            for (auto const& sensor : curve.sensors) {
+                uint8_t bit = get_fan_ctrl_sensor_bit(sensor);
+                if (bit == 0) {
+                    fmt::println(stderr, "pico_fan_control: {} cannot be read by the Pico", sensor);
+                }
+                p.sensor_mask |= bit;
+            }
+
+            if (curve.points.size() > PICO_FAN_CTRL_MAX_POINTS) {
+                fmt::println(stderr, "pico_fan_control: {} has more than {} curve points, "
+                    "the rest are ignored", curve.fan_name, PICO_FAN_CTRL_MAX_POINTS);
+            }
+
+            for (auto const& point : curve.points) {
+                if (p.num_points == PICO_FAN_CTRL_MAX_POINTS) {
+                    break;
+                }
+                long temperature_c = std::lround(point.temperature_c);
+                temperature_c = (temperature_c < 0) ? 0 : temperature_c;
+                temperature_c = (temperature_c > 0xFF) ? 0xFF : temperature_c;
+                p.points[p.num_points].temperature_c = static_cast<uint8_t>(temperature_c);
+                p.points[p.num_points].duty_pct = to_duty_pct(point.duty);
+                p.num_points++;
+            }
+
+            long hysteresis_c = std::lround(curve.hysteresis_c);
+            p.hysteresis_c = static_cast<uint8_t>((hysteresis_c > 0xFF) ? 0xFF : hysteresis_c);
+            p.min_duty_pct = to_duty_pct(curve.min_duty);
+            p.mode = mode;
+            break;
+        }
+
+        if (!send_fan_ctrl_request(p)) {
+            fmt::println(stderr, "pico_fan_control: failed to configure fan {}", fan_id);
+        }
+    }
+}
@@ -14,6 +14,7 @@
 #include "pico_pkt_fan_pwm.h"
 #include "SensorID.hpp"
 #include "PacketHandler.hpp"
+#include "Trace.hpp"
 
 void pkt_fan_pwm(struct pkt_buf *b) {    
     bool rw_flag = false; // Read(0)/Write(1) flag    
@@ -35,10 +36,9 @@ void pkt_fan_pwm(struct pkt_buf *b) {
         BOOLEAN_TO_STR(rw_flag), BOOLEAN_TO_STR(success));     
 }
 
-bool send_fan_pwm_request(bool rw_flag, 
-    std::vector<struct pico_pkt_fan_pwm_t> &fanInfo) {
-
-    pkt_buf pkt = {0,0,0};
+/// @brief Packs a FAN PWM read/write request for the fans listed in fanInfo
+static void pack_fan_pwm_request(pkt_buf &pkt, bool rw_flag, 
+    const std::vector<struct pico_pkt_fan_pwm_t> &fanInfo) {
     memset((void *)&pkt.req, 0, sizeof(pkt.req));
     memset((void *)&pkt.resp, 0, sizeof(pkt.resp));
     struct pico_pkt_fan_pwm_t fans[NUM_PWM_FANS] = {
@@ -46,51 +46,92 @@ bool send_fan_pwm_request(bool rw_flag,
         { .fan_id = INVALID_FAN_ID, .pwm_pct = 0.0f }
     };
     
-    {
-        const size_t TIMES_TO_LOOP = (fanInfo.size() > NUM_PWM_FANS) ? NUM_PWM_FANS : fanInfo.size();
+    const size_t TIMES_TO_LOOP = (fanInfo.size() > NUM_PWM_FANS) ? NUM_PWM_FANS : fanInfo.size();
+    
+    for (size_t i = 0; i < TIMES_TO_LOOP; i++) {
+        if (!is_valid_pico_fan_id(fanInfo[i].fan_id) || (fanInfo[i].fan_id < 1)) {
+            continue;
+        }
         
-        for (size_t i = 0; i < TIMES_TO_LOOP; i++) {
-            if (!is_valid_pico_fan_id(fanInfo[i].fan_id) || (fanInfo[i].fan_id < 1)) {
-                continue;
-            }
-            
-            uint8_t fan_idx = (fanInfo[i].fan_id - 1);
-            
-            fans[fan_idx].fan_id = fanInfo[i].fan_id;
-            fans[fan_idx].pwm_pct = fanInfo[i].pwm_pct;
-        }       
+        uint8_t fan_idx = (fanInfo[i].fan_id - 1);
+        
+        fans[fan_idx].fan_id = fanInfo[i].fan_id;
+        fans[fan_idx].pwm_pct = fanInfo[i].pwm_pct;
     }
     
     // Pack the PWM request message
-    pico_pkt_fan_pwm_req_pack((uint8_t *)pkt.req, fans, rw_flag);    
+    pico_pkt_fan_pwm_req_pack((uint8_t *)pkt.req, fans, rw_flag);
+}
+
+/// @brief Unpacks a FAN PWM response into fanInfo
+/// @return True(1) on success. False(0) on failure.
+static bool unpack_fan_pwm_response(const uint8_t *resp, bool rw_flag, 
+    std::vector<struct pico_pkt_fan_pwm_t> &fanInfo) {
+    bool success = false;
+    bool local_rw_Flag = rw_flag;
+    struct pico_pkt_fan_pwm_t fans[NUM_PWM_FANS] = {
+        { .fan_id = INVALID_FAN_ID, .pwm_pct = 0.0f },
+        { .fan_id = INVALID_FAN_ID, .pwm_pct = 0.0f }
+    };
+
+    // Unpack the PWM response message
+    pico_pkt_fan_pwm_unpack(resp, fans, &local_rw_Flag, &success);
+
+    success = success && (local_rw_Flag == rw_flag);
+
+    const size_t TIMES_TO_LOOP = (fanInfo.size() > NUM_PWM_FANS) ? NUM_PWM_FANS : fanInfo.size();
+    for (size_t i = 0; i < TIMES_TO_LOOP; i++) {
+        if (!is_valid_pico_fan_id(fanInfo[i].fan_id) || (fanInfo[i].fan_id < 1)) {
+            continue;
+        }
+        
+        uint8_t fan_idx = (fanInfo[i].fan_id - 1);
+
+        if (fanInfo[i].fan_id == fans[fan_idx].fan_id) {
+            fanInfo[i].pwm_pct = fans[fan_idx].pwm_pct;
+        }
+    }
+
+    return success;
+}
+
+bool send_fan_pwm_request(bool rw_flag, 
+    std::vector<struct pico_pkt_fan_pwm_t> &fanInfo) {
+    TRACE_SCOPE("pico/send_fan_pwm_request");
+    PacketHandler::RequestLock lock;
+
+    pkt_buf pkt = {0,0,0};
+    pack_fan_pwm_request(pkt, rw_flag, fanInfo);
 
     PacketHandler::instance().send_pico_request(pkt.req, PICO_PKT_LEN);
 
     bool success = PacketHandler::instance().get_pico_response(pkt, PICO_PKT_FAN_PWM_MAGIC);
-    
-    bool local_rw_Flag = rw_flag;
 
     if (success) {        
-        // Unpack the PWM response message
-        pico_pkt_fan_pwm_unpack(pkt.resp, fans, &local_rw_Flag, &success);
+        success = unpack_fan_pwm_response(pkt.resp, rw_flag, fanInfo);
+    }
+    
+    return success;
+}
 
-        success = success && (local_rw_Flag == rw_flag);
+bool send_fan_pwm_request_async(bool rw_flag, 
+    const std::vector<struct pico_pkt_fan_pwm_t> &fanInfo,
+    std::function<void(bool success, std::vector<struct pico_pkt_fan_pwm_t> &fanInfo)> callback) {
+    TRACE_SCOPE("pico/send_fan_pwm_request_async");
 
-        const size_t TIMES_TO_LOOP = (fanInfo.size() > NUM_PWM_FANS) ? NUM_PWM_FANS : fanInfo.size();
-        for (size_t i = 0; i < TIMES_TO_LOOP; i++) {
-            if (!is_valid_pico_fan_id(fanInfo[i].fan_id) || (fanInfo[i].fan_id < 1)) {
-                continue;
+    pkt_buf pkt = {0,0,0};
+    pack_fan_pwm_request(pkt, rw_flag, fanInfo);
+
+    return PacketHandler::instance().send_pico_request_async(pkt.req, PICO_PKT_FAN_PWM_MAGIC,
+        [rw_flag, info = fanInfo, callback](bool success, const uint8_t *resp) mutable {
+            if (success) {
+                success = unpack_fan_pwm_response(resp, rw_flag, info);
             }
-            
-            uint8_t fan_idx = (fanInfo[i].fan_id - 1);
 
-            if (fanInfo[i].fan_id == fans[fan_idx].fan_id) {
-                fanInfo[i].pwm_pct = fans[fan_idx].pwm_pct;
+            if (callback) {
+                callback(success, info);
             }
-        }
-    }
-    
-    return success;
+        });
 }
 
 void init_fan_pwm() {    
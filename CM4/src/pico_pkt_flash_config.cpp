@@ -0,0 +1,136 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdio.h>
+#include <cstring> // memset
+#include <string>
+#include "Utils.hpp"
+#include "settings.hpp"
+#include "pico_pkt_flash_config.h"
+#include "pico_pkt_fan_pwm.h"
+#include "pico_pkt_watchdog.h"
+#include "pico_pkt_fan_ctrl.h"
+#include "pico_pkt_ntc_cal.h"
+#include "PacketHandler.hpp"
+#include "fmt/core.h"
+#include "Trace.hpp"
+
+void pkt_flash_config(struct pkt_buf *b) {
+    pico_pkt_flash_config_t p = {0};
+
+    // Unpack the flash config response message
+    pico_pkt_flash_config_unpack(b->resp, &p);
+
+    printf("Saved: %s, Loaded at boot: %s, Modified: %s\n", BOOLEAN_TO_STR(p.saved),
+        BOOLEAN_TO_STR(p.loaded), BOOLEAN_TO_STR(p.modified));
+
+    printf("Host tag: %08x, Saves: %u\n", p.host_tag, p.seq);
+
+    printf("Command: %u, Success: %s\n", p.command, BOOLEAN_TO_STR(p.success));
+}
+
+bool send_flash_config_request(pico_pkt_flash_config_t & p) {
+    TRACE_SCOPE("pico/send_flash_config_request");
+    PacketHandler::RequestLock lock;
+    pkt_buf pkt = {0,0,0};
+    memset((void *)&pkt.req, 0, sizeof(pkt.req));
+    memset((void *)&pkt.resp, 0, sizeof(pkt.resp));
+
+    // Pack the flash config request message
+    pico_pkt_flash_config_pack((uint8_t *)pkt.req, &p, false);
+
+    PacketHandler::instance().send_pico_request(pkt.req, PICO_PKT_LEN);
+
+    bool success = PacketHandler::instance().get_pico_response(pkt, PICO_PKT_FLASH_CONFIG_MAGIC);
+
+    memset((void *)&p, 0, sizeof(p));
+
+    if (success) {
+        // Unpack the flash config response message
+        pico_pkt_flash_config_unpack(pkt.resp, &p);
+        success = p.success;
+    }
+
+    return success;
+}
+
+/// @brief Identifies the settings init_pico_config() sends to the Pico
+/// (FNV-1a hash), so that picod can tell whether the Pico saved them.
+static uint32_t get_settings_tag() {
+    std::string s = fmt::format("{}|{}|{}|{}|{}|{}|{}|{}|{}|", appSettings.fan1_pwm,
+        appSettings.cm4_fan_pwm, appSettings.enable_watchdog_timer,
+        appSettings.pico_watchdog_max_retries, appSettings.pico_watchdog_timeout_seconds,
+        appSettings.pico_fan_control_mode, appSettings.pico_fan_host_timeout_seconds,
+        appSettings.ntc_beta, appSettings.ntc_offsets_c.size());
+
+    for (auto const& offset : appSettings.ntc_offsets_c) {
+        s += fmt::format("{}|", offset);
+    }
+
+    // Fans and sensors are named in the settings
+    for (auto const& id : appSettings.sensorIds) {
+        s += id + "|";
+    }
+
+    for (auto const& curve : appSettings.pico_fan_curves) {
+        s += fmt::format("{}|{}|{}|", curve.fan_name, curve.min_duty, curve.hysteresis_c);
+        for (auto const& sensor : curve.sensors) {
+            s += sensor + "|";
+        }
+        for (auto const& point : curve.points) {
+            s += fmt::format("{}:{}|", point.temperature_c, point.duty);
+        }
+    }
+
+    uint32_t hash = 2166136261u;
+    for (unsigned char c : s) {
+        hash = (hash ^ c) * 16777619u;
+    }
+
+    return hash;
+}
+
+void init_pico_config() {
+    const uint32_t tag = get_settings_tag();
+    pico_pkt_flash_config_t p = {0};
+    p.command = PICO_FLASH_CONFIG_CMD_READ;
+
+    // Pico firmware without saved settings does not answer
+    const bool can_save = send_flash_config_request(p);
+
+    if (can_save && appSettings.save_pico_config && p.saved && !p.modified && (p.host_tag == tag)) {
+        fmt::println("The Pico is using the saved settings ({} saves)", p.seq);
+        return;
+    }
+
+    init_fan_pwm();
+    init_watchdog();
+    init_fan_ctrl();
+    init_ntc_cal();
+
+    if (!can_save) {
+        return;
+    }
+
+    const bool was_saved = p.saved;
+    memset((void *)&p, 0, sizeof(p));
+
+    if (appSettings.save_pico_config) {
+        p.command = PICO_FLASH_CONFIG_CMD_SAVE;
+        p.host_tag = tag;
+        if (send_flash_config_request(p)) {
+            fmt::println("Saved the Pico settings ({} saves)", p.seq);
+        } else {
+            fmt::println(stderr, "save_pico_config: failed to save the Pico settings");
+        }
+    } else if (was_saved) {
+        // The Pico boots with its built-in defaults again
+        p.command = PICO_FLASH_CONFIG_CMD_CLEAR;
+        if (!send_flash_config_request(p)) {
+            fmt::println(stderr, "save_pico_config: failed to clear the Pico settings");
+        }
+    }
+}
@@ -0,0 +1,97 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdio.h>
+#include <cstring> // memset
+#include <cmath>
+#include "Utils.hpp"
+#include "pico_pkt_ntc_cal.h"
+#include "PacketHandler.hpp"
+#include "fmt/core.h"
+#include "Trace.hpp"
+
+void pkt_ntc_cal(struct pkt_buf *b) {
+    pico_pkt_ntc_cal_t s = {0};
+
+    // Unpack the NTC calibration response message
+    pico_pkt_ntc_cal_unpack(b->resp, &s);
+
+    printf("NTC B value: %d K, Offsets: %.2f, %.2f, %.2f, %.2f\n", s.beta,
+        s.offset_cx100[0] / 100.0f, s.offset_cx100[1] / 100.0f,
+        s.offset_cx100[2] / 100.0f, s.offset_cx100[3] / 100.0f);
+
+    printf("R(0)/W(1): %s, Success: %s\n",
+        BOOLEAN_TO_STR(s.write), BOOLEAN_TO_STR(s.success));
+}
+
+bool send_ntc_cal_request(pico_pkt_ntc_cal_t & p) {
+    TRACE_SCOPE("pico/send_ntc_cal_request");
+    PacketHandler::RequestLock lock;
+    pkt_buf pkt = {0,0,0};
+    memset((void *)&pkt.req, 0, sizeof(pkt.req));
+    memset((void *)&pkt.resp, 0, sizeof(pkt.resp));
+
+    // Pack the NTC calibration request message
+    pico_pkt_ntc_cal_pack((uint8_t *)pkt.req, &p, false);
+
+    PacketHandler::instance().send_pico_request(pkt.req, PICO_PKT_LEN);
+
+    bool success = PacketHandler::instance().get_pico_response(pkt, PICO_PKT_NTC_CAL_MAGIC);
+
+    memset((void *)&p, 0, sizeof(p));
+
+    if (success) {
+        // Unpack the NTC calibration response message
+        pico_pkt_ntc_cal_unpack(pkt.resp, &p);
+        success = p.success;
+    }
+
+    return success;
+}
+
+bool send_ntc_cal_request_async(const pico_pkt_ntc_cal_t & p,
+    std::function<void(bool success, pico_pkt_ntc_cal_t & p)> callback) {
+    TRACE_SCOPE("pico/send_ntc_cal_request_async");
+    pkt_buf pkt = {0,0,0};
+    memset((void *)&pkt.req, 0, sizeof(pkt.req));
+
+    // Pack the NTC calibration request message
+    pico_pkt_ntc_cal_pack((uint8_t *)pkt.req, &p, false);
+
+    return PacketHandler::instance().send_pico_request_async(pkt.req, PICO_PKT_NTC_CAL_MAGIC,
+        [callback](bool success, const uint8_t *resp) {
+            pico_pkt_ntc_cal_t p = {0};
+
+            if (success) {
+                // Unpack the NTC calibration response message
+                pico_pkt_ntc_cal_unpack(resp, &p);
+                success = p.success;
+            }
+
+            if (callback) {
+                callback(success, p);
+            }
+        });
+}
+
+void init_ntc_cal() {
+    if ((appSettings.ntc_beta == 0) && appSettings.ntc_offsets_c.empty()) {
+        return;
+    }
+
+    pico_pkt_ntc_cal_t p = {0};
+    p.write = true;
+    p.beta = static_cast<uint16_t>(appSettings.ntc_beta);
+
+    for (size_t i = 0; (i < appSettings.ntc_offsets_c.size()) &&
+        (i < PICO_NTC_CAL_NUM_SENSORS); i++) {
+        p.offset_cx100[i] = static_cast<int16_t>(std::lround(appSettings.ntc_offsets_c[i] * 100.0f));
+    }
+
+    if (!send_ntc_cal_request(p)) {
+        fmt::println(stderr, "ntc_calibration: failed to configure the Pico");
+    }
+}
@@ -9,13 +9,8 @@
 #include "pico_pkt_fan_pwm.h"
 #include "PacketHandler.hpp"
 
-void pkt_shutdown(struct pkt_buf *b){
-    //print_bytes("Shutdown Request:", b->resp, PICO_PKT_LEN);
-    print_err("Shutdown Request\n");
-
-    // Turn off the PWM fans.
-    turn_off_fan_pwm();
-
+/// @brief Confirms the graceful shutdown to the Pico and powers off
+static void confirm_shutdown() {
     // Send back a confirmation of graceful shutdown
     pkt_buf pkt = {0,0,0};
     memset((void *)&pkt.req, 0, sizeof(pkt.req));
@@ -31,3 +26,27 @@ void pkt_shutdown(struct pkt_buf *b){
         run_cmd((char *)"sudo poweroff");
     }    
 }
+
+void pkt_shutdown(struct pkt_buf *b){
+    //print_bytes("Shutdown Request:", b->resp, PICO_PKT_LEN);
+    print_err("Shutdown Request\n");
+
+    // Turn off the PWM fans, then confirm. This runs on the thread 
+    // servicing the serial port, so it must not wait for the response.
+    std::vector<struct pico_pkt_fan_pwm_t> fanInfo;
+
+    fanInfo.emplace_back(pico_pkt_fan_pwm_t { 
+        .fan_id = SYS_FAN1, .pwm_pct = 0.0f });
+
+    fanInfo.emplace_back(pico_pkt_fan_pwm_t { 
+        .fan_id = CM4_FAN, .pwm_pct = 0.0f });
+
+    bool queued = send_fan_pwm_request_async(true, fanInfo,
+        [](bool success, std::vector<struct pico_pkt_fan_pwm_t> &fanInfo) {
+            confirm_shutdown();
+        });
+
+    if (!queued) {
+        confirm_shutdown();
+    }
+}
\ No newline at end of file
@@ -9,18 +9,31 @@
 #include <cstring> // memset
 #include <unistd.h>
 #include <iostream>
+#include <atomic>
 #include <mutex>
+#include <memory>
 #include "Utils.hpp"
 #include "InfluxDB.hpp"
 #include "pico_pkt_temperature.h"
 #include "SensorID.hpp"
 #include "PacketHandler.hpp"
+#include "PicoClock.hpp"
+#include "fmt/core.h"
+#include "Trace.hpp"
 
 void pkt_temperature(struct pkt_buf *b)
 {
     pico_pkt_temperature_u tmp;
     bool success = true;
 
+    if (pico_pkt_temperature_is_time(b->resp)) {
+        pico_pkt_temperature_time_t t = {0};
+        pico_pkt_temperature_time_unpack(b->resp, &t, &success);
+        printf("Window start: %llu (us), Length: %u (us), Samples: %u\n",
+            (unsigned long long)t.start_us, t.length_us, t.num_samples);
+        return;
+    }
+
     pico_pkt_temperature_resp_unpack((uint8_t *)b->resp, &tmp, &success);
 
     if (appSettings.enable_influx_db) {
@@ -46,36 +59,177 @@ void pkt_temperature(struct pkt_buf *b)
 }
 
 
+// Cleared once the Pico fails to send a timestamp frame: firmware older
+// than the timestamp flag never does, so asking again would only wait out
+// PICO_RESPONSE_TIMEOUT on every request.
+static std::atomic<bool> pico_sends_timestamps(true);
+
+static void on_timestamp_missing() {
+    if (pico_sends_timestamps.exchange(false)) {
+        fmt::println(stderr, "The Pico sent no timestamp, no longer asking for one");
+    }
+}
+
 void send_temperature_request(){
+    TRACE_SCOPE("pico/send_temperature_request");
     pkt_buf pkt = {0,0,0};
+    pico_pkt_temperature_req_t r = {0};
 
     memset((void *)&pkt.req, 0, sizeof(pkt.req));
     memset((void *)&pkt.resp, 0, sizeof(pkt.resp));
 
-    pico_pkt_temperature_req_pack((uint8_t *)pkt.req);
+    pico_pkt_temperature_req_pack((uint8_t *)pkt.req, &r);
 
     PacketHandler::instance().send_pico_request(pkt.req, PICO_PKT_LEN);
 }
 
-bool send_temperature_request(pico_pkt_temperature_u & tmp) {
+bool send_temperature_request(pico_pkt_temperature_u & tmp, uint8_t statistic,
+    pico_pkt_temperature_time_t * time) {
+    TRACE_SCOPE("pico/send_temperature_request");
+    PacketHandler::RequestLock lock;
 
     bool success = true;
 
     pkt_buf pkt = {0,0,0};
+    pico_pkt_temperature_req_t r = {0};
+    r.statistic = statistic;
+    r.timestamp = (time != nullptr) && pico_sends_timestamps;
 
     memset((void *)&pkt.req, 0, sizeof(pkt.req));
     memset((void *)&pkt.resp, 0, sizeof(pkt.resp));
 
-    pico_pkt_temperature_req_pack((uint8_t *)pkt.req);
+    pico_pkt_temperature_req_pack((uint8_t *)pkt.req, &r);
 
     PacketHandler::instance().send_pico_request(pkt.req, PICO_PKT_LEN);
     
     success =  PacketHandler::instance().get_pico_response(pkt, PICO_PKT_TEMPERATURE_MAGIC);
+
+    // Left over from an earlier request that timed out
+    if (success && pico_pkt_temperature_is_time(pkt.resp)) {
+        success = PacketHandler::instance().get_pico_response(pkt, PICO_PKT_TEMPERATURE_MAGIC);
+    }
     
     if (success) {        
         // Unpack the temperature response message
         pico_pkt_temperature_resp_unpack((uint8_t *)pkt.resp, &tmp, &success);
     }
+
+    if (time) {
+        memset((void *)time, 0, sizeof(*time));
+    }
+
+    if (success && r.timestamp) {
+        bool have_time = false;
+
+        // Firmware without timestamps sends no second frame
+        if (PacketHandler::instance().get_pico_response(pkt, PICO_PKT_TEMPERATURE_MAGIC)) {
+            if (pico_pkt_temperature_is_time(pkt.resp)) {
+                // Unpack the timestamp frame
+                pico_pkt_temperature_time_unpack(pkt.resp, time, &have_time);
+            }
+        } else {
+            on_timestamp_missing();
+        }
+
+        if (!have_time) {
+            memset((void *)time, 0, sizeof(*time));
+        }
+    }
     
     return success;    
-}
\ No newline at end of file
+}
+
+bool send_temperature_request_async(
+    std::function<void(bool success, pico_pkt_temperature_u & tmp,
+    const pico_pkt_temperature_time_t & time)> callback) {
+    TRACE_SCOPE("pico/send_temperature_request_async");
+
+    pkt_buf pkt = {0,0,0};
+    pico_pkt_temperature_req_t r = {0};
+    r.timestamp = pico_sends_timestamps;
+
+    memset((void *)&pkt.req, 0, sizeof(pkt.req));
+
+    pico_pkt_temperature_req_pack((uint8_t *)pkt.req, &r);
+
+    // Readings from the first frame, kept until the timestamp frame arrives
+    struct Pending {
+        bool have_data;
+        bool success;
+        pico_pkt_temperature_u tmp;
+    };
+    auto pending = std::make_shared<Pending>();
+    pending->have_data = false;
+    const bool timestamp = r.timestamp;
+
+    return PacketHandler::instance().send_pico_request_async(pkt.req, PICO_PKT_TEMPERATURE_MAGIC,
+        [callback, pending, timestamp](bool success, const uint8_t *resp) {
+            pico_pkt_temperature_time_t time = {0};
+
+            if (success && !pico_pkt_temperature_is_time(resp)) {
+                // Unpack the temperature response message
+                memset((void *)&pending->tmp, 0, sizeof(pending->tmp));
+                pico_pkt_temperature_resp_unpack(resp, &pending->tmp, &pending->success);
+                pending->have_data = true;
+                if (timestamp) {
+                    return;
+                }
+            } else if (success && !timestamp) {
+                // Left over from an earlier request that timed out
+                return;
+            } else if (success) {
+                bool have_time = false;
+                // Unpack the timestamp frame
+                pico_pkt_temperature_time_unpack(resp, &time, &have_time);
+                if (!have_time) {
+                    memset((void *)&time, 0, sizeof(time));
+                }
+            }
+
+            // Firmware without timestamps sends no second frame, so the
+            // request times out with the readings already in hand
+            if (!success && pending->have_data) {
+                on_timestamp_missing();
+            }
+
+            success = pending->have_data && pending->success;
+
+            if (callback) {
+                callback(success, pending->tmp, time);
+            }
+        },
+        [timestamp](const uint8_t *resp) {
+            return (pico_pkt_temperature_is_time(resp) == timestamp);
+        });
+}
+
+void init_temperature() {
+    PacketHandler::RequestLock lock;
+    pkt_buf pkt = {0,0,0};
+    pico_pkt_temperature_req_t r = {0};
+    r.configure = true;
+    r.sample_rate_hz = static_cast<uint16_t>(appSettings.pico_sample_rate_hz);
+    r.window_ms = static_cast<uint16_t>(appSettings.pico_sample_window_ms);
+
+    memset((void *)&pkt.req, 0, sizeof(pkt.req));
+    memset((void *)&pkt.resp, 0, sizeof(pkt.resp));
+
+    pico_pkt_temperature_req_pack((uint8_t *)pkt.req, &r);
+
+    PacketHandler::instance().send_pico_request(pkt.req, PICO_PKT_LEN);
+
+    if (!PacketHandler::instance().get_pico_response(pkt, PICO_PKT_TEMPERATURE_MAGIC)) {
+        fmt::println(stderr, "Failed to set the Pico sample rate");
+    }
+}
+
+int64_t get_temperature_timestamp_ms(const pico_pkt_temperature_time_t & time) {
+    int64_t timestamp_ms = 0;
+
+    if ((time.num_samples == 0) || !picod::PicoClock::instance().to_host_ms(
+        time.start_us + (time.length_us / 2), timestamp_ms)) {
+        return 0;
+    }
+
+    return timestamp_ms;
+}
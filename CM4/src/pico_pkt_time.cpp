@@ -0,0 +1,94 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdio.h>
+#include <cstring> // memset
+#include "Utils.hpp"
+#include "pico_pkt_time.h"
+#include "PicoClock.hpp"
+#include "PacketHandler.hpp"
+#include "Trace.hpp"
+
+void pkt_time(struct pkt_buf *b) {
+    pico_pkt_time_t p = {0};
+
+    // Unpack the time response message
+    pico_pkt_time_resp_unpack(b->resp, &p);
+
+    printf("Pico time: %llu (us), Turnaround: %u (us), Tag: %llu\n",
+        (unsigned long long)p.pico_time_us, p.turnaround_us, (unsigned long long)p.tag);
+
+    printf("Success: %s\n", BOOLEAN_TO_STR(p.success));
+}
+
+bool send_time_request() {
+    TRACE_SCOPE("pico/send_time_request");
+    PacketHandler::RequestLock lock;
+    pkt_buf pkt = {0,0,0};
+    memset((void *)&pkt.req, 0, sizeof(pkt.req));
+    memset((void *)&pkt.resp, 0, sizeof(pkt.resp));
+
+    const int64_t host_send_us = picod::PicoClock::now_us();
+
+    // Pack the time request message. The tag matches the response to this request.
+    pico_pkt_time_req_pack((uint8_t *)pkt.req, static_cast<uint64_t>(host_send_us));
+
+    PacketHandler::instance().send_pico_request(pkt.req, PICO_PKT_LEN);
+
+    if (!PacketHandler::instance().get_pico_response(pkt, PICO_PKT_TIME_MAGIC)) {
+        return false;
+    }
+
+    const int64_t host_recv_us = picod::PicoClock::now_us();
+    pico_pkt_time_t p = {0};
+
+    // Unpack the time response message
+    pico_pkt_time_resp_unpack(pkt.resp, &p);
+
+    if (!p.success || (p.tag != static_cast<uint64_t>(host_send_us))) {
+        return false;
+    }
+
+    picod::PicoClock::instance().add_exchange(host_send_us, p.pico_time_us,
+        p.turnaround_us, host_recv_us);
+
+    return true;
+}
+
+bool send_time_request_async(std::function<void(bool success)> callback) {
+    TRACE_SCOPE("pico/send_time_request_async");
+    pkt_buf pkt = {0,0,0};
+    memset((void *)&pkt.req, 0, sizeof(pkt.req));
+
+    // A request queued behind others is sent later than this, which only
+    // adds to its delay. The slowest exchanges are not used.
+    const int64_t host_send_us = picod::PicoClock::now_us();
+
+    // Pack the time request message. The tag matches the response to this request.
+    pico_pkt_time_req_pack((uint8_t *)pkt.req, static_cast<uint64_t>(host_send_us));
+
+    return PacketHandler::instance().send_pico_request_async(pkt.req, PICO_PKT_TIME_MAGIC,
+        [callback, host_send_us](bool success, const uint8_t *resp) {
+            const int64_t host_recv_us = picod::PicoClock::now_us();
+
+            if (success) {
+                pico_pkt_time_t p = {0};
+
+                // Unpack the time response message
+                pico_pkt_time_resp_unpack(resp, &p);
+                success = p.success && (p.tag == static_cast<uint64_t>(host_send_us));
+
+                if (success) {
+                    picod::PicoClock::instance().add_exchange(host_send_us, p.pico_time_us,
+                        p.turnaround_us, host_recv_us);
+                }
+            }
+
+            if (callback) {
+                callback(success);
+            }
+        });
+}
@@ -12,6 +12,7 @@
 #include <unistd.h>
 #include "Utils.hpp"
 #include "PacketHandler.hpp"
+#include "Trace.hpp"
 
 void pkt_version(struct pkt_buf *b) {    
     static std::string picoVersion;
@@ -39,6 +40,7 @@ void pkt_version(struct pkt_buf *b) {
 }
 
 void send_pico_version_read_request(int fd) {
+    TRACE_SCOPE("pico/send_pico_version_read_request");
     pkt_buf pkt = {0,0,0};
     memset((void *)&pkt.req, 0, sizeof(pkt.req));
     memset((void *)&pkt.resp, 0, sizeof(pkt.resp));
@@ -50,6 +52,7 @@ void send_pico_version_read_request(int fd) {
 }
 
 void get_pico_version(std::string & picoVersion) {
+    PacketHandler::RequestLock lock;
     bool pico_version_sop = false;   // Start of packet
     bool pico_version_eop = false;   // End of packet
 
@@ -13,6 +13,7 @@
 #include "Utils.hpp"
 #include "pico_pkt_watchdog.h"
 #include "PacketHandler.hpp"
+#include "Trace.hpp"
 
 void pkt_watchdog(struct pkt_buf *b) {    
     pico_pkt_watchdog_t s = {0};
@@ -28,6 +29,8 @@ void pkt_watchdog(struct pkt_buf *b) {
 }
 
 bool send_watchdog_request(pico_pkt_watchdog_t & s) {
+    TRACE_SCOPE("pico/send_watchdog_request");
+    PacketHandler::RequestLock lock;
     pkt_buf pkt = {0,0,0};
     memset((void *)&pkt.req, 0, sizeof(pkt.req));
     memset((void *)&pkt.resp, 0, sizeof(pkt.resp));
@@ -50,6 +53,32 @@ bool send_watchdog_request(pico_pkt_watchdog_t & s) {
     return success;
 }
 
+bool send_watchdog_request_async(const pico_pkt_watchdog_t & s,
+    std::function<void(bool success, pico_pkt_watchdog_t & s)> callback) {
+    TRACE_SCOPE("pico/send_watchdog_request_async");
+    pkt_buf pkt = {0,0,0};
+    memset((void *)&pkt.req, 0, sizeof(pkt.req));
+    pico_pkt_watchdog_t req = s;
+
+    // Pack the watchdog request message
+    pico_pkt_watchdog_req_pack((uint8_t *)pkt.req, &req);
+
+    return PacketHandler::instance().send_pico_request_async(pkt.req, PICO_PKT_WATCHDOG_MAGIC,
+        [callback](bool success, const uint8_t *resp) {
+            pico_pkt_watchdog_t s = {0};
+
+            if (success) {
+                // Unpack the watchdog response message
+                pico_pkt_watchdog_unpack(resp, &s);
+                success = s.success;
+            }
+
+            if (callback) {
+                callback(success, s);
+            }
+        });
+}
+
 void init_watchdog() {
     pico_pkt_watchdog_t s = {0};
     pkt_buf pkt = {0,0,0};
@@ -0,0 +1,135 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include "cxxopts.hpp"
+#include "PacketCapture.hpp"
+#include "PacketHandler.hpp"
+#include "settings.hpp"
+#include "fmt/core.h"
+
+using namespace picod;
+
+picod::Settings appSettings;
+
+/// @brief Prints one record: time since the first record, direction, magic and bytes
+static void print_record(const PacketCapture::Record & rec, int64_t first_us) {
+    const uint8_t magic = rec.frame[PKT_MAGIC_IDX];
+    std::string bytes;
+    for (auto b : rec.frame) {
+        bytes += fmt::format(" {:02x}", b);
+    }
+
+    fmt::println("{:>12.6f} {} '{}'{}", (rec.time_us - first_us) / 1e6,
+        (rec.type == PacketCapture::TX) ? "TX" : "RX",
+        ((magic >= 0x20) && (magic < 0x7f)) ? (char)magic : '?', bytes);
+}
+
+int main(int argc, char const *argv[])
+{
+    try
+    {
+        std::unique_ptr<cxxopts::Options> allocated(new cxxopts::Options(argv[0],
+            "Replays a picod serial link capture through its packet handler"));
+        auto& options = *allocated;
+
+        options
+        .set_width(70)
+        .set_tab_expansion()
+        .positional_help("<capture_path>.0 [<capture_path>.1 ...]")
+        .add_options()
+        ("s,speed", "Replay speed, relative to the recorded one. 0 replays as fast as possible.", cxxopts::value<double>()->default_value("1"))
+        ("r,repeat", "Number of times to replay the capture", cxxopts::value<uint32_t>()->default_value("1"))
+        ("v,verbose", "Print every frame", cxxopts::value<bool>()->default_value("false"))
+        ("files", "Capture files", cxxopts::value<std::vector<std::string>>())
+        ("h,help", "Print help")
+        ;
+
+        options.parse_positional({"files"});
+        auto result = options.parse(argc, argv);
+
+        if (result.count("help") || !result.count("files")) {
+            std::cout << options.help() << std::endl;
+            return result.count("help") ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+
+        const double speed = result["speed"].as<double>();
+        const uint32_t repeat = result["repeat"].as<uint32_t>();
+        const bool verbose = result["verbose"].as<bool>();
+
+        PacketCapture::Reader reader;
+        std::string error;
+        if (!reader.open(result["files"].as<std::vector<std::string>>(), error)) {
+            fmt::println(stderr, "error: {}", error);
+            return EXIT_FAILURE;
+        }
+
+        auto & handler = PacketHandler::instance();
+        handler.set_replay_mode(true);
+
+        uint64_t tx_frames = 0;
+        uint64_t rx_frames = 0;
+        std::chrono::nanoseconds feed_time(0);
+        const auto replay_start = std::chrono::steady_clock::now();
+
+        for (uint32_t pass = 0; pass < repeat; pass++) {
+            PacketCapture::Record rec;
+            int64_t first_us = 0;
+            bool first = true;
+            const auto pass_start = std::chrono::steady_clock::now();
+
+            reader.rewind();
+            while (reader.next(rec)) {
+                if (first) {
+                    first_us = rec.time_us;
+                    first = false;
+                }
+
+                if (speed > 0.0) {
+                    std::this_thread::sleep_until(pass_start +
+                        std::chrono::microseconds((int64_t)((rec.time_us - first_us) / speed)));
+                }
+
+                if (verbose) {
+                    print_record(rec, first_us);
+                }
+
+                if (rec.type == PacketCapture::TX) {
+                    tx_frames++;
+                    continue;
+                }
+
+                const auto t0 = std::chrono::steady_clock::now();
+                handler.feed(rec.frame.data(), rec.frame.size());
+                feed_time += std::chrono::steady_clock::now() - t0;
+                rx_frames++;
+            }
+        }
+
+        const double elapsed_s = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - replay_start).count();
+        auto s = handler.stats();
+
+        fmt::println("Replayed {} frames sent and {} received in {:.3f} s{}",
+            tx_frames, rx_frames, elapsed_s,
+            (reader.truncated() > 0) ? fmt::format(" ({} truncated records skipped)", reader.truncated()) : "");
+        fmt::println("Received: {} responses to queued requests, {} to asynchronous requests, "
+            "{} shutdown requests, {} out of sync",
+            s.queued, s.async_responses, s.shutdown_requests, s.out_of_sync);
+        if (rx_frames > 0) {
+            fmt::println("Packet handler: {:.1f} ns per received frame",
+                (double)feed_time.count() / rx_frames);
+        }
+
+    } catch (const cxxopts::exceptions::exception& e) {
+        fmt::println("error parsing options: {}", e.what());
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,171 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#include <signal.h>
+#include <unistd.h>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include "cxxopts.hpp"
+#include "PicoSim.hpp"
+#include "fmt/core.h"
+
+using namespace picod;
+
+static std::atomic<bool> quit(false);
+
+static void signal_handler(int signum) {
+    quit = true;
+}
+
+/// @brief Applies one "[@<seconds>] <channel>=<waveform>" waveform setting
+/// @throws std::invalid_argument if the setting is malformed
+static void set_waveform(PicoSim & sim, const std::string & setting) {
+    std::string s = setting;
+    double start_s = 0.0;
+
+    if (!s.empty() && (s[0] == '@')) {
+        size_t end = s.find_first_of(" \t");
+        start_s = std::stod(s.substr(1, end - 1));
+        s = (end == std::string::npos) ? "" : s.substr(s.find_first_not_of(" \t", end));
+    }
+
+    const size_t eq = s.find('=');
+    PicoSim::Channel channel;
+    if ((eq == std::string::npos) || !PicoSim::get_channel(s.substr(0, eq), channel)) {
+        throw std::invalid_argument("expected <channel>=<waveform>: " + setting);
+    }
+
+    sim.set_waveform(channel, start_s, Waveform::parse(s.substr(eq + 1)));
+}
+
+/// @brief Applies the waveform settings of a script, one per line. Lines
+/// starting with '#' are comments.
+static void load_script(PicoSim & sim, const std::string & path) {
+    std::ifstream f(path);
+    if (!f) {
+        throw std::invalid_argument("cannot open " + path);
+    }
+
+    std::string line;
+    while (std::getline(f, line)) {
+        const size_t first = line.find_first_not_of(" \t");
+        if ((first == std::string::npos) || (line[first] == '#')) {
+            continue;
+        }
+
+        set_waveform(sim, line.substr(first, line.find_last_not_of(" \t\r") + 1 - first));
+    }
+}
+
+int main(int argc, char const *argv[])
+{
+    try
+    {
+        std::unique_ptr<cxxopts::Options> allocated(new cxxopts::Options(argv[0], "Simulated RPi Pico for picod"));
+        auto& options = *allocated;
+
+        options
+        .set_width(70)
+        .set_tab_expansion()
+        .add_options()
+        ("w,wave", "Waveform of a channel: [@<seconds>] <channel>=<waveform>. Channels: ntc1 to ntc4, pico, fan1, cm4_fan. May be repeated.", cxxopts::value<std::vector<std::string>>())
+        ("s,script", "File of waveform settings, one per line", cxxopts::value<std::string>())
+        ("l,link", "Symbolic link to create to the simulated serial port", cxxopts::value<std::string>())
+        ("latency", "Time to handle a request (us)", cxxopts::value<uint32_t>()->default_value("100"))
+        ("jitter", "Up to this much is added to the latency at random (us)", cxxopts::value<uint32_t>()->default_value("0"))
+        ("drop-rate", "Probability of a byte being lost [0 to 1]", cxxopts::value<double>()->default_value("0"))
+        ("corrupt-rate", "Probability of a byte being corrupted [0 to 1]", cxxopts::value<double>()->default_value("0"))
+        ("drop-response", "Drop the response to the n-th request (from 1), 0 for none", cxxopts::value<uint64_t>()->default_value("0"))
+        ("baud", "Baud rate the frames are paced at, 0 for no pacing", cxxopts::value<uint32_t>()->default_value("115200"))
+        ("drift", "Pico clock drift (ppm)", cxxopts::value<double>()->default_value("0"))
+        ("seed", "Random seed, for repeatable runs", cxxopts::value<uint64_t>()->default_value("1"))
+        ("flash", "File standing in for the Pico flash, keeps saved settings across runs", cxxopts::value<std::string>())
+        ("v,verbose", "Print every frame", cxxopts::value<bool>()->default_value("false"))
+        ("h,help", "Print help")
+        ;
+
+        auto result = options.parse(argc, argv);
+
+        if (result.count("help")) {
+            std::cout << options.help() << std::endl;
+            std::cout << "Waveforms: const:<v>, sine:<mean>,<amplitude>,<period_s>[,<phase_s>]," << std::endl
+                << "  square:<low>,<high>,<period_s>[,<duty>], ramp:<from>,<to>,<period_s>," << std::endl
+                << "  triangle:<from>,<to>,<period_s>, duty:<max_rpm>[,<stall_pct>] (fans)," << std::endl
+                << "  each optionally followed by +noise:<sd>" << std::endl;
+            return EXIT_SUCCESS;
+        }
+
+        PicoSim::Options opts = {
+            .latency_us = result["latency"].as<uint32_t>(),
+            .jitter_us = result["jitter"].as<uint32_t>(),
+            .drop_rate = result["drop-rate"].as<double>(),
+            .corrupt_rate = result["corrupt-rate"].as<double>(),
+            .drop_response = result["drop-response"].as<uint64_t>(),
+            .baud_rate = result["baud"].as<uint32_t>(),
+            .clock_drift_ppm = result["drift"].as<double>(),
+            .seed = result["seed"].as<uint64_t>(),
+            .flash_path = result.count("flash") ? result["flash"].as<std::string>() : "",
+            .verbose = result["verbose"].as<bool>()
+        };
+
+        PicoSim sim(opts);
+
+        if (result.count("script")) {
+            load_script(sim, result["script"].as<std::string>());
+        }
+
+        if (result.count("wave")) {
+            for (auto const& setting : result["wave"].as<std::vector<std::string>>()) {
+                set_waveform(sim, setting);
+            }
+        }
+
+        std::string device_path;
+        if (!sim.open(device_path)) {
+            return EXIT_FAILURE;
+        }
+
+        std::string link;
+        if (result.count("link")) {
+            link = result["link"].as<std::string>();
+            unlink(link.c_str());
+            if (symlink(device_path.c_str(), link.c_str()) != 0) {
+                fmt::println(stderr, "Failed to create {}: {}", link, strerror(errno));
+                return EXIT_FAILURE;
+            }
+        }
+
+        fmt::println("Simulated Pico on {}{}", device_path, link.empty() ? "" : " (" + link + ")");
+        fmt::println("Set pico_serial_device_path to it in picod.conf");
+
+        signal(SIGINT, signal_handler);
+        signal(SIGTERM, signal_handler);
+
+        sim.run(quit);
+
+        if (!link.empty()) {
+            unlink(link.c_str());
+        }
+
+        auto s = sim.stats();
+        fmt::println("Received {} frames, sent {}. Bytes dropped: {}, corrupted: {}. "
+            "Partial frames dropped: {}, overruns: {}, out of sync: {}, responses dropped: {}",
+            s.rx_frames, s.tx_frames, s.dropped_bytes, s.corrupted_bytes,
+            s.rx_timeouts, s.rx_overruns, s.out_of_sync, s.dropped_responses);
+
+    } catch (const cxxopts::exceptions::exception& e) {
+        fmt::println("error parsing options: {}", e.what());
+        return EXIT_FAILURE;
+    } catch (const std::invalid_argument& e) {
+        fmt::println("error: {}", e.what());
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,467 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#include <sys/utsname.h>
+#include <unistd.h>
+#include <array>
+#include <filesystem>
+#include <fstream>
+#include <regex>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include "cxxopts.hpp"
+#include "Bench.hpp"
+#include "InfluxDB.hpp"
+#include "LatencyHistogram.hpp"
+#include "PacketHandler.hpp"
+#include "SensorHistory.hpp"
+#include "SensorID.hpp"
+#include "WebServer.hpp"
+#include "Utils.hpp"
+#include "settings.hpp"
+#include "version.h"
+#include "pico_pkt_event_log.h"
+#include "pico_pkt_fan_pwm.h"
+#include "pico_pkt_temperature.h"
+#include "pico_pkt_time.h"
+#include "pico_pkt_watchdog.h"
+#include "fmt/core.h"
+
+using namespace picod;
+
+picod::Settings appSettings;
+
+/// @brief Exit status when a benchmark regressed against the baseline
+#define EXIT_REGRESSION 2
+
+typedef std::array<uint8_t, PICO_PKT_LEN> Frame;
+
+/// @brief Readings as the Pico would report them
+static pico_pkt_temperature_u sample_temperatures() {
+    pico_pkt_temperature_u t = {};
+    t.s.ntc1 = 36.2f;
+    t.s.ntc2 = 34.5f;
+    t.s.ntc3 = 34.8f;
+    t.s.ntc4 = 33.0f;
+    t.s.pico = 37.4f;
+    t.s.fan1rpm = 3420;
+    t.s.cm4_fan_rpm = 0;
+    return t;
+}
+
+/// @brief Pack/unpack inlines of pico/pico_pkt_*.h
+static void add_packet_benchmarks(Bench & bench) {
+    bench.add("pkt/temperature_resp_pack", [](uint64_t n) {
+        Frame buf = {};
+        auto t = sample_temperatures();
+        for (uint64_t i = 0; i < n; i++) {
+            t.s.fan1rpm = i;
+            pico_pkt_temperature_resp_pack(buf.data(), &t, PICO_TEMPERATURE_STAT_MEAN, true);
+            Bench::keep(buf);
+        }
+    });
+
+    bench.add("pkt/temperature_resp_unpack", [](uint64_t n) {
+        Frame buf = {};
+        auto in = sample_temperatures();
+        pico_pkt_temperature_resp_pack(buf.data(), &in, PICO_TEMPERATURE_STAT_MEAN, true);
+        for (uint64_t i = 0; i < n; i++) {
+            pico_pkt_temperature_u t;
+            bool success;
+            Bench::keep(buf);
+            pico_pkt_temperature_resp_unpack(buf.data(), &t, &success);
+            Bench::keep(t);
+        }
+    });
+
+    bench.add("pkt/temperature_time_unpack", [](uint64_t n) {
+        Frame buf = {};
+        pico_pkt_temperature_time_t in = { .start_us = 123456789012, .length_us = 1000000, .num_samples = 1000 };
+        pico_pkt_temperature_time_pack(buf.data(), &in, true);
+        for (uint64_t i = 0; i < n; i++) {
+            pico_pkt_temperature_time_t t;
+            bool success;
+            Bench::keep(buf);
+            pico_pkt_temperature_time_unpack(buf.data(), &t, &success);
+            Bench::keep(t);
+        }
+    });
+
+    bench.add("pkt/fan_pwm_req_pack", [](uint64_t n) {
+        Frame buf = {};
+        pico_pkt_fan_pwm_t fans[NUM_PWM_FANS] = {
+            { .fan_id = SYS_FAN1, .pwm_pct = 0.5f }, { .fan_id = CM4_FAN, .pwm_pct = 0.35f } };
+        for (uint64_t i = 0; i < n; i++) {
+            Bench::keep(fans);
+            pico_pkt_fan_pwm_req_pack(buf.data(), fans, true);
+            Bench::keep(buf);
+        }
+    });
+
+    bench.add("pkt/fan_pwm_unpack", [](uint64_t n) {
+        Frame buf = {};
+        pico_pkt_fan_pwm_t in[NUM_PWM_FANS] = {
+            { .fan_id = SYS_FAN1, .pwm_pct = 0.5f }, { .fan_id = CM4_FAN, .pwm_pct = 0.35f } };
+        pico_pkt_fan_pwm_resp_pack(buf.data(), in, false, true);
+        for (uint64_t i = 0; i < n; i++) {
+            pico_pkt_fan_pwm_t fans[NUM_PWM_FANS] = {};
+            bool write, success;
+            Bench::keep(buf);
+            pico_pkt_fan_pwm_unpack(buf.data(), fans, &write, &success);
+            Bench::keep(fans);
+        }
+    });
+
+    bench.add("pkt/watchdog_unpack", [](uint64_t n) {
+        Frame buf = {};
+        pico_pkt_watchdog_t in = {};
+        in.enable = true;
+        in.timeout = 60;
+        in.max_retries = 3;
+        in.success = true;
+        pico_pkt_watchdog_resp_pack(buf.data(), &in);
+        for (uint64_t i = 0; i < n; i++) {
+            pico_pkt_watchdog_t w;
+            Bench::keep(buf);
+            pico_pkt_watchdog_unpack(buf.data(), &w);
+            Bench::keep(w);
+        }
+    });
+
+    bench.add("pkt/time_resp_unpack", [](uint64_t n) {
+        Frame req = {}, buf = {};
+        pico_pkt_time_req_pack(req.data(), 0x0123456789abcdef);
+        pico_pkt_time_t in = { .tag = 0, .pico_time_us = 98765432100, .turnaround_us = 40, .success = true };
+        pico_pkt_time_resp_pack(buf.data(), req.data(), &in);
+        for (uint64_t i = 0; i < n; i++) {
+            pico_pkt_time_t t;
+            Bench::keep(buf);
+            pico_pkt_time_resp_unpack(buf.data(), &t);
+            Bench::keep(t);
+        }
+    });
+
+    bench.add("pkt/event_log_unpack", [](uint64_t n) {
+        Frame buf = {};
+        pico_event_t in = { .seq = 1234, .time_ms = 5678000, .boot = 12,
+            .type = PICO_EVENT_WATCHDOG_RESET, .data = 2 };
+        pico_pkt_event_log_entry_pack(buf.data(), &in);
+        for (uint64_t i = 0; i < n; i++) {
+            pico_event_t e;
+            pico_event_log_status_t s;
+            bool success;
+            Bench::keep(buf);
+            Bench::keep(pico_pkt_event_log_unpack(buf.data(), &e, &s, &success));
+            Bench::keep(e);
+        }
+    });
+}
+
+/// @brief Frame parsing and dispatch of the bytes read from the serial port
+static void add_handler_benchmarks(Bench & bench) {
+    auto & handler = PacketHandler::instance();
+    handler.set_replay_mode(true);
+
+    // A temperature response, as the Pico sends one every poll
+    static Frame frame = {};
+    auto t = sample_temperatures();
+    pico_pkt_temperature_resp_pack(frame.data(), &t, PICO_TEMPERATURE_STAT_MEAN, true);
+
+    bench.add("handler/feed_frame", [&handler](uint64_t n) {
+        for (uint64_t i = 0; i < n; i++) {
+            handler.feed(frame.data(), frame.size());
+        }
+    });
+
+    // The serial port may return a frame in several reads
+    bench.add("handler/feed_split_frame", [&handler](uint64_t n) {
+        for (uint64_t i = 0; i < n; i++) {
+            handler.feed(&frame[0], 5);
+            handler.feed(&frame[5], 5);
+            handler.feed(&frame[10], PICO_PKT_LEN - 10);
+        }
+    });
+}
+
+/// @brief Sensor history, filled to capacity
+static void add_history_benchmarks(Bench & bench) {
+    auto & history = SensorHistory::instance();
+    const auto t = sample_temperatures();
+    const int64_t interval_ms = static_cast<int64_t>(appSettings.temperature_poll_interval_seconds * 1000.0);
+    const size_t capacity = static_cast<size_t>(appSettings.sensor_history_in_seconds /
+        appSettings.temperature_poll_interval_seconds);
+    const int64_t start_ms = SensorHistory::now_ms() - (capacity + 1) * interval_ms;
+
+    for (size_t i = 0; i < capacity; i++) {
+        const int64_t ts = start_ms + i * interval_ms;
+        for (int ch = 0; ch < NUM_NTC_SENSORS; ch++) {
+            history.addTemperature(appSettings.sensorIds[ch], t.data[ch], ts);
+        }
+        history.addTemperature(appSettings.sensorIds[RPi_Pico], t.s.pico, ts);
+        history.addTemperature(appSettings.sensorIds[Under_CM4_SOC], 36.0f, ts);
+        history.addTachometer(appSettings.sensorIds[System_FAN_J17], t.s.fan1rpm, ts);
+        history.addTachometer(appSettings.sensorIds[CM4_FAN_J18], t.s.cm4_fan_rpm, ts);
+    }
+
+    // Every reading of one poll, as pico_monitor adds them
+    bench.add("history/append_poll", [&history, t](uint64_t n) {
+        for (uint64_t i = 0; i < n; i++) {
+            for (int ch = 0; ch < NUM_NTC_SENSORS; ch++) {
+                history.addTemperature(appSettings.sensorIds[ch], t.data[ch]);
+            }
+            history.addTemperature(appSettings.sensorIds[RPi_Pico], t.s.pico);
+            history.addTemperature(appSettings.sensorIds[Under_CM4_SOC], 36.0f);
+            history.addTachometer(appSettings.sensorIds[System_FAN_J17], t.s.fan1rpm);
+            history.addTachometer(appSettings.sensorIds[CM4_FAN_J18], t.s.cm4_fan_rpm);
+        }
+    });
+
+    bench.add("history/series_all", [&history](uint64_t n) {
+        for (uint64_t i = 0; i < n; i++) {
+            Bench::keep(history.series(appSettings.sensorIds[RPi_Pico], 0, SensorHistory::now_ms()).size());
+        }
+    });
+
+    bench.add("history/series_60_points", [&history](uint64_t n) {
+        for (uint64_t i = 0; i < n; i++) {
+            Bench::keep(history.series(appSettings.sensorIds[RPi_Pico], 0, SensorHistory::now_ms(), 60).size());
+        }
+    });
+
+    bench.add("history/stats", [&history](uint64_t n) {
+        SensorHistory::Stats s;
+        for (uint64_t i = 0; i < n; i++) {
+            Bench::keep(history.stats(appSettings.sensorIds[System_FAN_J17], 0, SensorHistory::now_ms(), s));
+            Bench::keep(s);
+        }
+    });
+}
+
+/// @brief Server-sent events and /api/status
+static void add_web_benchmarks(Bench & bench) {
+    bench.add("sse/build_history_event", [](uint64_t n) {
+        for (uint64_t i = 0; i < n; i++) {
+            Bench::keep(WebServer::build_history_event().size());
+        }
+    });
+
+    bench.add("sse/serialize_event", [](uint64_t n) {
+        auto j = WebServer::build_history_event();
+        for (uint64_t i = 0; i < n; i++) {
+            Bench::keep(WebServer::to_event(j, i).size());
+        }
+    });
+
+    bench.add("status/build_api_status", [](uint64_t n) {
+        WebServer::PicoReadings r = {};
+        r.has_fan_pwm = true;
+        r.fanInfo = { { .fan_id = SYS_FAN1, .pwm_pct = 0.5f }, { .fan_id = CM4_FAN, .pwm_pct = 0.35f } };
+        r.has_watchdog = true;
+        r.watchdog.timeout = 60;
+        r.has_temperature = true;
+        r.temperature = sample_temperatures();
+        r.tmp103_c = 36.0f;
+        r.has_temperature_max = true;
+        r.temperature_max = sample_temperatures();
+
+        for (uint64_t i = 0; i < n; i++) {
+            Bench::keep(WebServer::build_pico_status(r).dump().size());
+        }
+    });
+}
+
+/// @brief Rendering of the home page template
+static void add_template_benchmarks(Bench & bench, const std::string & webroot) {
+    const auto path = std::filesystem::path(webroot) / "templates" / "index.html";
+    if (!std::filesystem::is_regular_file(path)) {
+        fmt::println(stderr, "Skipping template/render_index: {} not found, see --webroot", path.string());
+        return;
+    }
+
+    const std::string source = read_file(path.string());
+
+    bench.add("template/render_index", [source](uint64_t n) {
+        // The variables of the / route
+        nlohmann::json vars;
+        vars["__version__"] = VERSION_STR;
+        vars["fan_pwm_pct"] = { {"System_Fan_J17", 50}, {"CM4_FAN_J18", 35} };
+        vars["watchdog.timeout_sec"] = 60;
+        vars["watchdog.max_retries"] = 3;
+        vars["watchdog.is_enabled"] = "checked";
+
+        for (uint64_t i = 0; i < n; i++) {
+            std::ostringstream os;
+            WebServer::render_template(os, source, vars);
+            Bench::keep(os.tellp());
+        }
+    });
+}
+
+/// @brief InfluxDB line protocol encoding of one poll
+static void add_influx_benchmarks(Bench & bench) {
+    bench.add("influx/encode_poll", [](uint64_t n) {
+        auto & influx = InfluxDB::instance();
+        const auto t = sample_temperatures();
+        const int64_t ts = SensorHistory::now_ms();
+
+        for (uint64_t i = 0; i < n; i++) {
+            for (int ch = 0; ch < NUM_NTC_SENSORS; ch++) {
+                influx.addTemperature(appSettings.sensorIds[ch], t.data[ch], ts);
+            }
+            influx.addTemperature(appSettings.sensorIds[RPi_Pico], t.s.pico, ts);
+            influx.addTachometer(appSettings.sensorIds[System_FAN_J17], t.s.fan1rpm, ts);
+            influx.addTemperature(appSettings.sensorIds[Under_CM4_SOC], 36.0f);
+            Bench::keep(influx.takeLines().size());
+        }
+    });
+}
+
+/// @brief Recording a duration into a latency histogram, and its percentiles
+static void add_latency_benchmarks(Bench & bench) {
+    static LatencyHistogram histogram;
+
+    bench.add("latency/record", [](uint64_t n) {
+        for (uint64_t i = 0; i < n; i++) {
+            // Spread over the buckets of a 1 s poll cycle
+            histogram.record((int64_t)((i * 7919) % 1000000));
+        }
+    });
+
+    bench.add("latency/summarize", [](uint64_t n) {
+        for (uint64_t i = 0; i < n; i++) {
+            Bench::keep(LatencyHistogram::summarize(histogram.snapshot()).p99_us);
+        }
+    });
+}
+
+/// @brief Describes the machine and build, so results are only compared
+/// between like runs
+static nlohmann::ordered_json machine_info() {
+    nlohmann::ordered_json j;
+    struct utsname u;
+    if (uname(&u) == 0) {
+        j["system"] = u.sysname;
+        j["release"] = u.release;
+        j["arch"] = u.machine;
+        j["hostname"] = u.nodename;
+    }
+    j["cpus"] = sysconf(_SC_NPROCESSORS_ONLN);
+    j["compiler"] = __VERSION__;
+#ifdef NDEBUG
+    j["build"] = "release";
+#else
+    j["build"] = "debug";
+#endif
+    return j;
+}
+
+int main(int argc, char const *argv[])
+{
+    try
+    {
+        std::unique_ptr<cxxopts::Options> allocated(new cxxopts::Options(argv[0],
+            "Micro-benchmarks of picod. Exits with status 2 if a benchmark regressed against the baseline."));
+        auto& options = *allocated;
+
+        options
+        .set_width(70)
+        .set_tab_expansion()
+        .add_options()
+        ("f,filter", "Only run the benchmarks matching this regular expression", cxxopts::value<std::string>()->default_value(""))
+        ("min-time", "Shortest duration of one repetition (s)", cxxopts::value<double>()->default_value("0.2"))
+        ("r,repetitions", "Number of timed repetitions of each benchmark", cxxopts::value<uint32_t>()->default_value("5"))
+        ("webroot", "Website directory, for the template benchmark", cxxopts::value<std::string>()->default_value(appSettings.webroot_path))
+        ("b,baseline", "Results of an earlier run to compare against", cxxopts::value<std::string>())
+        ("threshold", "Slowdown (%) against the baseline counted as a regression", cxxopts::value<double>()->default_value("10"))
+        ("l,list", "List the benchmarks and exit", cxxopts::value<bool>()->default_value("false"))
+        ("label", "Name of the run, copied to the results", cxxopts::value<std::string>()->default_value(""))
+        ("o,output", "Write the JSON results to a file instead of stdout", cxxopts::value<std::string>())
+        ("h,help", "Print help")
+        ;
+
+        auto result = options.parse(argc, argv);
+
+        if (result.count("help")) {
+            std::cout << options.help() << std::endl;
+            return EXIT_SUCCESS;
+        }
+
+        nlohmann::json baseline;
+        if (result.count("baseline")) {
+            std::ifstream f(result["baseline"].as<std::string>());
+            if (!f) {
+                fmt::println(stderr, "Failed to open {}", result["baseline"].as<std::string>());
+                return EXIT_FAILURE;
+            }
+            baseline = nlohmann::json::parse(f);
+        }
+
+        Bench::Options opts = {
+            .filter = result["filter"].as<std::string>(),
+            .min_time_s = result["min-time"].as<double>(),
+            .repetitions = result["repetitions"].as<uint32_t>()
+        };
+
+        Bench bench(opts);
+        add_packet_benchmarks(bench);
+        add_handler_benchmarks(bench);
+        add_history_benchmarks(bench);
+        add_web_benchmarks(bench);
+        add_template_benchmarks(bench, result["webroot"].as<std::string>());
+        add_influx_benchmarks(bench);
+        add_latency_benchmarks(bench);
+
+        if (result["list"].as<bool>()) {
+            for (auto const& name : bench.names()) {
+                fmt::println("{}", name);
+            }
+            return EXIT_SUCCESS;
+        }
+
+        bench.run();
+
+        std::vector<std::string> regressions;
+        if (result.count("baseline")) {
+            regressions = bench.compare(baseline, result["threshold"].as<double>());
+        }
+
+        nlohmann::ordered_json j;
+        j["tool"] = "picod-bench";
+        j["version"] = VERSION_STR;
+        j["label"] = result["label"].as<std::string>();
+        j["machine"] = machine_info();
+        j.update(bench.results());
+        if (result.count("baseline")) {
+            j["baseline"] = { {"path", result["baseline"].as<std::string>()},
+                {"threshold_pct", result["threshold"].as<double>()}, {"regressions", regressions} };
+        }
+
+        if (result.count("output")) {
+            std::ofstream f(result["output"].as<std::string>());
+            if (!f) {
+                fmt::println(stderr, "Failed to open {}", result["output"].as<std::string>());
+                return EXIT_FAILURE;
+            }
+            f << j.dump(2) << std::endl;
+        } else {
+            std::cout << j.dump(2) << std::endl;
+        }
+
+        return regressions.empty() ? EXIT_SUCCESS : EXIT_REGRESSION;
+
+    } catch (const cxxopts::exceptions::exception& e) {
+        fmt::println("error parsing options: {}", e.what());
+        return EXIT_FAILURE;
+    } catch (const std::regex_error& e) {
+        fmt::println("error: invalid filter: {}", e.what());
+        return EXIT_FAILURE;
+    } catch (const nlohmann::json::exception& e) {
+        fmt::println("error: invalid baseline: {}", e.what());
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,124 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#include <signal.h>
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include "cxxopts.hpp"
+#include "LinkBench.hpp"
+#include "version.h"
+#include "fmt/core.h"
+
+using namespace picod;
+
+static std::atomic<bool> quit(false);
+
+static void signal_handler(int signum) {
+    quit = true;
+}
+
+/// @brief Parses a request mix: "<kind>[:<weight>],..."
+/// @throws std::invalid_argument if the mix is malformed
+static std::array<uint32_t, LinkBench::NUM_KINDS> parse_mix(const std::string & setting) {
+    std::array<uint32_t, LinkBench::NUM_KINDS> mix = {};
+    std::stringstream ss(setting);
+    std::string item;
+
+    while (std::getline(ss, item, ',')) {
+        const size_t colon = item.find(':');
+        LinkBench::Kind kind;
+        if (!LinkBench::get_kind(item.substr(0, colon), kind)) {
+            throw std::invalid_argument("unknown request type: " + item);
+        }
+        mix[kind] += (colon == std::string::npos) ? 1 : std::stoul(item.substr(colon + 1));
+    }
+
+    return mix;
+}
+
+int main(int argc, char const *argv[])
+{
+    try
+    {
+        std::unique_ptr<cxxopts::Options> allocated(new cxxopts::Options(argv[0],
+            "Measures the serial link to the RPi Pico. picod must not be running."));
+        auto& options = *allocated;
+
+        options
+        .set_width(70)
+        .set_tab_expansion()
+        .add_options()
+        ("d,device", "Pico serial port, or the link of pico-sim or firmware_host", cxxopts::value<std::string>()->default_value("/dev/ttyAMA3"))
+        ("m,mix", "Requests to send: <type>[:<weight>],... Types: ping, temperature, bundle (temperature with its timestamp frame)", cxxopts::value<std::string>()->default_value("ping"))
+        ("c,concurrency", "Most requests in flight at once", cxxopts::value<uint32_t>()->default_value("1"))
+        ("r,rate", "Requests per second, 0 to send as fast as responses allow", cxxopts::value<double>()->default_value("0"))
+        ("t,duration", "Length of the run (s)", cxxopts::value<double>()->default_value("10"))
+        ("n,requests", "Stop after this many requests, 0 for no limit", cxxopts::value<uint64_t>()->default_value("0"))
+        ("timeout", "Response timeout (ms)", cxxopts::value<uint32_t>()->default_value("1000"))
+        ("baud", "Baud rate", cxxopts::value<uint32_t>()->default_value("115200"))
+        ("progress", "Print a progress line every this many seconds, 0 never", cxxopts::value<double>()->default_value("0"))
+        ("label", "Name of the run, copied to the results", cxxopts::value<std::string>()->default_value(""))
+        ("o,output", "Write the JSON results to a file instead of stdout", cxxopts::value<std::string>())
+        ("h,help", "Print help")
+        ;
+
+        auto result = options.parse(argc, argv);
+
+        if (result.count("help")) {
+            std::cout << options.help() << std::endl;
+            return EXIT_SUCCESS;
+        }
+
+        LinkBench::Options opts = {
+            .device_path = result["device"].as<std::string>(),
+            .baud_rate = result["baud"].as<uint32_t>(),
+            .mix = parse_mix(result["mix"].as<std::string>()),
+            .concurrency = result["concurrency"].as<uint32_t>(),
+            .rate = result["rate"].as<double>(),
+            .duration_s = result["duration"].as<double>(),
+            .max_requests = result["requests"].as<uint64_t>(),
+            .timeout_ms = result["timeout"].as<uint32_t>(),
+            .progress_s = result["progress"].as<double>()
+        };
+
+        LinkBench bench(opts);
+        if (!bench.open()) {
+            return EXIT_FAILURE;
+        }
+
+        signal(SIGINT, signal_handler);
+        signal(SIGTERM, signal_handler);
+
+        bench.run(quit);
+
+        nlohmann::ordered_json j;
+        j["tool"] = "picod-linkbench";
+        j["version"] = VERSION_STR;
+        j["label"] = result["label"].as<std::string>();
+        j.update(bench.results());
+
+        if (result.count("output")) {
+            std::ofstream f(result["output"].as<std::string>());
+            if (!f) {
+                fmt::println(stderr, "Failed to open {}", result["output"].as<std::string>());
+                return EXIT_FAILURE;
+            }
+            f << j.dump(2) << std::endl;
+        } else {
+            std::cout << j.dump(2) << std::endl;
+        }
+
+    } catch (const cxxopts::exceptions::exception& e) {
+        fmt::println("error parsing options: {}", e.what());
+        return EXIT_FAILURE;
+    } catch (const std::invalid_argument& e) {
+        fmt::println("error: {}", e.what());
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,222 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#include <poll.h>
+#include <signal.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <thread>
+#include "cxxopts.hpp"
+#include "PacketHandler.hpp"
+#include "PicoSim.hpp"
+#include "pico_pkt_temperature.h"
+#include "settings.hpp"
+#include "fmt/core.h"
+
+/// Checks that the temperature poll of the OpenWrt build recovers from a
+/// lost response. picod's asynchronous requests are driven, as by uloop,
+/// from a single thread that waits for the serial port and one-shot timers
+/// expiring as early as uloop's may, against a pico-sim that drops the
+/// response to one request. Exits with a failure if polling does not resume.
+
+using namespace picod;
+
+picod::Settings appSettings;
+
+static std::atomic<bool> quit(false);
+
+static void signal_handler(int signum) {
+    quit = true;
+}
+
+/// @brief One-shot timer that expires the way a uloop_timeout can at the
+/// earliest: once less than a millisecond remains, as uloop truncates the
+/// remaining time to the millisecond.
+class LoopTimer {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    explicit LoopTimer(std::function<void()> cb) : cb_(cb), pending_(false) {}
+
+    void set(int timeout_ms) {
+        expiry_ = Clock::now() + std::chrono::milliseconds(timeout_ms);
+        pending_ = true;
+    }
+
+    /// @brief Time until the timer expires
+    /// @return False(0) if the timer is not pending
+    bool remaining(Clock::time_point now, Clock::duration & wait) const {
+        if (!pending_) {
+            return false;
+        }
+        wait = std::max(Clock::duration::zero(), expiry_ - now - EARLY);
+        return true;
+    }
+
+    /// @brief Calls the handler if the timer expired
+    void process(Clock::time_point now) {
+        if (pending_ && now >= expiry_ - EARLY) {
+            pending_ = false;
+            cb_();
+        }
+    }
+
+private:
+    static constexpr Clock::duration EARLY = std::chrono::microseconds(999);
+    std::function<void()> cb_;
+    bool pending_;
+    Clock::time_point expiry_;
+};
+
+int main(int argc, char const *argv[])
+{
+    uint32_t polls;
+    uint32_t interval_ms;
+    double max_s;
+    PicoSim::Options opts = {};
+
+    try
+    {
+        std::unique_ptr<cxxopts::Options> allocated(new cxxopts::Options(argv[0],
+            "Checks that the temperature poll resumes after a lost response"));
+        auto& options = *allocated;
+
+        options
+        .set_width(70)
+        .set_tab_expansion()
+        .add_options()
+        ("n,polls", "Temperature polls to complete", cxxopts::value<uint32_t>()->default_value("10"))
+        ("interval", "Time between polls (ms)", cxxopts::value<uint32_t>()->default_value("50"))
+        ("drop-response", "Drop the response to the n-th poll (from 1)", cxxopts::value<uint64_t>()->default_value("3"))
+        ("latency", "Time the simulated Pico takes to handle a request (us)", cxxopts::value<uint32_t>()->default_value("100"))
+        ("t,max-time", "Fail if the polls take longer than this (s)", cxxopts::value<double>()->default_value("10"))
+        ("v,verbose", "Print every frame", cxxopts::value<bool>()->default_value("false"))
+        ("h,help", "Print help")
+        ;
+
+        auto result = options.parse(argc, argv);
+
+        if (result.count("help")) {
+            std::cout << options.help() << std::endl;
+            return EXIT_SUCCESS;
+        }
+
+        polls = result["polls"].as<uint32_t>();
+        interval_ms = result["interval"].as<uint32_t>();
+        max_s = result["max-time"].as<double>();
+
+        opts.latency_us = result["latency"].as<uint32_t>();
+        opts.drop_response = result["drop-response"].as<uint64_t>();
+        opts.baud_rate = 115200;
+        opts.seed = 1;
+        opts.verbose = result["verbose"].as<bool>();
+
+    } catch (const cxxopts::exceptions::exception& e) {
+        fmt::println("error parsing options: {}", e.what());
+        return EXIT_FAILURE;
+    }
+
+    PicoSim sim(opts);
+    std::string device_path;
+    if (!sim.open(device_path)) {
+        return EXIT_FAILURE;
+    }
+
+    signal(SIGINT, signal_handler);
+    signal(SIGTERM, signal_handler);
+
+    std::atomic<bool> sim_quit(false);
+    std::thread sim_thread([&sim, &sim_quit] { sim.run(sim_quit); });
+
+    appSettings.pico_serial_device_path = device_path;
+    auto & handler = PacketHandler::instance();
+    int exit_code = EXIT_FAILURE;
+
+    if (handler.open_serial_port() == 0) {
+        uint32_t completed = 0;
+        uint32_t failed = 0;
+        std::function<void()> poll;
+
+        LoopTimer pico_timeout([&handler] { handler.service_timeouts(); });
+        LoopTimer poll_timer([&poll] { poll(); });
+
+        handler.set_timeout_scheduler([&pico_timeout](int timeout_ms) {
+            pico_timeout.set(timeout_ms);
+        });
+
+        poll = [&] {
+            bool queued = send_temperature_request_async(
+                [&](bool success, pico_pkt_temperature_u &t, const pico_pkt_temperature_time_t &time) {
+                    completed++;
+                    if (!success) {
+                        failed++;
+                        fmt::println("Poll {} failed", completed);
+                    }
+                    poll_timer.set(interval_ms);
+                });
+
+            if (!queued) {
+                poll_timer.set(interval_ms);
+            }
+        };
+
+        const auto start = LoopTimer::Clock::now();
+        const auto give_up = start + std::chrono::duration_cast<LoopTimer::Clock::duration>(
+            std::chrono::duration<double>(max_s));
+
+        poll();
+
+        while (!quit && completed < polls) {
+            auto now = LoopTimer::Clock::now();
+            if (now >= give_up) {
+                break;
+            }
+
+            LoopTimer::Clock::duration wait = std::chrono::milliseconds(100);
+            for (const LoopTimer * timer : {&pico_timeout, &poll_timer}) {
+                LoopTimer::Clock::duration d;
+                if (timer->remaining(now, d) && d < wait) {
+                    wait = d;
+                }
+            }
+
+            const auto wait_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(wait).count();
+            const struct timespec ts = { static_cast<time_t>(wait_ns / 1000000000),
+                static_cast<long>(wait_ns % 1000000000) };
+            struct pollfd pfd = { handler.fd(), POLLIN, 0 };
+            if (::ppoll(&pfd, 1, &ts, nullptr) > 0 && (pfd.revents & POLLIN)) {
+                handler.on_serial_readable();
+            }
+
+            now = LoopTimer::Clock::now();
+            pico_timeout.process(now);
+            poll_timer.process(now);
+        }
+
+        const double elapsed_s = std::chrono::duration<double>(LoopTimer::Clock::now() - start).count();
+        const uint64_t dropped = sim.stats().dropped_responses;
+
+        fmt::println("Polls completed: {}/{}, failed: {}, responses dropped: {}, time: {:.2f}s",
+            completed, polls, failed, dropped, elapsed_s);
+
+        if (completed < polls) {
+            fmt::println("FAIL: polling did not resume");
+        } else if (failed != ((dropped != 0) ? 1u : 0u)) {
+            fmt::println("FAIL: expected only the poll with the dropped response to fail");
+        } else {
+            fmt::println("OK");
+            exit_code = EXIT_SUCCESS;
+        }
+    }
+
+    sim_quit = true;
+    sim_thread.join();
+
+    return exit_code;
+}
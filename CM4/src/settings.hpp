@@ -9,12 +9,53 @@
 
 #include <string>
 #include <vector>
+#include <algorithm>
 
 #define SANITIZE_PWM_INPUT(pwm)\
 pwm = (pwm < 0.0f) ? 0.0f : pwm;\
 pwm = (pwm > 1.0f) ? 1.0f : pwm;
 
 namespace picod {
+    /// @brief A point on a fan curve
+    typedef struct FanCurvePoint {
+        /// @brief Sensor temperature in °C
+        float temperature_c;
+        /// @brief Fan duty cycle [0.0 to 1.0] at that temperature
+        float duty;
+    } FanCurvePoint;
+
+    /// @brief Fan curve of one sensor driving a fan
+    typedef struct FanSensorCurve {
+        /// @brief Sensor ID (name), see sensor_names
+        std::string sensor_name;
+        /// @brief Multiplies the duty cycle read from the curve
+        float weight;
+        /// @brief Curve points, sorted by temperature
+        std::vector<FanCurvePoint> points;
+    } FanSensorCurve;
+
+    /// @brief Sensors and curves driving one fan
+    typedef struct FanCurve {
+        /// @brief Fan ID (name), see sensor_names
+        std::string fan_name;
+        std::vector<FanSensorCurve> sensors;
+    } FanCurve;
+
+    /// @brief Fan curve run by the Pico itself, see pico_fan_control
+    typedef struct PicoFanCurve {
+        /// @brief Fan ID (name), see sensor_names
+        std::string fan_name;
+        /// @brief NTC and RPi_Pico sensor IDs. The hottest one drives the curve.
+        std::vector<std::string> sensors;
+        /// @brief Lowest duty cycle [0.0 to 1.0] requested by the curve
+        float min_duty;
+        /// @brief A falling temperature must drop this many °C before 
+        /// the fan duty cycle follows it down
+        float hysteresis_c;
+        /// @brief Curve points, sorted by temperature
+        std::vector<FanCurvePoint> points;
+    } PicoFanCurve;
+
     typedef struct Settings
     {
         /// @brief Specifies how often (in seconds) the host (CM4) 
@@ -89,6 +130,103 @@ namespace picod {
         /// @brief Enable(true) HTTP interface (for temperature and fan RPM graphs)
         bool enable_web_interface;
 
+        /// @brief Minimum time in seconds between ubus temperature/tachometer 
+        /// notifications. Zero(0) sends one per poll.
+        double ubus_notify_min_interval_seconds;
+
+        /// @brief Smallest temperature change (°C) that triggers a ubus notification.
+        /// Zero(0) for temperatures not to trigger one. Every reading is sent
+        /// when both thresholds are zero(0).
+        double ubus_notify_temperature_threshold;
+
+        /// @brief Smallest fan speed change (RPM) that triggers a ubus notification.
+        /// Zero(0) for fan speeds not to trigger one. Every reading is sent
+        /// when both thresholds are zero(0).
+        uint32_t ubus_notify_rpm_threshold;
+
+        /// @brief Enables closed loop fan control using fan_curves
+        bool enable_fan_control;
+
+        /// @brief Lowest duty cycle [0.0 to 1.0] a controlled fan is run at
+        float fan_min_duty;
+
+        /// @brief A falling temperature must drop this many °C before 
+        /// the fan duty cycle follows it down
+        float fan_hysteresis_c;
+
+        /// @brief Fastest rate the fan duty cycle may rise, per second. 
+        /// Zero(0) means no limit.
+        float fan_slew_up_per_second;
+
+        /// @brief Fastest rate the fan duty cycle may fall, per second. 
+        /// Zero(0) means no limit.
+        float fan_slew_down_per_second;
+
+        /// @brief Fan curves used by closed loop fan control
+        std::vector<FanCurve> fan_curves;
+
+        /// @brief On-Pico fan control mode: "host", "auto" or "advisory".
+        /// Empty leaves the Pico settings unchanged.
+        std::string pico_fan_control_mode;
+
+        /// @brief Seconds without word from picod before the Pico fan curves
+        /// take over in "advisory" mode. Zero(0) never takes over.
+        uint32_t pico_fan_host_timeout_seconds;
+
+        /// @brief Fan curves run by the Pico
+        std::vector<PicoFanCurve> pico_fan_curves;
+
+        /// @brief Enables stalled and degraded fan detection
+        bool enable_fan_health;
+
+        /// @brief File where fan calibration results are saved
+        std::string fan_calibration_path;
+
+        /// @brief Duty cycle step [0.01 to 0.5] of a fan calibration sweep
+        float fan_calibration_step;
+
+        /// @brief Seconds a fan is given to settle after each calibration step
+        double fan_calibration_settle_seconds;
+
+        /// @brief A calibrated fan is degraded when it turns slower than its 
+        /// calibration curve by more than this fraction [0.0 to 1.0]
+        float fan_degraded_tolerance;
+
+        /// @brief Samples per second the Pico takes of each temperature sensor
+        uint32_t pico_sample_rate_hz;
+
+        /// @brief The Pico reports the mean, min and max temperatures of 
+        /// windows of this length (ms)
+        uint32_t pico_sample_window_ms;
+
+        /// @brief Thermistor B value (K) uploaded to the Pico.
+        /// Zero(0) uses the Pico default.
+        uint32_t ntc_beta;
+
+        /// @brief Offsets (°C) added by the Pico to each NTC temperature.
+        /// Empty leaves the Pico calibration unchanged.
+        std::vector<float> ntc_offsets_c;
+
+        /// @brief When set to true, the Pico saves the fan PWM, watchdog,
+        /// fan control and NTC calibration settings in its flash, and
+        /// applies them before it powers up the CM4
+        bool save_pico_config;
+
+        /// @brief Records every frame sent to and received from the Pico
+        /// to <capture_path>.0, .1, etc. Empty disables recording.
+        std::string capture_path;
+
+        /// @brief Size (KiB) of each capture file
+        uint32_t capture_segment_size_kb;
+
+        /// @brief Number of capture files. Once all are full, the oldest
+        /// one is overwritten.
+        uint32_t capture_segments;
+
+        /// @brief Where picod writes its trace spans when it receives
+        /// SIGUSR1. Only used when built with -DPICOD_TRACE=ON.
+        std::string trace_path;
+
         Settings():
             temperature_poll_interval_seconds(1.0),
             enable_watchdog_timer(false),
@@ -109,7 +247,31 @@ namespace picod {
             http_host{"localhost"},
             http_port{8086},
             webroot_path{"/etc/picod/website"},
-            enable_web_interface{false} {}
+            enable_web_interface{false},
+            ubus_notify_min_interval_seconds{0.0},
+            ubus_notify_temperature_threshold{0.0},
+            ubus_notify_rpm_threshold{0},
+            enable_fan_control{false},
+            fan_min_duty{0.2f},
+            fan_hysteresis_c{2.0f},
+            fan_slew_up_per_second{0.5f},
+            fan_slew_down_per_second{0.05f},
+            pico_fan_control_mode{""},
+            pico_fan_host_timeout_seconds{30},
+            enable_fan_health{true},
+            fan_calibration_path{"/etc/picod/fan_calibration.json"},
+            fan_calibration_step{0.1f},
+            fan_calibration_settle_seconds{5.0},
+            fan_degraded_tolerance{0.3f},
+            pico_sample_rate_hz{1000},
+            pico_sample_window_ms{1000},
+            ntc_beta{0},
+            ntc_offsets_c{},
+            save_pico_config{true},
+            capture_path{""},
+            capture_segment_size_kb{1024},
+            capture_segments{4},
+            trace_path{"/tmp/picod-trace.json"} {}
 
         // Ensure reasonable limits
         void sanitize(){
@@ -135,6 +297,69 @@ namespace picod {
             }
 
             sensor_history_in_seconds = (sensor_history_in_seconds < 10) ? 10 : sensor_history_in_seconds;
+
+            ubus_notify_min_interval_seconds = (ubus_notify_min_interval_seconds < 0.0) ? 
+                0.0 : ubus_notify_min_interval_seconds;
+            ubus_notify_temperature_threshold = (ubus_notify_temperature_threshold < 0.0) ? 
+                0.0 : ubus_notify_temperature_threshold;
+
+            SANITIZE_PWM_INPUT(fan_min_duty)
+            fan_hysteresis_c = (fan_hysteresis_c < 0.0f) ? 0.0f : fan_hysteresis_c;
+            fan_slew_up_per_second = (fan_slew_up_per_second < 0.0f) ? 0.0f : fan_slew_up_per_second;
+            fan_slew_down_per_second = (fan_slew_down_per_second < 0.0f) ? 0.0f : fan_slew_down_per_second;
+
+            for (auto &fan : fan_curves) {
+                for (auto &sensor : fan.sensors) {
+                    sensor.weight = (sensor.weight < 0.0f) ? 0.0f : sensor.weight;
+                    for (auto &point : sensor.points) {
+                        SANITIZE_PWM_INPUT(point.duty)
+                    }
+                    std::sort(sensor.points.begin(), sensor.points.end(), 
+                        [](const FanCurvePoint &a, const FanCurvePoint &b) {
+                            return a.temperature_c < b.temperature_c;
+                        });
+                }
+            }
+
+            pico_fan_host_timeout_seconds = (pico_fan_host_timeout_seconds > 0xFF) ? 
+                0xFF : pico_fan_host_timeout_seconds;
+
+            for (auto &fan : pico_fan_curves) {
+                SANITIZE_PWM_INPUT(fan.min_duty)
+                fan.hysteresis_c = (fan.hysteresis_c < 0.0f) ? 0.0f : fan.hysteresis_c;
+                for (auto &point : fan.points) {
+                    SANITIZE_PWM_INPUT(point.duty)
+                }
+                std::sort(fan.points.begin(), fan.points.end(), 
+                    [](const FanCurvePoint &a, const FanCurvePoint &b) {
+                        return a.temperature_c < b.temperature_c;
+                    });
+            }
+
+            fan_calibration_step = (fan_calibration_step < 0.01f) ? 0.01f : fan_calibration_step;
+            fan_calibration_step = (fan_calibration_step > 0.5f) ? 0.5f : fan_calibration_step;
+            fan_calibration_settle_seconds = (fan_calibration_settle_seconds < 0.0) ? 
+                0.0 : fan_calibration_settle_seconds;
+            SANITIZE_PWM_INPUT(fan_degraded_tolerance)
+
+            // Same limits as the Pico, see adc_capture.h
+            pico_sample_rate_hz = (pico_sample_rate_hz < 200) ? 200 : pico_sample_rate_hz;
+            pico_sample_rate_hz = (pico_sample_rate_hz > 20000) ? 20000 : pico_sample_rate_hz;
+            pico_sample_window_ms = (pico_sample_window_ms < 100) ? 100 : pico_sample_window_ms;
+            pico_sample_window_ms = (pico_sample_window_ms > 10000) ? 10000 : pico_sample_window_ms;
+
+            if ((ntc_beta != 0) && ((ntc_beta < 1000) || (ntc_beta > 10000))) {
+                ntc_beta = 0;
+            }
+            for (auto &offset : ntc_offsets_c) {
+                offset = (offset < -20.0f) ? -20.0f : offset;
+                offset = (offset > 20.0f) ? 20.0f : offset;
+            }
+
+            capture_segment_size_kb = (capture_segment_size_kb < 4) ? 4 : capture_segment_size_kb;
+            capture_segment_size_kb = (capture_segment_size_kb > 1048576) ? 1048576 : capture_segment_size_kb;
+            capture_segments = (capture_segments < 1) ? 1 : capture_segments;
+            capture_segments = (capture_segments > 100) ? 100 : capture_segments;
         }
     } Settings;
 }//@END namespace picod
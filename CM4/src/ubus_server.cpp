@@ -12,6 +12,18 @@
 #include "version.h"
 #include "TMP103_I2C.hpp"
 #include "InfluxDB.hpp"
+#include "PacketHandler.hpp"
+#include "SensorHistory.hpp"
+#include "FanController.hpp"
+#include "FanCalibration.hpp"
+#include "PicoEventLog.hpp"
+#include "PicoClock.hpp"
+#include "pico_pkt_time.h"
+#include "Trace.hpp"
+#include "Latency.hpp"
+#include <chrono>
+#include <memory>
+#include <cmath>
 
 #define UBUS_OBJECT_TYPE_(_name, _methods) \
     {                                      \
@@ -23,6 +35,8 @@
 
 #define	UBUS_EVENT_TEMPERATURE	"temperature_c"
 #define	UBUS_EVENT_TACHOMETER	"tachometer_rpm"
+#define	UBUS_EVENT_FAN_HEALTH	"fan_health"
+#define	UBUS_EVENT_PICO_EVENT	"pico_event"
 
 namespace picod
 {
@@ -39,6 +53,27 @@ namespace picod
         __FAN_PWM_MAX
     };
 
+    enum {
+        FAN_CALIBRATE_NAME,
+        __FAN_CALIBRATE_MAX
+    };
+
+    enum {
+        HISTORY_SENSOR,
+        HISTORY_SINCE,
+        HISTORY_POINTS,
+        __HISTORY_MAX
+    };
+
+    enum {
+        STATS_SENSOR,
+        STATS_SINCE,
+        __STATS_MAX
+    };
+
+    // Default number of points returned by the history method
+    const uint32_t HISTORY_DEFAULT_POINTS = 60;
+
     const struct blobmsg_policy watchdog_policy[] = {        
         [WATCHDOG_ENABLE] = {.name = "is_enabled", .type = BLOBMSG_TYPE_BOOL},
         [WATCHDOG_TIMEOUT] = {.name = "timeout_sec", .type = BLOBMSG_TYPE_INT32},
@@ -50,8 +85,25 @@ namespace picod
         [FAN_PWM_PERCENT] = {.name = "fan_pwm_pct", .type = BLOBMSG_TYPE_INT32}
     };
 
+    const struct blobmsg_policy fan_calibrate_policy[] = {
+        [FAN_CALIBRATE_NAME] = {.name = "fan_name", .type = BLOBMSG_TYPE_STRING}
+    };
+
+    const struct blobmsg_policy history_policy[] = {
+        [HISTORY_SENSOR] = {.name = "sensor", .type = BLOBMSG_TYPE_STRING},
+        [HISTORY_SINCE] = {.name = "since_sec", .type = BLOBMSG_TYPE_INT32},
+        [HISTORY_POINTS] = {.name = "points", .type = BLOBMSG_TYPE_INT32}
+    };
+
+    const struct blobmsg_policy stats_policy[] = {
+        [STATS_SENSOR] = {.name = "sensor", .type = BLOBMSG_TYPE_STRING},
+        [STATS_SINCE] = {.name = "since_sec", .type = BLOBMSG_TYPE_INT32}
+    };
+
     const struct blobmsg_policy version_policy[] = {};
     const struct blobmsg_policy status_policy[] = {};
+    const struct blobmsg_policy fan_calibration_policy[] = {};
+    const struct blobmsg_policy pico_events_policy[] = {};
 
     struct ubus_context *g_ctx;
     int notify = 0;
@@ -60,7 +112,12 @@ namespace picod
         UBUS_METHOD("version", picod_version, version_policy),
         UBUS_METHOD("status", picod_status, status_policy),
         UBUS_METHOD("watchdog", picod_watchdog, watchdog_policy),
-        UBUS_METHOD("fan_pwm", picod_fan_pwm, fan_pwm_policy)
+        UBUS_METHOD("fan_pwm", picod_fan_pwm, fan_pwm_policy),
+        UBUS_METHOD("fan_calibrate", picod_fan_calibrate, fan_calibrate_policy),
+        UBUS_METHOD("fan_calibration", picod_fan_calibration, fan_calibration_policy),
+        UBUS_METHOD("history", picod_history, history_policy),
+        UBUS_METHOD("stats", picod_stats, stats_policy),
+        UBUS_METHOD("pico_events", picod_pico_events, pico_events_policy)
         };
 
     struct ubus_object_type picod_object_type =
@@ -85,6 +142,46 @@ namespace picod
     struct blob_buf pwm_blob;
     std::string picoVersion;
 
+    /// @brief Last known Pico state. Only accessed from the uloop thread.
+    struct PicoSnapshot {
+        bool have_fan_pwm = false;
+        float fan_pwm_pct[NUM_PWM_FANS] = {0.0f, 0.0f};
+        bool have_watchdog = false;
+        pico_pkt_watchdog_t watchdog = {0};
+        bool have_temperature = false;
+        pico_pkt_temperature_u temperature = {0};
+        int tmp103_temperature = 0;
+    } snapshot;
+
+    // When the current temperature poll was sent
+    std::chrono::steady_clock::time_point temperature_poll_start;
+    // When the next temperature poll is due
+    std::chrono::steady_clock::time_point temperature_poll_deadline;
+
+    /// @brief Readings last sent to ubus subscribers. Only accessed from the uloop thread.
+    struct NotifyState {
+        bool have_sent = false;
+        std::chrono::steady_clock::time_point last_sent;
+        pico_pkt_temperature_u temperature = {0};
+        int tmp103_temperature = 0;
+    } notified;
+
+    void picod_serial_cb(struct uloop_fd *u, unsigned int events) {
+        PacketHandler::instance().on_serial_readable();
+    }
+
+    struct uloop_fd pico_serial_fd = {
+        .cb = picod_serial_cb,
+    };
+
+    void picod_pico_timeout_cb(struct uloop_timeout *timeout) {
+        PacketHandler::instance().service_timeouts();
+    }
+
+    struct uloop_timeout pico_timeout_timer = {
+        .cb = picod_pico_timeout_cb,
+    };
+
     void put_container(struct blob_buf *buf, struct blob_attr *attr, const char *name) {
          void *c = blobmsg_open_table(buf, name);
          blob_put_raw(buf, blob_data(attr), blob_len(attr));
@@ -109,6 +206,7 @@ namespace picod
 
     int picod_version(struct ubus_context *ctx, struct ubus_object *obj,
         struct ubus_request_data *req, const char *method, struct blob_attr *msg) {
+        TRACE_SCOPE("ubus/version");
         blob_buf_init(&b, 0);
 
         if (!picoVersion.empty()) {
@@ -122,146 +220,406 @@ namespace picod
         return UBUS_STATUS_OK;
     }
 
-    int picod_status(struct ubus_context *ctx, struct ubus_object *obj,
-        struct ubus_request_data *req, const char *method, struct blob_attr *msg) {
-
-        blob_buf_init(&b, 0);
+    void add_fan_pwm_blob(struct blob_buf *buf) {
+        blob_buf_init(&pwm_blob, 0);
+            
+        blobmsg_add_u32(&pwm_blob,
+            appSettings.sensorIds[picod::System_FAN_J17].c_str(), 
+            (int)(snapshot.fan_pwm_pct[SYS_FAN1-1]*100));
         
-        bool rw_flag = false; // Read(0)/Write(1) flag        
-        std::vector<struct pico_pkt_fan_pwm_t> fanInfo;
-        fanInfo.emplace_back(pico_pkt_fan_pwm_t { 
-            .fan_id = SYS_FAN1, .pwm_pct = 0.0f });
-        fanInfo.emplace_back(pico_pkt_fan_pwm_t { 
-            .fan_id = CM4_FAN, .pwm_pct = 0.0f });
+        blobmsg_add_u32(&pwm_blob,
+            appSettings.sensorIds[picod::CM4_FAN_J18].c_str(), 
+            (int)(snapshot.fan_pwm_pct[CM4_FAN-1]*100));
+        
+        put_container(buf, pwm_blob.head, fan_pwm_policy[FAN_PWM_PERCENT].name);
+    }
 
-        if (send_fan_pwm_request(rw_flag, fanInfo)) {
-            blob_buf_init(&pwm_blob, 0);
-            
-            blobmsg_add_u32(&pwm_blob,
-                appSettings.sensorIds[picod::System_FAN_J17].c_str(), (int)(fanInfo[SYS_FAN1-1].pwm_pct*100));
-            
-            blobmsg_add_u32(&pwm_blob,
-                appSettings.sensorIds[picod::CM4_FAN_J18].c_str(), (int)(fanInfo[CM4_FAN-1].pwm_pct*100));
-            
-            put_container(&b, pwm_blob.head, fan_pwm_policy[FAN_PWM_PERCENT].name);           
+    void add_watchdog_blob(struct blob_buf *buf) {
+        const pico_pkt_watchdog_t &s = snapshot.watchdog;
+        blob_buf_init(&watchdog_blob, 0);                     
+        blobmsg_add_string(&watchdog_blob, watchdog_policy[WATCHDOG_ENABLE].name, s.enable ? "true" : "false");
+        blobmsg_add_u16(&watchdog_blob, watchdog_policy[WATCHDOG_TIMEOUT].name, s.timeout);
+        blobmsg_add_u16(&watchdog_blob, watchdog_policy[WATCHDOG_MAX_RETRIES].name, s.max_retries);
+        put_container(buf, watchdog_blob.head, "watchdog");
+    }
+
+    void add_fan_control_blob(struct blob_buf *buf) {
+        void *c = blobmsg_open_table(buf, "fan_control");
+        for (auto const& fan : FanController::instance().state()) {
+            void *f = blobmsg_open_table(buf, fan.fan_name.c_str());
+            blobmsg_add_double(buf, "duty_pct", fan.duty*100.0);
+            blobmsg_add_double(buf, "target_pct", fan.target*100.0);
+            blobmsg_add_string(buf, "sensor", fan.sensor_name.c_str());
+            blobmsg_add_double(buf, "temperature_c", fan.temperature_c);
+            blobmsg_close_table(buf, f);
         }
+        blobmsg_close_table(buf, c);
+    }
+
+    void add_fan_health_blob(struct blob_buf *buf) {
+        void *c = blobmsg_open_table(buf, UBUS_EVENT_FAN_HEALTH);
+        for (auto const& fan : FanCalibration::instance().health()) {
+            void *f = blobmsg_open_table(buf, fan.fan_name.c_str());
+            blobmsg_add_string(buf, "health", FanCalibration::to_string(fan.health));
+            blobmsg_add_u32(buf, "rpm", fan.rpm);
+            blobmsg_add_u32(buf, "expected_rpm", fan.expected_rpm);
+            blobmsg_close_table(buf, f);
+        }
+        blobmsg_close_table(buf, c);
+    }
+
+    /// @brief Fills temperature_blob and tachometer_blob from the snapshot
+    void fill_temperature_blobs() {
+        const pico_pkt_temperature_u &t = snapshot.temperature;
+        blob_buf_init(&temperature_blob, 0);
+        blob_buf_init(&tachometer_blob, 0);
         
-        pico_pkt_watchdog_t s = {0};
-        s.write = false; 
-        if (send_watchdog_request(s)) {
-            blob_buf_init(&watchdog_blob, 0);                     
-            blobmsg_add_string(&watchdog_blob, watchdog_policy[WATCHDOG_ENABLE].name, s.enable ? "true" : "false");
-            blobmsg_add_u16(&watchdog_blob, watchdog_policy[WATCHDOG_TIMEOUT].name, s.timeout);
-            blobmsg_add_u16(&watchdog_blob, watchdog_policy[WATCHDOG_MAX_RETRIES].name, s.max_retries);
-            put_container(&b, watchdog_blob.head, "watchdog");
-        }
-
-        pico_pkt_temperature_u t = {0};
-        if (send_temperature_request(t)) {
-            blob_buf_init(&temperature_blob, 0);
-            blob_buf_init(&tachometer_blob, 0);
+        if (appSettings.sensorIds.size() > NUM_NTC_SENSORS) {
+            for (int ch=0; ch < NUM_NTC_SENSORS; ch++) {
+                blobmsg_add_double(&temperature_blob, 
+                    appSettings.sensorIds[ch].c_str(), t.data[ch]);
+            }
+        }
+
+        if (picod::SensorId::NUM_SENSOR_IDs == appSettings.sensorIds.size()) {                
+            blobmsg_add_double(&temperature_blob, 
+                    appSettings.sensorIds[picod::RPi_Pico].c_str(), t.s.pico);
             
-            if (appSettings.sensorIds.size() > NUM_NTC_SENSORS) {
-                for (int ch=0; ch < NUM_NTC_SENSORS; ch++) {
-                    blobmsg_add_string(&temperature_blob, 
-                        appSettings.sensorIds[ch].c_str(), 
-                        formatDouble(t.data[ch]).c_str());
-                }
+            if (appSettings.enable_tmp103_sensor) {            
+                blobmsg_add_double(&temperature_blob, 
+                    appSettings.sensorIds[picod::Under_CM4_SOC].c_str(), snapshot.tmp103_temperature);
             }
 
-            if (picod::SensorId::NUM_SENSOR_IDs == appSettings.sensorIds.size()) {                
-                blobmsg_add_string(&temperature_blob, 
-                        appSettings.sensorIds[picod::RPi_Pico].c_str(), 
-                        formatDouble(t.s.pico).c_str());
-                
-                if (appSettings.enable_tmp103_sensor) {            
-                    blobmsg_add_string(&temperature_blob, 
-                        appSettings.sensorIds[picod::Under_CM4_SOC].c_str(), 
-                        formatDouble(TMP103_I2C::instance().getTemperature(), 0).c_str());
-                }
+            blobmsg_add_u32(&tachometer_blob,
+                appSettings.sensorIds[picod::System_FAN_J17].c_str(), t.s.fan1rpm);
+            blobmsg_add_u32(&tachometer_blob,
+                appSettings.sensorIds[picod::CM4_FAN_J18].c_str(), t.s.cm4_fan_rpm);
+        }
+    }
 
-                blobmsg_add_u32(&tachometer_blob,
-                    appSettings.sensorIds[picod::System_FAN_J17].c_str(), t.s.fan1rpm);
-                blobmsg_add_u32(&tachometer_blob,
-                    appSettings.sensorIds[picod::CM4_FAN_J18].c_str(), t.s.cm4_fan_rpm);
+    /// @brief Adds the latency percentiles (us) as latency_us.<group>.<name>
+    void add_latency_blob(struct blob_buf *buf) {
+        void *l = blobmsg_open_table(buf, "latency_us");
+        void *g = nullptr;
+        std::string group;
+
+        for (auto const& e : Latency::instance().summaries()) {
+            if (!g || (e.group != group)) {
+                if (g) {
+                    blobmsg_close_table(buf, g);
+                }
+                group = e.group;
+                g = blobmsg_open_table(buf, group.c_str());
             }
+
+            auto const& s = e.summary;
+            void *h = blobmsg_open_table(buf, e.name.c_str());
+            blobmsg_add_u64(buf, "count", s.count);
+            blobmsg_add_double(buf, "mean", s.mean_us);
+            blobmsg_add_u64(buf, "min", s.min_us);
+            blobmsg_add_u64(buf, "p50", s.p50_us);
+            blobmsg_add_u64(buf, "p90", s.p90_us);
+            blobmsg_add_u64(buf, "p99", s.p99_us);
+            blobmsg_add_u64(buf, "p99_9", s.p99_9_us);
+            blobmsg_add_u64(buf, "max", s.max_us);
+            blobmsg_close_table(buf, h);
+        }
+
+        if (g) {
+            blobmsg_close_table(buf, g);
+        }
+        blobmsg_close_table(buf, l);
+    }
+
+    int picod_status(struct ubus_context *ctx, struct ubus_object *obj,
+        struct ubus_request_data *req, const char *method, struct blob_attr *msg) {
+        TRACE_SCOPE("ubus/status");
+
+        // Answered from the cached snapshot so that callers never wait on 
+        // the serial port, or on each other.
+        blob_buf_init(&b, 0);
+        
+        if (snapshot.have_fan_pwm) {
+            add_fan_pwm_blob(&b);
+        }
+        
+        if (snapshot.have_watchdog) {
+            add_watchdog_blob(&b);
+        }
+
+        if (snapshot.have_temperature) {
+            fill_temperature_blobs();
             put_container(&b, temperature_blob.head, UBUS_EVENT_TEMPERATURE);
             put_container(&b, tachometer_blob.head, UBUS_EVENT_TACHOMETER);
         }
+
+        if (FanController::instance().is_enabled()) {
+            add_fan_control_blob(&b);
+        }
+
+        add_fan_health_blob(&b);
+
+        auto clock = PicoClock::instance().status();
+        void *c = blobmsg_open_table(&b, "pico_clock");
+        blobmsg_add_u8(&b, "synced", clock.synced);
+        blobmsg_add_u64(&b, "offset_us", clock.offset_us);
+        blobmsg_add_double(&b, "drift_ppm", clock.drift_ppm);
+        blobmsg_add_u64(&b, "delay_us", clock.delay_us);
+        blobmsg_add_u32(&b, "num_exchanges", clock.num_exchanges);
+        blobmsg_close_table(&b, c);
+
+        add_latency_blob(&b);
         
         ubus_send_reply(ctx, req, b.head);
 
         return UBUS_STATUS_OK;
     }
 
-    void picod_notify_temperature_cb(struct uloop_timeout *timeout){
+    /// @brief Decides whether the latest readings should be sent to ubus 
+    /// subscribers, based on the configured minimum interval and change 
+    /// thresholds.
+    bool should_notify() {
+        if (!notify) {
+            return false;
+        }
 
-        pico_pkt_temperature_u t = {0};
-        
-        if (send_temperature_request(t)) {
-            blob_buf_init(&temperature_blob, 0);
-            blob_buf_init(&tachometer_blob, 0);
-            
-            if (appSettings.sensorIds.size() > NUM_NTC_SENSORS) {
-                for (int ch=0; ch < NUM_NTC_SENSORS; ch++) {
-                    blobmsg_add_string(&temperature_blob, 
-                        appSettings.sensorIds[ch].c_str(), 
-                        formatDouble(t.data[ch]).c_str());
+        if (!notified.have_sent) {
+            return true;
+        }
 
-                    if (appSettings.enable_influx_db) {
-                        picod::InfluxDB::instance().addTemperature(
-                            appSettings.sensorIds[ch], t.data[ch]);
-                    }
+        auto now = std::chrono::steady_clock::now();
+        std::chrono::duration<double> since_last = now - notified.last_sent;
+        if (since_last.count() < appSettings.ubus_notify_min_interval_seconds) {
+            return false;
+        }
+
+        const double temperature_threshold = appSettings.ubus_notify_temperature_threshold;
+        const double rpm_threshold = appSettings.ubus_notify_rpm_threshold;
+        const pico_pkt_temperature_u &t = snapshot.temperature;
+        const pico_pkt_temperature_u &prev = notified.temperature;
+
+        // A zero threshold keeps its quantity from triggering, unless both are zero
+        if ((temperature_threshold <= 0.0) && (rpm_threshold <= 0.0)) {
+            return true;
+        }
+
+        if (temperature_threshold > 0.0) {
+            for (int ch=0; ch < NUM_NTC_SENSORS; ch++) {
+                if (std::fabs(t.data[ch] - prev.data[ch]) >= temperature_threshold) {
+                    return true;
                 }
             }
 
-            if (picod::SensorId::NUM_SENSOR_IDs == appSettings.sensorIds.size()) {                
-                blobmsg_add_string(&temperature_blob, 
-                        appSettings.sensorIds[picod::RPi_Pico].c_str(), 
-                        formatDouble(t.s.pico).c_str());
+            if ((std::fabs(t.s.pico - prev.s.pico) >= temperature_threshold) ||
+                (std::abs(snapshot.tmp103_temperature - notified.tmp103_temperature) >= temperature_threshold)) {
+                return true;
+            }
+        }
 
-                if (appSettings.enable_influx_db) {
-                    picod::InfluxDB::instance().addTemperature(
-                        appSettings.sensorIds[picod::RPi_Pico], t.s.pico);
+        return (rpm_threshold > 0.0) &&
+            ((std::fabs((double)t.s.fan1rpm - prev.s.fan1rpm) >= rpm_threshold) ||
+            (std::fabs((double)t.s.cm4_fan_rpm - prev.s.cm4_fan_rpm) >= rpm_threshold));
+    }
+
+    /// @brief Sends fan health and calibration events to ubus subscribers
+    void notify_fan_events() {
+        for (auto const& e : FanCalibration::instance().take_events()) {
+            if (!notify) {
+                continue;
+            }
 
-                    picod::InfluxDB::instance().addTachometer(
-                        appSettings.sensorIds[picod::System_FAN_J17], t.s.fan1rpm);
+            blob_buf_init(&b, 0);
+            blobmsg_add_string(&b, "fan_name", e.fan_name.c_str());
+            blobmsg_add_string(&b, "event", e.event.c_str());
+            blobmsg_add_u32(&b, "rpm", e.rpm);
+            blobmsg_add_u32(&b, "expected_rpm", e.expected_rpm);
+            blobmsg_add_u64(&b, "timestamp_ms", e.timestamp_ms);
+            picod_bcast_event((char*)UBUS_EVENT_FAN_HEALTH, b.head);
+        }
+    }
+
+    /// @brief Sends the events read from the Pico event log to ubus subscribers
+    void notify_pico_events() {
+        for (auto const& e : PicoEventLog::instance().take_events()) {
+            if (!notify) {
+                continue;
+            }
+
+            blob_buf_init(&b, 0);
+            blobmsg_add_string(&b, "event", e.event.c_str());
+            blobmsg_add_u32(&b, "data", e.data);
+            blobmsg_add_u32(&b, "boot", e.boot);
+            blobmsg_add_u64(&b, "timestamp_ms", e.timestamp_ms);
+            picod_bcast_event((char*)UBUS_EVENT_PICO_EVENT, b.head);
+        }
+    }
+
+    /// @param sampled_ms When the Pico sampled the readings, zero(0) if unknown
+    void on_temperature_response(const pico_pkt_temperature_u &t, int64_t sampled_ms) {
+        TRACE_SCOPE("monitor/on_temperature_response");
+        snapshot.temperature = t;
+        snapshot.have_temperature = true;
+
+        if (appSettings.enable_tmp103_sensor) {
+            snapshot.tmp103_temperature = TMP103_I2C::instance().getTemperature();
+        }
+
+        auto &history = picod::SensorHistory::instance();
+        if (appSettings.sensorIds.size() > NUM_NTC_SENSORS) {
+            for (int ch=0; ch < NUM_NTC_SENSORS; ch++) {
+                history.addTemperature(appSettings.sensorIds[ch], t.data[ch], sampled_ms);
+            }
+        }
+
+        if (picod::SensorId::NUM_SENSOR_IDs == appSettings.sensorIds.size()) {
+            history.addTemperature(appSettings.sensorIds[picod::RPi_Pico], t.s.pico, sampled_ms);
+
+            if (appSettings.enable_tmp103_sensor) {
+                history.addTemperature(appSettings.sensorIds[picod::Under_CM4_SOC], 
+                    snapshot.tmp103_temperature);
+            }
+
+            history.addTachometer(appSettings.sensorIds[picod::System_FAN_J17], t.s.fan1rpm, sampled_ms);
+            history.addTachometer(appSettings.sensorIds[picod::CM4_FAN_J18], t.s.cm4_fan_rpm, sampled_ms);
+        }
+
+        if (appSettings.enable_influx_db) {
+            if (appSettings.sensorIds.size() > NUM_NTC_SENSORS) {
+                for (int ch=0; ch < NUM_NTC_SENSORS; ch++) {
+                    picod::InfluxDB::instance().addTemperature(
+                        appSettings.sensorIds[ch], t.data[ch], sampled_ms);
                 }
-                
+            }
+
+            if (picod::SensorId::NUM_SENSOR_IDs == appSettings.sensorIds.size()) {
+                picod::InfluxDB::instance().addTemperature(
+                    appSettings.sensorIds[picod::RPi_Pico], t.s.pico, sampled_ms);
+
+                picod::InfluxDB::instance().addTachometer(
+                    appSettings.sensorIds[picod::System_FAN_J17], t.s.fan1rpm, sampled_ms);
+
                 if (appSettings.enable_tmp103_sensor) {
-                    int retVal = TMP103_I2C::instance().getTemperature(); 
-                    
-                    blobmsg_add_string(&temperature_blob, 
-                        appSettings.sensorIds[picod::Under_CM4_SOC].c_str(), 
-                        formatDouble(retVal, 0).c_str());
-
-                    if (appSettings.enable_influx_db) {
-                        picod::InfluxDB::instance().addTemperature(
-                        appSettings.sensorIds[picod::Under_CM4_SOC], retVal);
-                    }
+                    picod::InfluxDB::instance().addTemperature(
+                        appSettings.sensorIds[picod::Under_CM4_SOC], snapshot.tmp103_temperature);
                 }
 
-                blobmsg_add_u32(&tachometer_blob,
-                    appSettings.sensorIds[picod::System_FAN_J17].c_str(), t.s.fan1rpm);
-                
-                blobmsg_add_u32(&tachometer_blob,
-                    appSettings.sensorIds[picod::CM4_FAN_J18].c_str(), t.s.cm4_fan_rpm);
+                if (Latency::instance().is_report_due()) {
+                    for (auto const& e : Latency::instance().take_interval_summaries()) {
+                        picod::InfluxDB::instance().addLatency(e.group, e.name, e.summary);
+                    }
+                }
 
-                if (appSettings.enable_influx_db) {
-                    picod::InfluxDB::instance().publish();
-                }              
+                picod::InfluxDB::instance().publish();
             }
+        }
 
-            picod_bcast_event((char*)UBUS_EVENT_TEMPERATURE, temperature_blob.head);
-            picod_bcast_event((char*)UBUS_EVENT_TACHOMETER, tachometer_blob.head);            
+        auto fanInfo = FanController::instance().update(t, snapshot.tmp103_temperature);
+        auto calibrationInfo = FanCalibration::instance().update(t);
+        fanInfo.insert(fanInfo.end(), calibrationInfo.begin(), calibrationInfo.end());
+        if (!fanInfo.empty()) {
+            send_fan_pwm_request_async(true, fanInfo,
+                [](bool success, std::vector<struct pico_pkt_fan_pwm_t> &fanInfo) {
+                    if (success) {
+                        FanController::instance().confirm(fanInfo);
+                        FanCalibration::instance().record_pwm(fanInfo);
+                        for (auto &fan : fanInfo) {
+                            snapshot.fan_pwm_pct[fan.fan_id-1] = fan.pwm_pct;
+                        }
+                    }
+                });
         }
-        
-        uloop_timeout_set(&notify_temperature_timer, 
+
+        notify_fan_events();
+
+        if (PicoEventLog::instance().is_poll_due()) {
+            PicoEventLog::instance().poll_async(notify_pico_events);
+        }
+
+        // Nothing is built unless someone is listening
+        if (!should_notify()) {
+            return;
+        }
+
+        fill_temperature_blobs();
+        picod_bcast_event((char*)UBUS_EVENT_TEMPERATURE, temperature_blob.head);
+        picod_bcast_event((char*)UBUS_EVENT_TACHOMETER, tachometer_blob.head);
+
+        notified.have_sent = true;
+        notified.last_sent = std::chrono::steady_clock::now();
+        notified.temperature = snapshot.temperature;
+        notified.tmp103_temperature = snapshot.tmp103_temperature;
+    }
+
+    /// @brief Schedules the next temperature poll one poll interval after 
+    /// the previous one was sent.
+    void schedule_temperature_poll() {
+        using namespace std::chrono;
+        auto interval = milliseconds(
             static_cast<int>(appSettings.temperature_poll_interval_seconds * 1000));
+        auto elapsed = duration_cast<milliseconds>(steady_clock::now() - temperature_poll_start);
+        auto next = (elapsed < interval) ? (interval - elapsed) : milliseconds(0);
+
+        temperature_poll_deadline = temperature_poll_start + interval;
+        uloop_timeout_set(&notify_temperature_timer, static_cast<int>(next.count()));
+    }
+
+    void picod_notify_temperature_cb(struct uloop_timeout *timeout){
+        TRACE_SCOPE("monitor/poll");
+
+        temperature_poll_start = std::chrono::steady_clock::now();
+        Latency::instance().start_poll(temperature_poll_start, temperature_poll_deadline);
+
+        // The next poll is scheduled once the Pico answers (or times out)
+        if (PicoClock::instance().is_sync_due()) {
+            send_time_request_async(nullptr);
+        }
+
+        bool queued = send_temperature_request_async(
+            [](bool success, pico_pkt_temperature_u &t, const pico_pkt_temperature_time_t &time) {
+                if (success) {
+                    on_temperature_response(t, get_temperature_timestamp_ms(time));
+                }
+
+                Latency::instance().end_poll(std::chrono::steady_clock::now());
+                schedule_temperature_poll();
+            });
+
+        if (!queued) {
+            schedule_temperature_poll();
+        }
+    }
+
+    void refresh_snapshot() {
+        std::vector<struct pico_pkt_fan_pwm_t> fanInfo;
+        fanInfo.emplace_back(pico_pkt_fan_pwm_t { 
+            .fan_id = SYS_FAN1, .pwm_pct = 0.0f });
+        fanInfo.emplace_back(pico_pkt_fan_pwm_t { 
+            .fan_id = CM4_FAN, .pwm_pct = 0.0f });
+
+        send_fan_pwm_request_async(false, fanInfo,
+            [](bool success, std::vector<struct pico_pkt_fan_pwm_t> &fanInfo) {
+                if (success) {
+                    for (auto &fan : fanInfo) {
+                        snapshot.fan_pwm_pct[fan.fan_id-1] = fan.pwm_pct;
+                    }
+                    snapshot.have_fan_pwm = true;
+                    FanCalibration::instance().record_pwm(fanInfo);
+                }
+            });
+
+        pico_pkt_watchdog_t s = {0};
+        s.write = false; 
+        send_watchdog_request_async(s, [](bool success, pico_pkt_watchdog_t &s) {
+            if (success) {
+                snapshot.watchdog = s;
+                snapshot.have_watchdog = true;
+            }
+        });
     }
 
     int picod_watchdog(struct ubus_context *ctx, struct ubus_object *obj,
         struct ubus_request_data *req, const char *method, struct blob_attr *msg) {
+        TRACE_SCOPE("ubus/watchdog");
         
         struct blob_attr *tb[__WATCHDOG_MAX];
 
@@ -276,21 +634,39 @@ namespace picod
         s.max_retries = blobmsg_get_u32(tb[WATCHDOG_MAX_RETRIES]);
         s.timeout = sanitize_watchdog_timeout(s.timeout);        
         s.write = true;
-        if (send_watchdog_request(s)) {
-            blob_buf_init(&b, 0);
-            blobmsg_add_string(&b, blobmsg_name(tb[WATCHDOG_ENABLE]), s.enable ? "true" : "false");
-            blobmsg_add_u16(&b, blobmsg_name(tb[WATCHDOG_TIMEOUT]), s.timeout);
-            blobmsg_add_u16(&b, blobmsg_name(tb[WATCHDOG_MAX_RETRIES]), s.max_retries);
-            ubus_send_reply(ctx, req, b.head);
-        } else {
+
+        // The reply is sent once the Pico responds
+        auto deferred = std::make_shared<struct ubus_request_data>();
+        bool queued = send_watchdog_request_async(s, 
+            [deferred](bool success, pico_pkt_watchdog_t &s) {
+                if (!success) {
+                    ubus_complete_deferred_request(g_ctx, deferred.get(), UBUS_STATUS_UNKNOWN_ERROR);
+                    return;
+                }
+
+                snapshot.watchdog = s;
+                snapshot.have_watchdog = true;
+
+                blob_buf_init(&b, 0);
+                blobmsg_add_string(&b, watchdog_policy[WATCHDOG_ENABLE].name, s.enable ? "true" : "false");
+                blobmsg_add_u16(&b, watchdog_policy[WATCHDOG_TIMEOUT].name, s.timeout);
+                blobmsg_add_u16(&b, watchdog_policy[WATCHDOG_MAX_RETRIES].name, s.max_retries);
+                ubus_send_reply(g_ctx, deferred.get(), b.head);
+                ubus_complete_deferred_request(g_ctx, deferred.get(), UBUS_STATUS_OK);
+            });
+        
+        if (!queued) {
             return UBUS_STATUS_UNKNOWN_ERROR;
         }
+
+        ubus_defer_request(ctx, req, deferred.get());
         
         return UBUS_STATUS_OK;
     }
 
     int picod_fan_pwm(struct ubus_context *ctx, struct ubus_object *obj,
         struct ubus_request_data *req, const char *method, struct blob_attr *msg) {
+        TRACE_SCOPE("ubus/fan_pwm");
         
         struct blob_attr *tb[__FAN_PWM_MAX];
 
@@ -320,17 +696,224 @@ namespace picod
         fanInfo.emplace_back(pico_pkt_fan_pwm_t { 
                 .fan_id = static_cast<uint8_t>(fan_id), .pwm_pct = fan_pwm });
 
-        if (send_fan_pwm_request(rw_flag, fanInfo)) {
+        // The reply is sent once the Pico responds
+        auto deferred = std::make_shared<struct ubus_request_data>();
+        bool queued = send_fan_pwm_request_async(rw_flag, fanInfo,
+            [deferred, rw_flag](bool success, std::vector<struct pico_pkt_fan_pwm_t> &fanInfo) {
+                if (!success) {
+                    ubus_complete_deferred_request(g_ctx, deferred.get(), UBUS_STATUS_UNKNOWN_ERROR);
+                    return;
+                }
+
+                snapshot.fan_pwm_pct[fanInfo[0].fan_id-1] = fanInfo[0].pwm_pct;
+                if (rw_flag) {
+                    FanController::instance().confirm(fanInfo);
+                }
+                FanCalibration::instance().record_pwm(fanInfo);
+
+                blob_buf_init(&b, 0);
+                blobmsg_add_u32(&b, fan_pwm_policy[FAN_PWM_PERCENT].name, (int)(fanInfo[0].pwm_pct*100));
+                ubus_send_reply(g_ctx, deferred.get(), b.head);
+                ubus_complete_deferred_request(g_ctx, deferred.get(), UBUS_STATUS_OK);
+            });
+
+        if (!queued) {
+            return UBUS_STATUS_UNKNOWN_ERROR;
+        }
+
+        ubus_defer_request(ctx, req, deferred.get());
+
+        return UBUS_STATUS_OK;
+    }
+
+    int picod_fan_calibrate(struct ubus_context *ctx, struct ubus_object *obj,
+        struct ubus_request_data *req, const char *method, struct blob_attr *msg) {
+        TRACE_SCOPE("ubus/fan_calibrate");
+
+        struct blob_attr *tb[__FAN_CALIBRATE_MAX];
+
+        blobmsg_parse(fan_calibrate_policy, __FAN_CALIBRATE_MAX, tb, blob_data(msg), blob_len(msg));
+        if (!tb[FAN_CALIBRATE_NAME]) {
+            return UBUS_STATUS_INVALID_ARGUMENT;
+        }
+
+        std::string error;
+        if (!FanCalibration::instance().start(blobmsg_get_string(tb[FAN_CALIBRATE_NAME]), error)) {
             blob_buf_init(&b, 0);
-            blobmsg_add_u32(&b, fan_pwm_policy[FAN_PWM_PERCENT].name, (int)(fanInfo[0].pwm_pct*100));
+            blobmsg_add_string(&b, "error", error.c_str());
             ubus_send_reply(ctx, req, b.head);
-        } else {
-            return UBUS_STATUS_UNKNOWN_ERROR;
+            return UBUS_STATUS_INVALID_ARGUMENT;
         }
 
         return UBUS_STATUS_OK;
     }
 
+    int picod_fan_calibration(struct ubus_context *ctx, struct ubus_object *obj,
+        struct ubus_request_data *req, const char *method, struct blob_attr *msg) {
+        TRACE_SCOPE("ubus/fan_calibration");
+
+        auto &calibration = FanCalibration::instance();
+        blob_buf_init(&b, 0);
+
+        void *c = blobmsg_open_table(&b, "results");
+        for (auto const& result : calibration.results()) {
+            void *f = blobmsg_open_table(&b, result.fan_name.c_str());
+            blobmsg_add_u64(&b, "timestamp_ms", result.timestamp_ms);
+            blobmsg_add_double(&b, "min_start_duty_pct", result.min_start_duty*100.0);
+            blobmsg_add_double(&b, "min_stop_duty_pct", result.min_stop_duty*100.0);
+            void *a = blobmsg_open_array(&b, "curve");
+            for (auto const& p : result.curve) {
+                void *pt = blobmsg_open_table(&b, NULL);
+                blobmsg_add_double(&b, "duty_pct", p.duty*100.0);
+                blobmsg_add_u32(&b, "rpm", p.rpm);
+                blobmsg_close_table(&b, pt);
+            }
+            blobmsg_close_array(&b, a);
+            blobmsg_close_table(&b, f);
+        }
+        blobmsg_close_table(&b, c);
+
+        auto progress = calibration.progress();
+        c = blobmsg_open_table(&b, "progress");
+        blobmsg_add_u8(&b, "running", progress.running);
+        if (progress.running) {
+            blobmsg_add_string(&b, "fan_name", progress.fan_name.c_str());
+            blobmsg_add_string(&b, "phase", progress.phase.c_str());
+            blobmsg_add_double(&b, "duty_pct", progress.duty*100.0);
+        }
+        blobmsg_close_table(&b, c);
+
+        add_fan_health_blob(&b);
+
+        c = blobmsg_open_array(&b, "events");
+        for (auto const& e : calibration.events()) {
+            void *ev = blobmsg_open_table(&b, NULL);
+            blobmsg_add_u64(&b, "timestamp_ms", e.timestamp_ms);
+            blobmsg_add_string(&b, "fan_name", e.fan_name.c_str());
+            blobmsg_add_string(&b, "event", e.event.c_str());
+            blobmsg_add_u32(&b, "rpm", e.rpm);
+            blobmsg_add_u32(&b, "expected_rpm", e.expected_rpm);
+            blobmsg_close_table(&b, ev);
+        }
+        blobmsg_close_array(&b, c);
+
+        ubus_send_reply(ctx, req, b.head);
+
+        return UBUS_STATUS_OK;
+    }
+
+    int picod_pico_events(struct ubus_context *ctx, struct ubus_object *obj,
+        struct ubus_request_data *req, const char *method, struct blob_attr *msg) {
+        TRACE_SCOPE("ubus/pico_events");
+
+        blob_buf_init(&b, 0);
+
+        void *c = blobmsg_open_array(&b, "events");
+        for (auto const& e : PicoEventLog::instance().events()) {
+            void *ev = blobmsg_open_table(&b, NULL);
+            blobmsg_add_u32(&b, "seq", e.seq);
+            blobmsg_add_u32(&b, "boot", e.boot);
+            blobmsg_add_u64(&b, "timestamp_ms", e.timestamp_ms);
+            blobmsg_add_u32(&b, "pico_time_ms", e.pico_time_ms);
+            blobmsg_add_string(&b, "event", e.event.c_str());
+            blobmsg_add_u32(&b, "data", e.data);
+            blobmsg_close_table(&b, ev);
+        }
+        blobmsg_close_array(&b, c);
+
+        ubus_send_reply(ctx, req, b.head);
+
+        return UBUS_STATUS_OK;
+    }
+
+    /// @brief Converts the optional since_sec argument into a start time
+    int64_t get_history_start_ms(struct blob_attr *since, int64_t now) {
+        if (!since) {
+            return 0;
+        }
+
+        return now - static_cast<int64_t>(blobmsg_get_u32(since)) * 1000;
+    }
+
+    int picod_history(struct ubus_context *ctx, struct ubus_object *obj,
+        struct ubus_request_data *req, const char *method, struct blob_attr *msg) {
+        TRACE_SCOPE("ubus/history");
+
+        struct blob_attr *tb[__HISTORY_MAX];
+
+        blobmsg_parse(history_policy, __HISTORY_MAX, tb, blob_data(msg), blob_len(msg));
+        if (!tb[HISTORY_SENSOR]) {
+            return UBUS_STATUS_INVALID_ARGUMENT;
+        }
+
+        const char * sensor = blobmsg_get_string(tb[HISTORY_SENSOR]);
+        SensorHistory::Kind kind;
+        if (!SensorHistory::instance().kind(sensor, kind)) {
+            return UBUS_STATUS_NOT_FOUND;
+        }
+
+        uint32_t points = tb[HISTORY_POINTS] ? 
+            blobmsg_get_u32(tb[HISTORY_POINTS]) : HISTORY_DEFAULT_POINTS;
+        
+        const int64_t now = SensorHistory::now_ms();
+        auto series = SensorHistory::instance().series(sensor, 
+            get_history_start_ms(tb[HISTORY_SINCE], now), now, points);
+
+        blob_buf_init(&b, 0);
+        blobmsg_add_string(&b, history_policy[HISTORY_SENSOR].name, sensor);
+        blobmsg_add_string(&b, "unit", 
+            (kind == SensorHistory::TEMPERATURE) ? "celsius" : "rpm");
+
+        void *c = blobmsg_open_array(&b, "timestamp_ms");
+        for (auto const& s : series) {
+            blobmsg_add_u64(&b, NULL, s.timestamp_ms);
+        }
+        blobmsg_close_array(&b, c);
+
+        c = blobmsg_open_array(&b, "values");
+        for (auto const& s : series) {
+            blobmsg_add_double(&b, NULL, s.value);
+        }
+        blobmsg_close_array(&b, c);
+
+        ubus_send_reply(ctx, req, b.head);
+
+        return UBUS_STATUS_OK;
+    }
+
+    int picod_stats(struct ubus_context *ctx, struct ubus_object *obj,
+        struct ubus_request_data *req, const char *method, struct blob_attr *msg) {
+        TRACE_SCOPE("ubus/stats");
+
+        struct blob_attr *tb[__STATS_MAX];
+
+        blobmsg_parse(stats_policy, __STATS_MAX, tb, blob_data(msg), blob_len(msg));
+        if (!tb[STATS_SENSOR]) {
+            return UBUS_STATUS_INVALID_ARGUMENT;
+        }
+
+        const char * sensor = blobmsg_get_string(tb[STATS_SENSOR]);
+        const int64_t now = SensorHistory::now_ms();
+        SensorHistory::Stats stats;
+
+        if (!SensorHistory::instance().stats(sensor, 
+            get_history_start_ms(tb[STATS_SINCE], now), now, stats)) {
+            return UBUS_STATUS_NO_DATA;
+        }
+
+        blob_buf_init(&b, 0);
+        blobmsg_add_string(&b, stats_policy[STATS_SENSOR].name, sensor);
+        blobmsg_add_u32(&b, "count", stats.count);
+        blobmsg_add_double(&b, "min", stats.min);
+        blobmsg_add_double(&b, "max", stats.max);
+        blobmsg_add_double(&b, "mean", stats.mean);
+        blobmsg_add_double(&b, "p95", stats.p95);
+
+        ubus_send_reply(ctx, req, b.head);
+
+        return UBUS_STATUS_OK;
+    }
+
     void server_main(struct ubus_context *ctx) {
         int ret;
 
@@ -338,6 +921,17 @@ namespace picod
         if (ret)
             fprintf(stderr, "Failed to add object: %s\n", ubus_strerror(ret));
 
+        // Service the serial port from this event loop
+        pico_serial_fd.fd = PacketHandler::instance().fd();
+        uloop_fd_add(&pico_serial_fd, ULOOP_READ);
+        PacketHandler::instance().set_timeout_scheduler([](int timeout_ms) {
+            uloop_timeout_set(&pico_timeout_timer, timeout_ms);
+        });
+
+        refresh_snapshot();
+
+        temperature_poll_deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(
+            static_cast<int>(appSettings.temperature_poll_interval_seconds * 1000));
         uloop_timeout_set(&notify_temperature_timer, 
             static_cast<int>(appSettings.temperature_poll_interval_seconds * 1000));
 
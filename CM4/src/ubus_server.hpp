@@ -30,6 +30,21 @@ namespace picod {
     int picod_fan_pwm(struct ubus_context *ctx, struct ubus_object *obj,
         struct ubus_request_data *req, const char *method, struct blob_attr *msg);
 
+    int picod_fan_calibrate(struct ubus_context *ctx, struct ubus_object *obj,
+        struct ubus_request_data *req, const char *method, struct blob_attr *msg);
+
+    int picod_fan_calibration(struct ubus_context *ctx, struct ubus_object *obj,
+        struct ubus_request_data *req, const char *method, struct blob_attr *msg);
+
+    int picod_history(struct ubus_context *ctx, struct ubus_object *obj,
+        struct ubus_request_data *req, const char *method, struct blob_attr *msg);
+
+    int picod_stats(struct ubus_context *ctx, struct ubus_object *obj,
+        struct ubus_request_data *req, const char *method, struct blob_attr *msg);
+
+    int picod_pico_events(struct ubus_context *ctx, struct ubus_object *obj,
+        struct ubus_request_data *req, const char *method, struct blob_attr *msg);
+
     void server_main(void);
     int run_ubus_server(const char *ubus_socket = nullptr);
 
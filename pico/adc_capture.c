@@ -0,0 +1,256 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <string.h>
+#include "pico/stdlib.h"
+#include "pico/multicore.h"
+#include "hardware/adc.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "ntc.h"
+#include "adc_capture.h"
+
+// Samples in each DMA block, in round-robin order: input 0, 1, ... 4, 0, 1, ...
+#define ADC_CAPTURE_BLOCK_LEN (ADC_CAPTURE_NUM_INPUTS * ADC_CAPTURE_BLOCK_ROUNDS)
+
+// The ADC runs from the 48 MHz USB PLL
+#define ADC_CLOCK_Hz 48000000.0f
+
+// Onboard sensor: T = 27 - (V - 0.706) / 0.001721, as a line in ADC codes.
+// Q8 fixed point, in °C x 100.
+#define ONBOARD_CX100_AT_CODE0_Q8  ((int32_t)((27.0 + 0.706 / 0.001721) * 100.0 * 256.0))
+#define ONBOARD_CX100_PER_CODE_Q8  ((int32_t)((3.3 / 4096.0) / 0.001721 * 100.0 * 256.0 + 0.5))
+
+// Filled in turn by dma_chan[0] and dma_chan[1]. Block N is blocks[N & 1].
+static uint16_t blocks[2][ADC_CAPTURE_BLOCK_LEN];
+static int dma_chan[2] = { -1, -1 };
+// Blocks filled by DMA, and blocks added to the window by core1
+static volatile uint32_t blocks_filled = 0;
+static uint32_t blocks_done = 0;
+
+// Published windows. Core1 fills windows[(window_seq + 1) & 1], then
+// increments window_seq. A reader retries if window_seq changed while
+// it was copying.
+static adc_capture_window_t windows[2];
+static volatile uint32_t window_seq = 0;
+
+// Settings requested by core0, applied by core1 when config_seq changes
+static volatile uint32_t config_rate_hz = ADC_CAPTURE_DEFAULT_RATE_Hz;
+static volatile uint32_t config_window_ms = ADC_CAPTURE_DEFAULT_WINDOW_ms;
+static volatile uint32_t config_seq = 0;
+
+// Window being accumulated. Only used by core1.
+static int64_t sum_cx100[ADC_CAPTURE_NUM_INPUTS];
+static int32_t min_cx100[ADC_CAPTURE_NUM_INPUTS];
+static int32_t max_cx100[ADC_CAPTURE_NUM_INPUTS];
+static uint32_t num_samples = 0;
+static uint64_t window_start_us = 0;
+static uint32_t window_us = ADC_CAPTURE_DEFAULT_WINDOW_ms * 1000;
+
+static inline int32_t onboard_cx100(uint16_t code) {
+    return (ONBOARD_CX100_AT_CODE0_Q8 - (ONBOARD_CX100_PER_CODE_Q8 * (int32_t)code)) / 256;
+}
+
+static void window_reset(void) {
+    for (int i = 0; i < ADC_CAPTURE_NUM_INPUTS; i++) {
+        sum_cx100[i] = 0;
+        min_cx100[i] = INT32_MAX;
+        max_cx100[i] = INT32_MIN;
+    }
+
+    num_samples = 0;
+    // time_us_64() reads the raw timer registers, so it is safe on both
+    // cores, unlike get_time() which relies on the TIMELR/TIMEHR latch
+    window_start_us = time_us_64();
+}
+
+static void window_publish(void) {
+    adc_capture_window_t *w = &windows[(window_seq + 1) & 1];
+
+    for (int i = 0; i < ADC_CAPTURE_NUM_INPUTS; i++) {
+        w->mean_cx100[i] = (int32_t)(sum_cx100[i] / (int64_t)num_samples);
+        w->min_cx100[i] = min_cx100[i];
+        w->max_cx100[i] = max_cx100[i];
+    }
+    w->num_samples = num_samples;
+    w->start_us = window_start_us;
+    w->end_us = time_us_64();
+
+    // The window must be complete before readers can see it
+    __dmb();
+    window_seq++;
+
+    window_reset();
+}
+
+/// @brief Adds a DMA block to the current window
+static void window_add_block(const uint16_t *block) {
+    for (int r = 0; r < ADC_CAPTURE_BLOCK_ROUNDS; r++) {
+        for (int i = 0; i < ADC_CAPTURE_NUM_INPUTS; i++) {
+            uint16_t code = block[r * ADC_CAPTURE_NUM_INPUTS + i] & 0x0FFF;
+            int32_t t = (i == ADC_CAPTURE_ONBOARD_INPUT) ?
+                onboard_cx100(code) : ntc_lookup_cx100(code);
+
+            sum_cx100[i] += t;
+            min_cx100[i] = (t < min_cx100[i]) ? t : min_cx100[i];
+            max_cx100[i] = (t > max_cx100[i]) ? t : max_cx100[i];
+        }
+    }
+
+    num_samples += ADC_CAPTURE_BLOCK_ROUNDS;
+}
+
+// Runs on core1
+static void on_adc_dma_irq(void) {
+    for (int i = 0; i < 2; i++) {
+        if (!dma_channel_get_irq1_status(dma_chan[i])) {
+            continue;
+        }
+
+        dma_channel_acknowledge_irq1(dma_chan[i]);
+        // The other channel is filling its block now. Re-arm this one for
+        // when the other chains back to it.
+        dma_channel_set_write_addr(dma_chan[i], blocks[i], false);
+        blocks_filled++;
+    }
+}
+
+/// @brief Stops the ADC and DMA
+static void capture_stop(void) {
+    adc_run(false);
+
+    for (int i = 0; i < 2; i++) {
+        // Aborting may raise a completion interrupt (RP2040-E13), so keep it masked
+        dma_channel_set_irq1_enabled(dma_chan[i], false);
+        dma_channel_abort(dma_chan[i]);
+        dma_channel_acknowledge_irq1(dma_chan[i]);
+    }
+
+    adc_fifo_drain();
+}
+
+/// @brief (Re)starts round-robin sampling at rate_hz per input
+static void capture_start(uint32_t rate_hz) {
+    for (int i = 0; i < 2; i++) {
+        dma_channel_config c = dma_channel_get_default_config(dma_chan[i]);
+        channel_config_set_transfer_data_size(&c, DMA_SIZE_16);
+        channel_config_set_read_increment(&c, false);
+        channel_config_set_write_increment(&c, true);
+        channel_config_set_dreq(&c, DREQ_ADC);
+        channel_config_set_chain_to(&c, dma_chan[(i + 1) & 1]);
+
+        dma_channel_configure(dma_chan[i], &c, blocks[i], &adc_hw->fifo,
+            ADC_CAPTURE_BLOCK_LEN, false);
+        dma_channel_set_irq1_enabled(dma_chan[i], true);
+    }
+
+    blocks_filled = 0;
+    blocks_done = 0;
+
+    // One conversion per DREQ, starting from input 0
+    adc_select_input(0);
+    adc_set_round_robin((1 << ADC_CAPTURE_NUM_INPUTS) - 1);
+    adc_fifo_setup(true, true, 1, false, false);
+    adc_set_clkdiv((ADC_CLOCK_Hz / (float)(rate_hz * ADC_CAPTURE_NUM_INPUTS)) - 1.0f);
+
+    window_reset();
+    dma_channel_start(dma_chan[0]);
+    adc_run(true);
+}
+
+static void adc_capture_core1_entry(void) {
+    uint32_t applied_config_seq = config_seq;
+
+    // Core0 pauses this core while it writes the flash
+    multicore_lockout_victim_init();
+
+    irq_set_exclusive_handler(DMA_IRQ_1, on_adc_dma_irq);
+    irq_set_enabled(DMA_IRQ_1, true);
+
+    capture_start(config_rate_hz);
+
+    while (true) {
+        // Sleep until a block is filled. The interrupt still wakes the
+        // core while masked, so it cannot be missed between the check and
+        // the __wfi().
+        uint32_t status = save_and_disable_interrupts();
+        if (blocks_filled == blocks_done) {
+            __wfi();
+        }
+        restore_interrupts(status);
+
+        if (applied_config_seq != config_seq) {
+            applied_config_seq = config_seq;
+            window_us = config_window_ms * 1000;
+            capture_stop();
+            capture_start(config_rate_hz);
+            continue;
+        }
+
+        uint32_t filled = blocks_filled;
+
+        if ((filled - blocks_done) > 1) {
+            // Core1 fell behind, the older blocks were overwritten
+            blocks_done = filled - 1;
+        }
+
+        while (blocks_done != filled) {
+            window_add_block(blocks[blocks_done & 1]);
+            blocks_done++;
+        }
+
+        // The first window is published as soon as it has any samples,
+        // so readers never see an empty one after init_adc_capture()
+        if ((num_samples > 0) && ((window_seq == 0) ||
+            ((time_us_64() - window_start_us) >= window_us))) {
+            window_publish();
+        }
+    }
+}
+
+void init_adc_capture(void) {
+    dma_chan[0] = dma_claim_unused_channel(true);
+    dma_chan[1] = dma_claim_unused_channel(true);
+
+    multicore_launch_core1(adc_capture_core1_entry);
+
+    // Wait for the first window, one DMA block at most
+    while (window_seq == 0) {
+        tight_loop_contents();
+    }
+}
+
+void adc_capture_configure(uint32_t rate_hz, uint32_t window_ms) {
+    rate_hz = (rate_hz < ADC_CAPTURE_MIN_RATE_Hz) ? ADC_CAPTURE_MIN_RATE_Hz : rate_hz;
+    rate_hz = (rate_hz > ADC_CAPTURE_MAX_RATE_Hz) ? ADC_CAPTURE_MAX_RATE_Hz : rate_hz;
+    window_ms = (window_ms < ADC_CAPTURE_MIN_WINDOW_ms) ? ADC_CAPTURE_MIN_WINDOW_ms : window_ms;
+    window_ms = (window_ms > ADC_CAPTURE_MAX_WINDOW_ms) ? ADC_CAPTURE_MAX_WINDOW_ms : window_ms;
+
+    if ((rate_hz == config_rate_hz) && (window_ms == config_window_ms)) {
+        return;
+    }
+
+    config_rate_hz = rate_hz;
+    config_window_ms = window_ms;
+    __dmb();
+    config_seq++;
+}
+
+void adc_capture_get_window(adc_capture_window_t *w) {
+    uint32_t seq;
+
+    do {
+        seq = window_seq;
+        __dmb();
+        memcpy(w, &windows[seq & 1], sizeof(*w));
+        __dmb();
+    } while (seq != window_seq);
+}
+
+void adc_capture_hold(bool hold) {
+    // Without conversions there are no DREQs, so the DMA waits
+    adc_run(!hold);
+}
@@ -0,0 +1,80 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef ADC_CAPTURE_H_
+#define ADC_CAPTURE_H_
+
+#include "pico/stdlib.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The temperature sensors are sampled continuously by core1. The ADC runs
+ * free in round-robin mode over the four NTC inputs and the onboard
+ * sensor, and DMA moves the samples into two blocks in turn. While one
+ * block fills, core1 adds the other to the mean, min and max of the
+ * current window.
+ *
+ * Every window (ADC_CAPTURE_DEFAULT_WINDOW_ms by default), core1 publishes
+ * the aggregates to one of two buffers. Core0 copies the latest one, so
+ * reading a sensor takes the same short time whatever the sample rate,
+ * and a temperature spike between host polls still shows in the max.
+ */
+
+// ADC inputs sampled: the four NTC thermistors (0 to 3) and the onboard sensor (4)
+#define ADC_CAPTURE_NUM_INPUTS 5
+
+// Input of the onboard temperature sensor
+#define ADC_CAPTURE_ONBOARD_INPUT 4
+
+// Samples per input in each DMA block
+#define ADC_CAPTURE_BLOCK_ROUNDS 8
+
+// Samples per second per input
+#define ADC_CAPTURE_DEFAULT_RATE_Hz 1000
+#define ADC_CAPTURE_MIN_RATE_Hz     200
+#define ADC_CAPTURE_MAX_RATE_Hz     20000
+
+// Length of the aggregation window
+#define ADC_CAPTURE_DEFAULT_WINDOW_ms 1000
+#define ADC_CAPTURE_MIN_WINDOW_ms     100
+#define ADC_CAPTURE_MAX_WINDOW_ms     10000
+
+/// @brief Aggregates of one window. Temperatures are in °C x 100,
+/// without the NTC calibration offsets.
+typedef struct adc_capture_window_t {
+    int32_t mean_cx100[ADC_CAPTURE_NUM_INPUTS];
+    int32_t min_cx100[ADC_CAPTURE_NUM_INPUTS];
+    int32_t max_cx100[ADC_CAPTURE_NUM_INPUTS];
+    /// @brief Samples per input in the window. Zero(0) before the first window.
+    uint32_t num_samples;
+    /// @brief Pico time (us since boot) the window started and ended.
+    /// Accurate to about one DMA block (ADC_CAPTURE_BLOCK_ROUNDS samples).
+    uint64_t start_us;
+    uint64_t end_us;
+} adc_capture_window_t;
+
+/// @brief Starts sampling on core1. The ADC and its GPIOs must already be set up.
+void init_adc_capture(void);
+
+/// @brief Changes the sample rate and window length. Out of range values
+/// are clamped. Takes effect from the next window.
+void adc_capture_configure(uint32_t rate_hz, uint32_t window_ms);
+
+/// @brief Copies the most recently published window
+void adc_capture_get_window(adc_capture_window_t *w);
+
+/// @brief Stops (true) and restarts (false) the conversions, e.g. while
+/// core1 is locked out for a flash write and cannot re-arm the DMA.
+/// Sampling resumes where it stopped.
+void adc_capture_hold(bool hold);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -17,6 +17,13 @@
 #include "pico_pkt_watchdog.h"
 #include "pico_pkt_shutdown.h"
 #include "pico_pkt_version.h"
+#include "pico_pkt_fan_ctrl.h"
+#include "pico_pkt_ntc_cal.h"
+#include "pico_pkt_event_log.h"
+#include "pico_pkt_time.h"
+#include "pico_pkt_flash_config.h"
+#include "uart_dma.h"
+#include "adc_capture.h"
 
 #define SET_PIN_DIR(gpio, direction)\
     gpio_init(gpio);\
@@ -29,7 +36,6 @@
 static inline void init_board();
 
 static void init_uart();
-static void uart_write_response(uint8_t *resp);
 
 /*! @brief  Check whether GPIO04 and GPIO05 pins are shorted
 *
@@ -42,22 +48,32 @@ static inline bool is_CM4_USB_boot_mode_enabled();
 
 static bool is_CM4_in_USB_Boot_mode = false;
 
-// Select correct interrupt for the UART we are using
-static int UART_IRQ = UART_ID == uart0 ? UART0_IRQ : UART1_IRQ;
-
 volatile bool is_host_shutdown_request_pending = false;
 volatile bool is_host_hard_reset_request_pending = false;
 
 struct pkt_buf pkt;
+// Pico time (us since boot) the request in pkt finished arriving
+static uint64_t pkt_request_time_us = 0;
 static const struct pkt_handler pkt_handlers[] = {
     PKT_PING,
     PKT_TEMPERATURE,
     PKT_FAN_PWM,
     PKT_WATCHDOG,
     PKT_SHUTDOWN,
-    PKT_VERSION
+    PKT_VERSION,
+    PKT_FAN_CTRL,
+    PKT_NTC_CAL,
+    PKT_EVENT_LOG,
+    PKT_TIME,
+    PKT_FLASH_CONFIG
 };
 
+/// @brief True(1) when an interrupt has left work for the main loop
+static inline bool is_main_loop_work_pending(void) {
+    return is_host_shutdown_request_pending || is_host_hard_reset_request_pending ||
+        is_fan_ctrl_task_pending() || uart_dma_rx_pending();
+}
+
 static inline void blink_led(uint gpio, uint numTimes) {
     
     for (size_t i = 0; i < numTimes; i++) {
@@ -74,21 +90,10 @@ void gpio_isr_callback(uint gpio, uint32_t events) {
         detect_shutdown_events(events);
     } else if (gpio == CM4_RST_GPIO) {
         handle_cm4_events(events);
-    } else {
-        update_tachometer_counter(gpio, events);
     }
 }
 
-int main() {
-    
-    // Pointer to currently active packet handler
-    const struct pkt_handler *handler;
-
-    // Marked volatile to ensure we actually read the byte populated by
-    // the UART ISR
-    const volatile uint8_t *magic = &pkt.req[PKT_MAGIC_IDX];
-
-    volatile bool have_request = false;
+void init_firmware(void) {
 
     memset(&pkt, 0, sizeof(pkt));
     pkt.ready = false;
@@ -102,9 +107,59 @@ int main() {
     
     init_board();
     init_uart();
+}
+
+void load_request(const uint8_t *frame, uint64_t request_time_us) {
+    memcpy((uint8_t *)pkt.req, frame, PICO_PKT_LEN);
+    pkt_request_time_us = request_time_us;
+}
+
+void dispatch_request(void) {
+    
+    // Pointer to currently active packet handler
+    const struct pkt_handler *handler = NULL;
+
+    // Determine which packet handler should receive this message
+    for (int i = 0; i < ARRAY_SIZE(pkt_handlers); i++) {            
+        if (pkt_handlers[i].magic == pkt.req[PKT_MAGIC_IDX]) {
+            handler = &pkt_handlers[i];
+            break;
+        }
+    }
+
+    if (handler == NULL) {
+        // We are out of sync, just discard the data and
+        // wait for the next packet
+        pico_event_log(PICO_EVENT_OUT_OF_SYNC, pkt.req[PKT_MAGIC_IDX]);
+        memset(&pkt, 0, sizeof(pkt));
+        uart_dma_rx_flush();
+        blink_led(LED_PIN4_GPIO, 4);
+        return;
+    }           
+
+    // Process data and execute requested actions
+    handler->exec(&pkt);
+}
+
+int main() {
+    
+    // Oldest request received via the UART
+    const uint8_t *frame;
+
+    init_firmware();
         
     while (true) {
 
+        // Sleep until an interrupt leaves some work. Interrupts are masked
+        // from the check to __wfi(), and a masked interrupt still ends the
+        // __wfi(), so one that fires in between cannot be missed. It is
+        // serviced once interrupts are restored.
+        uint32_t status = save_and_disable_interrupts();
+        if (!is_main_loop_work_pending()) {
+            __wfi();
+        }
+        restore_interrupts(status);
+
         if (is_host_shutdown_request_pending) {
             send_shutdown_request();
             is_host_shutdown_request_pending = false;
@@ -112,37 +167,21 @@ int main() {
             reset_the_cm4();
             is_host_hard_reset_request_pending = false;
         }               
+
+        fan_ctrl_task();
+        uart_dma_task();
         
-        have_request = (pkt.ready == true);
+        frame = uart_dma_rx_peek();
 
-        if (!have_request) {
-            tight_loop_contents();
+        if (frame == NULL) {
             continue;
         }
 
-        // A command has been received via the UART
-        pkt.ready = false;          
-        handler = NULL;
-
-        // Determine which packet handler should receive this message
-        for (int i = 0; i < ARRAY_SIZE(pkt_handlers); i++) {            
-            if (pkt_handlers[i].magic == *magic) {
-                handler = &pkt_handlers[i];
-                break;
-            }
-        }
-
-        if (handler == NULL) {
-            // We are out of sync, just discard the data and
-            // wait for the next packet
-            memset(&pkt, 0, sizeof(pkt));
-            pkt.ready = false;
-            blink_led(LED_PIN4_GPIO, 4);
-            continue;
-        }           
-
-        // Process data and execute requested actions
-        handler->exec(&pkt);
+        // A command has been received via the UART. Handlers work on a
+        // copy so that the slot can take the next request right away.
+        load_request(frame, uart_dma_rx_time_us());
+        uart_dma_rx_pop();
+        dispatch_request();
         
     }//@END while (true)
 }
@@ -183,6 +222,14 @@ static inline void init_board() {
     gpio_put(M2_PWR_EN_GPIO, 1);
 
     is_CM4_in_USB_Boot_mode = is_CM4_USB_boot_mode_enabled();
+
+    // Apply the settings picod saved in flash, so that the fans and the
+    // watchdog are right before the CM4 is powered. A CM4 waiting in USB
+    // boot mode would be reset by the watchdog.
+    load_flash_config(!is_CM4_in_USB_Boot_mode);
+
+    // Fan revolutions are counted by PIO, see tachometer.pio
+    init_fan_pwm();
         
     if (is_CM4_in_USB_Boot_mode) {
         gpio_put(CM4_BOOT_GPIO, 0);
@@ -214,14 +261,8 @@ static inline void init_board() {
         ch_mask += 1 << ch;
     }
 
-    // Setup interrupt handler to count FAN1's revolutions
-    gpio_set_irq_enabled_with_callback(FAN1_TACHO_GPIO, 
-        GPIO_IRQ_EDGE_RISE, true, &gpio_isr_callback);
-
-    gpio_set_irq_enabled_with_callback(CM4_FAN_TACHO_GPIO, 
-        GPIO_IRQ_EDGE_RISE, true, &gpio_isr_callback);
-    
-    init_fan_pwm();    
+    // Sensors are sampled continuously by core1, see adc_capture.c
+    init_adc_capture();
 }
 
 static inline bool is_CM4_USB_boot_mode_enabled() {    
@@ -235,35 +276,6 @@ static inline bool is_CM4_USB_boot_mode_enabled() {
     return result;
 }
 
-static int rx_idx = 0;
-
-// RX interrupt handler
-static void on_uart_rx() {
-    uint8_t *req = (uint8_t *)pkt.req;
-
-    while (uart_is_readable(UART_ID)) {
-
-        int ch = uart_getc(UART_ID);
-
-        // Drop the NULL byte at the beginning.
-        if((ch == 0) && (rx_idx == 0)) {
-            continue;            
-        } else {
-            req[rx_idx] = ch;
-        }
-        
-        rx_idx++;
-
-        if (rx_idx == PICO_PKT_LEN) {           
-            // Tell the main loop that there is a request pending
-            pkt.ready = true;                        
-            rx_idx = 0;
-            update_watchdog();
-            break;
-        }
-    }
-}
-
 static void init_uart()
 {
     // Set up our UART with a basic baud rate.
@@ -285,22 +297,15 @@ static void init_uart()
     // Set our data format
     uart_set_format(UART_ID, DATA_BITS, STOP_BITS, PARITY);
 
-    // Turn off FIFO's - we want to do this character by character
-    uart_set_fifo_enabled(UART_ID, false);
+    // Keep the FIFOs on, the RX FIFO buffers bytes while DMA is between frames
+    uart_set_fifo_enabled(UART_ID, true);
 
-    // Set up a RX interrupt
-    // We need to set up the handler first
-    // Select correct interrupt for the UART we are using
-    //int UART_IRQ = UART_ID == uart0 ? UART0_IRQ : UART1_IRQ;
-
-    // Set up and enable the interrupt handlers
-    irq_set_exclusive_handler(UART_IRQ, on_uart_rx);
-    irq_set_enabled(UART0_IRQ, true);
-
-    // Now enable the UART to send interrupts - RX only
-    uart_set_irq_enables(UART_ID, true, false);
+    // Requests are received by DMA, see uart_dma.c
+    init_uart_dma();
+}
 
-    // Setup complete, now run a loop and wait for RX interrupts
+uint64_t get_request_time(void) {
+    return pkt_request_time_us;
 }
 
 uint64_t get_time(void) {
@@ -82,4 +82,18 @@
 // Returns 64 bit time from the timer
 uint64_t get_time(void);
 
+// Returns the time (as get_time()) the request being handled finished arriving
+uint64_t get_request_time(void);
+
+// Initializes the packet handlers, the board and the UART
+void init_firmware(void);
+
+// Copies a request from the host, which finished arriving at request_time_us
+// (as get_time()), to the buffer the packet handlers work on
+void load_request(const uint8_t *frame, uint64_t request_time_us);
+
+// Hands the loaded request to its packet handler. A request with an unknown
+// magic value drops the queued requests, to get back in sync with the host.
+void dispatch_request(void);
+
 #endif
\ No newline at end of file
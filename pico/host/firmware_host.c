@@ -0,0 +1,420 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Runs the firmware's packet handlers and dispatch (cm4-wrt-a.c and
+ * pico_pkt_*.c) on the host, against the mock Pico SDK in mock/.
+ *
+ *   firmware_host bench [rounds]
+ *
+ * Loads each kind of request and times dispatch_request(), i.e. finding
+ * the handler, running it and queueing the response(s), in virtual time
+ * with the timers running between requests. Also times the tachometer
+ * timer and a fan control step. Exits with status 1 if a request gets a
+ * response with the wrong magic value, or the wrong number of them.
+ *
+ * Timings are taken on the host CPU. They rank the handlers and show the
+ * effect of a change, but the Cortex-M0+ (125 MHz, no FPU, no cache in
+ * front of flash) is much slower, the more so for float code.
+ *
+ *   firmware_host pty [link] [flash file]
+ *
+ * Runs the firmware's main loop in real time on a pseudo terminal that
+ * picod can open as its pico_serial_device_path, optionally through a
+ * symbolic link. With a flash file, settings saved by picod are kept
+ * across runs. The fans follow their duty cycle.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pty.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include "mock_sdk.h"
+#include "cm4-wrt-a.h"
+#include "pkt_handler.h"
+#include "pico_pkt_temperature.h"
+#include "pico_pkt_ping.h"
+#include "pico_pkt_fan_pwm.h"
+#include "pico_pkt_watchdog.h"
+#include "pico_pkt_shutdown.h"
+#include "pico_pkt_version.h"
+#include "pico_pkt_fan_ctrl.h"
+#include "pico_pkt_ntc_cal.h"
+#include "pico_pkt_event_log.h"
+#include "pico_pkt_time.h"
+#include "pico_pkt_flash_config.h"
+
+#define BENCH_DEFAULT_ROUNDS 10000
+// Time a frame takes to arrive at 115200 baud
+#define BENCH_FRAME_TIME_us 1389
+// Responses kept per request, more than any handler sends
+#define BENCH_MAX_RESPONSES 16
+// Fan speed at 100% duty cycle, and the duty cycle below which fans stall
+#define FAN1_MAX_RPM 3000
+#define CM4_FAN_MAX_RPM 5000
+#define FAN_STALL_DUTY 0.1f
+#define FAN_UPDATE_ms 100
+#define CM4_BOOT_ms 1000
+
+// Main loop of cm4-wrt-a.c, renamed by CMakeLists.txt
+int firmware_main(void);
+// Timer callback in pico_pkt_fan_pwm.c
+bool tachometer_timer_callback(struct repeating_timer *t);
+
+typedef struct bench_case_t {
+    const char *name;
+    void (*pack)(uint8_t *req);
+    /// @brief Responses expected, -1 for at least one
+    int num_responses;
+} bench_case_t;
+
+static uint8_t responses[BENCH_MAX_RESPONSES][PICO_PKT_LEN];
+static int num_responses = 0;
+static struct repeating_timer fan_timer;
+static struct repeating_timer cm4_boot_timer;
+static int pty_fd = -1;
+static char link_path[256];
+static volatile uint64_t sink;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void collect_response(const uint8_t *frame) {
+    if (num_responses < BENCH_MAX_RESPONSES) {
+        memcpy(responses[num_responses], frame, PICO_PKT_LEN);
+    }
+    num_responses++;
+}
+
+/// @brief Spins the fans at a speed that follows their PWM duty cycle
+static bool fan_timer_callback(struct repeating_timer *t) {
+    const struct { uint pwm_gpio; uint tacho_gpio; uint32_t max_rpm; } fans[] = {
+        { FAN1_PWM_GPIO, FAN1_TACHO_GPIO, FAN1_MAX_RPM },
+        { CM4_FAN_PWM_GPIO, CM4_FAN_TACHO_GPIO, CM4_FAN_MAX_RPM },
+    };
+
+    for (size_t i = 0; i < ARRAY_SIZE(fans); i++) {
+        float duty = mock_pwm_get_duty(fans[i].pwm_gpio);
+        mock_fan_set_rpm(fans[i].tacho_gpio,
+            (duty < FAN_STALL_DUTY) ? 0 : (uint32_t)(duty * fans[i].max_rpm));
+    }
+
+    return true;
+}
+
+/// @brief The CM4 comes up a while after the Pico powers it
+static bool cm4_boot_timer_callback(struct repeating_timer *t) {
+    mock_gpio_set_input(CM4_RST_GPIO, true);
+    return false;
+}
+
+/// @brief Starts the board around the firmware: the fans and the CM4
+static void start_board(void) {
+    add_repeating_timer_ms(FAN_UPDATE_ms, fan_timer_callback, NULL, &fan_timer);
+    add_repeating_timer_ms(CM4_BOOT_ms, cm4_boot_timer_callback, NULL, &cm4_boot_timer);
+}
+
+static void pack_ping(uint8_t *req) {
+    pico_pkt_ping_req_pack(req);
+}
+
+static void pack_temperature(uint8_t *req) {
+    pico_pkt_temperature_req_t r = { .statistic = PICO_TEMPERATURE_STAT_MEAN };
+    pico_pkt_temperature_req_pack(req, &r);
+}
+
+static void pack_temperature_max_time(uint8_t *req) {
+    pico_pkt_temperature_req_t r = { .statistic = PICO_TEMPERATURE_STAT_MAX, .timestamp = true };
+    pico_pkt_temperature_req_pack(req, &r);
+}
+
+static void pack_fan_pwm_read(uint8_t *req) {
+    struct pico_pkt_fan_pwm_t fans[NUM_PWM_FANS] = {
+        { .fan_id = SYS_FAN1 }, { .fan_id = CM4_FAN }
+    };
+    pico_pkt_fan_pwm_req_pack(req, fans, false);
+}
+
+static void pack_fan_pwm_write(uint8_t *req) {
+    struct pico_pkt_fan_pwm_t fans[NUM_PWM_FANS] = {
+        { .fan_id = SYS_FAN1, .pwm_pct = 0.6f }, { .fan_id = CM4_FAN, .pwm_pct = 0.4f }
+    };
+    pico_pkt_fan_pwm_req_pack(req, fans, true);
+}
+
+static void pack_watchdog_read(uint8_t *req) {
+    pico_pkt_watchdog_t w = { .write = false };
+    pico_pkt_watchdog_req_pack(req, &w);
+}
+
+static void pack_shutdown(uint8_t *req) {
+    pico_pkt_shutdown_req_pack(req);
+}
+
+static void pack_version(uint8_t *req) {
+    pico_pkt_version_req_pack(req);
+}
+
+static void pack_fan_ctrl_read(uint8_t *req) {
+    pico_pkt_fan_ctrl_t c = { .fan_id = SYS_FAN1 };
+    pico_pkt_fan_ctrl_req_pack(req, &c);
+}
+
+static void pack_fan_ctrl_status(uint8_t *req) {
+    pico_pkt_fan_ctrl_t c = { .fan_id = SYS_FAN1, .status = true };
+    pico_pkt_fan_ctrl_req_pack(req, &c);
+}
+
+static void pack_fan_ctrl_auto(uint8_t *req) {
+    pico_pkt_fan_ctrl_t c = {
+        .write = true,
+        .fan_id = SYS_FAN1,
+        .mode = PICO_FAN_CTRL_MODE_AUTO,
+        .sensor_mask = 0x1f,
+        .hysteresis_c = 2,
+        .min_duty_pct = 20,
+        .num_points = 4,
+        .points = { { 30, 20 }, { 40, 40 }, { 50, 70 }, { 60, 100 } }
+    };
+    pico_pkt_fan_ctrl_req_pack(req, &c);
+}
+
+static void pack_ntc_cal_read(uint8_t *req) {
+    pico_pkt_ntc_cal_t n = { .write = false };
+    pico_pkt_ntc_cal_pack(req, &n, false);
+}
+
+static void pack_event_log(uint8_t *req) {
+    pico_pkt_event_log_req_pack(req, 0, PICO_EVENT_LOG_MAX_BURST);
+}
+
+static void pack_time(uint8_t *req) {
+    pico_pkt_time_req_pack(req, 0x0123456789abcdefull);
+}
+
+static void pack_flash_config_read(uint8_t *req) {
+    pico_pkt_flash_config_t f = { .command = PICO_FLASH_CONFIG_CMD_READ };
+    pico_pkt_flash_config_pack(req, &f, false);
+}
+
+static void pack_flash_config_save(uint8_t *req) {
+    pico_pkt_flash_config_t f = { .command = PICO_FLASH_CONFIG_CMD_SAVE, .host_tag = 1 };
+    pico_pkt_flash_config_pack(req, &f, false);
+}
+
+static const bench_case_t bench_cases[] = {
+    { "ping",                   pack_ping,                 1 },
+    { "temperature mean",       pack_temperature,          1 },
+    { "temperature max + time", pack_temperature_max_time, 2 },
+    { "fan_pwm read",           pack_fan_pwm_read,         1 },
+    { "fan_pwm write",          pack_fan_pwm_write,        1 },
+    { "watchdog read",          pack_watchdog_read,        1 },
+    { "shutdown",               pack_shutdown,             0 },
+    { "version",                pack_version,             -1 },
+    { "fan_ctrl read",          pack_fan_ctrl_read,        1 },
+    { "fan_ctrl status",        pack_fan_ctrl_status,      1 },
+    { "fan_ctrl write (auto)",  pack_fan_ctrl_auto,        1 },
+    { "ntc_cal read",           pack_ntc_cal_read,         1 },
+    { "event_log",              pack_event_log,           -1 },
+    { "time",                   pack_time,                 1 },
+    { "flash_config read",      pack_flash_config_read,    1 },
+    { "flash_config save",      pack_flash_config_save,    1 },
+};
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void print_times(const char *name, const char *responses, uint64_t *ns, int rounds) {
+    uint64_t sum = 0;
+    for (int i = 0; i < rounds; i++) {
+        sum += ns[i];
+    }
+
+    qsort(ns, rounds, sizeof(ns[0]), compare_u64);
+    printf("%-24s %9s %8llu %8llu %8llu %8.0f\n", name, responses,
+        (unsigned long long)ns[0], (unsigned long long)ns[rounds / 2],
+        (unsigned long long)ns[(rounds * 99) / 100], (double)sum / rounds);
+}
+
+/// @brief Times every kind of request
+/// @return Number of requests answered wrongly
+static int bench(int rounds) {
+    uint64_t *ns = calloc(rounds, sizeof(uint64_t));
+    uint8_t req[PICO_PKT_LEN];
+    int failures = 0;
+
+    mock_init(false);
+    mock_uart_set_tx_handler(collect_response);
+    // Let the Pico run a while before the host talks to it
+    mock_time_advance_us(1000000);
+    init_firmware();
+    start_board();
+    mock_time_advance_us(2000000);
+
+    printf("%-24s %9s %8s %8s %8s %8s\n", "request", "responses",
+        "min ns", "med ns", "p99 ns", "mean ns");
+
+    for (size_t c = 0; c < ARRAY_SIZE(bench_cases); c++) {
+        const bench_case_t *b = &bench_cases[c];
+        char counts[16] = "";
+
+        for (int i = 0; i < rounds; i++) {
+            memset(req, 0, sizeof(req));
+            b->pack(req);
+
+            mock_time_advance_us(BENCH_FRAME_TIME_us);
+            num_responses = 0;
+            load_request(req, mock_time_us());
+
+            uint64_t start = now_ns();
+            dispatch_request();
+            ns[i] = now_ns() - start;
+
+            bool ok = (b->num_responses < 0) ? (num_responses > 0) :
+                (num_responses == b->num_responses);
+            for (int r = 0; r < num_responses && r < BENCH_MAX_RESPONSES; r++) {
+                ok = ok && (responses[r][PKT_MAGIC_IDX] == req[PKT_MAGIC_IDX]);
+            }
+
+            if (!ok) {
+                if (failures == 0) {
+                    fprintf(stderr, "%s: wrong response (%d frames)\n", b->name, num_responses);
+                }
+                failures++;
+            }
+
+            snprintf(counts, sizeof(counts), "%d", num_responses);
+        }
+
+        print_times(b->name, counts, ns, rounds);
+    }
+
+    // Fan speeds are read every TACHO_TIMER_DELAY_ms
+    for (int i = 0; i < rounds; i++) {
+        mock_time_advance_us(BENCH_FRAME_TIME_us);
+        uint64_t start = now_ns();
+        tachometer_timer_callback(NULL);
+        ns[i] = now_ns() - start;
+    }
+    print_times("tachometer timer", "-", ns, rounds);
+
+    // A fan control step every timer period, with the curve driving fan 1
+    for (int i = 0; i < rounds; i++) {
+        mock_time_advance_us(1000 * 500);
+        uint64_t start = now_ns();
+        sink += is_fan_ctrl_task_pending();
+        fan_ctrl_task();
+        ns[i] = now_ns() - start;
+    }
+    print_times("fan_ctrl_task", "-", ns, rounds);
+
+    free(ns);
+    return failures;
+}
+
+static void pty_send(const uint8_t *frame) {
+    // Nothing is waiting for a response while the pty is closed
+    if (write(pty_fd, frame, PICO_PKT_LEN) != PICO_PKT_LEN) {
+        return;
+    }
+}
+
+static void pty_receive(void) {
+    uint8_t buf[64];
+    ssize_t n = read(pty_fd, buf, sizeof(buf));
+
+    if (n > 0) {
+        mock_uart_rx_write(buf, n);
+    } else {
+        // Nobody has the pty open: wait for picod
+        usleep(10000);
+    }
+}
+
+static void quit(int signum) {
+    if (link_path[0] != '\0') {
+        unlink(link_path);
+    }
+    _exit(EXIT_SUCCESS);
+}
+
+/// @brief Runs the firmware on a pseudo terminal until interrupted
+static int serve(const char *link, const char *flash) {
+    int slave_fd = -1;
+    char device_path[256];
+
+    if (openpty(&pty_fd, &slave_fd, device_path, NULL, NULL) != 0) {
+        fprintf(stderr, "Failed to open a pseudo terminal: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    struct termios tio;
+    tcgetattr(slave_fd, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(slave_fd, TCSANOW, &tio);
+    // Left open, picod's exclusive mode would stay set after it exits
+    close(slave_fd);
+
+    if (link != NULL) {
+        snprintf(link_path, sizeof(link_path), "%s", link);
+        unlink(link_path);
+        if (symlink(device_path, link_path) != 0) {
+            fprintf(stderr, "Failed to create %s: %s\n", link_path, strerror(errno));
+            return EXIT_FAILURE;
+        }
+    }
+
+    signal(SIGINT, quit);
+    signal(SIGTERM, quit);
+
+    mock_init(true);
+    if ((flash != NULL) && !mock_flash_open(flash)) {
+        fprintf(stderr, "Failed to open %s: %s\n", flash, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    mock_uart_set_tx_handler(pty_send);
+    mock_set_irq_source(pty_fd, pty_receive);
+
+    printf("Firmware running on %s%s%s%s\n", device_path, link ? " (" : "", link ? link : "",
+        link ? ")" : "");
+    printf("Set pico_serial_device_path to it in picod.conf\n");
+    fflush(stdout);
+
+    start_board();
+    return firmware_main();
+}
+
+int main(int argc, char *argv[]) {
+    if ((argc >= 2) && (strcmp(argv[1], "bench") == 0)) {
+        int rounds = (argc >= 3) ? atoi(argv[2]) : BENCH_DEFAULT_ROUNDS;
+        if (rounds <= 0) {
+            fprintf(stderr, "rounds must be positive\n");
+            return EXIT_FAILURE;
+        }
+        return (bench(rounds) == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if ((argc >= 2) && (strcmp(argv[1], "pty") == 0)) {
+        return serve((argc >= 3) ? argv[2] : NULL, (argc >= 4) ? argv[3] : NULL);
+    }
+
+    fprintf(stderr, "Usage: %s bench [rounds]\n"
+                    "       %s pty [link] [flash file]\n", argv[0], argv[0]);
+    return EXIT_FAILURE;
+}
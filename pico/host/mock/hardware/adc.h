@@ -0,0 +1,27 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef MOCK_HARDWARE_ADC_H_
+#define MOCK_HARDWARE_ADC_H_
+
+#include "pico/types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Only the set up is mocked. Temperatures go through the adc_capture.h
+ * interface, see mock_adc_capture.c */
+
+void adc_init(void);
+void adc_gpio_init(uint gpio);
+void adc_set_temp_sensor_enabled(bool enable);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,35 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef MOCK_HARDWARE_FLASH_H_
+#define MOCK_HARDWARE_FLASH_H_
+
+#include "pico/types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FLASH_PAGE_SIZE   (1u << 8)
+#define FLASH_SECTOR_SIZE (1u << 12)
+
+// Only the end of flash is used by the firmware (pico_pkt_flash_config.c),
+// so the mock flash is smaller than the Pico's
+#define PICO_FLASH_SIZE_BYTES (64 * 1024)
+
+extern uint8_t mock_flash[PICO_FLASH_SIZE_BYTES];
+
+// The mock flash is read where the Pico maps its flash
+#define XIP_BASE ((uintptr_t)mock_flash)
+
+void flash_range_erase(uint32_t flash_offs, size_t count);
+void flash_range_program(uint32_t flash_offs, const uint8_t *data, size_t count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
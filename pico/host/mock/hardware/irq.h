@@ -0,0 +1,14 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef MOCK_HARDWARE_IRQ_H_
+#define MOCK_HARDWARE_IRQ_H_
+
+#include "pico/types.h"
+
+/* The mock interrupts are serviced by mock_sdk.c, see hardware/sync.h */
+
+#endif
@@ -0,0 +1,102 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef MOCK_HARDWARE_PIO_H_
+#define MOCK_HARDWARE_PIO_H_
+
+#include "pico/types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The PIO is not simulated instruction by instruction. Each state machine
+ * runs one of the programs below, emulated by mock_sdk.c from the fan
+ * speeds set with mock_fan_set_rpm(). */
+
+#define NUM_PIO_STATE_MACHINES 4
+
+enum mock_pio_program {
+    MOCK_PIO_PROGRAM_NONE,
+    /// @brief Counts rising edges down from X, see tachometer.pio
+    MOCK_PIO_PROGRAM_TACHO_COUNT,
+    /// @brief Pushes the half period of each pulse, see tachometer.pio
+    MOCK_PIO_PROGRAM_TACHO_PERIOD
+};
+
+typedef struct pio_hw {
+    uint index;
+} pio_hw_t;
+
+typedef pio_hw_t *PIO;
+
+extern pio_hw_t mock_pio0;
+extern pio_hw_t mock_pio1;
+#define pio0 (&mock_pio0)
+#define pio1 (&mock_pio1)
+
+typedef struct pio_program {
+    const uint16_t *instructions;
+    uint8_t length;
+    int8_t origin;
+    enum mock_pio_program mock_program;
+} pio_program_t;
+
+typedef struct {
+    uint in_base;
+    uint jmp_pin;
+    uint wrap_target;
+    uint wrap;
+    float clkdiv;
+    bool join_rx;
+} pio_sm_config;
+
+enum pio_fifo_join {
+    PIO_FIFO_JOIN_NONE = 0,
+    PIO_FIFO_JOIN_TX = 1,
+    PIO_FIFO_JOIN_RX = 2,
+};
+
+enum pio_src_dest {
+    pio_pins = 0,
+    pio_x = 1,
+    pio_y = 2,
+    pio_null = 3,
+    pio_pindirs = 4,
+    pio_exec_mov = 4,
+    pio_status = 5,
+    pio_pc = 5,
+    pio_isr = 6,
+    pio_osr = 7,
+    pio_exec_out = 7,
+};
+
+pio_sm_config pio_get_default_sm_config(void);
+void sm_config_set_in_pins(pio_sm_config *c, uint in_base);
+void sm_config_set_jmp_pin(pio_sm_config *c, uint pin);
+void sm_config_set_clkdiv(pio_sm_config *c, float div);
+void sm_config_set_fifo_join(pio_sm_config *c, enum pio_fifo_join join);
+void sm_config_set_wrap(pio_sm_config *c, uint wrap_target, uint wrap);
+
+uint pio_add_program(PIO pio, const pio_program_t *program);
+int pio_claim_unused_sm(PIO pio, bool required);
+int pio_sm_set_consecutive_pindirs(PIO pio, uint sm, uint pin_base, uint pin_count, bool is_out);
+void pio_sm_init(PIO pio, uint sm, uint initial_pc, const pio_sm_config *config);
+void pio_sm_set_enabled(PIO pio, uint sm, bool enabled);
+void pio_sm_exec(PIO pio, uint sm, uint instr);
+uint32_t pio_sm_get(PIO pio, uint sm);
+bool pio_sm_is_rx_fifo_empty(PIO pio, uint sm);
+
+// Only the instructions tachometer.pio executes from C are understood
+uint pio_encode_set(enum pio_src_dest dest, uint value);
+uint pio_encode_mov(enum pio_src_dest dest, enum pio_src_dest src);
+uint pio_encode_push(bool if_full, bool block);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
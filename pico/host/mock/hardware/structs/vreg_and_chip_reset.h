@@ -0,0 +1,25 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef MOCK_HARDWARE_STRUCTS_VREG_AND_CHIP_RESET_H_
+#define MOCK_HARDWARE_STRUCTS_VREG_AND_CHIP_RESET_H_
+
+#include "pico/types.h"
+
+typedef struct {
+    volatile uint32_t vreg;
+    volatile uint32_t bod;
+    volatile uint32_t chip_reset;
+} vreg_and_chip_reset_hw_t;
+
+#define VREG_AND_CHIP_RESET_CHIP_RESET_HAD_POR_BITS         0x00000100
+#define VREG_AND_CHIP_RESET_CHIP_RESET_HAD_RUN_BITS         0x00010000
+#define VREG_AND_CHIP_RESET_CHIP_RESET_HAD_PSM_RESTART_BITS 0x00100000
+
+extern vreg_and_chip_reset_hw_t mock_vreg_and_chip_reset_hw;
+#define vreg_and_chip_reset_hw (&mock_vreg_and_chip_reset_hw)
+
+#endif
@@ -0,0 +1,34 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef MOCK_HARDWARE_SYNC_H_
+#define MOCK_HARDWARE_SYNC_H_
+
+#include "pico/types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// @brief Masks the mock interrupts. Returns the previous state.
+uint32_t save_and_disable_interrupts(void);
+
+/// @brief Restores the state saved by save_and_disable_interrupts(). Pending
+/// interrupts are serviced once they are unmasked, as on the RP2040.
+void restore_interrupts(uint32_t status);
+
+/// @brief Waits for the next mock interrupt: a timer falling due or the
+/// serial line becoming readable. Returns without servicing it when
+/// interrupts are masked.
+void __wfi(void);
+
+static inline void __sev(void) {}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
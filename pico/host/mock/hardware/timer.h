@@ -0,0 +1,30 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef MOCK_HARDWARE_TIMER_H_
+#define MOCK_HARDWARE_TIMER_H_
+
+#include "pico/types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    volatile uint32_t timehr;
+    volatile uint32_t timelr;
+} timer_hw_t;
+
+/// @brief Returns the timer registers, latched with the mock time
+timer_hw_t *mock_timer_hw(void);
+
+#define timer_hw (mock_timer_hw())
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
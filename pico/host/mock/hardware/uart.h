@@ -0,0 +1,42 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef MOCK_HARDWARE_UART_H_
+#define MOCK_HARDWARE_UART_H_
+
+#include "pico/types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Only the set up is mocked. Frames go through the uart_dma.h interface,
+ * see mock_uart_dma.c */
+
+typedef struct uart_inst uart_inst_t;
+
+extern uart_inst_t mock_uart0;
+extern uart_inst_t mock_uart1;
+#define uart0 (&mock_uart0)
+#define uart1 (&mock_uart1)
+
+typedef enum {
+    UART_PARITY_NONE,
+    UART_PARITY_EVEN,
+    UART_PARITY_ODD
+} uart_parity_t;
+
+uint uart_init(uart_inst_t *uart, uint baudrate);
+uint uart_set_baudrate(uart_inst_t *uart, uint baudrate);
+void uart_set_hw_flow(uart_inst_t *uart, bool cts, bool rts);
+void uart_set_format(uart_inst_t *uart, uint data_bits, uint stop_bits, uart_parity_t parity);
+void uart_set_fifo_enabled(uart_inst_t *uart, bool enabled);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,23 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef MOCK_HARDWARE_WATCHDOG_H_
+#define MOCK_HARDWARE_WATCHDOG_H_
+
+#include "pico/types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// @brief False(0): the mock always boots from power on
+bool watchdog_caused_reboot(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
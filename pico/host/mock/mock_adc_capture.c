@@ -0,0 +1,69 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <string.h>
+#include "pico/stdlib.h"
+#include "cm4-wrt-a.h"
+#include "adc_capture.h"
+#include "mock_sdk.h"
+
+/* Host (PC) stand-in for adc_capture.c. Nothing is sampled: each window
+ * reports the temperatures set with mock_adc_set_temperature_cx100() as
+ * its mean, min and max. Windows follow the configured length, with the
+ * number of samples the configured rate would take. */
+
+static int32_t temperature_cx100[ADC_CAPTURE_NUM_INPUTS] = {
+    4000, 4000, 4000, 4000, 3500
+};
+static uint32_t sample_rate_hz = ADC_CAPTURE_DEFAULT_RATE_Hz;
+static uint32_t window_ms = ADC_CAPTURE_DEFAULT_WINDOW_ms;
+// Start of the first window with the current settings
+static uint64_t window_origin_us = 0;
+
+static inline uint32_t clamp(uint32_t value, uint32_t min, uint32_t max) {
+    return (value < min) ? min : ((value > max) ? max : value);
+}
+
+void mock_adc_set_temperature_cx100(uint input, int32_t cx100) {
+    if (input < ADC_CAPTURE_NUM_INPUTS) {
+        temperature_cx100[input] = cx100;
+    }
+}
+
+void init_adc_capture(void) {
+    window_origin_us = get_time();
+}
+
+void adc_capture_configure(uint32_t rate_hz, uint32_t window) {
+    sample_rate_hz = clamp(rate_hz, ADC_CAPTURE_MIN_RATE_Hz, ADC_CAPTURE_MAX_RATE_Hz);
+    window_ms = clamp(window, ADC_CAPTURE_MIN_WINDOW_ms, ADC_CAPTURE_MAX_WINDOW_ms);
+    window_origin_us = get_time();
+}
+
+void adc_capture_get_window(adc_capture_window_t *w) {
+    const uint64_t window_us = (uint64_t)window_ms * 1000;
+    const uint64_t elapsed_us = get_time() - window_origin_us;
+
+    memset(w, 0, sizeof(*w));
+
+    // Nothing is published before the first window ends
+    if (elapsed_us < window_us) {
+        return;
+    }
+
+    w->end_us = window_origin_us + (elapsed_us / window_us) * window_us;
+    w->start_us = w->end_us - window_us;
+    w->num_samples = (uint32_t)(((uint64_t)sample_rate_hz * window_ms) / 1000);
+
+    for (int i = 0; i < ADC_CAPTURE_NUM_INPUTS; i++) {
+        w->mean_cx100[i] = temperature_cx100[i];
+        w->min_cx100[i] = temperature_cx100[i];
+        w->max_cx100[i] = temperature_cx100[i];
+    }
+}
+
+void adc_capture_hold(bool hold) {
+}
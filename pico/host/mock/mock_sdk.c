@@ -0,0 +1,726 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "pico/stdlib.h"
+#include "pico/multicore.h"
+#include "hardware/adc.h"
+#include "hardware/clocks.h"
+#include "hardware/flash.h"
+#include "hardware/pio.h"
+#include "hardware/pwm.h"
+#include "hardware/watchdog.h"
+#include "hardware/structs/vreg_and_chip_reset.h"
+#include "mock_sdk.h"
+
+#define MOCK_SYS_CLOCK_HZ 125000000
+#define MOCK_PIO_MAX_INSTRUCTIONS 32
+#define MOCK_PIO_FIFO_DEPTH 4
+
+typedef struct mock_sm_t {
+    bool claimed;
+    bool enabled;
+    enum mock_pio_program program;
+    uint pin;
+    bool join_rx;
+    /// @brief X as set by the last SET instruction, and the pulse count then
+    uint32_t x_set;
+    uint64_t x_set_pulses;
+    uint32_t isr;
+    uint32_t fifo[2 * MOCK_PIO_FIFO_DEPTH];
+    uint fifo_len;
+} mock_sm_t;
+
+typedef struct mock_pio_t {
+    enum mock_pio_program programs[MOCK_PIO_MAX_INSTRUCTIONS];
+    uint num_instructions;
+    mock_sm_t sm[NUM_PIO_STATE_MACHINES];
+} mock_pio_t;
+
+typedef struct mock_fan_t {
+    uint32_t rpm;
+    /// @brief Pulses so far, and the whole ones the state machines have seen
+    double pulses;
+    uint64_t whole_pulses;
+    uint64_t updated_us;
+} mock_fan_t;
+
+typedef struct mock_gpio_t {
+    bool out;
+    bool value;
+    bool input_set;
+    bool input;
+    bool pull_up;
+    uint32_t irq_events;
+    /// @brief Edges waiting for interrupts to be unmasked
+    uint32_t pending_events;
+} mock_gpio_t;
+
+struct uart_inst {
+    uint baudrate;
+};
+
+uart_inst_t mock_uart0;
+uart_inst_t mock_uart1;
+pio_hw_t mock_pio0 = { .index = 0 };
+pio_hw_t mock_pio1 = { .index = 1 };
+vreg_and_chip_reset_hw_t mock_vreg_and_chip_reset_hw;
+uint8_t mock_flash[PICO_FLASH_SIZE_BYTES];
+
+static bool real_time = false;
+static struct timespec real_time_base;
+static uint64_t virtual_time_us = 0;
+static timer_hw_t timer_regs;
+
+static bool irq_masked = false;
+static bool in_irq = false;
+static int irq_fd = -1;
+static void (*irq_handler)(void) = NULL;
+static struct repeating_timer *timers = NULL;
+
+static mock_gpio_t gpios[NUM_BANK0_GPIOS];
+static gpio_irq_callback_t gpio_callback = NULL;
+static uint16_t pwm_wrap[NUM_PWM_SLICES];
+static uint16_t pwm_level[NUM_BANK0_GPIOS];
+static mock_pio_t pios[2];
+static mock_fan_t fans[NUM_BANK0_GPIOS];
+static char flash_path[256];
+
+static inline uint64_t abs_delay_us(const struct repeating_timer *t) {
+    return (t->delay_us < 0) ? (uint64_t)(-t->delay_us) : (uint64_t)t->delay_us;
+}
+
+static struct repeating_timer *next_timer(void) {
+    struct repeating_timer *next = NULL;
+    for (struct repeating_timer *t = timers; t != NULL; t = t->next) {
+        if ((next == NULL) || (t->due_us < next->due_us)) {
+            next = t;
+        }
+    }
+    return next;
+}
+
+static bool remove_timer(struct repeating_timer *timer) {
+    for (struct repeating_timer **t = &timers; *t != NULL; t = &(*t)->next) {
+        if (*t == timer) {
+            *t = timer->next;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void run_due_timers(void) {
+    const uint64_t now = mock_time_us();
+    struct repeating_timer *t;
+
+    while (((t = next_timer()) != NULL) && (t->due_us <= now)) {
+        const uint64_t due = t->due_us;
+        // Moved ahead first, so that a callback cancelling its own timer works
+        t->due_us = UINT64_MAX;
+
+        if (!t->callback(t)) {
+            remove_timer(t);
+        } else if (t->due_us == UINT64_MAX) {
+            t->due_us = due + abs_delay_us(t);
+            // Behind in real time: skip the missed calls
+            if (t->due_us <= now) {
+                t->due_us = now + abs_delay_us(t);
+            }
+        }
+    }
+}
+
+static void run_gpio_irqs(void) {
+    for (uint gpio = 0; gpio < NUM_BANK0_GPIOS; gpio++) {
+        uint32_t events = gpios[gpio].pending_events & gpios[gpio].irq_events;
+        gpios[gpio].pending_events = 0;
+        if ((events != 0) && (gpio_callback != NULL)) {
+            gpio_callback(gpio, events);
+        }
+    }
+}
+
+/// @brief Waits until the interrupt source is readable, a timer is due or
+/// the deadline passes. Real time only.
+static void wait_for_irq(uint64_t deadline_us) {
+    struct repeating_timer *t = next_timer();
+    if ((t != NULL) && (t->due_us < deadline_us)) {
+        deadline_us = t->due_us;
+    }
+
+    const uint64_t now = mock_time_us();
+    if (deadline_us <= now) {
+        return;
+    }
+
+    struct timespec timeout = {
+        .tv_sec = (time_t)((deadline_us - now) / 1000000),
+        .tv_nsec = (long)(((deadline_us - now) % 1000000) * 1000)
+    };
+    const bool forever = (deadline_us == UINT64_MAX);
+
+    if (irq_fd >= 0) {
+        struct pollfd pfd = { .fd = irq_fd, .events = POLLIN };
+        ppoll(&pfd, 1, forever ? NULL : &timeout, NULL);
+    } else if (!forever) {
+        nanosleep(&timeout, NULL);
+    }
+}
+
+void mock_init(bool real) {
+    real_time = real;
+    clock_gettime(CLOCK_MONOTONIC, &real_time_base);
+    virtual_time_us = 0;
+    irq_masked = false;
+    in_irq = false;
+    irq_fd = -1;
+    irq_handler = NULL;
+    timers = NULL;
+    memset(gpios, 0, sizeof(gpios));
+    gpio_callback = NULL;
+    memset(pwm_wrap, 0xff, sizeof(pwm_wrap));
+    memset(pwm_level, 0, sizeof(pwm_level));
+    memset(pios, 0, sizeof(pios));
+    memset(fans, 0, sizeof(fans));
+    memset(mock_flash, 0xff, sizeof(mock_flash));
+    flash_path[0] = '\0';
+    mock_vreg_and_chip_reset_hw.chip_reset = VREG_AND_CHIP_RESET_CHIP_RESET_HAD_POR_BITS;
+}
+
+uint64_t mock_time_us(void) {
+    if (!real_time) {
+        return virtual_time_us;
+    }
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)(ts.tv_sec - real_time_base.tv_sec) * 1000000 +
+        (ts.tv_nsec - real_time_base.tv_nsec) / 1000;
+}
+
+void mock_time_advance_us(uint64_t us) {
+    const uint64_t end = mock_time_us() + us;
+
+    if (real_time) {
+        while (mock_time_us() < end) {
+            mock_service_interrupts();
+            wait_for_irq(end);
+        }
+        mock_service_interrupts();
+        return;
+    }
+
+    struct repeating_timer *t;
+    while (((t = next_timer()) != NULL) && (t->due_us <= end) && !irq_masked && !in_irq) {
+        if (t->due_us > virtual_time_us) {
+            virtual_time_us = t->due_us;
+        }
+        mock_service_interrupts();
+    }
+    virtual_time_us = end;
+    mock_service_interrupts();
+}
+
+void mock_service_interrupts(void) {
+    if (irq_masked || in_irq) {
+        return;
+    }
+
+    in_irq = true;
+
+    if ((irq_fd >= 0) && (irq_handler != NULL)) {
+        struct pollfd pfd = { .fd = irq_fd, .events = POLLIN };
+        if ((poll(&pfd, 1, 0) > 0) && (pfd.revents & (POLLIN | POLLHUP))) {
+            irq_handler();
+        }
+    }
+
+    run_gpio_irqs();
+    run_due_timers();
+
+    in_irq = false;
+}
+
+void mock_set_irq_source(int fd, void (*handler)(void)) {
+    irq_fd = fd;
+    irq_handler = handler;
+}
+
+// pico/platform.h, pico/time.h, hardware/sync.h and hardware/timer.h
+
+void tight_loop_contents(void) {
+    mock_service_interrupts();
+}
+
+timer_hw_t *mock_timer_hw(void) {
+    const uint64_t now = mock_time_us();
+    timer_regs.timelr = (uint32_t)now;
+    timer_regs.timehr = (uint32_t)(now >> 32);
+    return &timer_regs;
+}
+
+uint64_t time_us_64(void) {
+    return mock_time_us();
+}
+
+uint32_t time_us_32(void) {
+    return (uint32_t)mock_time_us();
+}
+
+void sleep_us(uint64_t us) {
+    mock_time_advance_us(us);
+}
+
+void sleep_ms(uint32_t ms) {
+    mock_time_advance_us((uint64_t)ms * 1000);
+}
+
+bool add_repeating_timer_us(int64_t delay_us, repeating_timer_callback_t callback,
+    void *user_data, struct repeating_timer *out) {
+    if ((delay_us == 0) || (callback == NULL) || (out == NULL)) {
+        return false;
+    }
+
+    remove_timer(out);
+    out->delay_us = delay_us;
+    out->callback = callback;
+    out->user_data = user_data;
+    out->due_us = mock_time_us() + abs_delay_us(out);
+    out->next = timers;
+    timers = out;
+    return true;
+}
+
+bool add_repeating_timer_ms(int32_t delay_ms, repeating_timer_callback_t callback,
+    void *user_data, struct repeating_timer *out) {
+    return add_repeating_timer_us((int64_t)delay_ms * 1000, callback, user_data, out);
+}
+
+bool cancel_repeating_timer(struct repeating_timer *timer) {
+    return remove_timer(timer);
+}
+
+uint32_t save_and_disable_interrupts(void) {
+    uint32_t status = irq_masked ? 1 : 0;
+    irq_masked = true;
+    return status;
+}
+
+void restore_interrupts(uint32_t status) {
+    irq_masked = (status != 0);
+    mock_service_interrupts();
+}
+
+void __wfi(void) {
+    if (real_time) {
+        wait_for_irq(UINT64_MAX);
+    } else {
+        // Nothing else can happen in virtual time: skip to the next timer
+        struct repeating_timer *t = next_timer();
+        if ((t != NULL) && (t->due_us > virtual_time_us)) {
+            virtual_time_us = t->due_us;
+        }
+    }
+    mock_service_interrupts();
+}
+
+// pico/multicore.h
+
+void multicore_lockout_victim_init(void) {
+}
+
+void multicore_lockout_start_blocking(void) {
+}
+
+void multicore_lockout_end_blocking(void) {
+}
+
+// hardware/gpio.h
+
+void gpio_init(uint gpio) {
+    gpios[gpio].out = false;
+    gpios[gpio].value = false;
+}
+
+void gpio_set_dir(uint gpio, bool out) {
+    gpios[gpio].out = out;
+}
+
+uint gpio_get_dir(uint gpio) {
+    return gpios[gpio].out ? GPIO_OUT : GPIO_IN;
+}
+
+void gpio_put(uint gpio, bool value) {
+    gpios[gpio].value = value;
+}
+
+bool gpio_get(uint gpio) {
+    const mock_gpio_t *g = &gpios[gpio];
+    if (g->out) {
+        return g->value;
+    }
+    return g->input_set ? g->input : g->pull_up;
+}
+
+void gpio_pull_up(uint gpio) {
+    gpios[gpio].pull_up = true;
+}
+
+void gpio_set_function(uint gpio, enum gpio_function fn) {
+}
+
+void gpio_set_irq_enabled(uint gpio, uint32_t events, bool enabled) {
+    if (enabled) {
+        gpios[gpio].irq_events |= events;
+    } else {
+        gpios[gpio].irq_events &= ~events;
+    }
+}
+
+void gpio_set_irq_enabled_with_callback(uint gpio, uint32_t events, bool enabled,
+    gpio_irq_callback_t callback) {
+    gpio_set_irq_enabled(gpio, events, enabled);
+    gpio_callback = callback;
+}
+
+void mock_gpio_set_input(uint gpio, bool value) {
+    const bool prev = gpio_get(gpio);
+    gpios[gpio].input_set = true;
+    gpios[gpio].input = value;
+
+    if (!gpios[gpio].out && (prev != value)) {
+        gpios[gpio].pending_events |= value ? GPIO_IRQ_EDGE_RISE : GPIO_IRQ_EDGE_FALL;
+        mock_service_interrupts();
+    }
+}
+
+// hardware/uart.h
+
+uint uart_init(uart_inst_t *uart, uint baudrate) {
+    uart->baudrate = baudrate;
+    return baudrate;
+}
+
+uint uart_set_baudrate(uart_inst_t *uart, uint baudrate) {
+    uart->baudrate = baudrate;
+    return baudrate;
+}
+
+void uart_set_hw_flow(uart_inst_t *uart, bool cts, bool rts) {
+}
+
+void uart_set_format(uart_inst_t *uart, uint data_bits, uint stop_bits, uart_parity_t parity) {
+}
+
+void uart_set_fifo_enabled(uart_inst_t *uart, bool enabled) {
+}
+
+// hardware/adc.h
+
+void adc_init(void) {
+}
+
+void adc_gpio_init(uint gpio) {
+}
+
+void adc_set_temp_sensor_enabled(bool enable) {
+}
+
+// hardware/clocks.h
+
+uint32_t clock_get_hz(enum clock_index clk_index) {
+    return MOCK_SYS_CLOCK_HZ;
+}
+
+// hardware/pwm.h
+
+pwm_config pwm_get_default_config(void) {
+    pwm_config c = { .csr = 0, .div = 1 << 4, .top = 0xffff };
+    return c;
+}
+
+void pwm_config_set_wrap(pwm_config *c, uint16_t wrap) {
+    c->top = wrap;
+}
+
+void pwm_init(uint slice_num, pwm_config *c, bool start) {
+    pwm_wrap[slice_num] = (uint16_t)c->top;
+}
+
+uint pwm_gpio_to_slice_num(uint gpio) {
+    return (gpio >> 1u) & 7u;
+}
+
+void pwm_set_gpio_level(uint gpio, uint16_t level) {
+    pwm_level[gpio] = level;
+}
+
+float mock_pwm_get_duty(uint gpio) {
+    float duty = (float)pwm_level[gpio] / ((float)pwm_wrap[pwm_gpio_to_slice_num(gpio)] + 1.0f);
+    return (duty > 1.0f) ? 1.0f : duty;
+}
+
+// hardware/pio.h
+
+/// @brief Counts the fan pulses up to now, and queues the periods of the
+/// new ones in the period state machines on its pin
+static void update_fan(uint pin) {
+    mock_fan_t *f = &fans[pin];
+    const uint64_t now = mock_time_us();
+
+    f->pulses += (double)f->rpm * (double)(now - f->updated_us) / 60e6;
+    f->updated_us = now;
+
+    const uint64_t whole = (uint64_t)floor(f->pulses);
+    const uint64_t new_pulses = whole - f->whole_pulses;
+    f->whole_pulses = whole;
+
+    if ((new_pulses == 0) || (f->rpm == 0)) {
+        return;
+    }
+
+    // Half the period in state machine clocks, less the loop overhead
+    const uint32_t half_period_us = (uint32_t)(30e6 / f->rpm);
+    const uint32_t value = (half_period_us > 3) ? (half_period_us - 3) : 0;
+
+    for (uint p = 0; p < 2; p++) {
+        for (uint i = 0; i < NUM_PIO_STATE_MACHINES; i++) {
+            mock_sm_t *sm = &pios[p].sm[i];
+            if (!sm->enabled || (sm->program != MOCK_PIO_PROGRAM_TACHO_PERIOD) || (sm->pin != pin)) {
+                continue;
+            }
+
+            const uint depth = sm->join_rx ? (2 * MOCK_PIO_FIFO_DEPTH) : MOCK_PIO_FIFO_DEPTH;
+            // A full FIFO stalls the state machine, so later periods are lost
+            for (uint64_t n = 0; (n < new_pulses) && (sm->fifo_len < depth); n++) {
+                sm->fifo[sm->fifo_len++] = value;
+            }
+        }
+    }
+}
+
+void mock_fan_set_rpm(uint tacho_gpio, uint32_t rpm) {
+    update_fan(tacho_gpio);
+    fans[tacho_gpio].rpm = rpm;
+}
+
+pio_sm_config pio_get_default_sm_config(void) {
+    pio_sm_config c;
+    memset(&c, 0, sizeof(c));
+    c.clkdiv = 1.0f;
+    c.wrap = MOCK_PIO_MAX_INSTRUCTIONS - 1;
+    return c;
+}
+
+void sm_config_set_in_pins(pio_sm_config *c, uint in_base) {
+    c->in_base = in_base;
+}
+
+void sm_config_set_jmp_pin(pio_sm_config *c, uint pin) {
+    c->jmp_pin = pin;
+}
+
+void sm_config_set_clkdiv(pio_sm_config *c, float div) {
+    c->clkdiv = div;
+}
+
+void sm_config_set_fifo_join(pio_sm_config *c, enum pio_fifo_join join) {
+    c->join_rx = (join == PIO_FIFO_JOIN_RX);
+}
+
+void sm_config_set_wrap(pio_sm_config *c, uint wrap_target, uint wrap) {
+    c->wrap_target = wrap_target;
+    c->wrap = wrap;
+}
+
+uint pio_add_program(PIO pio, const pio_program_t *program) {
+    mock_pio_t *p = &pios[pio->index];
+    const uint offset = p->num_instructions;
+
+    for (uint i = 0; (i < program->length) && (p->num_instructions < MOCK_PIO_MAX_INSTRUCTIONS); i++) {
+        p->programs[p->num_instructions++] = program->mock_program;
+    }
+
+    return offset;
+}
+
+int pio_claim_unused_sm(PIO pio, bool required) {
+    for (uint i = 0; i < NUM_PIO_STATE_MACHINES; i++) {
+        if (!pios[pio->index].sm[i].claimed) {
+            pios[pio->index].sm[i].claimed = true;
+            return (int)i;
+        }
+    }
+
+    if (required) {
+        fprintf(stderr, "mock: no free PIO state machine\n");
+    }
+    return -1;
+}
+
+int pio_sm_set_consecutive_pindirs(PIO pio, uint sm, uint pin_base, uint pin_count, bool is_out) {
+    return 0;
+}
+
+void pio_sm_init(PIO pio, uint sm, uint initial_pc, const pio_sm_config *config) {
+    mock_sm_t *s = &pios[pio->index].sm[sm];
+
+    update_fan(config->in_base);
+    s->program = (initial_pc < MOCK_PIO_MAX_INSTRUCTIONS) ?
+        pios[pio->index].programs[initial_pc] : MOCK_PIO_PROGRAM_NONE;
+    s->pin = config->in_base;
+    s->join_rx = config->join_rx;
+    s->enabled = false;
+    s->x_set = 0;
+    s->x_set_pulses = fans[s->pin].whole_pulses;
+    s->isr = 0;
+    s->fifo_len = 0;
+}
+
+void pio_sm_set_enabled(PIO pio, uint sm, bool enabled) {
+    pios[pio->index].sm[sm].enabled = enabled;
+}
+
+uint pio_encode_set(enum pio_src_dest dest, uint value) {
+    return 0xe000u | ((uint)dest << 5) | (value & 0x1fu);
+}
+
+uint pio_encode_mov(enum pio_src_dest dest, enum pio_src_dest src) {
+    return 0xa000u | ((uint)dest << 5) | (uint)src;
+}
+
+uint pio_encode_push(bool if_full, bool block) {
+    return 0x8000u | (if_full ? 0x40u : 0u) | (block ? 0x20u : 0u);
+}
+
+void pio_sm_exec(PIO pio, uint sm, uint instr) {
+    mock_sm_t *s = &pios[pio->index].sm[sm];
+    const uint dest = (instr >> 5) & 7u;
+
+    update_fan(s->pin);
+
+    // X counts rising edges down from the value it was set to
+    const uint32_t x = s->x_set - (uint32_t)(fans[s->pin].whole_pulses - s->x_set_pulses);
+
+    switch (instr & 0xe000u) {
+    case 0xe000u: // SET
+        if (dest == pio_x) {
+            s->x_set = instr & 0x1fu;
+            s->x_set_pulses = fans[s->pin].whole_pulses;
+        }
+        break;
+    case 0xa000u: // MOV
+        if ((dest == pio_isr) && ((instr & 7u) == pio_x)) {
+            s->isr = x;
+        }
+        break;
+    case 0x8000u: // PUSH
+        if (s->fifo_len < (s->join_rx ? (2 * MOCK_PIO_FIFO_DEPTH) : MOCK_PIO_FIFO_DEPTH)) {
+            s->fifo[s->fifo_len++] = s->isr;
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+uint32_t pio_sm_get(PIO pio, uint sm) {
+    mock_sm_t *s = &pios[pio->index].sm[sm];
+
+    update_fan(s->pin);
+    if (s->fifo_len == 0) {
+        return 0;
+    }
+
+    uint32_t value = s->fifo[0];
+    s->fifo_len--;
+    memmove(&s->fifo[0], &s->fifo[1], s->fifo_len * sizeof(s->fifo[0]));
+    return value;
+}
+
+bool pio_sm_is_rx_fifo_empty(PIO pio, uint sm) {
+    mock_sm_t *s = &pios[pio->index].sm[sm];
+    update_fan(s->pin);
+    return (s->fifo_len == 0);
+}
+
+// hardware/flash.h
+
+static void flash_store(void) {
+    if (flash_path[0] == '\0') {
+        return;
+    }
+
+    FILE *f = fopen(flash_path, "wb");
+    if (f == NULL) {
+        fprintf(stderr, "mock: cannot write %s: %s\n", flash_path, strerror(errno));
+        return;
+    }
+    fwrite(mock_flash, 1, sizeof(mock_flash), f);
+    fclose(f);
+}
+
+bool mock_flash_open(const char *path) {
+    if (strlen(path) >= sizeof(flash_path)) {
+        return false;
+    }
+
+    strcpy(flash_path, path);
+
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        // A new file is blank flash
+        return (errno == ENOENT);
+    }
+
+    size_t n = fread(mock_flash, 1, sizeof(mock_flash), f);
+    fclose(f);
+
+    if (n != sizeof(mock_flash)) {
+        memset(mock_flash, 0xff, sizeof(mock_flash));
+    }
+    return true;
+}
+
+void flash_range_erase(uint32_t flash_offs, size_t count) {
+    if (((flash_offs % FLASH_SECTOR_SIZE) != 0) || ((count % FLASH_SECTOR_SIZE) != 0) ||
+        ((flash_offs + count) > sizeof(mock_flash))) {
+        fprintf(stderr, "mock: bad flash erase 0x%x+0x%zx\n", flash_offs, count);
+        return;
+    }
+
+    memset(&mock_flash[flash_offs], 0xff, count);
+    flash_store();
+}
+
+void flash_range_program(uint32_t flash_offs, const uint8_t *data, size_t count) {
+    if (((flash_offs % FLASH_PAGE_SIZE) != 0) || ((count % FLASH_PAGE_SIZE) != 0) ||
+        ((flash_offs + count) > sizeof(mock_flash))) {
+        fprintf(stderr, "mock: bad flash program 0x%x+0x%zx\n", flash_offs, count);
+        return;
+    }
+
+    // Programming can only clear bits
+    for (size_t i = 0; i < count; i++) {
+        mock_flash[flash_offs + i] &= data[i];
+    }
+    flash_store();
+}
+
+// hardware/watchdog.h
+
+bool watchdog_caused_reboot(void) {
+    return false;
+}
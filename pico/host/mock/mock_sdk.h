@@ -0,0 +1,84 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef MOCK_SDK_H_
+#define MOCK_SDK_H_
+
+#include "pico/types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Controls the host (PC) mock of the Pico SDK that the firmware is built
+ * against in pico/host. The firmware's packet handlers, dispatch and
+ * timers run unchanged; the mock stands in for the hardware around them:
+ *
+ *  - Time is virtual, and only moves when the harness advances it, unless
+ *    mock_init(true) makes it follow the host's monotonic clock.
+ *  - Repeating timers and GPIO edges run their callbacks as interrupts:
+ *    when time passes, while sleeping or waiting in __wfi(), and when
+ *    interrupts are unmasked.
+ *  - The tachometer PIO programs count pulses of fans spinning at the
+ *    speeds set with mock_fan_set_rpm().
+ *  - uart_dma.h and adc_capture.h, which drive the DMA and core1, are
+ *    replaced by mock_uart_dma.c and mock_adc_capture.c.
+ */
+
+/// @brief Resets the mock. Call before anything else.
+/// @param real_time True(1) to follow the host's monotonic clock,
+/// False(0) for virtual time that only moves with mock_time_advance_us()
+void mock_init(bool real_time);
+
+/// @brief Pico time (us since boot)
+uint64_t mock_time_us(void);
+
+/// @brief Moves virtual time forward, running the timers that fall due
+/// on the way. Sleeps instead in real time.
+void mock_time_advance_us(uint64_t us);
+
+/// @brief Runs the timers that are due, and polls the interrupt source
+void mock_service_interrupts(void);
+
+/// @brief Makes a file descriptor an interrupt source: __wfi() returns when
+/// it becomes readable or hangs up, and the handler is called as an
+/// interrupt. The handler must wait a while on a hang up.
+/// @param fd -1 for none
+void mock_set_irq_source(int fd, void (*handler)(void));
+
+/// @brief Drives a GPIO input, raising its edge interrupt if enabled
+void mock_gpio_set_input(uint gpio, bool value);
+
+/// @brief Returns the PWM duty cycle [0.0 to 1.0] of a GPIO
+float mock_pwm_get_duty(uint gpio);
+
+/// @brief Spins the fan whose tachometer is on a GPIO, one pulse per revolution
+void mock_fan_set_rpm(uint tacho_gpio, uint32_t rpm);
+
+/// @brief Backs the mock flash with a file, so saved settings survive a
+/// restart. The file is read now and written on every erase or program.
+/// @return True(1) on success. False(0) on failure.
+bool mock_flash_open(const char *path);
+
+/// @brief Sets the temperature (°C x 100) of an ADC capture input. The
+/// windows report it as the mean, min and max.
+void mock_adc_set_temperature_cx100(uint input, int32_t cx100);
+
+/// @brief Feeds bytes from the host into the UART, as if received
+void mock_uart_rx_write(const uint8_t *data, size_t len);
+
+/// @brief Sets where frames sent to the host go. Without a handler they
+/// are dropped.
+void mock_uart_set_tx_handler(void (*handler)(const uint8_t *frame));
+
+/// @brief Number of bytes lost because every receive slot was full
+uint64_t mock_uart_rx_overruns(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
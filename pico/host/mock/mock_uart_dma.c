@@ -0,0 +1,130 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <string.h>
+#include "pico/stdlib.h"
+#include "cm4-wrt-a.h"
+#include "uart_dma.h"
+#include "pico_pkt_watchdog.h"
+#include "mock_sdk.h"
+
+/* Host (PC) stand-in for uart_dma.c. Bytes fed by mock_uart_rx_write()
+ * fill the same queue of frame slots the DMA channel would, with the same
+ * idle timeout for partial frames. While every slot is full, up to
+ * MOCK_UART_RX_FIFO_LEN bytes wait, as in the UART RX FIFO, and the rest
+ * are lost. Frames sent to the host go to the handler set with
+ * mock_uart_set_tx_handler(). */
+
+// Depth of the RP2040 UART RX FIFO
+#define MOCK_UART_RX_FIFO_LEN 32
+
+static uint8_t rx_slots[UART_RX_NUM_SLOTS][PICO_PKT_LEN];
+static uint64_t rx_slot_time_us[UART_RX_NUM_SLOTS];
+static uint32_t rx_head = 0;
+static uint32_t rx_tail = 0;
+// Bytes received so far of the frame in slot (rx_head % UART_RX_NUM_SLOTS)
+static uint32_t rx_received = 0;
+static uint64_t rx_last_progress_time = 0;
+
+static uint8_t rx_fifo[MOCK_UART_RX_FIFO_LEN];
+static uint32_t rx_fifo_len = 0;
+static uint64_t rx_overruns = 0;
+
+static void (*tx_handler)(const uint8_t *frame) = NULL;
+
+/// @brief Moves bytes from the RX FIFO into the slot being received
+static void rx_drain_fifo(void) {
+    uint32_t used = 0;
+
+    while ((used < rx_fifo_len) && ((rx_head - rx_tail) < UART_RX_NUM_SLOTS)) {
+        rx_slots[rx_head % UART_RX_NUM_SLOTS][rx_received++] = rx_fifo[used++];
+        rx_last_progress_time = get_time();
+
+        if (rx_received == PICO_PKT_LEN) {
+            rx_slot_time_us[rx_head % UART_RX_NUM_SLOTS] = rx_last_progress_time;
+            rx_received = 0;
+            rx_head++;
+            update_watchdog();
+        }
+    }
+
+    rx_fifo_len -= used;
+    memmove(rx_fifo, &rx_fifo[used], rx_fifo_len);
+}
+
+void mock_uart_rx_write(const uint8_t *data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (rx_fifo_len < MOCK_UART_RX_FIFO_LEN) {
+            rx_fifo[rx_fifo_len++] = data[i];
+        } else {
+            rx_overruns++;
+        }
+
+        // Received bytes go straight to a slot unless the queue is full
+        rx_drain_fifo();
+    }
+}
+
+void mock_uart_set_tx_handler(void (*handler)(const uint8_t *frame)) {
+    tx_handler = handler;
+}
+
+uint64_t mock_uart_rx_overruns(void) {
+    return rx_overruns;
+}
+
+void init_uart_dma(void) {
+    rx_head = 0;
+    rx_tail = 0;
+    rx_received = 0;
+    rx_fifo_len = 0;
+    rx_overruns = 0;
+    rx_last_progress_time = get_time();
+}
+
+const uint8_t *uart_dma_rx_peek(void) {
+    return (rx_head == rx_tail) ? NULL : rx_slots[rx_tail % UART_RX_NUM_SLOTS];
+}
+
+uint64_t uart_dma_rx_time_us(void) {
+    return (rx_head == rx_tail) ? 0 : rx_slot_time_us[rx_tail % UART_RX_NUM_SLOTS];
+}
+
+void uart_dma_rx_pop(void) {
+    if (rx_head == rx_tail) {
+        return;
+    }
+
+    rx_tail++;
+    rx_drain_fifo();
+}
+
+void uart_dma_rx_flush(void) {
+    rx_tail = rx_head;
+    rx_received = 0;
+    rx_drain_fifo();
+}
+
+void uart_dma_tx_write(const uint8_t *frame) {
+    if (tx_handler != NULL) {
+        tx_handler(frame);
+    }
+}
+
+void uart_dma_task(void) {
+    if ((rx_received == 0) || ((rx_head - rx_tail) >= UART_RX_NUM_SLOTS)) {
+        return;
+    }
+
+    if ((get_time() - rx_last_progress_time) >= UART_RX_IDLE_TIMEOUT_us) {
+        rx_received = 0;
+        rx_last_progress_time = get_time();
+    }
+}
+
+bool uart_dma_rx_pending(void) {
+    return (rx_head != rx_tail) || (rx_received != 0);
+}
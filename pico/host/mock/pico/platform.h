@@ -0,0 +1,37 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef MOCK_PICO_PLATFORM_H_
+#define MOCK_PICO_PLATFORM_H_
+
+#include "pico/types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define __unused __attribute__((unused))
+
+// The host keeps no RAM across a reset, so this is ordinary zeroed data
+#define __uninitialized_ram(group) group
+
+static inline void __compiler_memory_barrier(void) {
+    __asm__ volatile ("" : : : "memory");
+}
+
+static inline void __dmb(void) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+/// @brief Busy wait loops service the mock interrupts, so that what they
+/// wait for can happen
+void tight_loop_contents(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,47 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef MOCK_PICO_TIME_H_
+#define MOCK_PICO_TIME_H_
+
+#include "pico/types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct repeating_timer;
+typedef bool (*repeating_timer_callback_t)(struct repeating_timer *t);
+
+struct repeating_timer {
+    int64_t delay_us;
+    repeating_timer_callback_t callback;
+    void *user_data;
+    /// @brief Mock time the callback is due
+    uint64_t due_us;
+    struct repeating_timer *next;
+};
+
+/// @brief Calls the callback every delay_ms from the mock interrupt
+/// context while it returns true
+bool add_repeating_timer_ms(int32_t delay_ms, repeating_timer_callback_t callback,
+    void *user_data, struct repeating_timer *out);
+bool add_repeating_timer_us(int64_t delay_us, repeating_timer_callback_t callback,
+    void *user_data, struct repeating_timer *out);
+bool cancel_repeating_timer(struct repeating_timer *timer);
+
+uint64_t time_us_64(void);
+uint32_t time_us_32(void);
+
+/// @brief Interrupts are serviced while sleeping
+void sleep_us(uint64_t us);
+void sleep_ms(uint32_t ms);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,20 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef MOCK_PICO_TYPES_H_
+#define MOCK_PICO_TYPES_H_
+
+/* Host (PC) stand-ins for the parts of the Pico SDK the firmware uses, so
+ * that the packet handlers can be built and run off target. See mock_sdk.h
+ * for how a harness drives them. */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef unsigned int uint;
+
+#endif
@@ -0,0 +1,127 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Checks the NTC lookup table (ntc.c) against the thermistor formula for
+ * every 12-bit ADC code, and compares the cost of both conversions.
+ *
+ * Timings are taken on the host CPU. The Cortex-M0+ has no FPU, so on the
+ * Pico the formula (software log() and division) costs far more relative
+ * to the table than it does here.
+ *
+ * Exits with status 1 if, anywhere in the range the fan control treats as
+ * valid, the table is off by more than NTC_CHECK_MAX_ERROR_LSB of the
+ * temperature step between neighbouring ADC codes, i.e. if it is ever worse
+ * than rounding to the nearest ADC code. That step is about 0.03 °C at
+ * 25 °C, but several °C near 150 °C.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include "thermistor.h"
+#include "ntc.h"
+
+#define NTC_ADC_CODES 4096
+// Same valid range as the Pico fan control
+#define NTC_CHECK_MIN_VALID_C (-40.0f)
+#define NTC_CHECK_MAX_VALID_C (150.0f)
+#define NTC_CHECK_MAX_ERROR_LSB 0.5f
+// Conversions of every ADC code timed per method
+#define NTC_CHECK_TIMING_ROUNDS 2000
+
+static volatile float float_sink;
+static volatile int32_t int_sink;
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/// @brief Compares the table and the formula for the current B value
+/// @return Largest error (ADC LSBs) in the valid range
+static float check_accuracy(const char *table) {
+    float max_error = 0.0f;
+    float max_error_lsb = 0.0f;
+    double sum_error = 0.0;
+    int worst_code = -1;
+    int count = 0;
+
+    for (int code = 0; code < NTC_ADC_CODES; code++) {
+        float expected = ntc_formula((uint16_t)code, (float)ntc_get_beta());
+        if ((expected < NTC_CHECK_MIN_VALID_C) || (expected > NTC_CHECK_MAX_VALID_C)) {
+            continue;
+        }
+
+        float actual = ntc_lookup_cx100((uint16_t)code) / 100.0f;
+        float error = fabsf(actual - expected);
+        float step = fabsf(ntc_formula((uint16_t)(code + 1), (float)ntc_get_beta()) - expected);
+        sum_error += error;
+        count++;
+
+        if (error > max_error) {
+            max_error = error;
+        }
+
+        if ((step > 0.0f) && ((error / step) > max_error_lsb)) {
+            max_error_lsb = error / step;
+            worst_code = code;
+        }
+    }
+
+    printf("%s, B = %u K: %d ADC codes in [%.0f, %.0f] °C, max error %.3f °C, "
+        "%.3f LSB (code %d), mean error %.4f °C\n", table, ntc_get_beta(), count,
+        NTC_CHECK_MIN_VALID_C, NTC_CHECK_MAX_VALID_C, max_error, max_error_lsb, worst_code,
+        (count > 0) ? sum_error / count : 0.0);
+
+    return max_error_lsb;
+}
+
+static void compare_timing(void) {
+    double start = now_sec();
+    for (int round = 0; round < NTC_CHECK_TIMING_ROUNDS; round++) {
+        for (int code = 0; code < NTC_ADC_CODES; code++) {
+            float_sink = ntc_formula((uint16_t)code, NTC_B);
+        }
+    }
+    double formula_ns = (now_sec() - start) * 1e9 / (NTC_CHECK_TIMING_ROUNDS * NTC_ADC_CODES);
+
+    start = now_sec();
+    for (int round = 0; round < NTC_CHECK_TIMING_ROUNDS; round++) {
+        for (int code = 0; code < NTC_ADC_CODES; code++) {
+            int_sink = ntc_lookup_cx100((uint16_t)code);
+        }
+    }
+    double lookup_ns = (now_sec() - start) * 1e9 / (NTC_CHECK_TIMING_ROUNDS * NTC_ADC_CODES);
+
+    printf("Formula: %.1f ns/conversion, table: %.1f ns/conversion (%.1fx faster, host CPU)\n",
+        formula_ns, lookup_ns, (lookup_ns > 0.0) ? formula_ns / lookup_ns : 0.0);
+}
+
+int main(void) {
+    int rc = EXIT_SUCCESS;
+
+    // As generated by ntc_table.py
+    if (check_accuracy("Generated table") > NTC_CHECK_MAX_ERROR_LSB) {
+        rc = EXIT_FAILURE;
+    }
+
+    // As rebuilt by an NTC calibration packet
+    ntc_set_beta(3950);
+    if (check_accuracy("Rebuilt table") > NTC_CHECK_MAX_ERROR_LSB) {
+        rc = EXIT_FAILURE;
+    }
+
+    ntc_set_beta(0);
+    if (check_accuracy("Rebuilt table") > NTC_CHECK_MAX_ERROR_LSB) {
+        rc = EXIT_FAILURE;
+    }
+
+    compare_timing();
+
+    return rc;
+}
@@ -0,0 +1,75 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <math.h>
+#include "thermistor.h"
+#include "ntc.h"
+
+// 12-bit ADC
+#define NTC_ADC_MAX 4095
+
+// Lives in RAM, so that lookups do not go through the flash cache
+static int32_t ntc_table_cx100[NTC_TABLE_LEN] = NTC_TABLE_INIT;
+static uint16_t ntc_beta = (uint16_t)NTC_B;
+
+float ntc_formula(uint16_t code, float beta)
+{
+    // 12-bit conversion, assume max value == ADC_VREF == 3.3 V
+    const float conversion_factor = 3.3f / (1 << 12);
+    float voltage = code * conversion_factor;
+    // The analog-to-digital converter measures the voltage at
+    // the midpoint of a divider consisting of a known resistance of
+    // 10kohm between Vcc(3.3V) and a thermistor of unknown resistance.
+    // We can thus calculate the thermistor resistance from
+    // the measured voltage as:
+
+    const float known_res = 10e3f;
+    float thermistor_res = known_res * (1.0f/((3.3f/voltage) - 1.0f));
+
+    // Ref: https://en.wikipedia.org/wiki/Thermistor
+    float temp_kelvin = beta / (log(thermistor_res) - LN_NTC_B + (beta / NTC_T0));
+    return KELVIN_TO_CELSIOUS(temp_kelvin) + REFERENCE_TEMPERATURE;
+}
+
+int32_t ntc_lookup_cx100(uint16_t code)
+{
+    if (code == 0) {
+        return NTC_TABLE_SHORTED_CX100;
+    }
+
+    code = (code > NTC_ADC_MAX) ? NTC_ADC_MAX : code;
+
+    uint32_t i = code >> NTC_TABLE_SHIFT;
+    int32_t frac = code & (NTC_TABLE_STEP - 1);
+    int32_t t0 = ntc_table_cx100[i];
+    int32_t t1 = ntc_table_cx100[i + 1];
+
+    // Round to nearest. The division by a power of two is a shift.
+    int32_t delta = (t1 - t0) * frac;
+    delta += (delta < 0) ? -(NTC_TABLE_STEP / 2) : (NTC_TABLE_STEP / 2);
+    return t0 + delta / NTC_TABLE_STEP;
+}
+
+void ntc_set_beta(uint16_t beta)
+{
+    beta = (beta == 0) ? (uint16_t)NTC_B : beta;
+
+    for (uint32_t i = 0; i < NTC_TABLE_LEN; i++) {
+        // Same sample points as ntc_table.py
+        uint32_t code = i << NTC_TABLE_SHIFT;
+        code = (code < 1) ? 1 : code;
+        code = (code > NTC_ADC_MAX) ? NTC_ADC_MAX : code;
+        float t = ntc_formula((uint16_t)code, (float)beta) * 100.0f;
+        ntc_table_cx100[i] = (int32_t)((t < 0.0f) ? (t - 0.5f) : (t + 0.5f));
+    }
+
+    ntc_beta = beta;
+}
+
+uint16_t ntc_get_beta(void)
+{
+    return ntc_beta;
+}
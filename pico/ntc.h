@@ -0,0 +1,52 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef NTC_H_
+#define NTC_H_
+
+#include <stdint.h>
+#include "ntc_table.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* NTC thermistor ADC code to temperature conversion.
+ *
+ * The thermistor formula needs log() and float division, which the
+ * Cortex-M0+ does in software. Instead, temperatures (°C x 100) are
+ * read from a table with one entry every NTC_TABLE_STEP ADC codes, and
+ * linearly interpolated in fixed point. The table is generated at build
+ * time by ntc_table.py from the constants in thermistor.h.
+ *
+ * ntc_set_beta() rebuilds the table for another B value. Only that
+ * call uses the formula. Core1 keeps converting samples meanwhile, so
+ * for a few ms readings fall between the old and the new B value.
+ */
+
+#define NTC_TABLE_STEP (1 << NTC_TABLE_SHIFT)
+
+/// @brief Converts a 12-bit ADC code to a temperature with the thermistor formula
+/// @param beta Thermistor B value (K)
+/// @return Temperature in degrees Celsius
+float ntc_formula(uint16_t code, float beta);
+
+/// @brief Converts a 12-bit ADC code to a temperature using the table
+/// @return Temperature in degrees Celsius x 100
+int32_t ntc_lookup_cx100(uint16_t code);
+
+/// @brief Rebuilds the table for another thermistor B value.
+/// @param beta B value (K), zero(0) restores NTC_B
+void ntc_set_beta(uint16_t beta);
+
+/// @brief Returns the B value (K) the table was built for
+uint16_t ntc_get_beta(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // NTC_H_
@@ -0,0 +1,82 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2024 MyTechCatalog LLC.
+#
+# SPDX-License-Identifier: MIT
+#
+# Generates ntc_table.h, the ADC code to temperature (°C x 100) lookup table
+# used by ntc.c, from the thermistor constants in thermistor.h.
+#
+# Usage: ntc_table.py <path to thermistor.h> <output header>
+
+import math
+import re
+import sys
+
+# ADC codes between table entries, as a power of two
+NTC_TABLE_SHIFT = 3
+ADC_BITS = 12
+
+
+def read_constants(path):
+    """Returns the numeric #defines of thermistor.h"""
+    constants = {}
+    with open(path) as f:
+        for line in f:
+            m = re.match(r'\s*#define\s+(\w+)\s+([0-9.eE+-]+)f?\b', line)
+            if m:
+                constants[m.group(1)] = float(m.group(2))
+    return constants
+
+
+def ntc_formula(code, c):
+    """Same conversion as ntc_formula() in ntc.c"""
+    if code <= 0:
+        # A shorted thermistor reads as 0 Ω: log(0) = -inf
+        return -273.15 + c['REFERENCE_TEMPERATURE']
+    adc_max = 1 << ADC_BITS
+    voltage = code * 3.3 / adc_max
+    thermistor_res = 10e3 * (1.0 / ((3.3 / voltage) - 1.0))
+    t0 = c['REFERENCE_TEMPERATURE'] + 273.15
+    temp_kelvin = c['NTC_B'] / (math.log(thermistor_res) - c['LN_NTC_B'] + (c['NTC_B'] / t0))
+    return temp_kelvin - 273.15 + c['REFERENCE_TEMPERATURE']
+
+
+def main():
+    if len(sys.argv) != 3:
+        print(f'Usage: {sys.argv[0]} <thermistor.h> <ntc_table.h>', file=sys.stderr)
+        return 1
+
+    c = read_constants(sys.argv[1])
+    for name in ('REFERENCE_TEMPERATURE', 'NTC_B', 'LN_NTC_B'):
+        if name not in c:
+            print(f'{sys.argv[1]}: {name} not found', file=sys.stderr)
+            return 1
+
+    step = 1 << NTC_TABLE_SHIFT
+    adc_max = (1 << ADC_BITS) - 1
+    entries = []
+    for i in range((1 << ADC_BITS) // step + 1):
+        # Entry 0 is taken at code 1 so that nearly shorted thermistors
+        # interpolate to hot (invalid) readings. Code 0 is handled by ntc.c.
+        code = min(max(i * step, 1), adc_max)
+        entries.append(int(round(ntc_formula(code, c) * 100.0)))
+
+    with open(sys.argv[2], 'w') as out:
+        out.write('/* Generated by ntc_table.py from thermistor.h. Do not edit. */\n\n')
+        out.write('#ifndef NTC_TABLE_H_\n#define NTC_TABLE_H_\n\n')
+        out.write(f'#define NTC_TABLE_SHIFT {NTC_TABLE_SHIFT}\n')
+        out.write(f'#define NTC_TABLE_LEN {len(entries)}\n')
+        out.write(f'#define NTC_TABLE_SHORTED_CX100 ({int(round(ntc_formula(0, c) * 100.0))})\n\n')
+        out.write('#define NTC_TABLE_INIT { \\\n')
+        for i in range(0, len(entries), 8):
+            row = ', '.join(str(e) for e in entries[i:i + 8])
+            sep = ',' if i + 8 < len(entries) else ''
+            out.write(f'    {row}{sep} \\\n')
+        out.write('}\n\n#endif // NTC_TABLE_H_\n')
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,131 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/watchdog.h"
+#include "hardware/structs/vreg_and_chip_reset.h"
+#include "pkt_handler.h"
+#include "uart_dma.h"
+#include "pico_pkt_event_log.h"
+#include "cm4-wrt-a.h"
+
+// "EVLG"
+#define EVENT_LOG_MAGIC 0x45564C47
+
+typedef struct event_log_ram_t {
+    uint32_t magic;
+    uint32_t next_seq;
+    uint16_t boot;
+    pico_event_t entries[PICO_EVENT_LOG_LEN];
+    /// @brief magic ^ next_seq ^ boot, to tell a kept log from RAM garbage
+    uint32_t check;
+} event_log_ram_t;
+
+// Not cleared at startup, so the events survive a Pico reset
+static event_log_ram_t __uninitialized_ram(event_log);
+
+static inline uint32_t event_log_check(void) {
+    return EVENT_LOG_MAGIC ^ event_log.next_seq ^ event_log.boot;
+}
+
+static inline uint32_t event_log_oldest_seq(void) {
+    return (event_log.next_seq > PICO_EVENT_LOG_LEN) ?
+        (event_log.next_seq - PICO_EVENT_LOG_LEN) : 0;
+}
+
+void pico_event_log(uint8_t type, uint16_t data) {
+    uint32_t status = save_and_disable_interrupts();
+
+    pico_event_t *e = &event_log.entries[event_log.next_seq % PICO_EVENT_LOG_LEN];
+    e->seq = event_log.next_seq;
+    e->time_ms = (uint32_t)(get_time() / 1000);
+    e->boot = event_log.boot;
+    e->type = type;
+    e->data = data;
+
+    event_log.next_seq++;
+    event_log.check = event_log_check();
+
+    restore_interrupts(status);
+}
+
+void init_event_log(void) {
+    uint16_t reason = 0;
+    uint32_t chip_reset = vreg_and_chip_reset_hw->chip_reset;
+
+    if (chip_reset & VREG_AND_CHIP_RESET_CHIP_RESET_HAD_POR_BITS) {
+        reason |= PICO_EVENT_BOOT_POWER_ON;
+    }
+    if (chip_reset & VREG_AND_CHIP_RESET_CHIP_RESET_HAD_RUN_BITS) {
+        reason |= PICO_EVENT_BOOT_RUN_PIN;
+    }
+    if (watchdog_caused_reboot()) {
+        reason |= PICO_EVENT_BOOT_WATCHDOG;
+    }
+
+    if ((event_log.magic != EVENT_LOG_MAGIC) || (event_log.check != event_log_check())) {
+        // RAM does not hold its contents without power, so nothing is
+        // lost on a power on reset
+        if ((reason & PICO_EVENT_BOOT_POWER_ON) == 0) {
+            reason |= PICO_EVENT_BOOT_LOG_LOST;
+        }
+
+        memset(&event_log, 0, sizeof(event_log));
+        event_log.magic = EVENT_LOG_MAGIC;
+    }
+
+    event_log.boot++;
+    event_log.check = event_log_check();
+
+    pico_event_log(PICO_EVENT_BOOT, reason);
+}
+
+void pkt_event_log(struct pkt_buf *b) {
+    uint32_t seq = 0;
+    uint8_t max_count = 0;
+    pico_event_log_status_t s = {0};
+
+    pico_pkt_event_log_req_unpack(b->req, &seq, &max_count);
+
+    max_count = ((max_count == 0) || (max_count > PICO_EVENT_LOG_MAX_BURST)) ?
+        PICO_EVENT_LOG_MAX_BURST : max_count;
+
+    uint32_t status = save_and_disable_interrupts();
+    s.next_seq = event_log.next_seq;
+    s.oldest_seq = event_log_oldest_seq();
+    s.boot = event_log.boot;
+    restore_interrupts(status);
+
+    // Overwritten events are skipped. A sequence number from the future
+    // means the log was lost (e.g. power loss), so start over.
+    if ((seq < s.oldest_seq) || (seq > s.next_seq)) {
+        seq = s.oldest_seq;
+    }
+
+    for (uint8_t count = 0; (seq != s.next_seq) && (count < max_count); seq++) {
+        pico_event_t e;
+
+        status = save_and_disable_interrupts();
+        e = event_log.entries[seq % PICO_EVENT_LOG_LEN];
+        restore_interrupts(status);
+
+        // Overwritten while sending the previous ones
+        if (e.seq != seq) {
+            continue;
+        }
+
+        pico_pkt_event_log_entry_pack(b->resp, &e);
+        // Queue response to host (sent by DMA)
+        uart_dma_tx_write(b->resp);
+        count++;
+    }
+
+    s.time_ms = (uint32_t)(get_time() / 1000);
+    pico_pkt_event_log_end_pack(b->resp, &s, true);
+    // Queue response to host (sent by DMA)
+    uart_dma_tx_write(b->resp);
+}
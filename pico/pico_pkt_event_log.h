@@ -0,0 +1,322 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef PICO_PKT_EVENT_LOG_H_
+#define PICO_PKT_EVENT_LOG_H_
+
+#ifdef PICO_BOARD
+#include "pico/stdlib.h"
+#else
+#include <stdint.h>
+#include <vector>
+#include <functional>
+#endif
+
+#include "pico_pkt_id.h"
+#include "pkt_handler.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* This file defines the Host (RPi CM4) <-> Pico (RP2040) packet format
+ * for reading the Pico event log. The Pico records events the host could
+ * otherwise not know about (e.g. watchdog resets of the CM4, shutdown
+ * button presses) in a ring of PICO_EVENT_LOG_LEN entries. The ring is
+ * kept in RAM that survives Pico resets, other than power loss.
+ *
+ * Every event has a sequence number, one higher than the previous event.
+ * The host asks for the events from a sequence number on, and the Pico
+ * answers with up to PICO_EVENT_LOG_MAX_BURST entry frames, followed by
+ * one end frame. All values are little-endian.
+ *
+ *                              Request
+ *                      ----------------------
+ *
+ * +================+=========================================================+
+ * |  Byte offset   |                       Description                       |
+ * +================+=========================================================+
+ * |        0       | Magic Value                                             |
+ * +----------------+---------------------------------------------------------+
+ * |        1       | Flags. Reserved, set to 0.                              |
+ * +----------------+---------------------------------------------------------+
+ * |       5:2      | 32-bit data. Sequence number of the first event wanted. |
+ * |                | Events that were overwritten are skipped.               |
+ * +----------------+---------------------------------------------------------+
+ * |        6       | Maximum number of entry frames.                         |
+ * |                | 0 = PICO_EVENT_LOG_MAX_BURST                            |
+ * +----------------+---------------------------------------------------------+
+ * |      15:7      | Reserved. Set to 0.                                     |
+ * +----------------+---------------------------------------------------------+
+ *
+ *                         Response: Entry frame
+ *                      ----------------------
+ *
+ * +================+=========================================================+
+ * |        0       | Magic Value                                             |
+ * +----------------+---------------------------------------------------------+
+ * |        1       | Flags (Note 1). End = 0.                                |
+ * +----------------+---------------------------------------------------------+
+ * |       5:2      | 32-bit data. Sequence number                            |
+ * +----------------+---------------------------------------------------------+
+ * |       9:6      | 32-bit data. Pico time (ms since the Pico booted)       |
+ * +----------------+---------------------------------------------------------+
+ * |      11:10     | 16-bit data. Pico boot number                           |
+ * +----------------+---------------------------------------------------------+
+ * |       12       | Event type (see pico_event_type)                        |
+ * +----------------+---------------------------------------------------------+
+ * |      14:13     | 16-bit data. Event data (see pico_event_type)           |
+ * +----------------+---------------------------------------------------------+
+ * |       15       | Reserved. Set to 0.                                     |
+ * +----------------+---------------------------------------------------------+
+ *
+ *                          Response: End frame
+ *                      ----------------------
+ *
+ * +================+=========================================================+
+ * |        0       | Magic Value                                             |
+ * +----------------+---------------------------------------------------------+
+ * |        1       | Flags (Note 1). End = 1.                                |
+ * +----------------+---------------------------------------------------------+
+ * |       5:2      | 32-bit data. Sequence number the next event will get    |
+ * +----------------+---------------------------------------------------------+
+ * |       9:6      | 32-bit data. Pico time now (ms since the Pico booted)   |
+ * +----------------+---------------------------------------------------------+
+ * |      11:10     | 16-bit data. Pico boot number now                       |
+ * +----------------+---------------------------------------------------------+
+ * |      15:12     | 32-bit data. Sequence number of the oldest event kept   |
+ * +----------------+---------------------------------------------------------+
+ *
+ * (Note 1)
+ *  The flags are defined as follows:
+ *
+ *    +================+========================+
+ *    |      Bit(s)    |         Value          |
+ *    +================+========================+
+ *    |       7:2      | Reserved. Set to 0.    |
+ *    +----------------+------------------------+
+ *    |        1       |   1 = End frame        |
+ *    |                |   0 = Entry frame      |
+ *    +----------------+------------------------+
+ *    |        0       | Status.                |
+ *    |                |   1 = Success          |
+ *    |                |   0 = Failure          |
+ *    +----------------+------------------------+
+ *
+ * The Pico time and boot number of an event only relate to the host's
+ * clock if the boot number is the same as in the end frame.
+ */
+
+/* Request packet indices */
+#define PICO_PKT_EVENT_LOG_IDX_MAGIC        0
+#define PICO_PKT_EVENT_LOG_IDX_FLAGS        1
+#define PICO_PKT_EVENT_LOG_IDX_FIRST_SEQ    2
+#define PICO_PKT_EVENT_LOG_IDX_MAX_COUNT    6
+
+/* Response packet indices */
+#define PICO_PKT_EVENT_LOG_IDX_SEQ          2
+#define PICO_PKT_EVENT_LOG_IDX_TIME_MS      6
+#define PICO_PKT_EVENT_LOG_IDX_BOOT         10
+#define PICO_PKT_EVENT_LOG_IDX_TYPE         12
+#define PICO_PKT_EVENT_LOG_IDX_DATA         13
+#define PICO_PKT_EVENT_LOG_IDX_OLDEST_SEQ   12
+
+/* Flag bits */
+#define PICO_PKT_EVENT_LOG_FLAG_SUCCESS     (1 << 0)
+#define PICO_PKT_EVENT_LOG_FLAG_END         (1 << 1)
+
+// Number of events kept by the Pico
+#define PICO_EVENT_LOG_LEN 64
+
+// Most entry frames sent for one request
+#define PICO_EVENT_LOG_MAX_BURST 8
+
+#define PKT_EVENT_LOG { \
+    .magic          = PICO_PKT_EVENT_LOG_MAGIC, \
+    .init           = init_event_log, \
+    .exec           = pkt_event_log \
+}
+
+enum pico_event_type {
+    /// @brief The Pico started. Data: PICO_EVENT_BOOT_* reset reason bits.
+    PICO_EVENT_BOOT = 1,
+    /// @brief The watchdog reset the CM4. Data: retries left.
+    PICO_EVENT_WATCHDOG_RESET,
+    /// @brief The shutdown button asked the host to shut down
+    PICO_EVENT_SHUTDOWN_BUTTON,
+    /// @brief The shutdown button reset the CM4
+    PICO_EVENT_HARD_RESET_BUTTON,
+    /// @brief The shutdown button turned the CM4 on
+    PICO_EVENT_POWER_ON_BUTTON,
+    /// @brief A request with an unknown magic value was dropped. Data: the magic value.
+    PICO_EVENT_OUT_OF_SYNC,
+    /// @brief The CM4 stopped after a graceful shutdown, power rails are off
+    PICO_EVENT_CM4_OFF,
+    /// @brief The CM4 came out of reset
+    PICO_EVENT_CM4_ON,
+    /// @brief The settings saved in flash were applied at boot. Data: save count.
+    PICO_EVENT_CONFIG_LOADED,
+    /// @brief The settings were saved in flash. Data: save count.
+    PICO_EVENT_CONFIG_SAVED,
+    PICO_EVENT_TYPE_MAX
+};
+
+/* PICO_EVENT_BOOT reset reason bits */
+#define PICO_EVENT_BOOT_POWER_ON            (1 << 0) /* Power on or brownout */
+#define PICO_EVENT_BOOT_RUN_PIN             (1 << 1) /* RUN pin */
+#define PICO_EVENT_BOOT_WATCHDOG            (1 << 2) /* Pico watchdog or software reset */
+#define PICO_EVENT_BOOT_LOG_LOST            (1 << 3) /* Earlier events were lost */
+
+typedef struct pico_event_t {
+    uint32_t seq;
+    /// @brief ms since the Pico booted
+    uint32_t time_ms;
+    /// @brief Pico boot number
+    uint16_t boot;
+    /// @brief pico_event_type
+    uint8_t type;
+    uint16_t data;
+} pico_event_t;
+
+typedef struct pico_event_log_status_t {
+    /// @brief Sequence number the next event will get
+    uint32_t next_seq;
+    /// @brief Sequence number of the oldest event kept
+    uint32_t oldest_seq;
+    /// @brief ms since the Pico booted
+    uint32_t time_ms;
+    /// @brief Pico boot number
+    uint16_t boot;
+} pico_event_log_status_t;
+
+// Packet handler
+void pkt_event_log(struct pkt_buf *b);
+
+#ifdef PICO_BOARD
+/// @brief Records the boot event. Keeps the events of earlier boots.
+void init_event_log(void);
+
+/// @brief Adds an event to the log. May be called from interrupt handlers.
+void pico_event_log(uint8_t type, uint16_t data);
+#endif
+
+#define PACK_EVENT_LOG_U32(val, idx)\
+    buf[idx]     = (val) & 0xff;\
+    buf[idx + 1] = ((val) >> 8) & 0xff;\
+    buf[idx + 2] = ((val) >> 16) & 0xff;\
+    buf[idx + 3] = ((val) >> 24) & 0xff;
+
+#define UNPACK_EVENT_LOG_U32(idx)\
+    ((uint32_t)buf[idx] | ((uint32_t)buf[idx + 1] << 8) |\
+    ((uint32_t)buf[idx + 2] << 16) | ((uint32_t)buf[idx + 3] << 24))
+
+/* Pack the request buffer */
+static inline void pico_pkt_event_log_req_pack(uint8_t *buf, uint32_t first_seq,
+    uint8_t max_count) {
+    for (int i = 0; i < PICO_PKT_LEN; i++) {
+        buf[i] = 0x00;
+    }
+
+    buf[PICO_PKT_EVENT_LOG_IDX_MAGIC] = PICO_PKT_EVENT_LOG_MAGIC;
+    PACK_EVENT_LOG_U32(first_seq, PICO_PKT_EVENT_LOG_IDX_FIRST_SEQ)
+    buf[PICO_PKT_EVENT_LOG_IDX_MAX_COUNT] = max_count;
+}
+
+/* Unpack the request buffer */
+static inline void pico_pkt_event_log_req_unpack(const uint8_t *buf, uint32_t *first_seq,
+    uint8_t *max_count) {
+    *first_seq = UNPACK_EVENT_LOG_U32(PICO_PKT_EVENT_LOG_IDX_FIRST_SEQ);
+    *max_count = buf[PICO_PKT_EVENT_LOG_IDX_MAX_COUNT];
+}
+
+/* Pack an entry frame */
+static inline void pico_pkt_event_log_entry_pack(uint8_t *buf, const pico_event_t *e) {
+    for (int i = 0; i < PICO_PKT_LEN; i++) {
+        buf[i] = 0x00;
+    }
+
+    buf[PICO_PKT_EVENT_LOG_IDX_MAGIC] = PICO_PKT_EVENT_LOG_MAGIC;
+    buf[PICO_PKT_EVENT_LOG_IDX_FLAGS] = PICO_PKT_EVENT_LOG_FLAG_SUCCESS;
+    PACK_EVENT_LOG_U32(e->seq, PICO_PKT_EVENT_LOG_IDX_SEQ)
+    PACK_EVENT_LOG_U32(e->time_ms, PICO_PKT_EVENT_LOG_IDX_TIME_MS)
+    buf[PICO_PKT_EVENT_LOG_IDX_BOOT]     = e->boot & 0xff;
+    buf[PICO_PKT_EVENT_LOG_IDX_BOOT + 1] = (e->boot >> 8);
+    buf[PICO_PKT_EVENT_LOG_IDX_TYPE]     = e->type;
+    buf[PICO_PKT_EVENT_LOG_IDX_DATA]     = e->data & 0xff;
+    buf[PICO_PKT_EVENT_LOG_IDX_DATA + 1] = (e->data >> 8);
+}
+
+/* Pack the end frame */
+static inline void pico_pkt_event_log_end_pack(uint8_t *buf,
+    const pico_event_log_status_t *s, bool success) {
+    for (int i = 0; i < PICO_PKT_LEN; i++) {
+        buf[i] = 0x00;
+    }
+
+    buf[PICO_PKT_EVENT_LOG_IDX_MAGIC] = PICO_PKT_EVENT_LOG_MAGIC;
+    buf[PICO_PKT_EVENT_LOG_IDX_FLAGS] = PICO_PKT_EVENT_LOG_FLAG_END;
+    if (success) {
+        buf[PICO_PKT_EVENT_LOG_IDX_FLAGS] |= PICO_PKT_EVENT_LOG_FLAG_SUCCESS;
+    }
+
+    PACK_EVENT_LOG_U32(s->next_seq, PICO_PKT_EVENT_LOG_IDX_SEQ)
+    PACK_EVENT_LOG_U32(s->time_ms, PICO_PKT_EVENT_LOG_IDX_TIME_MS)
+    buf[PICO_PKT_EVENT_LOG_IDX_BOOT]     = s->boot & 0xff;
+    buf[PICO_PKT_EVENT_LOG_IDX_BOOT + 1] = (s->boot >> 8);
+    PACK_EVENT_LOG_U32(s->oldest_seq, PICO_PKT_EVENT_LOG_IDX_OLDEST_SEQ)
+}
+
+/* Unpack a response frame.
+ * Returns True(1) for the end frame, which fills s. Entry frames fill e. */
+static inline bool pico_pkt_event_log_unpack(const uint8_t *buf, pico_event_t *e,
+    pico_event_log_status_t *s, bool *success) {
+    uint8_t flags = buf[PICO_PKT_EVENT_LOG_IDX_FLAGS];
+    uint16_t boot = (uint16_t)((buf[PICO_PKT_EVENT_LOG_IDX_BOOT] << 0) |
+        (buf[PICO_PKT_EVENT_LOG_IDX_BOOT + 1] << 8));
+
+    *success = ((flags & PICO_PKT_EVENT_LOG_FLAG_SUCCESS) != 0);
+
+    if ((flags & PICO_PKT_EVENT_LOG_FLAG_END) != 0) {
+        s->next_seq = UNPACK_EVENT_LOG_U32(PICO_PKT_EVENT_LOG_IDX_SEQ);
+        s->time_ms = UNPACK_EVENT_LOG_U32(PICO_PKT_EVENT_LOG_IDX_TIME_MS);
+        s->boot = boot;
+        s->oldest_seq = UNPACK_EVENT_LOG_U32(PICO_PKT_EVENT_LOG_IDX_OLDEST_SEQ);
+        return true;
+    }
+
+    e->seq = UNPACK_EVENT_LOG_U32(PICO_PKT_EVENT_LOG_IDX_SEQ);
+    e->time_ms = UNPACK_EVENT_LOG_U32(PICO_PKT_EVENT_LOG_IDX_TIME_MS);
+    e->boot = boot;
+    e->type = buf[PICO_PKT_EVENT_LOG_IDX_TYPE];
+    e->data = (uint16_t)((buf[PICO_PKT_EVENT_LOG_IDX_DATA] << 0) |
+        (buf[PICO_PKT_EVENT_LOG_IDX_DATA + 1] << 8));
+    return false;
+}
+
+// Host (CM4) function definitions
+#ifndef PICO_BOARD
+/// @brief Reads events from the Pico event log.
+/// @param first_seq Sequence number of the first event wanted
+/// @param events [out] Events read, oldest first. At most PICO_EVENT_LOG_MAX_BURST.
+/// @param status [out] State of the Pico event log
+/// @return True(1) on success. False(0) on failure.
+bool send_event_log_request(uint32_t first_seq, std::vector<pico_event_t> & events,
+    pico_event_log_status_t & status);
+
+/// @brief Queues an event log request without waiting for the response.
+/// @param callback Called from the thread servicing the serial port once the
+/// end frame arrives, or the request fails.
+/// @return True(1) if the request was queued. False(0) otherwise.
+bool send_event_log_request_async(uint32_t first_seq,
+    std::function<void(bool success, std::vector<pico_event_t> & events,
+    pico_event_log_status_t & status)> callback);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //PICO_PKT_EVENT_LOG_H_
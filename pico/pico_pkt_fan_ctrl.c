@@ -0,0 +1,308 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "pico/stdlib.h"
+#include "cm4-wrt-a.h"
+#include "pkt_handler.h"
+#include "uart_dma.h"
+#include "pico_pkt_fan_ctrl.h"
+#include "pico_pkt_fan_pwm.h"
+#include "pico_pkt_temperature.h"
+
+// Period of the fan control loop
+#define FAN_CTRL_TIMER_DELAY_ms 500
+// Readings outside this range (°C x 100) are treated as a missing sensor
+#define FAN_CTRL_MIN_VALID_CX100 (-4000)
+#define FAN_CTRL_MAX_VALID_CX100 (15000)
+
+typedef struct fan_ctrl_t {
+    /// @brief Settings uploaded by the host
+    pico_pkt_fan_ctrl_t cfg;
+
+    /// @brief Hysteresis filtered temperature (°C x 100)
+    int32_t filtered_cx100;
+    bool have_filtered;
+
+    /// @brief Duty cycle in 0.01% requested by the curve
+    uint16_t curve_duty_x100;
+
+    /// @brief Duty cycle in 0.01% applied to the fan
+    uint16_t applied_duty_x100;
+
+    /// @brief Hottest selected sensor (°C x 100)
+    int32_t temperature_cx100;
+
+    /// @brief True(1) when the curve is driving the fan
+    volatile bool active;
+} fan_ctrl_t;
+
+static fan_ctrl_t fan_ctrl[NUM_PWM_FANS] = {
+    { .cfg = { .fan_id = SYS_FAN1, .mode = PICO_FAN_CTRL_MODE_HOST } },
+    { .cfg = { .fan_id = CM4_FAN,  .mode = PICO_FAN_CTRL_MODE_HOST } }
+};
+
+static struct repeating_timer fan_ctrl_timer;
+static volatile bool is_fan_ctrl_step_pending = false;
+// System time when the last message from the host was received
+extern uint64_t lastHostMessageTime;
+
+static bool fan_ctrl_timer_callback(struct repeating_timer *t) {
+    // Curves are stepped from the main loop, this only wakes it up
+    is_fan_ctrl_step_pending = true;
+    return true;
+}
+
+void init_fan_ctrl(void) {
+    add_repeating_timer_ms(FAN_CTRL_TIMER_DELAY_ms,
+        fan_ctrl_timer_callback, NULL, &fan_ctrl_timer);
+}
+
+static fan_ctrl_t *find_fan_ctrl(uint8_t fan_id) {
+    for (size_t i = 0; i < NUM_PWM_FANS; i++) {
+        if (fan_ctrl[i].cfg.fan_id == fan_id) {
+            return &fan_ctrl[i];
+        }
+    }
+
+    return NULL;
+}
+
+bool is_fan_ctrl_active(uint8_t fan_id) {
+    fan_ctrl_t *c = find_fan_ctrl(fan_id);
+    return (c != NULL) && c->active;
+}
+
+/// @brief Linearly interpolates the fan curve, in fixed point
+/// @return Duty cycle in 0.01% [0 to 10000]
+static uint16_t interpolate(const pico_pkt_fan_ctrl_t *cfg, int32_t temperature_cx100) {
+    const pico_fan_ctrl_point_t *p = cfg->points;
+
+    if (cfg->num_points == 0) {
+        return 0;
+    }
+
+    if (temperature_cx100 <= p[0].temperature_c * 100) {
+        return p[0].duty_pct * 100;
+    }
+
+    for (size_t i = 1; i < cfg->num_points; i++) {
+        int32_t t0 = p[i-1].temperature_c * 100;
+        int32_t t1 = p[i].temperature_c * 100;
+        if (temperature_cx100 <= t1) {
+            int32_t span = t1 - t0;
+            if (span <= 0) {
+                return p[i].duty_pct * 100;
+            }
+            int32_t d0 = p[i-1].duty_pct * 100;
+            int32_t d1 = p[i].duty_pct * 100;
+            return (uint16_t)(d0 + ((d1 - d0) * (temperature_cx100 - t0)) / span);
+        }
+    }
+
+    return p[cfg->num_points - 1].duty_pct * 100;
+}
+
+/// @brief Runs one control step for a fan
+/// @param temperature_cx100 Latest reading (°C x 100) of every sensor
+/// @param valid_mask Bit N is set when temperature_cx100[N] is valid
+static void fan_ctrl_step(fan_ctrl_t *c, const int32_t *temperature_cx100, uint8_t valid_mask) {
+    const pico_pkt_fan_ctrl_t *cfg = &c->cfg;
+    uint16_t host_duty_x100 = get_fan_pwm_setting(cfg->fan_id);
+    bool was_active = c->active;
+    bool found = false;
+    int32_t hottest = 0;
+
+    for (uint ch = 0; ch < PICO_FAN_CTRL_NUM_SENSORS; ch++) {
+        if ((cfg->sensor_mask & valid_mask & (1 << ch)) == 0) {
+            continue;
+        }
+
+        if (!found || (temperature_cx100[ch] > hottest)) {
+            hottest = temperature_cx100[ch];
+            found = true;
+        }
+    }
+
+    if (found) {
+        // Follow rising temperatures at once, falling ones only
+        // once they drop by more than the hysteresis.
+        int32_t hysteresis_cx100 = cfg->hysteresis_c * 100;
+        if (!c->have_filtered || (hottest > c->filtered_cx100)) {
+            c->filtered_cx100 = hottest;
+            c->have_filtered = true;
+        } else if (hottest < (c->filtered_cx100 - hysteresis_cx100)) {
+            c->filtered_cx100 = hottest + hysteresis_cx100;
+        }
+
+        c->temperature_cx100 = hottest;
+        c->curve_duty_x100 = interpolate(cfg, c->filtered_cx100);
+    } else {
+        // No valid sensor: fail safe
+        c->have_filtered = false;
+        c->curve_duty_x100 = 10000;
+    }
+
+    uint16_t min_duty_x100 = cfg->min_duty_pct * 100;
+    c->curve_duty_x100 = (c->curve_duty_x100 < min_duty_x100) ? min_duty_x100 : c->curve_duty_x100;
+    c->curve_duty_x100 = (c->curve_duty_x100 > 10000) ? 10000 : c->curve_duty_x100;
+
+    bool active = false;
+    if (cfg->mode == PICO_FAN_CTRL_MODE_AUTO) {
+        active = true;
+    } else if ((cfg->mode == PICO_FAN_CTRL_MODE_ADVISORY) && (cfg->host_timeout_sec > 0)) {
+        uint64_t timeout_us = cfg->host_timeout_sec * 1000000ULL;
+        active = ((get_time() - lastHostMessageTime) >= timeout_us);
+    }
+
+    c->active = active;
+
+    if (active) {
+        // The host can only raise the fan speed
+        c->applied_duty_x100 = (host_duty_x100 > c->curve_duty_x100) ?
+            host_duty_x100 : c->curve_duty_x100;
+        set_fan_pwm_output(cfg->fan_id, c->applied_duty_x100);
+    } else {
+        c->applied_duty_x100 = host_duty_x100;
+        if (was_active) {
+            // Hand the fan back to the host
+            set_fan_pwm_output(cfg->fan_id, host_duty_x100);
+        }
+    }
+}
+
+bool is_fan_ctrl_task_pending(void) {
+    return is_fan_ctrl_step_pending;
+}
+
+void fan_ctrl_task(void) {
+    if (!is_fan_ctrl_step_pending) {
+        return;
+    }
+
+    is_fan_ctrl_step_pending = false;
+
+    // Only read the sensors some fan is using
+    uint8_t used_mask = 0;
+    for (size_t i = 0; i < NUM_PWM_FANS; i++) {
+        if (fan_ctrl[i].cfg.mode != PICO_FAN_CTRL_MODE_HOST) {
+            used_mask |= fan_ctrl[i].cfg.sensor_mask;
+        }
+    }
+
+    int32_t temperature_cx100[PICO_FAN_CTRL_NUM_SENSORS] = {0};
+    uint8_t valid_mask = 0;
+
+    for (uint ch = 0; ch < PICO_FAN_CTRL_NUM_SENSORS; ch++) {
+        if ((used_mask & (1 << ch)) == 0) {
+            continue;
+        }
+
+        // An open or shorted NTC reads far outside the valid range
+        int32_t t = read_sensor_temperature_cx100(ch);
+        if ((t >= FAN_CTRL_MIN_VALID_CX100) && (t <= FAN_CTRL_MAX_VALID_CX100)) {
+            temperature_cx100[ch] = t;
+            valid_mask |= (1 << ch);
+        }
+    }
+
+    for (size_t i = 0; i < NUM_PWM_FANS; i++) {
+        if ((fan_ctrl[i].cfg.mode != PICO_FAN_CTRL_MODE_HOST) || fan_ctrl[i].active) {
+            fan_ctrl_step(&fan_ctrl[i], temperature_cx100, valid_mask);
+        }
+    }
+}
+
+/// @brief Checks fan control settings received from the host
+static bool is_valid_fan_ctrl(const pico_pkt_fan_ctrl_t *p) {
+    if ((p->mode >= PICO_FAN_CTRL_MODE_INVALID) || (p->min_duty_pct > 100) ||
+        (p->sensor_mask >= (1 << PICO_FAN_CTRL_NUM_SENSORS))) {
+        return false;
+    }
+
+    for (size_t i = 0; i < p->num_points; i++) {
+        if (p->points[i].duty_pct > 100) {
+            return false;
+        }
+        if ((i > 0) && (p->points[i].temperature_c < p->points[i-1].temperature_c)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool fan_ctrl_configure(const pico_pkt_fan_ctrl_t *p) {
+    fan_ctrl_t *c = find_fan_ctrl(p->fan_id);
+
+    if ((c == NULL) || !is_valid_fan_ctrl(p)) {
+        return false;
+    }
+
+    c->cfg = *p;
+    c->cfg.write = false;
+    c->have_filtered = false;
+    // The next control step applies the new settings
+    return true;
+}
+
+bool fan_ctrl_get_config(uint8_t fan_id, pico_pkt_fan_ctrl_t *p) {
+    fan_ctrl_t *c = find_fan_ctrl(fan_id);
+
+    if (c == NULL) {
+        return false;
+    }
+
+    *p = (pico_pkt_fan_ctrl_t) {
+        .fan_id = c->cfg.fan_id,
+        .mode = c->cfg.mode,
+        .sensor_mask = c->cfg.sensor_mask,
+        .hysteresis_c = c->cfg.hysteresis_c,
+        .min_duty_pct = c->cfg.min_duty_pct,
+        .host_timeout_sec = c->cfg.host_timeout_sec,
+        .num_points = c->cfg.num_points
+    };
+
+    for (size_t i = 0; i < PICO_FAN_CTRL_MAX_POINTS; i++) {
+        p->points[i] = c->cfg.points[i];
+    }
+
+    return true;
+}
+
+void pkt_fan_ctrl(struct pkt_buf *b) {
+    pico_pkt_fan_ctrl_t s = {0};
+
+    // Unpack the fan control request message
+    pico_pkt_fan_ctrl_unpack(b->req, &s);
+
+    fan_ctrl_t *c = find_fan_ctrl(s.fan_id);
+    s.success = (c != NULL);
+
+    if (s.success && s.write) {
+        s.success = fan_ctrl_configure(&s);
+    }
+
+    if (c != NULL) {
+        bool write = s.write;
+        bool status = s.status;
+        bool success = s.success;
+
+        s = c->cfg;
+        s.write = write;
+        s.status = status;
+        s.success = success;
+        s.active = c->active;
+        s.curve_duty_pct = (c->curve_duty_x100 + 50) / 100;
+        s.applied_duty_pct = c->active ? (c->applied_duty_x100 + 50) / 100 :
+            (get_fan_pwm_setting(s.fan_id) + 50) / 100;
+        s.temperature_cx100 = (int16_t)c->temperature_cx100;
+    }
+
+    // Pack the fan control response message
+    pico_pkt_fan_ctrl_resp_pack(b->resp, &s);
+    // Queue response to host (sent by DMA)
+    uart_dma_tx_write(b->resp);
+}
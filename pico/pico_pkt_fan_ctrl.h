@@ -0,0 +1,400 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef PICO_PKT_FAN_CTRL_H_
+#define PICO_PKT_FAN_CTRL_H_
+
+#ifdef PICO_BOARD
+#include "pico/stdlib.h"
+#else
+#include <stdint.h>
+#include <functional>
+#endif
+
+#include "pico_pkt_id.h"
+#include "pkt_handler.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* This file defines the Host (RPi CM4) <-> Pico (RP2040) packet format
+ * for on-Pico fan control messages. The Pico runs a fan curve against its
+ * own NTC/onboard temperature readings, so the fans keep following the
+ * board temperature when picod is not running. This packet is formatted,
+ * as follows:
+ * All values are little-endian.
+ *
+ *                              Request
+ *                      ----------------------
+ *
+ * +================+=========================================================+
+ * |  Byte offset   |                       Description                       |
+ * +================+=========================================================+
+ * |        0       | Magic Value                                             |
+ * +----------------+---------------------------------------------------------+
+ * |        1       | FAN ID [1 to N]                                         |
+ * +----------------+---------------------------------------------------------+
+ * |        2       | Flags (Note 1)                                          |
+ * +----------------+---------------------------------------------------------+
+ * |        3       | Mode (Note 2)                                           |
+ * +----------------+---------------------------------------------------------+
+ * |        4       | Sensor mask: Bit N-1 selects NTC N, bit 4 selects the   |
+ * |                | Pico onboard sensor                                     |
+ * +----------------+---------------------------------------------------------+
+ * |        5       | Hysteresis [0 to 255] °C                                |
+ * +----------------+---------------------------------------------------------+
+ * |        6       | Minimum duty cycle [0 to 100]%                          |
+ * +----------------+---------------------------------------------------------+
+ * |        7       | Host timeout [0 to 255] seconds (Note 2)                |
+ * +----------------+---------------------------------------------------------+
+ * |      15:8      | Curve: Up to 4 x (8-bit °C, 8-bit duty cycle [0-100]%)  |
+ * |                | points, in increasing temperature order                 |
+ * +----------------+---------------------------------------------------------+
+ *
+ *                              Response
+ *                      ----------------------
+ *
+ * The response packet contains the fan control settings as indicated above.
+ * A status flag will be set if the operation completed successfully.
+ *
+ * When the Status flag is set in a read request, bytes 15:3 of the response
+ * contain the fan control status instead:
+ *
+ * +================+=========================================================+
+ * |  Byte offset   |                       Description                       |
+ * +================+=========================================================+
+ * |        3       | Mode (Note 2)                                           |
+ * +----------------+---------------------------------------------------------+
+ * |        4       | 1 = The curve is driving the fan, 0 = The host is       |
+ * +----------------+---------------------------------------------------------+
+ * |        5       | Duty cycle [0 to 100]% requested by the curve           |
+ * +----------------+---------------------------------------------------------+
+ * |        6       | Duty cycle [0 to 100]% applied to the fan               |
+ * +----------------+---------------------------------------------------------+
+ * |       8:7      | 16-bit signed, hottest selected sensor (°C x 100)       |
+ * +----------------+---------------------------------------------------------+
+ * |      15:9      | Reserved. Set to 0.                                     |
+ * +----------------+---------------------------------------------------------+
+ *
+ * (Note 1)
+ *  The flags are defined as follows:
+ *
+ *    +================+========================+
+ *    |      Bit(s)    |         Value          |
+ *    +================+========================+
+ *    |       7:6      | Reserved. Set to 0.    |
+ *    +----------------+------------------------+
+ *    |       5:3      | Number of curve points |
+ *    |                | [0 to 4]               |
+ *    +----------------+------------------------+
+ *    |        2       | 1 = Read status        |
+ *    |                | Ignored on write.      |
+ *    +----------------+------------------------+
+ *    |                | Status. Only used in   |
+ *    |                | response packet.       |
+ *    |                | Ignored in request.    |
+ *    |        1       |                        |
+ *    |                |   1 = Success          |
+ *    |                |   0 = Failure          |
+ *    +----------------+------------------------+
+ *    |        0       |   0 = Read operation   |
+ *    |                |   1 = Write operation  |
+ *    +----------------+------------------------+
+ *
+ * (Note 2)
+ *  The modes are defined as follows:
+ *
+ *    HOST     - The fan runs at the duty cycle set by FAN PWM packets (default).
+ *    AUTO     - The fan runs at the higher of the curve and the FAN PWM
+ *               duty cycle. The host can only raise the fan speed.
+ *    ADVISORY - The curve is evaluated and reported, but the fan runs at the
+ *               FAN PWM duty cycle until no message has been received from
+ *               the host for the host timeout. The curve then takes over
+ *               as in AUTO, until the host is heard from again.
+ *               A host timeout of 0 never hands over.
+ *
+ *  If none of the selected sensors has a valid reading, the curve requests 100%.
+ */
+
+/* Request packet indices */
+#define PICO_PKT_FAN_CTRL_IDX_MAGIC         0
+#define PICO_PKT_FAN_CTRL_IDX_FAN_ID        1
+#define PICO_PKT_FAN_CTRL_IDX_FLAGS         2
+#define PICO_PKT_FAN_CTRL_IDX_MODE          3
+#define PICO_PKT_FAN_CTRL_IDX_SENSOR_MASK   4
+#define PICO_PKT_FAN_CTRL_IDX_HYSTERESIS    5
+#define PICO_PKT_FAN_CTRL_IDX_MIN_DUTY      6
+#define PICO_PKT_FAN_CTRL_IDX_HOST_TIMEOUT  7
+#define PICO_PKT_FAN_CTRL_IDX_POINTS        8
+
+/* Status response indices */
+#define PICO_PKT_FAN_CTRL_IDX_ACTIVE        4
+#define PICO_PKT_FAN_CTRL_IDX_CURVE_DUTY    5
+#define PICO_PKT_FAN_CTRL_IDX_APPLIED_DUTY  6
+#define PICO_PKT_FAN_CTRL_IDX_TEMPERATURE   7
+#define PICO_PKT_FAN_CTRL_STATUS_RESV       9
+
+/* Flag bits */
+#define PICO_PKT_FAN_CTRL_FLAG_WRITE        (1 << 0)
+#define PICO_PKT_FAN_CTRL_FLAG_SUCCESS      (1 << 1)
+#define PICO_PKT_FAN_CTRL_FLAG_STATUS       (1 << 2)
+#define PICO_PKT_FAN_CTRL_POINTS_SHIFT      3
+#define PICO_PKT_FAN_CTRL_POINTS_MASK       (0x07 << PICO_PKT_FAN_CTRL_POINTS_SHIFT)
+
+#define PICO_FAN_CTRL_MAX_POINTS            4
+/// @brief Sensor mask bits [0 to 3] are the NTC sensors, bit 4 the Pico onboard sensor
+#define PICO_FAN_CTRL_NUM_SENSORS           5
+
+#define PKT_FAN_CTRL { \
+    .magic          = PICO_PKT_FAN_CTRL_MAGIC, \
+    .init           = init_fan_ctrl, \
+    .exec           = pkt_fan_ctrl \
+}
+
+enum pico_fan_ctrl_mode {
+    PICO_FAN_CTRL_MODE_HOST     = 0,
+    PICO_FAN_CTRL_MODE_AUTO     = 1,
+    PICO_FAN_CTRL_MODE_ADVISORY = 2,
+    PICO_FAN_CTRL_MODE_INVALID
+};
+
+typedef struct pico_fan_ctrl_point_t {
+    /// @brief Temperature (°C)
+    uint8_t temperature_c;
+
+    /// @brief Duty cycle [0 to 100]%
+    uint8_t duty_pct;
+} pico_fan_ctrl_point_t;
+
+typedef struct pico_pkt_fan_ctrl_t {
+    /// @brief 1 - Write operation, 0 - Read operation
+    bool write;
+
+    /// @brief Read the fan control status instead of the settings
+    bool status;
+
+    /// @brief Success (true), Failure (false)
+    bool success;
+
+    /// @brief Fan Identifier
+    uint8_t fan_id;
+
+    /// @brief One of pico_fan_ctrl_mode
+    uint8_t mode;
+
+    /// @brief Bit N-1 selects NTC N, bit 4 the Pico onboard sensor
+    uint8_t sensor_mask;
+
+    /// @brief A falling temperature must drop this many °C before
+    /// the duty cycle follows it down
+    uint8_t hysteresis_c;
+
+    /// @brief Lowest duty cycle [0 to 100]% requested by the curve
+    uint8_t min_duty_pct;
+
+    /// @brief Seconds without a host message before ADVISORY mode
+    /// hands the fan over to the curve
+    uint8_t host_timeout_sec;
+
+    /// @brief Number of valid curve points
+    uint8_t num_points;
+
+    /// @brief Curve points, in increasing temperature order
+    pico_fan_ctrl_point_t points[PICO_FAN_CTRL_MAX_POINTS];
+
+    /// @brief Status: True(1) when the curve is driving the fan
+    bool active;
+
+    /// @brief Status: Duty cycle [0 to 100]% requested by the curve
+    uint8_t curve_duty_pct;
+
+    /// @brief Status: Duty cycle [0 to 100]% applied to the fan
+    uint8_t applied_duty_pct;
+
+    /// @brief Status: Hottest selected sensor (°C x 100)
+    int16_t temperature_cx100;
+
+} pico_pkt_fan_ctrl_t;
+
+// Packet handler
+void pkt_fan_ctrl(struct pkt_buf *b);
+
+#ifdef PICO_BOARD
+/// @brief Starts the fan control timer
+void init_fan_ctrl(void);
+
+/// @brief Runs a fan control step when the fan control timer has fired.
+/// Called from the main loop.
+void fan_ctrl_task(void);
+
+/// @brief True(1) when fan_ctrl_task() has a step to run
+bool is_fan_ctrl_task_pending(void);
+
+/// @brief True(1) when the curve is driving the given fan
+bool is_fan_ctrl_active(uint8_t fan_id);
+
+/// @brief Applies the settings of a fan control write request
+/// @return True(1) on success. False(0) if the fan or settings are invalid.
+bool fan_ctrl_configure(const pico_pkt_fan_ctrl_t *p);
+
+/// @brief Returns the fan control settings of a fan, without the status
+/// @return True(1) on success. False(0) if the fan is invalid.
+bool fan_ctrl_get_config(uint8_t fan_id, pico_pkt_fan_ctrl_t *p);
+#endif
+
+/// @brief Packs the flags byte
+static inline uint8_t pico_pkt_fan_ctrl_flags(const pico_pkt_fan_ctrl_t *p) {
+    uint8_t flags = 0x00;
+    uint8_t num_points = (p->num_points > PICO_FAN_CTRL_MAX_POINTS) ?
+        PICO_FAN_CTRL_MAX_POINTS : p->num_points;
+
+    if (p->write) {
+        flags |= PICO_PKT_FAN_CTRL_FLAG_WRITE;
+    } else if (p->status) {
+        flags |= PICO_PKT_FAN_CTRL_FLAG_STATUS;
+    }
+
+    if (p->success) {
+        flags |= PICO_PKT_FAN_CTRL_FLAG_SUCCESS;
+    }
+
+    flags |= (num_points << PICO_PKT_FAN_CTRL_POINTS_SHIFT) & PICO_PKT_FAN_CTRL_POINTS_MASK;
+    return flags;
+}
+
+/// @brief Packs the fan control settings (bytes 15:3)
+static inline void pico_pkt_fan_ctrl_pack_settings(uint8_t *buf,
+    const pico_pkt_fan_ctrl_t *p) {
+    buf[PICO_PKT_FAN_CTRL_IDX_MODE]         = p->mode;
+    buf[PICO_PKT_FAN_CTRL_IDX_SENSOR_MASK]  = p->sensor_mask;
+    buf[PICO_PKT_FAN_CTRL_IDX_HYSTERESIS]   = p->hysteresis_c;
+    buf[PICO_PKT_FAN_CTRL_IDX_MIN_DUTY]     = p->min_duty_pct;
+    buf[PICO_PKT_FAN_CTRL_IDX_HOST_TIMEOUT] = p->host_timeout_sec;
+
+    for (int i = 0; i < PICO_FAN_CTRL_MAX_POINTS; i++) {
+        bool valid = (i < p->num_points);
+        buf[PICO_PKT_FAN_CTRL_IDX_POINTS + 2*i]     = valid ? p->points[i].temperature_c : 0x00;
+        buf[PICO_PKT_FAN_CTRL_IDX_POINTS + 2*i + 1] = valid ? p->points[i].duty_pct : 0x00;
+    }
+}
+
+/* Pack the request buffer */
+/// @brief Packs a fan control settings read/write or status read request
+/// @param buf Pointer to request buffer
+/// @param p request details
+static inline void pico_pkt_fan_ctrl_req_pack(uint8_t *buf,
+    const pico_pkt_fan_ctrl_t *p) {
+    if (p == NULL) {
+        return;
+    }
+
+    for (int i = 0; i < PICO_PKT_LEN; i++) {
+        buf[i] = 0x00;
+    }
+
+    buf[PICO_PKT_FAN_CTRL_IDX_MAGIC]  = PICO_PKT_FAN_CTRL_MAGIC;
+    buf[PICO_PKT_FAN_CTRL_IDX_FAN_ID] = p->fan_id;
+    buf[PICO_PKT_FAN_CTRL_IDX_FLAGS]  = pico_pkt_fan_ctrl_flags(p) & ~PICO_PKT_FAN_CTRL_FLAG_SUCCESS;
+
+    if (p->write) {
+        pico_pkt_fan_ctrl_pack_settings(buf, p);
+    } else {
+        buf[PICO_PKT_FAN_CTRL_IDX_FLAGS] &= ~PICO_PKT_FAN_CTRL_POINTS_MASK;
+    }
+}
+
+/* Pack the response buffer */
+static inline void pico_pkt_fan_ctrl_resp_pack(uint8_t *buf,
+    const pico_pkt_fan_ctrl_t *p) {
+    if (p == NULL) {
+        return;
+    }
+
+    for (int i = 0; i < PICO_PKT_LEN; i++) {
+        buf[i] = 0x00;
+    }
+
+    buf[PICO_PKT_FAN_CTRL_IDX_MAGIC]  = PICO_PKT_FAN_CTRL_MAGIC;
+    buf[PICO_PKT_FAN_CTRL_IDX_FAN_ID] = p->fan_id;
+    buf[PICO_PKT_FAN_CTRL_IDX_FLAGS]  = pico_pkt_fan_ctrl_flags(p);
+
+    if (!p->write && p->status) {
+        uint16_t temperature = (uint16_t)p->temperature_cx100;
+        buf[PICO_PKT_FAN_CTRL_IDX_FLAGS]       &= ~PICO_PKT_FAN_CTRL_POINTS_MASK;
+        buf[PICO_PKT_FAN_CTRL_IDX_MODE]         = p->mode;
+        buf[PICO_PKT_FAN_CTRL_IDX_ACTIVE]       = p->active ? 1 : 0;
+        buf[PICO_PKT_FAN_CTRL_IDX_CURVE_DUTY]   = p->curve_duty_pct;
+        buf[PICO_PKT_FAN_CTRL_IDX_APPLIED_DUTY] = p->applied_duty_pct;
+        buf[PICO_PKT_FAN_CTRL_IDX_TEMPERATURE]     = temperature & 0xff;
+        buf[PICO_PKT_FAN_CTRL_IDX_TEMPERATURE + 1] = (temperature >> 8);
+    } else {
+        pico_pkt_fan_ctrl_pack_settings(buf, p);
+    }
+}
+
+/* Unpack the request/response buffer */
+static inline void pico_pkt_fan_ctrl_unpack(const uint8_t *buf,
+    pico_pkt_fan_ctrl_t *p) {
+    if (p == NULL) {
+        return;
+    }
+
+    uint8_t flags = buf[PICO_PKT_FAN_CTRL_IDX_FLAGS];
+
+    p->fan_id  = buf[PICO_PKT_FAN_CTRL_IDX_FAN_ID];
+    p->write   = ((flags & PICO_PKT_FAN_CTRL_FLAG_WRITE) != 0);
+    p->status  = !p->write && ((flags & PICO_PKT_FAN_CTRL_FLAG_STATUS) != 0);
+    p->success = ((flags & PICO_PKT_FAN_CTRL_FLAG_SUCCESS) != 0);
+    p->mode    = buf[PICO_PKT_FAN_CTRL_IDX_MODE];
+
+    if (p->status) {
+        p->active = (buf[PICO_PKT_FAN_CTRL_IDX_ACTIVE] != 0);
+        p->curve_duty_pct = buf[PICO_PKT_FAN_CTRL_IDX_CURVE_DUTY];
+        p->applied_duty_pct = buf[PICO_PKT_FAN_CTRL_IDX_APPLIED_DUTY];
+        p->temperature_cx100 = (int16_t)((buf[PICO_PKT_FAN_CTRL_IDX_TEMPERATURE] << 0) |
+            (buf[PICO_PKT_FAN_CTRL_IDX_TEMPERATURE + 1] << 8));
+        return;
+    }
+
+    p->sensor_mask      = buf[PICO_PKT_FAN_CTRL_IDX_SENSOR_MASK];
+    p->hysteresis_c     = buf[PICO_PKT_FAN_CTRL_IDX_HYSTERESIS];
+    p->min_duty_pct     = buf[PICO_PKT_FAN_CTRL_IDX_MIN_DUTY];
+    p->host_timeout_sec = buf[PICO_PKT_FAN_CTRL_IDX_HOST_TIMEOUT];
+    p->num_points = (flags & PICO_PKT_FAN_CTRL_POINTS_MASK) >> PICO_PKT_FAN_CTRL_POINTS_SHIFT;
+    p->num_points = (p->num_points > PICO_FAN_CTRL_MAX_POINTS) ?
+        PICO_FAN_CTRL_MAX_POINTS : p->num_points;
+
+    for (int i = 0; i < PICO_FAN_CTRL_MAX_POINTS; i++) {
+        p->points[i].temperature_c = buf[PICO_PKT_FAN_CTRL_IDX_POINTS + 2*i];
+        p->points[i].duty_pct = buf[PICO_PKT_FAN_CTRL_IDX_POINTS + 2*i + 1];
+    }
+}
+
+// Host (CM4) function definitions
+#ifndef PICO_BOARD
+/// @brief Uploads the pico_fan_control settings to the Pico, if any.
+void init_fan_ctrl();
+
+/// @brief Sends a request to the Pico to read/write the fan control
+/// settings, or read the fan control status, of one fan.
+/// @param p [in/out] request, replaced by the response.
+/// @return True(1) on success. False(0) on failure.
+bool send_fan_ctrl_request(pico_pkt_fan_ctrl_t & p);
+
+/// @brief Queues a fan control request to the Pico without waiting for the response.
+/// @param p request
+/// @param callback Called from the thread servicing the serial port with the result.
+/// @return True(1) if the request was queued. False(0) otherwise.
+bool send_fan_ctrl_request_async(const pico_pkt_fan_ctrl_t & p,
+    std::function<void(bool success, pico_pkt_fan_ctrl_t & p)> callback);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //PICO_PKT_FAN_CTRL_H_
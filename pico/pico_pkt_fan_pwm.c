@@ -7,44 +7,99 @@
 
 #include "pico/stdlib.h"
 #include "hardware/pwm.h"
+#include "hardware/pio.h"
+#include "tachometer.pio.h"
 #include "cm4-wrt-a.h"
 #include "pkt_handler.h"
+#include "uart_dma.h"
 #include "pico_pkt_fan_pwm.h"
+#include "pico_pkt_fan_ctrl.h"
 
 struct pwm_fan_t pwm_fan[NUM_PWM_FANS] = {
     { .fan_id = SYS_FAN1, .tacho_gpio = FAN1_TACHO_GPIO, .pwm_gpio = FAN1_PWM_GPIO, 
-      .prev_tacho_cnt = 0, .tacho_cnt = 0, .rpm = 0, .duty_cycle = 0.5f },
+      .prev_tacho_cnt = 0, .rpm = 0, .duty_cycle = 0.5f },
 
     { .fan_id = CM4_FAN,  .tacho_gpio = CM4_FAN_TACHO_GPIO, .pwm_gpio = CM4_FAN_PWM_GPIO, 
-      .prev_tacho_cnt = 0, .tacho_cnt = 0, .rpm = 0, .duty_cycle = 0.5f }    
+      .prev_tacho_cnt = 0, .rpm = 0, .duty_cycle = 0.5f }    
 };
 
 const uint FAN_PWM_COUNT_TOP = 1000;
+// PIO block counting the tachometer pulses
+static const PIO tacho_pio = pio0;
 
 struct repeating_timer tacho_timer;
 
+static inline void update_fan_rpm(struct pwm_fan_t *fan, uint64_t currentTime) {
+    
+    uint32_t tacho_cnt = tachometer_count_get(tacho_pio, fan->tacho_count_sm);
+    uint16_t tacho = (uint16_t)(tacho_cnt - fan->prev_tacho_cnt);
+    fan->prev_tacho_cnt = tacho_cnt;
+
+    // Pulses counted over the last second
+    fan->tacho_window_cnt += tacho;
+    fan->tacho_window_cnt -= fan->tacho_window[fan->tacho_window_idx];
+    fan->tacho_window[fan->tacho_window_idx] = tacho;
+    fan->tacho_window_idx = (fan->tacho_window_idx + 1) % TACHO_WINDOW_SAMPLES;
+
+    // Average the periods measured since the last timer period
+    uint32_t sum = 0;
+    uint32_t num_periods = 0;
+    while (!pio_sm_is_rx_fifo_empty(tacho_pio, fan->tacho_period_sm)) {
+        sum += tachometer_period_us(pio_sm_get(tacho_pio, fan->tacho_period_sm));
+        num_periods++;
+    }
+    fan->tacho_period_us = (num_periods > 0) ? (sum / num_periods) : 0;
+
+    if ((tacho > 0) || (num_periods > 0)) {
+        fan->last_tacho_time = currentTime;
+    }
+
+    uint32_t rpm = 0;
+    if ((currentTime - fan->last_tacho_time) >= TACHO_STALL_TIMEOUT_us) {
+        // Stalled
+        rpm = 0;
+    } else if (fan->tacho_period_us > 0) {
+        rpm = (1000000 * REVS_PER_MSEC_TO_RPM) / fan->tacho_period_us;
+    } else {
+        // Slower than one pulse per timer period
+        rpm = fan->tacho_window_cnt * REVS_PER_MSEC_TO_RPM;
+    }
+
+    fan->rpm = (rpm > UINT16_MAX) ? UINT16_MAX : rpm;
+}
+
 bool tachometer_timer_callback(struct repeating_timer *t) {
 
+    uint64_t currentTime = get_time();
     for (size_t i = 0; i < NUM_PWM_FANS; i++) {
-        uint16_t tacho = (pwm_fan[i].tacho_cnt - pwm_fan[i].prev_tacho_cnt);
-        pwm_fan[i].prev_tacho_cnt = pwm_fan[i].tacho_cnt;        
-        pwm_fan[i].rpm = tacho * REVS_PER_MSEC_TO_RPM;
+        update_fan_rpm(&pwm_fan[i], currentTime);
     }
 
     return true;
 }
 
-void update_tachometer_counter(uint gpio, uint32_t events){
+static void init_tachometer() {
+    
+    uint count_offset = pio_add_program(tacho_pio, &tachometer_count_program);
+    uint period_offset = pio_add_program(tacho_pio, &tachometer_period_program);
+
     for (size_t i = 0; i < NUM_PWM_FANS; i++) {
-        if (pwm_fan[i].tacho_gpio == gpio) {
-           pwm_fan[i].tacho_cnt++;
-           break;
-        }        
+        pwm_fan[i].tacho_count_sm = pio_claim_unused_sm(tacho_pio, true);
+        pwm_fan[i].tacho_period_sm = pio_claim_unused_sm(tacho_pio, true);
+        pwm_fan[i].last_tacho_time = get_time();
+
+        tachometer_count_program_init(tacho_pio, pwm_fan[i].tacho_count_sm, 
+            count_offset, pwm_fan[i].tacho_gpio);
+        tachometer_period_program_init(tacho_pio, pwm_fan[i].tacho_period_sm, 
+            period_offset, pwm_fan[i].tacho_gpio);
+        pwm_fan[i].prev_tacho_cnt = tachometer_count_get(tacho_pio, pwm_fan[i].tacho_count_sm);
     }
 }
 
 void init_fan_pwm() {
     
+    init_tachometer();
+
     add_repeating_timer_ms(TACHO_TIMER_DELAY_ms, 
     tachometer_timer_callback, NULL, &tacho_timer);
 
@@ -59,6 +114,35 @@ void init_fan_pwm() {
     }    
 }
 
+bool fan_pwm_configure(const struct pico_pkt_fan_pwm_t fans[NUM_PWM_FANS]) {
+    bool success = false;
+
+    for (size_t i = 0; i < NUM_PWM_FANS; i++) {
+        if (fans[i].fan_id == pwm_fan[i].fan_id) {
+            // Sanitize the input
+            float pwm_pct = (fans[i].pwm_pct < 0.0f)? 0.0f : fans[i].pwm_pct;
+            pwm_pct = (pwm_pct > 1.0f)? 1.0f : pwm_pct;
+            pwm_fan[i].duty_cycle = pwm_pct;
+            // The fan control loop applies the new setting on its next step
+            if (!is_fan_ctrl_active(pwm_fan[i].fan_id)) {
+                pwm_set_gpio_level(pwm_fan[i].pwm_gpio, pwm_fan[i].duty_cycle * (FAN_PWM_COUNT_TOP + 1));
+            }
+            success = true;
+        }
+    }
+
+    return success;
+}
+
+void fan_pwm_get_config(struct pico_pkt_fan_pwm_t fans[NUM_PWM_FANS]) {
+    for (size_t i = 0; i < NUM_PWM_FANS; i++) {
+        fans[i].fan_id = pwm_fan[i].fan_id;
+        // Packing truncates, so nudge by half an LSB to round instead.
+        // Unpacking and packing again then gives back the same byte.
+        fans[i].pwm_pct = pwm_fan[i].duty_cycle + (0.5f / FAN_PWM_LSB);
+    }
+}
+
 void pkt_fan_pwm(struct pkt_buf *b) {    
     bool write = false;    
     bool success = false;
@@ -72,16 +156,7 @@ void pkt_fan_pwm(struct pkt_buf *b) {
     pico_pkt_fan_pwm_unpack(b->req, fans, &write, &success);
     
     if (write) {        
-        for (size_t i = 0; i < NUM_PWM_FANS; i++) {
-            if (fans[i].fan_id == pwm_fan[i].fan_id) {
-                // Sanitize the input
-                float pwm_pct = (fans[i].pwm_pct < 0.0f)? 0.0f : fans[i].pwm_pct;
-                pwm_pct = (pwm_pct > 1.0f)? 1.0f : pwm_pct;
-                pwm_fan[i].duty_cycle = pwm_pct;
-                pwm_set_gpio_level(pwm_fan[i].pwm_gpio, pwm_fan[i].duty_cycle * (FAN_PWM_COUNT_TOP + 1));
-                success = true;
-            }            
-        }
+        success = fan_pwm_configure(fans);
     } else {               
         for (size_t i = 0; i < NUM_PWM_FANS; i++) {
             if (fans[i].fan_id == pwm_fan[i].fan_id) {
@@ -94,8 +169,8 @@ void pkt_fan_pwm(struct pkt_buf *b) {
     // Pack the PWM response message
     pico_pkt_fan_pwm_resp_pack(b->resp, fans, write, success);
 
-    // Write response to host (blocking)
-    uart_write_blocking(UART_ID, b->resp, PICO_PKT_LEN);
+    // Queue response to host (sent by DMA)
+    uart_dma_tx_write(b->resp);
 }
 
 uint16_t get_fan_rpm(uint8_t fan_id) {
@@ -111,4 +186,29 @@ uint16_t get_fan_rpm(uint8_t fan_id) {
     }
 
     return rpm;    
+}
+
+uint16_t get_fan_pwm_setting(uint8_t fan_id) {
+    
+    uint16_t duty_x100 = 0;
+    for (size_t i = 0; i < NUM_PWM_FANS; i++) {
+        if (fan_id == pwm_fan[i].fan_id) {
+            duty_x100 = (uint16_t)(pwm_fan[i].duty_cycle * 10000.0f + 0.5f);
+            break;
+        }
+    }
+
+    return duty_x100;
+}
+
+void set_fan_pwm_output(uint8_t fan_id, uint16_t duty_x100) {
+    
+    duty_x100 = (duty_x100 > 10000) ? 10000 : duty_x100;
+    for (size_t i = 0; i < NUM_PWM_FANS; i++) {
+        if (fan_id == pwm_fan[i].fan_id) {
+            pwm_set_gpio_level(pwm_fan[i].pwm_gpio, 
+                ((uint32_t)duty_x100 * (FAN_PWM_COUNT_TOP + 1)) / 10000);
+            break;
+        }
+    }
 }
\ No newline at end of file
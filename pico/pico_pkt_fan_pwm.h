@@ -12,6 +12,7 @@
 #else
 #include <stdint.h>
 #include <vector>
+#include <functional>
 #endif
 
 #include "pico_pkt_id.h"
@@ -100,7 +101,11 @@ extern "C" {
 }
 
 // Period of timer used to calculate FAN speed
-#define TACHO_TIMER_DELAY_ms 1000
+#define TACHO_TIMER_DELAY_ms 100
+// Number of timer periods over which tachometer pulses are counted (1 second)
+#define TACHO_WINDOW_SAMPLES 10
+// A fan without tachometer pulses for this long reads 0 RPM
+#define TACHO_STALL_TIMEOUT_us 1000000
 #define REVS_PER_MSEC_TO_RPM 60
 #define NUM_PWM_FANS 2
 
@@ -121,11 +126,30 @@ typedef struct pwm_fan_t {
     /// @brief Fan's PWM GPIO pin
     uint pwm_gpio;
 
-    /// @brief Tachometer interrupt Count
-    volatile uint64_t tacho_cnt;
-    
-    /// @brief Prevoius tachometer interrupt Count
-    uint64_t prev_tacho_cnt;
+    /// @brief PIO state machine counting tachometer pulses
+    uint tacho_count_sm;
+
+    /// @brief PIO state machine measuring the tachometer period
+    uint tacho_period_sm;
+
+    /// @brief Tachometer pulse count at the previous timer period
+    uint32_t prev_tacho_cnt;
+
+    /// @brief Tachometer pulses counted in each of the last timer periods
+    uint16_t tacho_window[TACHO_WINDOW_SAMPLES];
+
+    /// @brief Index of the oldest entry of tacho_window
+    uint8_t tacho_window_idx;
+
+    /// @brief Sum of tacho_window
+    uint32_t tacho_window_cnt;
+
+    /// @brief Average tachometer period (microseconds) measured in the 
+    /// last timer period, or zero(0) if none
+    uint32_t tacho_period_us;
+
+    /// @brief System time of the last tachometer pulse
+    uint64_t last_tacho_time;
 
     /// @brief Fan Revolutions Per Minute (RPM)
     uint16_t rpm;
@@ -153,8 +177,20 @@ void init_fan_pwm();
 void turn_off_fan_pwm();
 
 #ifdef PICO_BOARD
-// Called by GPIO ISR to update tachometer counter(s)
-void update_tachometer_counter(uint gpio, uint32_t events);
+/// @brief Returns the duty cycle set by the host, in 0.01% [0 to 10000]
+uint16_t get_fan_pwm_setting(uint8_t fan_id);
+
+/// @brief Drives the fan PWM output without changing the host setting
+/// @param duty_x100 Duty cycle in 0.01% [0 to 10000]
+void set_fan_pwm_output(uint8_t fan_id, uint16_t duty_x100);
+
+/// @brief Applies the duty cycle of each fan whose ID is set, as a
+/// FAN PWM write request does
+/// @return True(1) if any fan was set. False(0) otherwise.
+bool fan_pwm_configure(const struct pico_pkt_fan_pwm_t fans[NUM_PWM_FANS]);
+
+/// @brief Returns the duty cycle of every fan, ready for pico_pkt_fan_pwm_req_pack()
+void fan_pwm_get_config(struct pico_pkt_fan_pwm_t fans[NUM_PWM_FANS]);
 #endif
 
 inline bool is_valid_pico_fan_id(uint8_t fan_id) {
@@ -279,6 +315,16 @@ uint8_t get_fan_id_from_name(const char * fan_name);
 /// @param fanInfo Fan info.
 /// @return True(1) on success. False(0) on failure.
 bool send_fan_pwm_request(bool rw_flag, std::vector<struct pico_pkt_fan_pwm_t> &fanInfo);
+
+/// @brief Queues a request to the Pico to read/write FAN PWM setting
+/// without waiting for the response.
+/// @param rw_flag Read(0)/Write(1) flag
+/// @param fanInfo Fan info.
+/// @param callback Called from the thread servicing the serial port with the result.
+/// @return True(1) if the request was queued. False(0) otherwise.
+bool send_fan_pwm_request_async(bool rw_flag, 
+    const std::vector<struct pico_pkt_fan_pwm_t> &fanInfo,
+    std::function<void(bool success, std::vector<struct pico_pkt_fan_pwm_t> &fanInfo)> callback);
 #endif
 
 #ifdef __cplusplus
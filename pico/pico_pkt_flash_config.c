@@ -0,0 +1,322 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <string.h>
+#include <assert.h>
+#include "pico/stdlib.h"
+#include "pico/multicore.h"
+#include "hardware/flash.h"
+#include "hardware/sync.h"
+#include "pkt_handler.h"
+#include "uart_dma.h"
+#include "pico_pkt_flash_config.h"
+#include "pico_pkt_fan_pwm.h"
+#include "pico_pkt_watchdog.h"
+#include "pico_pkt_fan_ctrl.h"
+#include "pico_pkt_ntc_cal.h"
+#include "pico_pkt_event_log.h"
+#include "adc_capture.h"
+#include "cm4-wrt-a.h"
+
+// "CFGK"
+#define FLASH_CONFIG_MAGIC 0x4346474B
+// Bumped whenever the saved packets change
+#define FLASH_CONFIG_VERSION 1
+
+// The settings are kept in the last sectors of the flash, one record per
+// page. Each save programs the page after the newest record, and a sector
+// is only erased once the records reach it, so the newest record of the
+// other sector survives a power loss during the erase.
+#define FLASH_CONFIG_NUM_SECTORS 2
+#define FLASH_CONFIG_OFFSET (PICO_FLASH_SIZE_BYTES - (FLASH_CONFIG_NUM_SECTORS * FLASH_SECTOR_SIZE))
+#define FLASH_CONFIG_SLOTS_PER_SECTOR (FLASH_SECTOR_SIZE / FLASH_PAGE_SIZE)
+#define FLASH_CONFIG_NUM_SLOTS (FLASH_CONFIG_NUM_SECTORS * FLASH_CONFIG_SLOTS_PER_SECTOR)
+
+// Settings are saved as the write requests that set them
+enum flash_config_pkt {
+    FLASH_CONFIG_PKT_FAN_PWM,
+    FLASH_CONFIG_PKT_WATCHDOG,
+    FLASH_CONFIG_PKT_FAN_CTRL,
+    FLASH_CONFIG_PKT_NTC_CAL = FLASH_CONFIG_PKT_FAN_CTRL + NUM_PWM_FANS,
+    FLASH_CONFIG_NUM_PKTS
+};
+
+typedef struct flash_config_record_t {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t num_pkts;
+    /// @brief Number of times the settings were saved
+    uint32_t seq;
+    uint32_t host_tag;
+    uint8_t pkts[FLASH_CONFIG_NUM_PKTS][PICO_PKT_LEN];
+    /// @brief CRC-32 of the fields above
+    uint32_t crc;
+} flash_config_record_t;
+
+static_assert(sizeof(flash_config_record_t) <= FLASH_PAGE_SIZE, "Record must fit in a page");
+
+// Copy of the newest record, valid when saved_slot >= 0
+static flash_config_record_t saved;
+static int saved_slot = -1;
+// True(1) when the saved settings were applied at boot
+static bool is_loaded = false;
+
+static const uint8_t *slot_data(uint slot) {
+    return (const uint8_t *)(XIP_BASE + FLASH_CONFIG_OFFSET + (slot * FLASH_PAGE_SIZE));
+}
+
+static uint32_t crc32(const uint8_t *data, size_t len) {
+    uint32_t crc = 0xFFFFFFFF;
+
+    for (size_t i = 0; i < len; i++) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+        }
+    }
+
+    return ~crc;
+}
+
+static uint32_t record_crc(const flash_config_record_t *r) {
+    return crc32((const uint8_t *)r, offsetof(flash_config_record_t, crc));
+}
+
+static bool is_valid_record(const flash_config_record_t *r) {
+    return (r->magic == FLASH_CONFIG_MAGIC) && (r->version == FLASH_CONFIG_VERSION) &&
+        (r->num_pkts == FLASH_CONFIG_NUM_PKTS) && (r->crc == record_crc(r));
+}
+
+static bool is_slot_blank(uint slot) {
+    const uint8_t *data = slot_data(slot);
+
+    for (uint i = 0; i < FLASH_PAGE_SIZE; i++) {
+        if (data[i] != 0xFF) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/// @brief Finds the newest valid record
+static void scan_slots(void) {
+    saved_slot = -1;
+
+    for (uint slot = 0; slot < FLASH_CONFIG_NUM_SLOTS; slot++) {
+        flash_config_record_t r;
+        memcpy(&r, slot_data(slot), sizeof(r));
+
+        if (!is_valid_record(&r)) {
+            continue;
+        }
+
+        if ((saved_slot < 0) || ((int32_t)(r.seq - saved.seq) > 0)) {
+            saved = r;
+            saved_slot = slot;
+        }
+    }
+}
+
+/// @brief Erases and/or programs the flash. Interrupts are disabled and
+/// core1 is paused, as neither can run code from flash meanwhile.
+static void flash_write(uint32_t erase_offset, uint32_t program_offset, const uint8_t *page) {
+    multicore_lockout_start_blocking();
+    adc_capture_hold(true);
+    uint32_t status = save_and_disable_interrupts();
+
+    if (erase_offset != UINT32_MAX) {
+        flash_range_erase(erase_offset, FLASH_SECTOR_SIZE);
+    }
+
+    if (page != NULL) {
+        flash_range_program(program_offset, page, FLASH_PAGE_SIZE);
+    }
+
+    restore_interrupts(status);
+    adc_capture_hold(false);
+    multicore_lockout_end_blocking();
+}
+
+/// @brief Programs a record into the slot after the newest one
+static bool write_record(const flash_config_record_t *r) {
+    uint slot = (saved_slot < 0) ? 0 : ((saved_slot + 1) % FLASH_CONFIG_NUM_SLOTS);
+
+    // Skip pages left behind by an interrupted write, up to the next sector
+    while (((slot % FLASH_CONFIG_SLOTS_PER_SECTOR) != 0) && !is_slot_blank(slot)) {
+        slot = (slot + 1) % FLASH_CONFIG_NUM_SLOTS;
+    }
+
+    uint32_t offset = FLASH_CONFIG_OFFSET + (slot * FLASH_PAGE_SIZE);
+    uint32_t erase_offset = is_slot_blank(slot) ? UINT32_MAX : offset;
+
+    uint8_t page[FLASH_PAGE_SIZE];
+    memset(page, 0xFF, sizeof(page));
+    memcpy(page, r, sizeof(*r));
+
+    flash_write(erase_offset, offset, page);
+
+    if (memcmp(slot_data(slot), r, sizeof(*r)) != 0) {
+        return false;
+    }
+
+    saved = *r;
+    saved_slot = slot;
+    return true;
+}
+
+/// @brief Packs the settings in use as write requests
+static void capture_settings(uint8_t pkts[FLASH_CONFIG_NUM_PKTS][PICO_PKT_LEN]) {
+    memset(pkts, 0, FLASH_CONFIG_NUM_PKTS * PICO_PKT_LEN);
+
+    struct pico_pkt_fan_pwm_t fans[NUM_PWM_FANS];
+    fan_pwm_get_config(fans);
+    pico_pkt_fan_pwm_req_pack(pkts[FLASH_CONFIG_PKT_FAN_PWM], fans, true);
+
+    pico_pkt_watchdog_t w = { .write = true };
+    cm4_watchdog_get_config(&w);
+    pico_pkt_watchdog_req_pack(pkts[FLASH_CONFIG_PKT_WATCHDOG], &w);
+
+    for (size_t i = 0; i < NUM_PWM_FANS; i++) {
+        pico_pkt_fan_ctrl_t c = {0};
+        if (fan_ctrl_get_config(i + 1, &c)) {
+            c.write = true;
+            pico_pkt_fan_ctrl_req_pack(pkts[FLASH_CONFIG_PKT_FAN_CTRL + i], &c);
+        }
+    }
+
+    pico_pkt_ntc_cal_t n = { .write = true };
+    ntc_cal_get_config(&n);
+    pico_pkt_ntc_cal_pack(pkts[FLASH_CONFIG_PKT_NTC_CAL], &n, false);
+}
+
+/// @brief Applies the saved write requests
+static void apply_settings(const flash_config_record_t *r, bool enable_watchdog) {
+    const uint8_t (*pkts)[PICO_PKT_LEN] = r->pkts;
+
+    if (pkts[FLASH_CONFIG_PKT_FAN_PWM][PKT_MAGIC_IDX] == PICO_PKT_FAN_PWM_MAGIC) {
+        struct pico_pkt_fan_pwm_t fans[NUM_PWM_FANS] = {
+            { .fan_id = INVALID_FAN_ID, .pwm_pct = 0.0f },
+            { .fan_id = INVALID_FAN_ID, .pwm_pct = 0.0f },
+        };
+        pico_pkt_fan_pwm_unpack(pkts[FLASH_CONFIG_PKT_FAN_PWM], fans, NULL, NULL);
+        fan_pwm_configure(fans);
+    }
+
+    if (pkts[FLASH_CONFIG_PKT_WATCHDOG][PKT_MAGIC_IDX] == PICO_PKT_WATCHDOG_MAGIC) {
+        pico_pkt_watchdog_t w = {0};
+        pico_pkt_watchdog_unpack(pkts[FLASH_CONFIG_PKT_WATCHDOG], &w);
+        w.enable = w.enable && enable_watchdog;
+        cm4_watchdog_configure(&w);
+    }
+
+    for (size_t i = 0; i < NUM_PWM_FANS; i++) {
+        if (pkts[FLASH_CONFIG_PKT_FAN_CTRL + i][PKT_MAGIC_IDX] == PICO_PKT_FAN_CTRL_MAGIC) {
+            pico_pkt_fan_ctrl_t c = {0};
+            pico_pkt_fan_ctrl_unpack(pkts[FLASH_CONFIG_PKT_FAN_CTRL + i], &c);
+            fan_ctrl_configure(&c);
+        }
+    }
+
+    if (pkts[FLASH_CONFIG_PKT_NTC_CAL][PKT_MAGIC_IDX] == PICO_PKT_NTC_CAL_MAGIC) {
+        pico_pkt_ntc_cal_t n = {0};
+        pico_pkt_ntc_cal_unpack(pkts[FLASH_CONFIG_PKT_NTC_CAL], &n);
+        ntc_cal_configure(&n);
+    }
+}
+
+void load_flash_config(bool enable_watchdog) {
+    scan_slots();
+
+    if (saved_slot < 0) {
+        return;
+    }
+
+    apply_settings(&saved, enable_watchdog);
+    is_loaded = true;
+    pico_event_log(PICO_EVENT_CONFIG_LOADED, (uint16_t)saved.seq);
+}
+
+/// @brief True(1) when the settings in use differ from the saved ones
+static bool is_modified(void) {
+    uint8_t pkts[FLASH_CONFIG_NUM_PKTS][PICO_PKT_LEN];
+
+    if (saved_slot < 0) {
+        return true;
+    }
+
+    capture_settings(pkts);
+    return memcmp(pkts, saved.pkts, sizeof(pkts)) != 0;
+}
+
+static bool save_settings(uint32_t host_tag) {
+    if (!is_modified() && (host_tag == saved.host_tag)) {
+        // Spare the flash
+        return true;
+    }
+
+    flash_config_record_t r;
+    memset(&r, 0, sizeof(r));
+    r.magic = FLASH_CONFIG_MAGIC;
+    r.version = FLASH_CONFIG_VERSION;
+    r.num_pkts = FLASH_CONFIG_NUM_PKTS;
+    r.seq = (saved_slot < 0) ? 1 : (saved.seq + 1);
+    r.host_tag = host_tag;
+    capture_settings(r.pkts);
+    r.crc = record_crc(&r);
+
+    if (!write_record(&r)) {
+        // Whatever is in the flash now is what the Pico boots with
+        scan_slots();
+        return false;
+    }
+
+    pico_event_log(PICO_EVENT_CONFIG_SAVED, (uint16_t)r.seq);
+    return true;
+}
+
+static bool clear_settings(void) {
+    for (uint sector = 0; sector < FLASH_CONFIG_NUM_SECTORS; sector++) {
+        uint32_t offset = FLASH_CONFIG_OFFSET + (sector * FLASH_SECTOR_SIZE);
+        flash_write(offset, 0, NULL);
+    }
+
+    scan_slots();
+    return (saved_slot < 0);
+}
+
+void pkt_flash_config(struct pkt_buf *b) {
+    pico_pkt_flash_config_t p = {0};
+
+    // Unpack the flash config request message
+    pico_pkt_flash_config_unpack(b->req, &p);
+
+    switch (p.command) {
+    case PICO_FLASH_CONFIG_CMD_READ:
+        p.success = true;
+        break;
+    case PICO_FLASH_CONFIG_CMD_SAVE:
+        p.success = save_settings(p.host_tag);
+        break;
+    case PICO_FLASH_CONFIG_CMD_CLEAR:
+        p.success = clear_settings();
+        break;
+    default:
+        p.success = false;
+        break;
+    }
+
+    p.saved = (saved_slot >= 0);
+    p.loaded = is_loaded;
+    p.modified = p.saved && is_modified();
+    p.host_tag = p.saved ? saved.host_tag : 0;
+    p.seq = p.saved ? saved.seq : 0;
+
+    // Pack the flash config response message
+    pico_pkt_flash_config_pack(b->resp, &p, true);
+    // Queue response to host (sent by DMA)
+    uart_dma_tx_write(b->resp);
+}
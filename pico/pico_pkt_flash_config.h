@@ -0,0 +1,247 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef PICO_PKT_FLASH_CONFIG_H_
+#define PICO_PKT_FLASH_CONFIG_H_
+
+#ifdef PICO_BOARD
+#include "pico/stdlib.h"
+#else
+#include <stdint.h>
+#endif
+
+#include "pico_pkt_id.h"
+#include "pkt_handler.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* This file defines the Host (RPi CM4) <-> Pico (RP2040) packet format
+ * for saving the Pico settings in its flash. A save stores the fan PWM,
+ * watchdog, fan control and NTC calibration settings in use, and the
+ * Pico applies them on every boot before it powers up the CM4, so that
+ * the fans and the watchdog do not wait for picod to start.
+ * The host tag is stored with the settings for the host to tell whether
+ * they match its own configuration. Saving settings that match the saved
+ * ones does not write the flash.
+ * All values are little-endian.
+ *
+ *                              Request
+ *                      ----------------------
+ *
+ * +================+=========================================================+
+ * |  Byte offset   |                       Description                       |
+ * +================+=========================================================+
+ * |        0       | Magic Value                                             |
+ * +----------------+---------------------------------------------------------+
+ * |        1       | Flags (Note 1)                                          |
+ * +----------------+---------------------------------------------------------+
+ * |       5:2      | 32-bit data. Host tag, saved with the settings.         |
+ * |                | Only used by the Save command.                          |
+ * +----------------+---------------------------------------------------------+
+ * |      15:6      | Reserved. Set to 0.                                     |
+ * +----------------+---------------------------------------------------------+
+ *
+ *                              Response
+ *                      ----------------------
+ *
+ * +================+=========================================================+
+ * |        0       | Magic Value                                             |
+ * +----------------+---------------------------------------------------------+
+ * |        1       | Flags (Note 1)                                          |
+ * +----------------+---------------------------------------------------------+
+ * |       5:2      | 32-bit data. Host tag of the saved settings.            |
+ * +----------------+---------------------------------------------------------+
+ * |       9:6      | 32-bit data. Number of times the settings were saved.   |
+ * +----------------+---------------------------------------------------------+
+ * |      15:10     | Reserved. Set to 0.                                     |
+ * +----------------+---------------------------------------------------------+
+ *
+ * (Note 1)
+ *  The flags are defined as follows:
+ *
+ *    +================+========================+
+ *    |      Bit(s)    |         Value          |
+ *    +================+========================+
+ *    |       7:6      | Reserved. Set to 0.    |
+ *    +----------------+------------------------+
+ *    |        5       | Response only.         |
+ *    |                | 1 = The settings in    |
+ *    |                | use differ from the    |
+ *    |                | saved ones.            |
+ *    +----------------+------------------------+
+ *    |        4       | Response only.         |
+ *    |                | 1 = The saved settings |
+ *    |                | were applied at boot.  |
+ *    +----------------+------------------------+
+ *    |        3       | Response only.         |
+ *    |                | 1 = Settings are saved |
+ *    +----------------+------------------------+
+ *    |                | Status. Only used in   |
+ *    |                | response packet.       |
+ *    |                | Ignored in request.    |
+ *    |        2       |                        |
+ *    |                |   1 = Success          |
+ *    |                |   0 = Failure          |
+ *    +----------------+------------------------+
+ *    |       1:0      | Command (Note 2)       |
+ *    +----------------+------------------------+
+ *
+ * (Note 2)
+ *  The commands are defined as follows:
+ *
+ *    READ  - Reads the state of the saved settings.
+ *    SAVE  - Saves the settings in use.
+ *    CLEAR - Erases the saved settings. The Pico boots with its
+ *            built-in defaults again.
+ */
+
+/* Packet indices */
+#define PICO_PKT_FLASH_CONFIG_IDX_MAGIC     0
+#define PICO_PKT_FLASH_CONFIG_IDX_FLAGS     1
+#define PICO_PKT_FLASH_CONFIG_IDX_HOST_TAG  2
+#define PICO_PKT_FLASH_CONFIG_IDX_SEQ       6
+
+/* Flag bits */
+#define PICO_PKT_FLASH_CONFIG_CMD_MASK      0x03
+#define PICO_PKT_FLASH_CONFIG_FLAG_SUCCESS  (1 << 2)
+#define PICO_PKT_FLASH_CONFIG_FLAG_SAVED    (1 << 3)
+#define PICO_PKT_FLASH_CONFIG_FLAG_LOADED   (1 << 4)
+#define PICO_PKT_FLASH_CONFIG_FLAG_MODIFIED (1 << 5)
+
+#define PKT_FLASH_CONFIG { \
+    .magic          = PICO_PKT_FLASH_CONFIG_MAGIC, \
+    .init           = NULL, \
+    .exec           = pkt_flash_config \
+}
+
+enum pico_flash_config_cmd {
+    PICO_FLASH_CONFIG_CMD_READ  = 0,
+    PICO_FLASH_CONFIG_CMD_SAVE  = 1,
+    PICO_FLASH_CONFIG_CMD_CLEAR = 2,
+    PICO_FLASH_CONFIG_CMD_INVALID
+};
+
+typedef struct pico_pkt_flash_config_t {
+    /// @brief One of pico_flash_config_cmd
+    uint8_t command;
+
+    /// @brief Success (true), Failure (false)
+    bool success;
+
+    /// @brief True(1) when settings are saved
+    bool saved;
+
+    /// @brief True(1) when the saved settings were applied at boot
+    bool loaded;
+
+    /// @brief True(1) when the settings in use differ from the saved ones
+    bool modified;
+
+    /// @brief Host tag of the saved settings
+    uint32_t host_tag;
+
+    /// @brief Number of times the settings were saved
+    uint32_t seq;
+
+} pico_pkt_flash_config_t;
+
+// Packet handler
+void pkt_flash_config(struct pkt_buf *b);
+
+#ifdef PICO_BOARD
+/// @brief Applies the saved settings, if any. Called once at boot,
+/// before the CM4 is powered up.
+/// @param enable_watchdog False(0) keeps the CM4 watchdog disabled
+/// whatever the saved settings, e.g. in USB boot mode.
+void load_flash_config(bool enable_watchdog);
+#endif
+
+/* Pack the request/response buffer */
+static inline void pico_pkt_flash_config_pack(uint8_t *buf,
+    const pico_pkt_flash_config_t *p, bool is_response) {
+    if (p == NULL) {
+        return;
+    }
+
+    for (int i = 0; i < PICO_PKT_LEN; i++) {
+        buf[i] = 0x00;
+    }
+
+    buf[PICO_PKT_FLASH_CONFIG_IDX_MAGIC] = PICO_PKT_FLASH_CONFIG_MAGIC;
+    buf[PICO_PKT_FLASH_CONFIG_IDX_FLAGS] = p->command & PICO_PKT_FLASH_CONFIG_CMD_MASK;
+
+    for (int i = 0; i < 4; i++) {
+        buf[PICO_PKT_FLASH_CONFIG_IDX_HOST_TAG + i] = (p->host_tag >> (8 * i)) & 0xff;
+    }
+
+    if (!is_response) {
+        return;
+    }
+
+    if (p->success) {
+        buf[PICO_PKT_FLASH_CONFIG_IDX_FLAGS] |= PICO_PKT_FLASH_CONFIG_FLAG_SUCCESS;
+    }
+
+    if (p->saved) {
+        buf[PICO_PKT_FLASH_CONFIG_IDX_FLAGS] |= PICO_PKT_FLASH_CONFIG_FLAG_SAVED;
+    }
+
+    if (p->loaded) {
+        buf[PICO_PKT_FLASH_CONFIG_IDX_FLAGS] |= PICO_PKT_FLASH_CONFIG_FLAG_LOADED;
+    }
+
+    if (p->modified) {
+        buf[PICO_PKT_FLASH_CONFIG_IDX_FLAGS] |= PICO_PKT_FLASH_CONFIG_FLAG_MODIFIED;
+    }
+
+    for (int i = 0; i < 4; i++) {
+        buf[PICO_PKT_FLASH_CONFIG_IDX_SEQ + i] = (p->seq >> (8 * i)) & 0xff;
+    }
+}
+
+/* Unpack the request/response buffer */
+static inline void pico_pkt_flash_config_unpack(const uint8_t *buf,
+    pico_pkt_flash_config_t *p) {
+    if (p == NULL) {
+        return;
+    }
+
+    uint8_t flags = buf[PICO_PKT_FLASH_CONFIG_IDX_FLAGS];
+
+    p->command  = flags & PICO_PKT_FLASH_CONFIG_CMD_MASK;
+    p->success  = ((flags & PICO_PKT_FLASH_CONFIG_FLAG_SUCCESS) != 0);
+    p->saved    = ((flags & PICO_PKT_FLASH_CONFIG_FLAG_SAVED) != 0);
+    p->loaded   = ((flags & PICO_PKT_FLASH_CONFIG_FLAG_LOADED) != 0);
+    p->modified = ((flags & PICO_PKT_FLASH_CONFIG_FLAG_MODIFIED) != 0);
+
+    p->host_tag = 0;
+    p->seq = 0;
+    for (int i = 0; i < 4; i++) {
+        p->host_tag |= (uint32_t)buf[PICO_PKT_FLASH_CONFIG_IDX_HOST_TAG + i] << (8 * i);
+        p->seq |= (uint32_t)buf[PICO_PKT_FLASH_CONFIG_IDX_SEQ + i] << (8 * i);
+    }
+}
+
+// Host (CM4) function definitions
+#ifndef PICO_BOARD
+/// @brief Sends the fan PWM, watchdog, fan control and NTC calibration
+/// settings to the Pico, unless it booted with them from its flash, and
+/// saves them there (save_pico_config).
+void init_pico_config();
+
+/// @brief Sends a request to the Pico to read, save or clear its saved settings.
+/// @param p [in/out] request, replaced by the response.
+/// @return True(1) on success. False(0) on failure.
+bool send_flash_config_request(pico_pkt_flash_config_t & p);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //PICO_PKT_FLASH_CONFIG_H_
@@ -17,5 +17,10 @@
 #define PICO_PKT_SHUTDOWN_MAGIC         ((uint8_t) 'D')
 #define PICO_PKT_PING_MAGIC             ((uint8_t) 'E')
 #define PICO_PKT_VERSION_MAGIC          ((uint8_t) 'F')
+#define PICO_PKT_FAN_CTRL_MAGIC         ((uint8_t) 'G')
+#define PICO_PKT_NTC_CAL_MAGIC          ((uint8_t) 'H')
+#define PICO_PKT_EVENT_LOG_MAGIC        ((uint8_t) 'I')
+#define PICO_PKT_TIME_MAGIC             ((uint8_t) 'J')
+#define PICO_PKT_FLASH_CONFIG_MAGIC     ((uint8_t) 'K')
 
 #endif // PICO_PKT_
\ No newline at end of file
@@ -0,0 +1,86 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "pico/stdlib.h"
+#include "pkt_handler.h"
+#include "uart_dma.h"
+#include "pico_pkt_ntc_cal.h"
+#include "ntc.h"
+#include "thermistor.h"
+
+// Accepted thermistor B values (K)
+#define NTC_CAL_MIN_BETA 1000
+#define NTC_CAL_MAX_BETA 10000
+// Largest accepted offset (°C x 100)
+#define NTC_CAL_MAX_OFFSET_CX100 2000
+
+static int16_t ntc_offset_cx100[PICO_NTC_CAL_NUM_SENSORS] = {0};
+
+int32_t get_ntc_offset_cx100(uint input) {
+    return (input < PICO_NTC_CAL_NUM_SENSORS) ? ntc_offset_cx100[input] : 0;
+}
+
+/// @brief Checks NTC calibration settings received from the host
+static bool is_valid_ntc_cal(const pico_pkt_ntc_cal_t *p) {
+    if ((p->beta != 0) &&
+        ((p->beta < NTC_CAL_MIN_BETA) || (p->beta > NTC_CAL_MAX_BETA))) {
+        return false;
+    }
+
+    for (size_t i = 0; i < PICO_NTC_CAL_NUM_SENSORS; i++) {
+        if ((p->offset_cx100[i] < -NTC_CAL_MAX_OFFSET_CX100) ||
+            (p->offset_cx100[i] > NTC_CAL_MAX_OFFSET_CX100)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool ntc_cal_configure(const pico_pkt_ntc_cal_t *p) {
+    if (!is_valid_ntc_cal(p)) {
+        return false;
+    }
+
+    // Rebuilding the table takes the formula once per entry
+    uint16_t beta = (p->beta == 0) ? (uint16_t)NTC_B : p->beta;
+    if (beta != ntc_get_beta()) {
+        ntc_set_beta(beta);
+    }
+
+    for (size_t i = 0; i < PICO_NTC_CAL_NUM_SENSORS; i++) {
+        ntc_offset_cx100[i] = p->offset_cx100[i];
+    }
+
+    return true;
+}
+
+void ntc_cal_get_config(pico_pkt_ntc_cal_t *p) {
+    p->beta = ntc_get_beta();
+    for (size_t i = 0; i < PICO_NTC_CAL_NUM_SENSORS; i++) {
+        p->offset_cx100[i] = ntc_offset_cx100[i];
+    }
+}
+
+void pkt_ntc_cal(struct pkt_buf *b) {
+    pico_pkt_ntc_cal_t s = {0};
+
+    // Unpack the NTC calibration request message
+    pico_pkt_ntc_cal_unpack(b->req, &s);
+
+    s.success = true;
+
+    if (s.write) {
+        s.success = ntc_cal_configure(&s);
+    }
+
+    ntc_cal_get_config(&s);
+
+    // Pack the NTC calibration response message
+    pico_pkt_ntc_cal_pack(b->resp, &s, true);
+    // Queue response to host (sent by DMA)
+    uart_dma_tx_write(b->resp);
+}
@@ -0,0 +1,204 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef PICO_PKT_NTC_CAL_H_
+#define PICO_PKT_NTC_CAL_H_
+
+#ifdef PICO_BOARD
+#include "pico/stdlib.h"
+#else
+#include <stdint.h>
+#include <functional>
+#endif
+
+#include "pico_pkt_id.h"
+#include "pkt_handler.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* This file defines the Host (RPi CM4) <-> Pico (RP2040) packet format
+ * for NTC thermistor calibration messages. The calibration applies to
+ * every NTC temperature the Pico reports or uses for fan control, and is
+ * kept until the Pico restarts. This packet is formatted, as follows:
+ * All values are little-endian.
+ *
+ *                              Request
+ *                      ----------------------
+ *
+ * +================+=========================================================+
+ * |  Byte offset   |                       Description                       |
+ * +================+=========================================================+
+ * |        0       | Magic Value                                             |
+ * +----------------+---------------------------------------------------------+
+ * |        1       | Flags (Note 1)                                          |
+ * +----------------+---------------------------------------------------------+
+ * |       3:2      | 16-bit data, little-endian. Thermistor B value (K).     |
+ * |                | 0 = Default (NTC_B in thermistor.h)                     |
+ * +----------------+---------------------------------------------------------+
+ * |       5:4      | 16-bit signed, little-endian. NTC1 offset (°C x 100)    |
+ * +----------------+---------------------------------------------------------+
+ * |       7:6      | 16-bit signed, little-endian. NTC2 offset (°C x 100)    |
+ * +----------------+---------------------------------------------------------+
+ * |       9:8      | 16-bit signed, little-endian. NTC3 offset (°C x 100)    |
+ * +----------------+---------------------------------------------------------+
+ * |      11:10     | 16-bit signed, little-endian. NTC4 offset (°C x 100)    |
+ * +----------------+---------------------------------------------------------+
+ * |      15:12     | Reserved. Set to 0.                                     |
+ * +----------------+---------------------------------------------------------+
+ *
+ *                              Response
+ *                      ----------------------
+ *
+ * The response packet contains the calibration in use as indicated above.
+ * A status flag will be set if the operation completed successfully.
+ *
+ * (Note 1)
+ *  The flags are defined as follows:
+ *
+ *    +================+========================+
+ *    |      Bit(s)    |         Value          |
+ *    +================+========================+
+ *    |       7:2      | Reserved. Set to 0.    |
+ *    +----------------+------------------------+
+ *    |                | Status. Only used in   |
+ *    |                | response packet.       |
+ *    |                | Ignored in request.    |
+ *    |        1       |                        |
+ *    |                |   1 = Success          |
+ *    |                |   0 = Failure          |
+ *    +----------------+------------------------+
+ *    |        0       |   0 = Read operation   |
+ *    |                |   1 = Write operation  |
+ *    +----------------+------------------------+
+ *
+ * The offset is added to the temperature read from the thermistor.
+ */
+
+/* Request packet indices */
+#define PICO_PKT_NTC_CAL_IDX_MAGIC          0
+#define PICO_PKT_NTC_CAL_IDX_FLAGS          1
+#define PICO_PKT_NTC_CAL_IDX_BETA           2
+#define PICO_PKT_NTC_CAL_IDX_OFFSETS        4
+
+/* Flag bits */
+#define PICO_PKT_NTC_CAL_FLAG_WRITE         (1 << 0)
+#define PICO_PKT_NTC_CAL_FLAG_SUCCESS       (1 << 1)
+
+/// @brief Number of NTC thermistor inputs (see NUM_NTC_SENSORS)
+#define PICO_NTC_CAL_NUM_SENSORS            4
+
+#define PKT_NTC_CAL { \
+    .magic          = PICO_PKT_NTC_CAL_MAGIC, \
+    .init           = NULL, \
+    .exec           = pkt_ntc_cal \
+}
+
+typedef struct pico_pkt_ntc_cal_t {
+    /// @brief 1 - Write operation, 0 - Read operation
+    bool write;
+
+    /// @brief Success (true), Failure (false)
+    bool success;
+
+    /// @brief Thermistor B value (K), 0 for the default
+    uint16_t beta;
+
+    /// @brief Added to each NTC temperature (°C x 100)
+    int16_t offset_cx100[PICO_NTC_CAL_NUM_SENSORS];
+
+} pico_pkt_ntc_cal_t;
+
+// Packet handler
+void pkt_ntc_cal(struct pkt_buf *b);
+
+#ifdef PICO_BOARD
+/// @brief Returns the calibration offset (°C x 100) of an NTC input
+int32_t get_ntc_offset_cx100(uint input);
+
+/// @brief Applies the settings of an NTC calibration write request
+/// @return True(1) on success. False(0) if the settings are invalid.
+bool ntc_cal_configure(const pico_pkt_ntc_cal_t *p);
+
+/// @brief Returns the NTC calibration in use
+void ntc_cal_get_config(pico_pkt_ntc_cal_t *p);
+#endif
+
+/* Pack the request/response buffer */
+static inline void pico_pkt_ntc_cal_pack(uint8_t *buf,
+    const pico_pkt_ntc_cal_t *p, bool is_response) {
+    if (p == NULL) {
+        return;
+    }
+
+    for (int i = 0; i < PICO_PKT_LEN; i++) {
+        buf[i] = 0x00;
+    }
+
+    buf[PICO_PKT_NTC_CAL_IDX_MAGIC] = PICO_PKT_NTC_CAL_MAGIC;
+
+    if (p->write) {
+        buf[PICO_PKT_NTC_CAL_IDX_FLAGS] |= PICO_PKT_NTC_CAL_FLAG_WRITE;
+    }
+
+    if (is_response && p->success) {
+        buf[PICO_PKT_NTC_CAL_IDX_FLAGS] |= PICO_PKT_NTC_CAL_FLAG_SUCCESS;
+    }
+
+    buf[PICO_PKT_NTC_CAL_IDX_BETA]     = p->beta & 0xff;
+    buf[PICO_PKT_NTC_CAL_IDX_BETA + 1] = (p->beta >> 8);
+
+    for (int i = 0; i < PICO_NTC_CAL_NUM_SENSORS; i++) {
+        uint16_t offset = (uint16_t)p->offset_cx100[i];
+        buf[PICO_PKT_NTC_CAL_IDX_OFFSETS + 2*i]     = offset & 0xff;
+        buf[PICO_PKT_NTC_CAL_IDX_OFFSETS + 2*i + 1] = (offset >> 8);
+    }
+}
+
+/* Unpack the request/response buffer */
+static inline void pico_pkt_ntc_cal_unpack(const uint8_t *buf,
+    pico_pkt_ntc_cal_t *p) {
+    if (p == NULL) {
+        return;
+    }
+
+    uint8_t flags = buf[PICO_PKT_NTC_CAL_IDX_FLAGS];
+
+    p->write   = ((flags & PICO_PKT_NTC_CAL_FLAG_WRITE) != 0);
+    p->success = ((flags & PICO_PKT_NTC_CAL_FLAG_SUCCESS) != 0);
+    p->beta    = (uint16_t)((buf[PICO_PKT_NTC_CAL_IDX_BETA] << 0) |
+        (buf[PICO_PKT_NTC_CAL_IDX_BETA + 1] << 8));
+
+    for (int i = 0; i < PICO_NTC_CAL_NUM_SENSORS; i++) {
+        p->offset_cx100[i] = (int16_t)((buf[PICO_PKT_NTC_CAL_IDX_OFFSETS + 2*i] << 0) |
+            (buf[PICO_PKT_NTC_CAL_IDX_OFFSETS + 2*i + 1] << 8));
+    }
+}
+
+// Host (CM4) function definitions
+#ifndef PICO_BOARD
+/// @brief Uploads the ntc_calibration settings to the Pico, if any.
+void init_ntc_cal();
+
+/// @brief Sends a request to the Pico to read/write the NTC calibration.
+/// @param p [in/out] request, replaced by the response.
+/// @return True(1) on success. False(0) on failure.
+bool send_ntc_cal_request(pico_pkt_ntc_cal_t & p);
+
+/// @brief Queues an NTC calibration request to the Pico without waiting for the response.
+/// @param p request
+/// @param callback Called from the thread servicing the serial port with the result.
+/// @return True(1) if the request was queued. False(0) otherwise.
+bool send_ntc_cal_request_async(const pico_pkt_ntc_cal_t & p,
+    std::function<void(bool success, pico_pkt_ntc_cal_t & p)> callback);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //PICO_PKT_NTC_CAL_H_
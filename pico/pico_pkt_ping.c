@@ -5,6 +5,7 @@
  */
 
 #include "pkt_handler.h"
+#include "uart_dma.h"
 #include "pico_pkt_ping.h"
 #include "cm4-wrt-a.h"
 
@@ -16,7 +17,7 @@ void pkt_ping(struct pkt_buf *b) {
     }
     
     pico_pkt_ping_resp_pack((uint8_t *)b->resp, success);
-    // Write response to host (blocking)
-    uart_write_blocking(UART_ID, b->resp, PICO_PKT_LEN);
+    // Queue response to host (sent by DMA)
+    uart_dma_tx_write(b->resp);
 }
 
@@ -7,6 +7,8 @@
 #include <string.h>
 #include "pico_pkt_shutdown.h"
 #include "cm4-wrt-a.h"
+#include "uart_dma.h"
+#include "pico_pkt_event_log.h"
 #include "hardware/gpio.h"
 #include "hardware/timer.h"
 
@@ -51,8 +53,8 @@ void send_shutdown_request(){
     // Note the use of the pkt.resp buffer here because that is where
     // the host places incoming UART commands.
     pico_pkt_shutdown_resp_pack((uint8_t *)pkt.resp, success);
-    // Write response to host (blocking)        
-    uart_write_blocking(UART_ID, pkt.resp, PICO_PKT_LEN);
+    // Queue response to host (sent by DMA)
+    uart_dma_tx_write(pkt.resp);
 }
 
 void detect_shutdown_events(uint32_t events){
@@ -70,13 +72,16 @@ void detect_shutdown_events(uint32_t events){
         if (!gpio_get(CM4_RST_GPIO)) {
              // The CM4 is off. Turn it on.
             reset_the_cm4();
+            pico_event_log(PICO_EVENT_POWER_ON_BUTTON, 0);
         } else if ((buttonUpTime > buttonDownTime) && 
             (diff >= GRACEFUL_SHUTDOWN_MIN_THRESH_uSEC) &&
             (diff < HARD_RESET_MIN_THRESH_uSEC)) {
                 is_host_shutdown_request_pending = true;
+                pico_event_log(PICO_EVENT_SHUTDOWN_BUTTON, 0);
         } else if ((buttonUpTime > buttonDownTime) && 
             (diff >= HARD_RESET_MIN_THRESH_uSEC)) {
             is_host_hard_reset_request_pending = true;
+            pico_event_log(PICO_EVENT_HARD_RESET_BUTTON, 0);
         }
     }
 }
@@ -98,9 +103,12 @@ void handle_cm4_events(uint32_t events){
 
             // Turn off the M.2 Sockets and Ethernet1
             gpio_put(M2_PWR_EN_GPIO, 0);
+
+            pico_event_log(PICO_EVENT_CM4_OFF, 0);
         }
     } else if (events & GPIO_IRQ_EDGE_RISE) {
         is_cm4_graceful_shutdown = false;
+        pico_event_log(PICO_EVENT_CM4_ON, 0);
         // Turn ON(0) Pico LED1
         //gpio_put(LED_PIN1_GPIO, 0);
     }
@@ -4,76 +4,88 @@
  * SPDX-License-Identifier: MIT
  */
 
-#include "thermistor.h"
+#include "adc_capture.h"
+#include "pico_pkt_ntc_cal.h"
 #include "pkt_handler.h"
+#include "uart_dma.h"
 #include "pico_pkt_temperature.h"
 #include "pico_pkt_fan_pwm.h"
-#include "hardware/adc.h"
 #include "cm4-wrt-a.h"
 
 static pico_pkt_temperature_u temp_data;
 
-/*! @brief Calculates the temperature from ADC value.
-* Reads the ADC value associated with the specified 
-* Negative Temperature Coefficient (NTC) thermistor
-* sensor, and calculates the temperature in degrees Celsius
-* \return Temperature in degrees Celsius
-*/
-static inline float get_ntc_temperature(uint input)
+/// @brief Picks a statistic of the window, plus the NTC calibration offset
+static inline int32_t get_window_temperature_cx100(const adc_capture_window_t *w, 
+    uint input, uint8_t statistic)
 {
-    float temp_out = 0.0f;
-    // Select ADC input
-    adc_select_input(input);
-    
-    // 12-bit conversion, assume max value == ADC_VREF == 3.3 V
-    const float conversion_factor = 3.3f / (1 << 12);
-    uint16_t result = adc_read();
-    float voltage = result * conversion_factor;
-    // The analog-to-digital converter measures the voltage at 
-    // the midpoint of a divider consisting of a known resistance of 
-    // 10kohm between Vcc(3.3V) and a thermistor of unknown resistance. 
-    // We can thus calculate the thermistor resistance from 
-    // the measured voltage as:
-
-    const float known_res = 10e3f;
-    float thermistor_res = known_res * (1.0f/((3.3f/voltage) - 1.0f));
-    
-    // Ref: https://en.wikipedia.org/wiki/Thermistor
-    float temp_kelvin = NTC_B / (log(thermistor_res) - LN_NTC_B + (NTC_B / NTC_T0));
-    temp_out = KELVIN_TO_CELSIOUS(temp_kelvin) + REFERENCE_TEMPERATURE;
-
-    return temp_out;    
+    const int32_t *values = w->mean_cx100;
+
+    if (statistic == PICO_TEMPERATURE_STAT_MIN) {
+        values = w->min_cx100;
+    } else if (statistic == PICO_TEMPERATURE_STAT_MAX) {
+        values = w->max_cx100;
+    }
+
+    if (input < NUM_NTC_SENSORS) {
+        return values[input] + get_ntc_offset_cx100(input);
+    }
+
+    return values[ADC_CAPTURE_ONBOARD_INPUT];
 }
 
-/* References for this implementation:
- * raspberry-pi-pico-c-sdk.pdf, Section '4.1.1. hardware_adc'
- * pico-examples/adc/adc_console/adc_console.c */
-static inline float read_onboard_temperature() {
-    
-    /* 12-bit conversion, assume max value == ADC_VREF == 3.3 V */
-    const float conversionFactor = 3.3f / (1 << 12);
-    
-    // Select ADC input
-    adc_select_input(4);
-    
-    float adc = (float)adc_read() * conversionFactor;
-    float tempC = 27.0f - (adc - 0.706f) / 0.001721f;
-    return tempC;
+float read_sensor_temperature(uint input) {
+    return read_sensor_temperature_cx100(input) / TEMPERATURE_LSB;
+}
+
+int32_t read_sensor_temperature_cx100(uint input) {
+    adc_capture_window_t w;
+    // Sampled continuously by core1, see adc_capture.c
+    adc_capture_get_window(&w);
+
+    return get_window_temperature_cx100(&w, input, PICO_TEMPERATURE_STAT_MEAN);
 }
 
 void pkt_temperature(struct pkt_buf *b)
 {    
     bool success = true;
+    pico_pkt_temperature_req_t r = {0};
+    adc_capture_window_t w;
+
+    pico_pkt_temperature_req_unpack(b->req, &r);
+
+    if (r.configure) {
+        adc_capture_configure(r.sample_rate_hz, r.window_ms);
+    }
+
+    if (r.statistic > PICO_TEMPERATURE_STAT_MAX) {
+        r.statistic = PICO_TEMPERATURE_STAT_MEAN;
+        success = false;
+    }
+
+    adc_capture_get_window(&w);
 
     for (int ch=0; ch < NUM_NTC_SENSORS; ch++) {
-        temp_data.data[ch] = get_ntc_temperature(ch);
+        temp_data.data[ch] = get_window_temperature_cx100(&w, ch, r.statistic) / TEMPERATURE_LSB;
     }
 
-    temp_data.s.pico = read_onboard_temperature();
+    temp_data.s.pico = get_window_temperature_cx100(&w, ADC_CAPTURE_ONBOARD_INPUT, 
+        r.statistic) / TEMPERATURE_LSB;
     temp_data.s.fan1rpm = get_fan_rpm(SYS_FAN1);
     temp_data.s.cm4_fan_rpm = get_fan_rpm(CM4_FAN);
    
-    pico_pkt_temperature_resp_pack((uint8_t *)b->resp, &temp_data, success);
-    // Write response to host (blocking)
-    uart_write_blocking(UART_ID, b->resp, PICO_PKT_LEN);
+    pico_pkt_temperature_resp_pack((uint8_t *)b->resp, &temp_data, r.statistic, success);
+    // Queue response to host (sent by DMA)
+    uart_dma_tx_write(b->resp);
+
+    if (r.timestamp) {
+        pico_pkt_temperature_time_t t = {
+            .start_us = w.start_us,
+            .length_us = (uint32_t)(w.end_us - w.start_us),
+            .num_samples = w.num_samples
+        };
+
+        pico_pkt_temperature_time_pack((uint8_t *)b->resp, &t, true);
+        // Queue response to host (sent by DMA)
+        uart_dma_tx_write(b->resp);
+    }
 }
\ No newline at end of file
@@ -11,6 +11,7 @@
 #include "pico/stdlib.h"
 #else
 #include <stdint.h>
+#include <functional>
 #endif
 
 #include "math.h"
@@ -50,6 +51,11 @@ extern "C" {
  * |      15:14     | 16-bit data, little-endian. CM4 FAN Speed (RPM)         |
  * +----------------+---------------------------------------------------------+
  *
+ * When the Configure flag is set, bytes 3:2 of the request instead hold the
+ * sample rate (samples per second per sensor) and bytes 5:4 the length of
+ * the aggregation window (ms). See adc_capture.h. Both are 16-bit,
+ * little-endian. Set the other data bytes to 0.
+ *
  *                              Response
  *                      ----------------------
  *
@@ -59,13 +65,55 @@ extern "C" {
  * In the case of a read request, the data field will contain the read data, if
  * the read succeeded.
  *
+ * When the Timestamp flag is set in the request, the response is followed
+ * by a second frame, with the Timestamp flag set, telling when the
+ * readings were sampled:
+ *
+ *                         Response: Timestamp frame
+ *                      ----------------------
+ *
+ * +================+=========================================================+
+ * |        0       | Magic Value                                             |
+ * +----------------+---------------------------------------------------------+
+ * |        1       | Flags (Note 1). Timestamp = 1.                          |
+ * +----------------+---------------------------------------------------------+
+ * |       7:2      | 48-bit data. Pico time (us since the Pico booted) the   |
+ * |                | sampling window started.                                |
+ * +----------------+---------------------------------------------------------+
+ * |      11:8      | 32-bit data. Length of the sampling window (us)         |
+ * +----------------+---------------------------------------------------------+
+ * |      15:12     | 32-bit data. Samples per sensor in the window           |
+ * +----------------+---------------------------------------------------------+
+ *
+ * Fan speeds are measured when the request arrives, not over the window.
+ *
  * (Note 1)
  *  The flags are defined as follows:
  *
  *    +================+========================+
  *    |      Bit(s)    |         Value          |
  *    +================+========================+
- *    |       7:1      | Reserved. Set to 0.    |
+ *    |       7:5      | Reserved. Set to 0.    |
+ *    +----------------+------------------------+
+ *    |                | Timestamp.             |
+ *    |        4       |   1 = Request: also    |
+ *    |                |       send a timestamp |
+ *    |                |       frame.           |
+ *    |                |       Response: this   |
+ *    |                |       is the timestamp |
+ *    |                |       frame.           |
+ *    +----------------+------------------------+
+ *    |                | Statistic of the last  |
+ *    |                | window reported for    |
+ *    |       3:2      | the temperatures:      |
+ *    |                |   0 = Mean             |
+ *    |                |   1 = Minimum          |
+ *    |                |   2 = Maximum          |
+ *    +----------------+------------------------+
+ *    |                | Configure. Only used   |
+ *    |        1       | in request packet.     |
+ *    |                |   1 = Set sample rate  |
+ *    |                |       and window       |
  *    +----------------+------------------------+
  *    |                | Status. Only used in   |
  *    |                | response packet.       |
@@ -122,8 +170,26 @@ extern "C" {
 #define PICO_PKT_IDX_FAN1_SPEED             12 /* System FAN 1 speed in Revolutions Per Minute (RPM) */
 #define PICO_PKT_IDX_CM4_FAN_SPEED          14 /* CM4 FAN speed in Revolutions Per Minute (RPM) */
 
+/* Request packet indices, when configuring */
+#define PICO_PKT_TEMPERATURE_IDX_RATE       2 /* Samples per second per sensor */
+#define PICO_PKT_TEMPERATURE_IDX_WINDOW     4 /* Aggregation window in ms */
+
+/* Timestamp frame indices */
+#define PICO_PKT_TEMPERATURE_IDX_START      2 /* Window start, Pico time in us */
+#define PICO_PKT_TEMPERATURE_IDX_LENGTH     8 /* Window length in us */
+#define PICO_PKT_TEMPERATURE_IDX_SAMPLES    12 /* Samples per sensor */
+
 /* Flag bits */
 #define PICO_PKT_TEMPERATURE_FLAG_SUCCESS   (1 << 0)
+#define PICO_PKT_TEMPERATURE_FLAG_CONFIGURE (1 << 1)
+#define PICO_PKT_TEMPERATURE_STAT_SHIFT     2
+#define PICO_PKT_TEMPERATURE_STAT_MASK      (0x03 << PICO_PKT_TEMPERATURE_STAT_SHIFT)
+#define PICO_PKT_TEMPERATURE_FLAG_TIMESTAMP (1 << 4)
+
+/* Statistic of the aggregation window (flag bits 3:2) */
+#define PICO_TEMPERATURE_STAT_MEAN          0
+#define PICO_TEMPERATURE_STAT_MIN           1
+#define PICO_TEMPERATURE_STAT_MAX           2
 
 #define PKT_TEMPERATURE { \
     .magic          = PICO_PKT_TEMPERATURE_MAGIC, \
@@ -146,14 +212,58 @@ typedef union pico_pkt_temperature_u {
     float data[NUM_NTC_SENSORS + 3];
 } pico_pkt_temperature_u;
 
+typedef struct pico_pkt_temperature_req_t {
+    /// @brief PICO_TEMPERATURE_STAT_MEAN, _MIN or _MAX
+    uint8_t statistic;
+
+    /// @brief Set the sample rate and window
+    bool configure;
+
+    /// @brief Samples per second per sensor
+    uint16_t sample_rate_hz;
+
+    /// @brief Aggregation window (ms)
+    uint16_t window_ms;
+
+    /// @brief Also send a timestamp frame
+    bool timestamp;
+
+} pico_pkt_temperature_req_t;
+
+typedef struct pico_pkt_temperature_time_t {
+    /// @brief Pico time (us since the Pico booted) the sampling window started
+    uint64_t start_us;
+
+    /// @brief Length of the sampling window (us)
+    uint32_t length_us;
+
+    /// @brief Samples per sensor in the window. Zero(0) if unknown.
+    uint32_t num_samples;
+
+} pico_pkt_temperature_time_t;
+
 // Packet handler
 void pkt_temperature(struct pkt_buf *b);
 
+#ifdef PICO_BOARD
+/// @brief Returns the mean temperature of a sensor over the last sampling window
+/// @param input ADC input [0 to NUM_NTC_SENSORS - 1] for the NTC sensors,
+/// any other value for the Pico onboard sensor
+/// @return Temperature in degrees Celsius
+float read_sensor_temperature(uint input);
+
+/// @brief Same as read_sensor_temperature(), without float math
+/// @return Temperature in degrees Celsius x 100
+int32_t read_sensor_temperature_cx100(uint input);
+#endif
+
 /* Pack the request buffer */
-static inline void pico_pkt_temperature_req_pack(uint8_t *buf)
+static inline void pico_pkt_temperature_req_pack(uint8_t *buf, 
+    const pico_pkt_temperature_req_t *r)
 {    
     buf[PICO_PKT_TEMPERATURE_IDX_MAGIC] = PICO_PKT_TEMPERATURE_MAGIC;
-    buf[PICO_PKT_TEMPERATURE_IDX_FLAGS] = 0x00;
+    buf[PICO_PKT_TEMPERATURE_IDX_FLAGS] = 
+        (r->statistic << PICO_PKT_TEMPERATURE_STAT_SHIFT) & PICO_PKT_TEMPERATURE_STAT_MASK;
 
     buf[PICO_PKT_TEMPERATURE_IDX_NTC1]     = 0x00;
     buf[PICO_PKT_TEMPERATURE_IDX_NTC1 + 1] = 0x00;
@@ -169,14 +279,42 @@ static inline void pico_pkt_temperature_req_pack(uint8_t *buf)
     buf[PICO_PKT_IDX_FAN1_SPEED + 1]       = 0x00;
     buf[PICO_PKT_IDX_CM4_FAN_SPEED + 0]    = 0x00;
     buf[PICO_PKT_IDX_CM4_FAN_SPEED + 1]    = 0x00;
+
+    if (r->timestamp) {
+        buf[PICO_PKT_TEMPERATURE_IDX_FLAGS] |= PICO_PKT_TEMPERATURE_FLAG_TIMESTAMP;
+    }
+
+    if (r->configure) {
+        buf[PICO_PKT_TEMPERATURE_IDX_FLAGS] |= PICO_PKT_TEMPERATURE_FLAG_CONFIGURE;
+        buf[PICO_PKT_TEMPERATURE_IDX_RATE]       = r->sample_rate_hz & 0xff;
+        buf[PICO_PKT_TEMPERATURE_IDX_RATE + 1]   = (r->sample_rate_hz >> 8);
+        buf[PICO_PKT_TEMPERATURE_IDX_WINDOW]     = r->window_ms & 0xff;
+        buf[PICO_PKT_TEMPERATURE_IDX_WINDOW + 1] = (r->window_ms >> 8);
+    }
+}
+
+/* Unpack the request buffer */
+static inline void pico_pkt_temperature_req_unpack(const uint8_t *buf, 
+    pico_pkt_temperature_req_t *r)
+{
+    uint8_t flags = buf[PICO_PKT_TEMPERATURE_IDX_FLAGS];
+
+    r->statistic = (flags & PICO_PKT_TEMPERATURE_STAT_MASK) >> PICO_PKT_TEMPERATURE_STAT_SHIFT;
+    r->configure = ((flags & PICO_PKT_TEMPERATURE_FLAG_CONFIGURE) != 0);
+    r->timestamp = ((flags & PICO_PKT_TEMPERATURE_FLAG_TIMESTAMP) != 0);
+    r->sample_rate_hz = r->configure ? (uint16_t)((buf[PICO_PKT_TEMPERATURE_IDX_RATE] << 0) |
+        (buf[PICO_PKT_TEMPERATURE_IDX_RATE + 1] << 8)) : 0;
+    r->window_ms = r->configure ? (uint16_t)((buf[PICO_PKT_TEMPERATURE_IDX_WINDOW] << 0) |
+        (buf[PICO_PKT_TEMPERATURE_IDX_WINDOW + 1] << 8)) : 0;
 }
 
 /* Pack the response buffer */
 static inline void pico_pkt_temperature_resp_pack(uint8_t *buf, 
-    pico_pkt_temperature_u* p, bool success)
+    pico_pkt_temperature_u* p, uint8_t statistic, bool success)
 {    
     buf[PICO_PKT_TEMPERATURE_IDX_MAGIC] = PICO_PKT_TEMPERATURE_MAGIC;
-    buf[PICO_PKT_TEMPERATURE_IDX_FLAGS] = 0x00;
+    buf[PICO_PKT_TEMPERATURE_IDX_FLAGS] = 
+        (statistic << PICO_PKT_TEMPERATURE_STAT_SHIFT) & PICO_PKT_TEMPERATURE_STAT_MASK;
 
     PACK_TEMPERATURE(p->s.ntc1, PICO_PKT_TEMPERATURE_IDX_NTC1)
     PACK_TEMPERATURE(p->s.ntc2, PICO_PKT_TEMPERATURE_IDX_NTC2)
@@ -210,12 +348,83 @@ static inline void pico_pkt_temperature_resp_unpack(const uint8_t *buf,
     } 
 }
 
+/* Pack the timestamp frame */
+static inline void pico_pkt_temperature_time_pack(uint8_t *buf, 
+    const pico_pkt_temperature_time_t *t, bool success)
+{
+    buf[PICO_PKT_TEMPERATURE_IDX_MAGIC] = PICO_PKT_TEMPERATURE_MAGIC;
+    buf[PICO_PKT_TEMPERATURE_IDX_FLAGS] = PICO_PKT_TEMPERATURE_FLAG_TIMESTAMP;
+
+    if (success) {
+        buf[PICO_PKT_TEMPERATURE_IDX_FLAGS] |= PICO_PKT_TEMPERATURE_FLAG_SUCCESS;
+    }
+
+    for (int i = 0; i < 6; i++) {
+        buf[PICO_PKT_TEMPERATURE_IDX_START + i] = (t->start_us >> (8 * i)) & 0xff;
+    }
+
+    for (int i = 0; i < 4; i++) {
+        buf[PICO_PKT_TEMPERATURE_IDX_LENGTH + i] = (t->length_us >> (8 * i)) & 0xff;
+        buf[PICO_PKT_TEMPERATURE_IDX_SAMPLES + i] = (t->num_samples >> (8 * i)) & 0xff;
+    }
+}
+
+/* Unpack the timestamp frame */
+static inline void pico_pkt_temperature_time_unpack(const uint8_t *buf, 
+    pico_pkt_temperature_time_t *t, bool *success)
+{
+    t->start_us = 0;
+    for (int i = 0; i < 6; i++) {
+        t->start_us |= (uint64_t)buf[PICO_PKT_TEMPERATURE_IDX_START + i] << (8 * i);
+    }
+
+    t->length_us = 0;
+    t->num_samples = 0;
+    for (int i = 0; i < 4; i++) {
+        t->length_us |= (uint32_t)buf[PICO_PKT_TEMPERATURE_IDX_LENGTH + i] << (8 * i);
+        t->num_samples |= (uint32_t)buf[PICO_PKT_TEMPERATURE_IDX_SAMPLES + i] << (8 * i);
+    }
+
+    *success = ((buf[PICO_PKT_TEMPERATURE_IDX_FLAGS] & PICO_PKT_TEMPERATURE_FLAG_SUCCESS) != 0);
+}
+
+/* True(1) if the response frame is a timestamp frame */
+static inline bool pico_pkt_temperature_is_time(const uint8_t *buf)
+{
+    return (buf[PICO_PKT_TEMPERATURE_IDX_FLAGS] & PICO_PKT_TEMPERATURE_FLAG_TIMESTAMP) != 0;
+}
+
 // Host (CM4) function definitions
 #ifndef PICO_BOARD
 /// @brief Sends a board temperature request to the RPi Pico
 /// @param tmp [out] board temperatures
+/// @param statistic Statistic of the Pico's last sampling window to read.
+/// Fan speeds are the same for all of them.
+/// @param time [out] If not null, when the temperatures were sampled.
+/// num_samples is zero(0) if the Pico did not say. Timestamps are no longer
+/// requested once the Pico fails to send one (older firmware).
 /// @return True(1) on success. False(0) on failure
-bool send_temperature_request(pico_pkt_temperature_u & tmp);
+bool send_temperature_request(pico_pkt_temperature_u & tmp, 
+    uint8_t statistic = PICO_TEMPERATURE_STAT_MEAN,
+    pico_pkt_temperature_time_t * time = nullptr);
+
+/// @brief Queues a board temperature request to the RPi Pico without
+/// waiting for the response.
+/// @param callback Called from the thread servicing the serial port with 
+/// the result, and when the temperatures were sampled (num_samples is 
+/// zero(0) if the Pico did not say).
+/// @return True(1) if the request was queued. False(0) otherwise.
+bool send_temperature_request_async(
+    std::function<void(bool success, pico_pkt_temperature_u & tmp,
+    const pico_pkt_temperature_time_t & time)> callback);
+
+/// @brief Uploads the pico_sample_rate_hz and pico_sample_window_ms settings.
+void init_temperature();
+
+/// @brief Converts the timestamp of a temperature response to host time.
+/// @return The middle of the sampling window, in milliseconds since the 
+/// Unix epoch. Zero(0) if unknown, e.g. before picod::PicoClock has synchronized.
+int64_t get_temperature_timestamp_ms(const pico_pkt_temperature_time_t & time);
 #endif
 
 #ifdef __cplusplus
@@ -0,0 +1,25 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "pico/stdlib.h"
+#include "pkt_handler.h"
+#include "uart_dma.h"
+#include "pico_pkt_time.h"
+#include "cm4-wrt-a.h"
+
+void pkt_time(struct pkt_buf *b) {
+    pico_pkt_time_t p = {0};
+
+    p.pico_time_us = get_request_time();
+    p.success = (p.pico_time_us != 0);
+
+    // Measured last, so it covers all the work done on the request
+    p.turnaround_us = (uint32_t)(get_time() - p.pico_time_us);
+
+    pico_pkt_time_resp_pack(b->resp, b->req, &p);
+    // Queue response to host (sent by DMA)
+    uart_dma_tx_write(b->resp);
+}
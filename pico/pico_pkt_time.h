@@ -0,0 +1,198 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef PICO_PKT_TIME_H_
+#define PICO_PKT_TIME_H_
+
+#ifdef PICO_BOARD
+#include "pico/stdlib.h"
+#else
+#include <stdint.h>
+#include <functional>
+#endif
+
+#include "pico_pkt_id.h"
+#include "pkt_handler.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* This file defines the Host (RPi CM4) <-> Pico (RP2040) packet format
+ * for clock synchronization messages. Like an NTP exchange, the host notes
+ * when it sent the request (T1) and received the response (T4), and the
+ * Pico reports when the request arrived (T2) and how long it took to
+ * answer (T3 - T2). From those, the host works out the offset between
+ * the Pico clock and its own, and the round trip delay.
+ * All values are little-endian.
+ *
+ *                              Request
+ *                      ----------------------
+ *
+ * +================+=========================================================+
+ * |  Byte offset   |                       Description                       |
+ * +================+=========================================================+
+ * |        0       | Magic Value                                             |
+ * +----------------+---------------------------------------------------------+
+ * |        1       | Flags. Reserved, set to 0.                              |
+ * +----------------+---------------------------------------------------------+
+ * |       9:2      | 64-bit data. Host tag, returned as is in the response.  |
+ * +----------------+---------------------------------------------------------+
+ * |      15:10     | Reserved. Set to 0.                                     |
+ * +----------------+---------------------------------------------------------+
+ *
+ *                              Response
+ *                      ----------------------
+ *
+ * +================+=========================================================+
+ * |        0       | Magic Value                                             |
+ * +----------------+---------------------------------------------------------+
+ * |        1       | Flags (Note 1)                                          |
+ * +----------------+---------------------------------------------------------+
+ * |       9:2      | 64-bit data. Host tag from the request                  |
+ * +----------------+---------------------------------------------------------+
+ * |      15:10     | 48-bit data. Pico time (us since the Pico booted) the   |
+ * |                | request finished arriving.                              |
+ * +----------------+---------------------------------------------------------+
+ *
+ * The 48-bit Pico time wraps after about 8.9 years.
+ *
+ * (Note 1)
+ *  The flags are defined as follows:
+ *
+ *    +================+========================+
+ *    |      Bit(s)    |         Value          |
+ *    +================+========================+
+ *    |       7:1      | Pico turnaround time:  |
+ *    |                | time from the request  |
+ *    |                | arriving to the        |
+ *    |                | response being queued, |
+ *    |                | in units of 8 us,      |
+ *    |                | 127 = 1016 us or more. |
+ *    +----------------+------------------------+
+ *    |                | Status. Only used in   |
+ *    |                | response packet.       |
+ *    |                | Ignored in request.    |
+ *    |        0       |                        |
+ *    |                |   1 = Success          |
+ *    |                |   0 = Failure          |
+ *    +----------------+------------------------+
+ *
+ */
+
+/* Packet indices */
+#define PICO_PKT_TIME_IDX_MAGIC         0
+#define PICO_PKT_TIME_IDX_FLAGS         1
+#define PICO_PKT_TIME_IDX_TAG           2
+#define PICO_PKT_TIME_IDX_PICO_TIME     10
+
+/* Flag bits */
+#define PICO_PKT_TIME_FLAG_SUCCESS      (1 << 0)
+#define PICO_PKT_TIME_TURNAROUND_SHIFT  1
+#define PICO_PKT_TIME_TURNAROUND_MASK   (0x7f << PICO_PKT_TIME_TURNAROUND_SHIFT)
+
+// Resolution of the turnaround time
+#define PICO_PKT_TIME_TURNAROUND_LSB_us 8
+
+#define PKT_TIME { \
+    .magic          = PICO_PKT_TIME_MAGIC, \
+    .init           = NULL, \
+    .exec           = pkt_time \
+}
+
+typedef struct pico_pkt_time_t {
+    /// @brief Host tag, returned as is
+    uint64_t tag;
+
+    /// @brief Pico time (us since the Pico booted) the request finished arriving
+    uint64_t pico_time_us;
+
+    /// @brief Time (us) from the request arriving to the response being queued
+    uint32_t turnaround_us;
+
+    bool success;
+
+} pico_pkt_time_t;
+
+// Packet handler
+void pkt_time(struct pkt_buf *b);
+
+/* Pack the request buffer */
+static inline void pico_pkt_time_req_pack(uint8_t *buf, uint64_t tag)
+{
+    for (int i = 0; i < PICO_PKT_LEN; i++) {
+        buf[i] = 0x00;
+    }
+
+    buf[PICO_PKT_TIME_IDX_MAGIC] = PICO_PKT_TIME_MAGIC;
+
+    for (int i = 0; i < 8; i++) {
+        buf[PICO_PKT_TIME_IDX_TAG + i] = (tag >> (8 * i)) & 0xff;
+    }
+}
+
+/* Pack the response buffer. The tag is copied from the request. */
+static inline void pico_pkt_time_resp_pack(uint8_t *buf, const uint8_t *req,
+    const pico_pkt_time_t *p)
+{
+    uint32_t turnaround = (p->turnaround_us + PICO_PKT_TIME_TURNAROUND_LSB_us - 1) /
+        PICO_PKT_TIME_TURNAROUND_LSB_us;
+    turnaround = (turnaround > 0x7f) ? 0x7f : turnaround;
+
+    buf[PICO_PKT_TIME_IDX_MAGIC] = PICO_PKT_TIME_MAGIC;
+    buf[PICO_PKT_TIME_IDX_FLAGS] = (turnaround << PICO_PKT_TIME_TURNAROUND_SHIFT) &
+        PICO_PKT_TIME_TURNAROUND_MASK;
+
+    if (p->success) {
+        buf[PICO_PKT_TIME_IDX_FLAGS] |= PICO_PKT_TIME_FLAG_SUCCESS;
+    }
+
+    for (int i = 0; i < 8; i++) {
+        buf[PICO_PKT_TIME_IDX_TAG + i] = req[PICO_PKT_TIME_IDX_TAG + i];
+    }
+
+    for (int i = 0; i < 6; i++) {
+        buf[PICO_PKT_TIME_IDX_PICO_TIME + i] = (p->pico_time_us >> (8 * i)) & 0xff;
+    }
+}
+
+/* Unpack the response buffer */
+static inline void pico_pkt_time_resp_unpack(const uint8_t *buf, pico_pkt_time_t *p)
+{
+    p->tag = 0;
+    for (int i = 0; i < 8; i++) {
+        p->tag |= (uint64_t)buf[PICO_PKT_TIME_IDX_TAG + i] << (8 * i);
+    }
+
+    p->pico_time_us = 0;
+    for (int i = 0; i < 6; i++) {
+        p->pico_time_us |= (uint64_t)buf[PICO_PKT_TIME_IDX_PICO_TIME + i] << (8 * i);
+    }
+
+    p->turnaround_us = ((buf[PICO_PKT_TIME_IDX_FLAGS] & PICO_PKT_TIME_TURNAROUND_MASK) >>
+        PICO_PKT_TIME_TURNAROUND_SHIFT) * PICO_PKT_TIME_TURNAROUND_LSB_us;
+
+    p->success = ((buf[PICO_PKT_TIME_IDX_FLAGS] & PICO_PKT_TIME_FLAG_SUCCESS) != 0);
+}
+
+// Host (CM4) function definitions
+#ifndef PICO_BOARD
+/// @brief Makes one clock synchronization exchange with the RPi Pico and
+/// adds it to picod::PicoClock.
+/// @return True(1) on success. False(0) on failure
+bool send_time_request();
+
+/// @brief Same as above, without waiting for the response.
+/// @param callback Called from the thread servicing the serial port with the result.
+/// @return True(1) if the request was queued. False(0) otherwise.
+bool send_time_request_async(std::function<void(bool success)> callback);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //PICO_PKT_TIME_H_
@@ -5,6 +5,7 @@
  */
 
 #include "pkt_handler.h"
+#include "uart_dma.h"
 #include "pico_pkt_version.h"
 #include "cm4-wrt-a.h"
 
@@ -13,7 +14,7 @@ void pkt_version(struct pkt_buf *b) {
     bool eop = false;   // End of packet
 
     pico_pkt_version_resp_pack((uint8_t *)b->resp, &sop, &eop);
-    // Write response to host (blocking)
-    uart_write_blocking(UART_ID, b->resp, PICO_PKT_LEN);
+    // Queue response to host (sent by DMA)
+    uart_dma_tx_write(b->resp);
 }
 
@@ -6,12 +6,19 @@
 
 #include "pico/stdlib.h"
 #include "pkt_handler.h"
+#include "uart_dma.h"
 #include "pico_pkt_watchdog.h"
 #include "pico_pkt_shutdown.h"
+#include "pico_pkt_event_log.h"
 #include "cm4-wrt-a.h"
 
 // Watchdog timeout for CM4. 
 static uint16_t cm4_watchdog_timeout_sec = 30;
+// Timeout until picod is first heard from, so that a watchdog enabled
+// from the settings saved in flash lets the CM4 boot first
+#define CM4_WATCHDOG_BOOT_TIMEOUT_sec 180
+// Period of the watchdog timer
+#define CM4_WATCHDOG_TIMER_DELAY_ms 100
 // Flag indicating whether the CM4 watchdog is enabled (true) 
 static volatile bool is_cm4_watchdog_enabled = false;
 extern bool is_host_shutdown_request_pending;
@@ -33,6 +40,11 @@ bool cm4_watchdog_timer_callback(struct repeating_timer *t) {
     uint64_t currentTime = get_time();
     uint64_t diff = currentTime - lastHostMessageTime;
     uint64_t timeout_us = cm4_watchdog_timeout_sec * 1000000LL;
+    if ((lastHostMessageTime == 0) &&
+        (timeout_us < (CM4_WATCHDOG_BOOT_TIMEOUT_sec * 1000000LL))) {
+        // picod has not started since the Pico booted
+        timeout_us = CM4_WATCHDOG_BOOT_TIMEOUT_sec * 1000000LL;
+    }
     // Assume CM4 (picod) is alive   
     bool is_CM4_alive = true;
 
@@ -51,42 +63,33 @@ bool cm4_watchdog_timer_callback(struct repeating_timer *t) {
         } else {
             is_cm4_watchdog_enabled = false;
         }
+        pico_event_log(PICO_EVENT_WATCHDOG_RESET, max_retries);
     }
 
     return true;
 }
 
-void pkt_watchdog(struct pkt_buf *b){
-        
-    // Unpack the Watchdog request message
-    pico_pkt_watchdog_unpack(b->req, &s);
-    
-    s.success = true;
+bool cm4_watchdog_configure(const pico_pkt_watchdog_t *w) {
+    bool success = true;
 
-    if (s.write) {        
-        max_retries = s.max_retries;
-        cm4_watchdog_timeout_sec = s.timeout;
-    } else {       
-        s.max_retries = max_retries;
-        s.timeout = cm4_watchdog_timeout_sec;
-    }
+    max_retries = w->max_retries;
+    cm4_watchdog_timeout_sec = w->timeout;
 
-    if (s.enable) {
-        if (s.write && !is_cm4_watchdog_enabled) {
-            uint32_t timout_ms = 100;            
+    if (w->enable) {
+        if (!is_cm4_watchdog_enabled) {
             // Start the timer          
-            is_cm4_watchdog_enabled = add_repeating_timer_ms(timout_ms, 
+            is_cm4_watchdog_enabled = add_repeating_timer_ms(CM4_WATCHDOG_TIMER_DELAY_ms, 
                 cm4_watchdog_timer_callback, NULL, &cm4_watchdog_timer);
-            s.success = is_cm4_watchdog_enabled;
+            success = is_cm4_watchdog_enabled;
             /*if (is_cm4_watchdog_enabled) {
                 // Turn ON(0) Pico LED1
                 gpio_put(LED_PIN1_GPIO, 0);
             }*/
         }      
     } else {
-        if (s.write && is_cm4_watchdog_enabled) {            
-            s.success = cancel_repeating_timer(&cm4_watchdog_timer);
-            if (s.success) {
+        if (is_cm4_watchdog_enabled) {            
+            success = cancel_repeating_timer(&cm4_watchdog_timer);
+            if (success) {
                 is_cm4_watchdog_enabled = false;                
                 // Turn OFF(1) Pico LED1
                 //gpio_put(LED_PIN1_GPIO, 1);
@@ -94,10 +97,30 @@ void pkt_watchdog(struct pkt_buf *b){
         }
     }
 
-    s.enable = is_cm4_watchdog_enabled;
+    return success;
+}
+
+void cm4_watchdog_get_config(pico_pkt_watchdog_t *w) {
+    w->enable = is_cm4_watchdog_enabled;
+    w->max_retries = max_retries;
+    w->timeout = cm4_watchdog_timeout_sec;
+}
+
+void pkt_watchdog(struct pkt_buf *b){
+        
+    // Unpack the Watchdog request message
+    pico_pkt_watchdog_unpack(b->req, &s);
+    
+    s.success = true;
+
+    if (s.write) {        
+        s.success = cm4_watchdog_configure(&s);
+    }
+
+    cm4_watchdog_get_config(&s);
         
     // Pack the Watchdog response message
     pico_pkt_watchdog_resp_pack(b->resp, &s);
-    // Write response to host (blocking)
-    uart_write_blocking(UART_ID, b->resp, PICO_PKT_LEN);
+    // Queue response to host (sent by DMA)
+    uart_dma_tx_write(b->resp);
 }
\ No newline at end of file
@@ -12,6 +12,7 @@
 #include "pico/stdlib.h"
 #else
 #include <stdint.h>
+#include <functional>
 #endif
 
 #include "pico_pkt_id.h"
@@ -125,6 +126,15 @@ void pkt_watchdog(struct pkt_buf *b);
 // to "reset" count down
 void update_watchdog();
 
+#ifdef PICO_BOARD
+/// @brief Applies the settings of a watchdog write request
+/// @return True(1) on success. False(0) on failure.
+bool cm4_watchdog_configure(const pico_pkt_watchdog_t *w);
+
+/// @brief Returns the watchdog settings in use
+void cm4_watchdog_get_config(pico_pkt_watchdog_t *w);
+#endif
+
 /* Pack the request buffer */
 /// @brief Packs Watchdog timeout read/write request
 /// @param buf Pointer to request buffer
@@ -219,6 +229,14 @@ void init_watchdog();
 /// @param s [In/Out] Watchdog request data
 /// @return True(1) on success. False(0) on failure.
 bool send_watchdog_request(pico_pkt_watchdog_t & s);
+
+/// @brief Queues a watchdog read/write request to the RPi Pico without
+/// waiting for the response.
+/// @param s Watchdog request data
+/// @param callback Called from the thread servicing the serial port with the result.
+/// @return True(1) if the request was queued. False(0) otherwise.
+bool send_watchdog_request_async(const pico_pkt_watchdog_t & s,
+    std::function<void(bool success, pico_pkt_watchdog_t & s)> callback);
 #endif
 
 #ifdef __cplusplus
@@ -0,0 +1,249 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "hardware/uart.h"
+#include "cm4-wrt-a.h"
+#include "uart_dma.h"
+#include "pico_pkt_watchdog.h"
+
+// Received frames. The DMA channel writes slot (rx_head % UART_RX_NUM_SLOTS),
+// the main loop reads slot (rx_tail % UART_RX_NUM_SLOTS).
+static uint8_t rx_slots[UART_RX_NUM_SLOTS][PICO_PKT_LEN];
+// Pico time (us since boot) each slot's frame finished arriving
+static uint64_t rx_slot_time_us[UART_RX_NUM_SLOTS];
+static volatile uint32_t rx_head = 0;
+static volatile uint32_t rx_tail = 0;
+// True(1) when the queue filled up and the DMA channel was left idle.
+// The UART RX FIFO holds the next bytes until a slot is freed.
+static volatile bool rx_stalled = false;
+static int rx_dma_chan = -1;
+
+// Frames to send. The DMA channel reads slot (tx_tail % UART_TX_NUM_SLOTS),
+// uart_dma_tx_write() fills slot (tx_head % UART_TX_NUM_SLOTS).
+static uint8_t tx_slots[UART_TX_NUM_SLOTS][PICO_PKT_LEN];
+static volatile uint32_t tx_head = 0;
+static volatile uint32_t tx_tail = 0;
+// True(1) while the DMA channel is sending a frame
+static volatile bool tx_busy = false;
+static int tx_dma_chan = -1;
+
+// Progress of the frame being received, for idle detection
+static uint32_t rx_last_head = 0;
+static uint32_t rx_last_remaining = PICO_PKT_LEN;
+static uint64_t rx_last_progress_time = 0;
+
+/// @brief Points the DMA channel at the next free slot and starts it
+static void rx_dma_start(void) {
+    dma_channel_set_trans_count(rx_dma_chan, PICO_PKT_LEN, false);
+    dma_channel_set_write_addr(rx_dma_chan, rx_slots[rx_head % UART_RX_NUM_SLOTS], true);
+}
+
+/// @brief Stops the DMA channel, dropping any partially received frame
+static void rx_dma_stop(void) {
+    // Aborting may raise a completion interrupt (RP2040-E13), so keep it masked
+    dma_channel_set_irq0_enabled(rx_dma_chan, false);
+    dma_channel_abort(rx_dma_chan);
+    dma_channel_acknowledge_irq0(rx_dma_chan);
+    dma_channel_set_irq0_enabled(rx_dma_chan, true);
+}
+
+static void on_uart_dma_irq(void) {
+    if (!dma_channel_get_irq0_status(rx_dma_chan)) {
+        return;
+    }
+
+    dma_channel_acknowledge_irq0(rx_dma_chan);
+
+    // A complete frame is in the slot. time_us_64() does not use the
+    // TIMELR/TIMEHR latch, so it cannot upset a get_time() it interrupted.
+    rx_slot_time_us[rx_head % UART_RX_NUM_SLOTS] = time_us_64();
+    rx_head++;
+    update_watchdog();
+
+    if ((rx_head - rx_tail) < UART_RX_NUM_SLOTS) {
+        rx_dma_start();
+    } else {
+        rx_stalled = true;
+    }
+}
+
+/// @brief Starts sending the oldest queued frame
+static void tx_dma_start(void) {
+    tx_busy = true;
+    dma_channel_transfer_from_buffer_now(tx_dma_chan,
+        tx_slots[tx_tail % UART_TX_NUM_SLOTS], PICO_PKT_LEN);
+}
+
+static void on_uart_dma_tx_irq(void) {
+    if (!dma_channel_get_irq0_status(tx_dma_chan)) {
+        return;
+    }
+
+    dma_channel_acknowledge_irq0(tx_dma_chan);
+
+    // The frame is in the TX FIFO, its slot is free
+    tx_tail++;
+
+    if (tx_tail != tx_head) {
+        tx_dma_start();
+    } else {
+        tx_busy = false;
+    }
+}
+
+void init_uart_dma(void) {
+    rx_dma_chan = dma_claim_unused_channel(true);
+
+    // uart_init() already enables the UART DMA requests
+    dma_channel_config c = dma_channel_get_default_config(rx_dma_chan);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, true);
+    channel_config_set_dreq(&c, uart_get_dreq(UART_ID, false));
+
+    dma_channel_configure(rx_dma_chan, &c, rx_slots[0],
+        &uart_get_hw(UART_ID)->dr, PICO_PKT_LEN, false);
+
+    tx_dma_chan = dma_claim_unused_channel(true);
+
+    c = dma_channel_get_default_config(tx_dma_chan);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+    channel_config_set_read_increment(&c, true);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_dreq(&c, uart_get_dreq(UART_ID, true));
+
+    dma_channel_configure(tx_dma_chan, &c, &uart_get_hw(UART_ID)->dr,
+        tx_slots[0], PICO_PKT_LEN, false);
+
+    dma_channel_set_irq0_enabled(rx_dma_chan, true);
+    dma_channel_set_irq0_enabled(tx_dma_chan, true);
+    irq_add_shared_handler(DMA_IRQ_0, on_uart_dma_irq,
+        PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+    irq_add_shared_handler(DMA_IRQ_0, on_uart_dma_tx_irq,
+        PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+    irq_set_enabled(DMA_IRQ_0, true);
+
+    rx_last_progress_time = get_time();
+    rx_dma_start();
+}
+
+const uint8_t *uart_dma_rx_peek(void) {
+    if (rx_head == rx_tail) {
+        return NULL;
+    }
+
+    // Read the slot only after seeing the new head
+    __compiler_memory_barrier();
+    return rx_slots[rx_tail % UART_RX_NUM_SLOTS];
+}
+
+uint64_t uart_dma_rx_time_us(void) {
+    if (rx_head == rx_tail) {
+        return 0;
+    }
+
+    __compiler_memory_barrier();
+    return rx_slot_time_us[rx_tail % UART_RX_NUM_SLOTS];
+}
+
+void uart_dma_rx_pop(void) {
+    if (rx_head == rx_tail) {
+        return;
+    }
+
+    __compiler_memory_barrier();
+    rx_tail++;
+
+    // The DMA interrupt sees the new tail before deciding to stall,
+    // so a stalled channel is idle here and safe to restart.
+    if (rx_stalled) {
+        rx_stalled = false;
+        rx_dma_start();
+    }
+}
+
+void uart_dma_tx_write(const uint8_t *frame) {
+    // Wait for the DMA interrupt to free a slot
+    while ((tx_head - tx_tail) >= UART_TX_NUM_SLOTS) {
+        tight_loop_contents();
+    }
+
+    memcpy(tx_slots[tx_head % UART_TX_NUM_SLOTS], frame, PICO_PKT_LEN);
+
+    uint32_t status = save_and_disable_interrupts();
+
+    tx_head++;
+    if (!tx_busy) {
+        tx_dma_start();
+    }
+
+    restore_interrupts(status);
+}
+
+void uart_dma_rx_flush(void) {
+    uint32_t status = save_and_disable_interrupts();
+
+    rx_dma_stop();
+    rx_tail = rx_head;
+    rx_stalled = false;
+    rx_last_remaining = PICO_PKT_LEN;
+    rx_dma_start();
+
+    restore_interrupts(status);
+}
+
+bool uart_dma_rx_pending(void) {
+    if (rx_head != rx_tail) {
+        return true;
+    }
+
+    uint32_t remaining = dma_hw->ch[rx_dma_chan].transfer_count;
+    return (remaining != PICO_PKT_LEN) && (remaining != 0);
+}
+
+void uart_dma_task(void) {
+    if (rx_stalled) {
+        return;
+    }
+
+    uint32_t head = rx_head;
+    uint32_t remaining = dma_hw->ch[rx_dma_chan].transfer_count;
+    uint64_t now = get_time();
+
+    if ((head != rx_last_head) || (remaining != rx_last_remaining)) {
+        rx_last_head = head;
+        rx_last_remaining = remaining;
+        rx_last_progress_time = now;
+        return;
+    }
+
+    // Nothing to drop between frames
+    if ((remaining == PICO_PKT_LEN) || (remaining == 0)) {
+        return;
+    }
+
+    if ((now - rx_last_progress_time) < UART_RX_IDLE_TIMEOUT_us) {
+        return;
+    }
+
+    uint32_t status = save_and_disable_interrupts();
+
+    // Unless the frame completed in the meantime, start it over
+    if ((rx_head == head) && !rx_stalled &&
+        (dma_hw->ch[rx_dma_chan].transfer_count != 0)) {
+        rx_dma_stop();
+        rx_dma_start();
+    }
+
+    rx_last_remaining = PICO_PKT_LEN;
+    rx_last_progress_time = now;
+
+    restore_interrupts(status);
+}
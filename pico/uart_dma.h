@@ -0,0 +1,79 @@
+/**
+ * Copyright (c) 2024 MyTechCatalog LLC.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef UART_DMA_H_
+#define UART_DMA_H_
+
+#include "pico/stdlib.h"
+#include "pkt_handler.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Requests from the host are received by DMA, one PICO_PKT_LEN frame at a
+ * time, straight into a small queue of frame slots. The CPU is interrupted
+ * once per frame instead of once per byte, and requests the host sends
+ * back to back wait in the queue while the main loop handles the previous
+ * one.
+ *
+ * A frame that stops arriving part way through (e.g. a stray byte while
+ * the host boots) is dropped once the line has been idle for
+ * UART_RX_IDLE_TIMEOUT_us, so the next frame starts at byte 0 again.
+ *
+ * Responses to the host are copied into a queue of frame slots that a
+ * second DMA channel sends in order, so handlers return without waiting
+ * for the UART.
+ */
+
+// Number of received frames that can wait for the main loop
+#define UART_RX_NUM_SLOTS 8
+
+// Number of frames that can wait to be sent to the host
+#define UART_TX_NUM_SLOTS 8
+
+// A partial frame is dropped after the line has been idle this long.
+// A whole frame takes about 1.4 ms at 115200 baud.
+#define UART_RX_IDLE_TIMEOUT_us 5000
+
+/// @brief Starts receiving frames and sets up sending. The UART must already be set up.
+void init_uart_dma(void);
+
+/// @brief Returns the oldest received frame, or NULL if there is none.
+/// The frame stays valid until uart_dma_rx_pop() is called.
+const uint8_t *uart_dma_rx_peek(void);
+
+/// @brief Returns the Pico time (us since boot) the frame returned by
+/// uart_dma_rx_peek() finished arriving, or 0 if there is none. A frame
+/// received while the queue was full is stamped when a slot frees up.
+uint64_t uart_dma_rx_time_us(void);
+
+/// @brief Frees the frame returned by uart_dma_rx_peek()
+void uart_dma_rx_pop(void);
+
+/// @brief Drops every queued frame and any partially received one.
+/// Used to get back in sync with the host.
+void uart_dma_rx_flush(void);
+
+/// @brief Queues a PICO_PKT_LEN frame to be sent to the host and returns.
+/// The frame is copied. Only waits if UART_TX_NUM_SLOTS frames are already
+/// queued. Must not be called with interrupts disabled.
+void uart_dma_tx_write(const uint8_t *frame);
+
+/// @brief Drops partially received frames once the line goes idle.
+/// Call from the main loop.
+void uart_dma_task(void);
+
+/// @brief True(1) if a frame is waiting, or one is partly received.
+/// The main loop must not sleep while a frame is partly received: no
+/// interrupt would wake it to drop the frame if the line goes idle.
+bool uart_dma_rx_pending(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif